@@ -14,7 +14,13 @@ initpyfirtree(void)
     PyObject *m, *d;
 	
     init_pygobject ();
-    g_thread_init (NULL);
+
+    /* Rendering, reducing and compiling release the GIL. Signal handlers
+     * and callbacks written in Python may therefore be invoked from a
+     * thread which does not hold it and pygobject must re-acquire it. This
+     * also initialises the GLib thread system. */
+    if (pyg_enable_threads ())
+        return;
 
     m = Py_InitModule ("pyfirtree", pyfirtree_functions);
     d = PyModule_GetDict (m);
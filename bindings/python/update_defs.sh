@@ -11,6 +11,7 @@ python codegen/defsgen.py \
 	../../firtree/firtree-kernel.h \
 	../../firtree/firtree-kernel-sampler.h \
 	../../firtree/firtree-sampler.h \
+	../../firtree/firtree-tiled-file-sampler.h \
 	../../firtree/firtree-types.h \
 	../../firtree/firtree-type-builtins.h \
 	../../firtree/firtree-vector.h
@@ -31,25 +31,51 @@ typedef struct {
     /* A condition to signal when all tasks have been completed (task_count <= 0) */
     GCond*      completion_cond;
     GMutex*     completion_mutex;
+
+    /* For asynchronous work, a function to call instead of signalling
+     * completion. The worker and its tasks are then freed. */
+    ThreadingDoneFunc done;
+    gpointer    done_data;
+    GArray*     task_array;
 } ThreadingWorker;
 
+typedef struct {
+    ThreadingApplyFunc func;
+    gpointer user_data;
+} ThreadingApplyContext;
+
 typedef struct {
     ThreadingWorker*    worker; /* The worker to use for this task. */
     gpointer            data;   /* What to pass to 'data' */
 } ThreadingTask;
 
+/* Non-NULL in the threads of the global pool. */
+static GStaticPrivate _threading_in_worker = G_STATIC_PRIVATE_INIT;
+
 static void
 _worker_func(gpointer data, gpointer user_data)
 {
     ThreadingTask* task = (ThreadingTask*)data;
+    ThreadingWorker* worker = task->worker;
+
+    g_static_private_set(&_threading_in_worker, GINT_TO_POINTER(1), NULL);
+
+    worker->func(task->data, worker->user_data);
 
-    task->worker->func(task->data, task->worker->user_data);
+    if(g_atomic_int_dec_and_test(&worker->task_count)) {
+        if(worker->done) {
+            /* This was the last task of some asynchronous work. */
+            worker->done(worker->done_data);
+            g_slice_free(ThreadingApplyContext, worker->user_data);
+            g_array_free(worker->task_array, TRUE);
+            g_slice_free(ThreadingWorker, worker);
+            return;
+        }
 
-    if(g_atomic_int_dec_and_test(&task->worker->task_count)) {
         /* This was the last task, signal completion */
-        g_mutex_lock(task->worker->completion_mutex);
-        g_cond_broadcast(task->worker->completion_cond);
-        g_mutex_unlock(task->worker->completion_mutex);
+        g_mutex_lock(worker->completion_mutex);
+        g_cond_broadcast(worker->completion_cond);
+        g_mutex_unlock(worker->completion_mutex);
     }
 }
 
@@ -77,11 +103,6 @@ _threading_get_global_pool()
     return pool;
 }
 
-typedef struct {
-    ThreadingApplyFunc func;
-    gpointer user_data;
-} ThreadingApplyContext;
-
 static void
 _apply_task_func(gpointer data, gpointer user_data)
 {
@@ -94,13 +115,23 @@ threading_apply(guint count, ThreadingApplyFunc func, gpointer user_data)
 {
     guint i;
 
+    /* A worker waiting on the pool holds one of its threads. If every
+     * thread did so nothing would be left to do the work and so the work
+     * is done here instead. */
+    if(g_static_private_get(&_threading_in_worker)) {
+        for(i=0; i<count; ++i) {
+            func(i, user_data);
+        }
+        return;
+    }
+
     /* Initialise a worker structure for this process. */
     GCond* completion_cond = g_cond_new();
     GMutex* completion_mutex = g_mutex_new();
     ThreadingApplyContext context = { func, user_data };
     ThreadingWorker worker = { 
         _apply_task_func, &context, count, 
-        completion_cond, completion_mutex };
+        completion_cond, completion_mutex, NULL, NULL, NULL };
 
     /* Allocate an array to hold the task structures. */
     GArray* task_array = g_array_sized_new(FALSE, FALSE, 
@@ -129,5 +160,48 @@ threading_apply(guint count, ThreadingApplyFunc func, gpointer user_data)
     g_cond_free(completion_cond);
 }
 
+void
+threading_apply_async(guint count, ThreadingApplyFunc func, gpointer user_data,
+        ThreadingDoneFunc done, gpointer done_data)
+{
+    guint i;
+
+    g_assert(done);
+
+    if(count == 0) {
+        done(done_data);
+        return;
+    }
+
+    /* The worker outlives this call and is freed by the last task. */
+    ThreadingApplyContext* context = g_slice_new(ThreadingApplyContext);
+    context->func = func;
+    context->user_data = user_data;
+
+    ThreadingWorker* worker = g_slice_new(ThreadingWorker);
+    worker->func = _apply_task_func;
+    worker->user_data = context;
+    worker->task_count = count;
+    worker->completion_cond = NULL;
+    worker->completion_mutex = NULL;
+    worker->done = done;
+    worker->done_data = done_data;
+
+    /* The array is sized up front so that pushing tasks never moves it. */
+    worker->task_array = g_array_sized_new(FALSE, FALSE,
+            sizeof(ThreadingTask), count);
+    for(i=0; i<count; ++i) {
+        ThreadingTask task = { worker, GUINT_TO_POINTER(i) };
+        g_array_append_val(worker->task_array, task);
+    }
+
+    GThreadPool* pool = _threading_get_global_pool();
+    for(i=0; i<count; ++i) {
+        g_thread_pool_push(pool, 
+                &(g_array_index(worker->task_array, ThreadingTask, i)), 
+                NULL);
+    }
+}
+
 /* vim:sw=4:ts=4:et:cindent
  */
@@ -39,11 +39,41 @@ typedef void (*ThreadingApplyFunc) ( guint i, gpointer data );
   *
   * Call @func @count times with the initial i parameter of @func taking 
   * unique values 0 to @count-1. There is no guarantee of the order of i and
-  * @func may be called simultaneously from multiple threads.
+  * @func may be called simultaneously from multiple threads. If this is
+  * called from a function already running on the thread pool, such as the
+  * @done function of threading_apply_async(), @func is called serially
+  * from the calling thread.
   */
 void
 threading_apply(guint count, ThreadingApplyFunc func, gpointer data);
 
+/**
+ * ThreadingDoneFunc:
+ *
+ * A function called by threading_apply_async() once all work is done.
+ */
+typedef void (*ThreadingDoneFunc) ( gpointer done_data );
+
+ /**
+  * threading_apply_async:
+  * @count: Number of times to apply @func.
+  * @func: The function to call.
+  * @data: Data to pass to the function.
+  * @done: The function to call once every call to @func has returned.
+  * @done_data: Data to pass to @done.
+  *
+  * Queue @count calls to @func as threading_apply() would but return without
+  * waiting for them. @done is called from whichever thread completes the
+  * last call to @func. If @count is zero, @done is called immediately.
+  *
+  * Work queued by successive calls is started in the order it was queued but
+  * is not otherwise synchronised so the end of one piece of work may
+  * overlap with the start of the next.
+  */
+void
+threading_apply_async(guint count, ThreadingApplyFunc func, gpointer data,
+        ThreadingDoneFunc done, gpointer done_data);
+
 G_END_DECLS
  
 #endif /* end of include guard: COMMON_THREADING_H */
@@ -0,0 +1,698 @@
+/* firtree-cpu-caching-sampler.cc */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.    See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA    02110-1301, USA
+ */
+
+#define __STDC_LIMIT_MACROS
+#define __STDC_CONSTANT_MACROS
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "firtree-cpu-caching-sampler.h"
+#include "firtree-cpu-renderer.h"
+#include "firtree-cpu-jit.hh"
+#include "firtree-cpu-common.hh"
+
+#include <firtree/firtree-kernel-sampler.h>
+#include <firtree/internal/firtree-engine-intl.hh>
+#include <firtree/internal/firtree-kernel-intl.hh>
+#include <firtree/internal/firtree-sampler-intl.hh>
+
+#include <math.h>
+#include <string.h>
+
+/* Inputs covering more pixels than this are sampled directly. */
+#define MAX_CACHE_PIXELS (1 << 22)
+
+/* The cache is rendered in this format and so is never quantised. */
+#define CACHE_FORMAT FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED
+#define CACHE_PIXEL_SIZE 16
+
+/* The estimated cost, in the units of firtree_sampler_estimate_cost(), of
+ * sampling a cached render with linear interpolation. */
+#define CACHED_SAMPLE_COST 32
+
+G_DEFINE_TYPE (FirtreeCpuCachingSampler, firtree_cpu_caching_sampler,
+        FIRTREE_TYPE_SAMPLER)
+
+#define GET_PRIVATE(o) \
+    (G_TYPE_INSTANCE_GET_PRIVATE ((o), FIRTREE_TYPE_CPU_CACHING_SAMPLER, FirtreeCpuCachingSamplerPrivate))
+
+typedef struct _FirtreeCpuCachingSamplerPrivate FirtreeCpuCachingSamplerPrivate;
+
+struct _FirtreeCpuCachingSamplerPrivate {
+    FirtreeSampler*         sampler;
+    gulong                  module_changed_handler_id;
+    gulong                  contents_changed_handler_id;
+    gulong                  region_changed_handler_id;
+    gulong                  extents_changed_handler_id;
+
+    FirtreeCpuRenderer*     renderer;
+    llvm::Function*         cached_function;
+
+    /* The render of the input covering the pixels of region, which is
+     * (x, y, width, height). buffer is NULL if the input is sampled
+     * directly. */
+    gpointer                buffer;
+    gint                    region[4];
+    gboolean                dirty;
+
+    /* Set while the input is locked on behalf of a direct render. */
+    gboolean                input_locked;
+};
+
+gboolean
+firtree_cpu_caching_sampler_get_param(FirtreeSampler* self, guint param,
+        gpointer dest, guint dest_size);
+
+llvm::Function*
+firtree_cpu_caching_sampler_get_sample_function(FirtreeSampler* self);
+
+static gsize
+_firtree_cpu_caching_sampler_buffer_size(const gint* region)
+{
+    return (gsize)region[2] * (gsize)region[3] * CACHE_PIXEL_SIZE;
+}
+
+/* Release the cached render and function. The next call to
+ * ..._get_sample_function() re-creates them. */
+static void
+_firtree_cpu_caching_sampler_invalidate_llvm_cache(FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    if(p && p->cached_function) {
+        delete p->cached_function->getParent();
+        p->cached_function = NULL;
+    }
+    if(p && p->buffer) {
+        firtree_cpu_common_scratch_buffer_free(p->buffer,
+                _firtree_cpu_caching_sampler_buffer_size(p->region));
+        p->buffer = NULL;
+
+        /* A new buffer may be allocated at the same address. */
+        firtree_cpu_renderer_invalidate(p->renderer, NULL);
+    }
+    p->dirty = TRUE;
+    firtree_sampler_module_changed(FIRTREE_SAMPLER(self));
+}
+
+/* Find the whole pixels covering the output extent of the input. Returns
+ * FALSE if the input cannot be cached. */
+static gboolean
+_firtree_cpu_caching_sampler_get_region(FirtreeCpuCachingSampler* self,
+        gint* region)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    if(!p->sampler) {
+        return FALSE;
+    }
+
+    firtree_cpu_jit_lock();
+    FirtreeVec4 extent = firtree_sampler_get_output_extent(p->sampler);
+    firtree_cpu_jit_unlock();
+
+    if(firtree_sampler_extent_is_infinite(&extent)) {
+        return FALSE;
+    }
+
+    double min_x = floor(extent.x), min_y = floor(extent.y);
+    double max_x = ceil(extent.x + extent.z);
+    double max_y = ceil(extent.y + extent.w);
+
+    /* An empty input is cached as a single transparent pixel. */
+    double width = MAX(1.0, max_x - min_x);
+    double height = MAX(1.0, max_y - min_y);
+    if(width * height > (double)MAX_CACHE_PIXELS) {
+        g_debug("Input too large to cache, sampling it directly.");
+        return FALSE;
+    }
+
+    region[0] = (gint)min_x;
+    region[1] = (gint)min_y;
+    region[2] = (gint)width;
+    region[3] = (gint)height;
+
+    return TRUE;
+}
+
+/* Re-render the input into the buffer if it has changed. */
+static gboolean
+_firtree_cpu_caching_sampler_update(FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    if(!p->buffer) {
+        return FALSE;
+    }
+    if(!p->dirty) {
+        return TRUE;
+    }
+
+    /* Only the parts of the buffer affected by the changes to the input
+     * are re-rendered. */
+    FirtreeVec4 extents = {
+        p->region[0], p->region[1], p->region[2], p->region[3] };
+    if(!firtree_cpu_renderer_update_buffer(p->renderer, &extents,
+                p->buffer, p->region[2], p->region[3],
+                p->region[2] * CACHE_PIXEL_SIZE, CACHE_FORMAT)) {
+        g_debug("Failed to render caching sampler input.");
+        return FALSE;
+    }
+
+    p->dirty = FALSE;
+    return TRUE;
+}
+
+static void
+_firtree_cpu_caching_sampler_module_changed_cb(FirtreeSampler* sampler,
+        FirtreeCpuCachingSampler* self)
+{
+    _firtree_cpu_caching_sampler_invalidate_llvm_cache(self);
+}
+
+static void
+_firtree_cpu_caching_sampler_extents_changed_cb(FirtreeSampler* sampler,
+        FirtreeCpuCachingSampler* self)
+{
+    /* The region to cache may have changed. */
+    _firtree_cpu_caching_sampler_invalidate_llvm_cache(self);
+    firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
+}
+
+static void
+_firtree_cpu_caching_sampler_contents_changed_cb(FirtreeSampler* sampler,
+        FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    p->dirty = TRUE;
+    firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
+}
+
+/* The cache covers the output space of the input and so the region is
+ * mapped into it. The input's ::contents-changed signal follows. */
+static void
+_firtree_cpu_caching_sampler_region_changed_cb(FirtreeSampler* sampler,
+        FirtreeVec4* region, FirtreeCpuCachingSampler* self)
+{
+    firtree_cpu_jit_lock();
+    FirtreeVec4 changed = firtree_sampler_map_region_to_output(sampler,
+            region);
+    firtree_cpu_jit_unlock();
+    firtree_sampler_region_changed(FIRTREE_SAMPLER(self), &changed);
+}
+
+static FirtreeVec4
+firtree_cpu_caching_sampler_get_extent(FirtreeSampler* self)
+{
+    gint region[4];
+    if(!_firtree_cpu_caching_sampler_get_region(
+                FIRTREE_CPU_CACHING_SAMPLER(self), region)) {
+        return FIRTREE_SAMPLER_CLASS(firtree_cpu_caching_sampler_parent_class)->
+            get_extent(self);
+    }
+
+    FirtreeVec4 rv = { region[0], region[1], region[2], region[3] };
+    return rv;
+}
+
+/* The cache is refreshed here so that changes to the input's contents are
+ * seen by renders which re-use an existing function. */
+static gboolean
+firtree_cpu_caching_sampler_lock(FirtreeSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+
+    if(p->buffer) {
+        return _firtree_cpu_caching_sampler_update(
+                FIRTREE_CPU_CACHING_SAMPLER(self));
+    }
+
+    /* The input is being sampled directly. */
+    if(p->sampler) {
+        if(!firtree_sampler_lock(p->sampler)) {
+            return FALSE;
+        }
+        p->input_locked = TRUE;
+    }
+
+    return TRUE;
+}
+
+static void
+firtree_cpu_caching_sampler_unlock(FirtreeSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    if(p->input_locked) {
+        firtree_sampler_unlock(p->sampler);
+        p->input_locked = FALSE;
+    }
+}
+
+static void
+firtree_cpu_caching_sampler_dispose (GObject *object)
+{
+    G_OBJECT_CLASS (firtree_cpu_caching_sampler_parent_class)->dispose (object);
+
+    FirtreeCpuCachingSampler* self = FIRTREE_CPU_CACHING_SAMPLER(object);
+    firtree_cpu_caching_sampler_set_sampler(self, NULL);
+
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    if(p->renderer) {
+        g_object_unref(p->renderer);
+        p->renderer = NULL;
+    }
+}
+
+static FirtreeSamplerIntlVTable _firtree_cpu_caching_sampler_class_vtable;
+
+static void
+firtree_cpu_caching_sampler_class_init (FirtreeCpuCachingSamplerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    g_type_class_add_private (klass, sizeof (FirtreeCpuCachingSamplerPrivate));
+    object_class->dispose = firtree_cpu_caching_sampler_dispose;
+
+    /* override the sampler virtual functions with our own */
+    FirtreeSamplerClass* sampler_class = FIRTREE_SAMPLER_CLASS(klass);
+
+    sampler_class->get_extent = firtree_cpu_caching_sampler_get_extent;
+    sampler_class->lock = firtree_cpu_caching_sampler_lock;
+    sampler_class->unlock = firtree_cpu_caching_sampler_unlock;
+
+    sampler_class->intl_vtable = &_firtree_cpu_caching_sampler_class_vtable;
+    sampler_class->intl_vtable->get_param =
+        firtree_cpu_caching_sampler_get_param;
+    sampler_class->intl_vtable->get_sample_function =
+        firtree_cpu_caching_sampler_get_sample_function;
+}
+
+static void
+firtree_cpu_caching_sampler_init (FirtreeCpuCachingSampler *self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    p->sampler = NULL;
+    p->renderer = firtree_cpu_renderer_new();
+    p->cached_function = NULL;
+    p->buffer = NULL;
+    p->dirty = TRUE;
+    p->input_locked = FALSE;
+}
+
+FirtreeCpuCachingSampler*
+firtree_cpu_caching_sampler_new (void)
+{
+    return (FirtreeCpuCachingSampler*)
+        g_object_new (FIRTREE_TYPE_CPU_CACHING_SAMPLER, NULL);
+}
+
+void
+firtree_cpu_caching_sampler_set_sampler (FirtreeCpuCachingSampler* self,
+        FirtreeSampler* sampler)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+
+    if(p->sampler) {
+        g_signal_handler_disconnect(p->sampler,
+                p->module_changed_handler_id);
+        g_signal_handler_disconnect(p->sampler,
+                p->contents_changed_handler_id);
+        g_signal_handler_disconnect(p->sampler,
+                p->region_changed_handler_id);
+        g_signal_handler_disconnect(p->sampler,
+                p->extents_changed_handler_id);
+        g_object_unref(p->sampler);
+        p->sampler = NULL;
+    }
+
+    if(sampler) {
+        p->sampler = sampler;
+        g_object_ref(p->sampler);
+
+        p->module_changed_handler_id = g_signal_connect(p->sampler,
+                "module-changed",
+                G_CALLBACK(_firtree_cpu_caching_sampler_module_changed_cb),
+                self);
+        p->contents_changed_handler_id = g_signal_connect(p->sampler,
+                "contents-changed",
+                G_CALLBACK(_firtree_cpu_caching_sampler_contents_changed_cb),
+                self);
+        p->region_changed_handler_id = g_signal_connect(p->sampler,
+                "region-changed",
+                G_CALLBACK(_firtree_cpu_caching_sampler_region_changed_cb),
+                self);
+        p->extents_changed_handler_id = g_signal_connect(p->sampler,
+                "extents-changed",
+                G_CALLBACK(_firtree_cpu_caching_sampler_extents_changed_cb),
+                self);
+    }
+
+    if(p->renderer) {
+        firtree_cpu_renderer_set_sampler(p->renderer, p->sampler);
+    }
+
+    _firtree_cpu_caching_sampler_invalidate_llvm_cache(self);
+    firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
+}
+
+FirtreeSampler*
+firtree_cpu_caching_sampler_get_sampler (FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    return p->sampler;
+}
+
+gboolean
+firtree_cpu_caching_sampler_is_cached (FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+    return (p->buffer != NULL) && !p->dirty;
+}
+
+gboolean
+firtree_cpu_caching_sampler_get_param(FirtreeSampler* self, guint param,
+        gpointer dest, guint dest_size)
+{
+    return FALSE;
+}
+
+/* Create a function which samples the input directly, applying its
+ * transform as a kernel would. */
+static llvm::Function*
+_firtree_cpu_caching_sampler_create_direct_function(
+        FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+
+    llvm::Function* input_f = firtree_sampler_get_sample_function(p->sampler);
+    if(!input_f) {
+        return NULL;
+    }
+
+    llvm::Module* m = llvm::CloneModule(input_f->getParent());
+    llvm::Function* new_input_f = m->getFunction(input_f->getName());
+    g_assert(new_input_f);
+
+    llvm::Function* sample_func =
+        firtree_engine_create_sample_function_prototype(m);
+    llvm::BasicBlock* bb = llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT
+            "entry", sample_func);
+
+    llvm::Value* location = sample_func->arg_begin();
+    FirtreeAffineTransform* transform =
+        firtree_sampler_get_transform(p->sampler);
+    if(!firtree_affine_transform_is_identity(transform)) {
+        location = firtree_engine_create_affine_transform_call(m,
+                transform, location, bb);
+    }
+    g_object_unref(transform);
+
+    llvm::Value* ret_val = llvm::CallInst::Create(new_input_f, location,
+            "rv", bb);
+    llvm::ReturnInst::Create(FIRTREE_LLVM_CONTEXT ret_val, bb);
+
+    return sample_func;
+}
+
+/* Create a function which samples the cached render in p->buffer. */
+static llvm::Function*
+_firtree_cpu_caching_sampler_create_cached_function(
+        FirtreeCpuCachingSampler* self)
+{
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+
+#if FIRTREE_LLVM_AT_LEAST_2_6
+    llvm::Module* m = new llvm::Module("cache", llvm::getGlobalContext());
+#else
+    llvm::Module* m = new llvm::Module("cache");
+#endif
+
+    llvm::Function* sample_buffer_func =
+        firtree_engine_create_sample_image_buffer_prototype(m, TRUE);
+    llvm::Function* sample_func =
+        firtree_engine_create_sample_function_prototype(m);
+    llvm::BasicBlock* bb = llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT
+            "entry", sample_func);
+
+    /* Pixel (0,0) of the buffer covers the top-left of the region. */
+    llvm::Value* location = sample_func->arg_begin();
+    if((p->region[0] != 0) || (p->region[1] != 0)) {
+        FirtreeAffineTransform* transform = firtree_affine_transform_new();
+        firtree_affine_transform_translate_by(transform,
+                -p->region[0], -p->region[1]);
+        location = firtree_engine_create_affine_transform_call(m,
+                transform, location, bb);
+        g_object_unref(transform);
+    }
+
+    llvm::Constant* data_int = llvm::ConstantInt::get(FIRTREE_LLVM_INT64_TY,
+            (uint64_t) p->buffer, false);
+
+    std::vector<llvm::Value*> func_args;
+    func_args.push_back(llvm::ConstantExpr::getIntToPtr(data_int,
+                llvm::PointerType::getUnqual(FIRTREE_LLVM_INT8_TY)));
+    func_args.push_back(llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+                (uint64_t) CACHE_FORMAT, false));
+    func_args.push_back(llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+                (uint64_t) p->region[2], false));
+    func_args.push_back(llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+                (uint64_t) p->region[3], false));
+    func_args.push_back(llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+                (uint64_t) p->region[2] * CACHE_PIXEL_SIZE, false));
+    func_args.push_back(location);
+
+    llvm::Value* ret_val = llvm::CallInst::Create(sample_buffer_func,
+            func_args.begin(), func_args.end(), "rv", bb);
+    llvm::ReturnInst::Create(FIRTREE_LLVM_CONTEXT ret_val, bb);
+
+    return sample_func;
+}
+
+llvm::Function*
+firtree_cpu_caching_sampler_get_sample_function(FirtreeSampler* self)
+{
+    FirtreeCpuCachingSampler* caching_self = FIRTREE_CPU_CACHING_SAMPLER(self);
+    FirtreeCpuCachingSamplerPrivate* p = GET_PRIVATE(self);
+
+    if(p->cached_function) {
+        return p->cached_function;
+    }
+
+    if(!p->sampler) {
+        g_debug("No input associated with caching sampler.");
+        return NULL;
+    }
+
+    if(!_firtree_cpu_caching_sampler_get_region(caching_self, p->region)) {
+        p->cached_function =
+            _firtree_cpu_caching_sampler_create_direct_function(caching_self);
+        return p->cached_function;
+    }
+
+    p->buffer = firtree_cpu_common_scratch_buffer_alloc(
+            _firtree_cpu_caching_sampler_buffer_size(p->region));
+    p->dirty = TRUE;
+
+    if(!_firtree_cpu_caching_sampler_update(caching_self)) {
+        firtree_cpu_common_scratch_buffer_free(p->buffer,
+                _firtree_cpu_caching_sampler_buffer_size(p->region));
+        p->buffer = NULL;
+        return NULL;
+    }
+
+    p->cached_function =
+        _firtree_cpu_caching_sampler_create_cached_function(caching_self);
+    return p->cached_function;
+}
+
+/* Decide if the sampler argument @arg_name of @kernel, currently bound to
+ * @input, should be rendered once rather than evaluated at every tap. Caching
+ * costs one evaluation of @input per cached pixel and an interpolated lookup
+ * per tap. */
+static gboolean
+_firtree_cpu_caching_sampler_should_cache(FirtreeKernel* kernel,
+        GQuark arg_name, FirtreeSampler* input)
+{
+    guint taps = firtree_kernel_get_sample_count(kernel, arg_name);
+    if(taps < 2) {
+        return FALSE;
+    }
+
+    FirtreeVec4 extent = firtree_sampler_get_output_extent(input);
+    if(firtree_sampler_extent_is_infinite(&extent) ||
+            ((double)extent.z * (double)extent.w > (double)MAX_CACHE_PIXELS)) {
+        return FALSE;
+    }
+
+    guint cost = firtree_sampler_estimate_cost(input);
+    gboolean rv = (taps * cost) > (cost + taps * CACHED_SAMPLE_COST);
+
+    g_debug("Argument '%s': %u taps of cost %u, %s.",
+            g_quark_to_string(arg_name), taps, cost,
+            rv ? "caching" : "sampling directly");
+
+    return rv;
+}
+
+/* Return TRUE if @transform only moves its input by whole pixels. */
+static gboolean
+_firtree_cpu_caching_sampler_is_whole_translation(
+        FirtreeAffineTransform* transform)
+{
+    return (transform->m11 == 1.f) && (transform->m12 == 0.f) &&
+        (transform->m21 == 0.f) && (transform->m22 == 1.f) &&
+        (floorf(transform->tx) == transform->tx) &&
+        (floorf(transform->ty) == transform->ty);
+}
+
+/* Return TRUE if the kernel argument @arg_name, bound to @input, is only
+ * ever sampled at pixel centres given that the kernel's own output is. A
+ * cache of @input then reproduces it exactly since its linear interpolation
+ * is only ever evaluated at the cached pixels. */
+static gboolean
+_firtree_cpu_caching_sampler_taps_on_grid(FirtreeKernel* kernel,
+        GQuark arg_name, FirtreeSampler* input)
+{
+    if(!firtree_kernel_samples_whole_pixels(kernel, arg_name)) {
+        return FALSE;
+    }
+
+    FirtreeAffineTransform* transform = firtree_sampler_get_transform(input);
+    gboolean rv = _firtree_cpu_caching_sampler_is_whole_translation(transform);
+    g_object_unref(transform);
+
+    return rv;
+}
+
+/* Plan the graph rooted at @sampler, children first so that the costs of
+ * inputs reflect the caches inserted beneath them. @visited records the
+ * samplers already planned and @caches maps inputs to the caching sampler
+ * inserted for them so that shared inputs are rendered once. @on_grid is
+ * TRUE if @sampler is only ever sampled at pixel centres. Only the inputs
+ * of such samplers which are themselves sampled at pixel centres are
+ * cached. */
+static guint
+_firtree_cpu_caching_sampler_plan(FirtreeSampler* sampler, gboolean on_grid,
+        GHashTable* visited, GHashTable* caches)
+{
+    if(!sampler || g_hash_table_lookup(visited, sampler)) {
+        return 0;
+    }
+    g_hash_table_insert(visited, sampler, sampler);
+
+    if(FIRTREE_IS_CPU_CACHING_SAMPLER(sampler)) {
+        /* The cache is rendered at its pixel centres. */
+        return _firtree_cpu_caching_sampler_plan(
+                firtree_cpu_caching_sampler_get_sampler(
+                    FIRTREE_CPU_CACHING_SAMPLER(sampler)),
+                TRUE, visited, caches);
+    }
+
+    if(!FIRTREE_IS_KERNEL_SAMPLER(sampler)) {
+        return 0;
+    }
+
+    FirtreeKernel* kernel = firtree_kernel_sampler_get_kernel(
+            FIRTREE_KERNEL_SAMPLER(sampler));
+    if(!kernel) {
+        return 0;
+    }
+
+    guint n_inserted = 0;
+    GQuark* args = firtree_kernel_list_arguments(kernel, NULL);
+    for(; args && *args; ++args) {
+        FirtreeKernelArgumentSpec* spec =
+            firtree_kernel_get_argument_spec(kernel, *args);
+        if(spec->type != FIRTREE_TYPE_SAMPLER) {
+            continue;
+        }
+
+        GValue* val = firtree_kernel_get_argument_value(kernel, *args);
+        FirtreeSampler* input = val ?
+            (FirtreeSampler*) g_value_get_object(val) : NULL;
+        if(!input) {
+            continue;
+        }
+
+        gboolean input_on_grid = on_grid &&
+            _firtree_cpu_caching_sampler_taps_on_grid(kernel, *args, input);
+
+        n_inserted += _firtree_cpu_caching_sampler_plan(input,
+                input_on_grid, visited, caches);
+
+        if(FIRTREE_IS_CPU_CACHING_SAMPLER(input) || !input_on_grid) {
+            continue;
+        }
+
+        FirtreeSampler* cache =
+            (FirtreeSampler*) g_hash_table_lookup(caches, input);
+        if(!cache) {
+            if(!_firtree_cpu_caching_sampler_should_cache(kernel,
+                        *args, input)) {
+                continue;
+            }
+
+            FirtreeCpuCachingSampler* new_cache =
+                firtree_cpu_caching_sampler_new();
+            firtree_cpu_caching_sampler_set_sampler(new_cache, input);
+            cache = FIRTREE_SAMPLER(new_cache);
+
+            /* The table holds the only reference until the cache is bound
+             * to the argument below. */
+            g_hash_table_insert(caches, input, cache);
+            ++n_inserted;
+        }
+
+        GValue cache_val = { 0, };
+        g_value_init(&cache_val, FIRTREE_TYPE_SAMPLER);
+        g_value_set_object(&cache_val, cache);
+        firtree_kernel_set_argument_value(kernel, *args, &cache_val);
+        g_value_unset(&cache_val);
+    }
+
+    return n_inserted;
+}
+
+guint
+firtree_cpu_caching_sampler_plan_graph (FirtreeSampler* sampler)
+{
+    g_return_val_if_fail(FIRTREE_IS_SAMPLER(sampler), 0);
+
+    GHashTable* visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable* caches = g_hash_table_new_full(g_direct_hash,
+            g_direct_equal, NULL, g_object_unref);
+
+    /* The pipeline is assumed to be rendered at whole pixels. */
+    FirtreeAffineTransform* transform = firtree_sampler_get_transform(sampler);
+    gboolean on_grid =
+        _firtree_cpu_caching_sampler_is_whole_translation(transform);
+    g_object_unref(transform);
+
+    guint rv = _firtree_cpu_caching_sampler_plan(sampler, on_grid,
+            visited, caches);
+
+    g_hash_table_destroy(caches);
+    g_hash_table_destroy(visited);
+
+    return rv;
+}
+
+/* vim:sw=4:ts=4:et:cindent
+ */
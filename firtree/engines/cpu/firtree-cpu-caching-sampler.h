@@ -0,0 +1,163 @@
+/* firtree-cpu-caching-sampler.h */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.    See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA    02110-1301, USA
+ */
+
+#ifndef _FIRTREE_CPU_CACHING_SAMPLER
+#define _FIRTREE_CPU_CACHING_SAMPLER
+
+#include <glib-object.h>
+
+#include <firtree/firtree.h>
+#include <firtree/firtree-sampler.h>
+
+/**
+ * SECTION:firtree-cpu-caching-sampler
+ * @short_description: A sampler which renders its input once and caches it.
+ * @include: firtree/engines/cpu/firtree-cpu-caching-sampler.h
+ *
+ * When a kernel is rendered, the samplers it samples from are compiled into
+ * the same function. A kernel which samples an expensive input at several
+ * offsets, such as a blur of a colour-corrected image, therefore evaluates
+ * that input several times for each output pixel.
+ *
+ * A FirtreeCpuCachingSampler wraps such an input. The first time it is
+ * needed it renders its input into an intermediate floating point buffer
+ * covering the input's extent and is then sampled as a buffer with linear
+ * interpolation. The buffer is brought up to date before the next render
+ * after the input's contents change. Only the tiles affected by a change
+ * reported via FirtreeSampler::region-changed are re-rendered.
+ *
+ * Inputs with an infinite extent, or which are too large to cache, are
+ * sampled directly as if there were no caching sampler.
+ */
+
+G_BEGIN_DECLS
+
+#define FIRTREE_TYPE_CPU_CACHING_SAMPLER firtree_cpu_caching_sampler_get_type()
+
+#define FIRTREE_CPU_CACHING_SAMPLER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), FIRTREE_TYPE_CPU_CACHING_SAMPLER, FirtreeCpuCachingSampler))
+
+#define FIRTREE_CPU_CACHING_SAMPLER_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), FIRTREE_TYPE_CPU_CACHING_SAMPLER, FirtreeCpuCachingSamplerClass))
+
+#define FIRTREE_IS_CPU_CACHING_SAMPLER(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FIRTREE_TYPE_CPU_CACHING_SAMPLER))
+
+#define FIRTREE_IS_CPU_CACHING_SAMPLER_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), FIRTREE_TYPE_CPU_CACHING_SAMPLER))
+
+#define FIRTREE_CPU_CACHING_SAMPLER_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), FIRTREE_TYPE_CPU_CACHING_SAMPLER, FirtreeCpuCachingSamplerClass))
+
+/**
+ * FirtreeCpuCachingSampler:
+ * @parent: The parent FirtreeSampler.
+ *
+ * A structure representing a FirtreeCpuCachingSampler object.
+ */
+typedef struct {
+    FirtreeSampler parent;
+} FirtreeCpuCachingSampler;
+
+typedef struct {
+    FirtreeSamplerClass parent_class;
+} FirtreeCpuCachingSamplerClass;
+
+GType firtree_cpu_caching_sampler_get_type (void);
+
+/**
+ * firtree_cpu_caching_sampler_new:
+ *
+ * Construct a caching sampler with no input. Until an input has been set
+ * via firtree_cpu_caching_sampler_set_sampler(), the sampler is invalid.
+ *
+ * Returns: A new FirtreeCpuCachingSampler.
+ */
+FirtreeCpuCachingSampler*
+firtree_cpu_caching_sampler_new (void);
+
+/**
+ * firtree_cpu_caching_sampler_set_sampler:
+ * @self: A FirtreeCpuCachingSampler.
+ * @sampler: The FirtreeSampler to cache or NULL.
+ *
+ * Set @sampler as the input of @self, discarding any cached render of the
+ * previous input. A reference to @sampler is taken.
+ */
+void
+firtree_cpu_caching_sampler_set_sampler (FirtreeCpuCachingSampler* self,
+        FirtreeSampler* sampler);
+
+/**
+ * firtree_cpu_caching_sampler_get_sampler:
+ * @self: A FirtreeCpuCachingSampler.
+ *
+ * Retrieve the input set via firtree_cpu_caching_sampler_set_sampler().
+ *
+ * Returns: The input sampler or NULL if there is none.
+ */
+FirtreeSampler*
+firtree_cpu_caching_sampler_get_sampler (FirtreeCpuCachingSampler* self);
+
+/**
+ * firtree_cpu_caching_sampler_is_cached:
+ * @self: A FirtreeCpuCachingSampler.
+ *
+ * Returns: TRUE if @self holds a render of its input which is up to date.
+ */
+gboolean
+firtree_cpu_caching_sampler_is_cached (FirtreeCpuCachingSampler* self);
+
+/**
+ * firtree_cpu_caching_sampler_plan_graph:
+ * @sampler: The root FirtreeSampler of a pipeline.
+ *
+ * Decide, for each sampler argument of each kernel in the pipeline rooted at
+ * @sampler, whether its input should be compiled into the kernel or rendered
+ * once into an intermediate buffer. Inputs which are sampled at several
+ * different co-ordinates and which are expensive to evaluate compared to an
+ * interpolated buffer lookup are wrapped in a new FirtreeCpuCachingSampler.
+ * Inputs with an infinite extent are never cached.
+ *
+ * A cache holds one pixel per unit of its input and is sampled with linear
+ * interpolation, so it only reproduces its input exactly at pixel centres.
+ * Inputs are therefore only cached if every sample taken of them is a whole
+ * number of pixels from samplerCoord() and their transform, and that of
+ * every sampler between them and @sampler, is at most a translation by
+ * whole pixels. The pipeline is assumed to be rendered at one pixel per
+ * unit from a whole-pixel origin. Rendering it at any other scale or offset
+ * samples the caches between their pixels and so approximates the uncached
+ * output.
+ *
+ * The decision is based on estimates of the cost of each input and the
+ * number of times each kernel samples it, taken from their compiled code.
+ * Existing caching samplers are kept and so calling this function again on
+ * the same pipeline inserts no new caches unless the pipeline has changed.
+ *
+ * Returns: The number of caching samplers inserted.
+ */
+guint
+firtree_cpu_caching_sampler_plan_graph (FirtreeSampler* sampler);
+
+G_END_DECLS
+
+#endif /* _FIRTREE_CPU_CACHING_SAMPLER */
+
+/* vim:sw=4:ts=4:et:cindent
+ */
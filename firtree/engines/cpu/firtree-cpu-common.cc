@@ -19,9 +19,104 @@
 
 #include "firtree-cpu-common.hh"
 #include <firtree/firtree-lock-free-set.h>
+#include <firtree/internal/firtree-tiled-file-sampler-intl.hh>
 
 #include <cmath>
 
+/* Each thread running a reduction has its own output set so that slices
+ * of a reduction may write to separate sets. */
+static GStaticPrivate _firtree_cpu_common_reduce_output = G_STATIC_PRIVATE_INIT;
+
+void
+firtree_cpu_common_set_reduce_output(FirtreeLockFreeSet* set)
+{
+    g_static_private_set(&_firtree_cpu_common_reduce_output, set, NULL);
+}
+
+void
+firtree_cpu_common_reduce_emit(gpointer element)
+{
+    FirtreeLockFreeSet* set = (FirtreeLockFreeSet*)
+        g_static_private_get(&_firtree_cpu_common_reduce_output);
+    firtree_lock_free_set_add_element(set, element);
+}
+
+/* The pool never holds more than this many bytes of free buffers. */
+#define SCRATCH_POOL_MAX_BYTES (64 << 20)
+
+typedef struct {
+    gpointer    buffer;
+    gsize       size;
+} ScratchBuffer;
+
+G_LOCK_DEFINE_STATIC(_firtree_cpu_common_scratch_pool);
+static GSList* _firtree_cpu_common_scratch_pool = NULL;
+static gsize _firtree_cpu_common_scratch_pool_bytes = 0;
+
+gpointer
+firtree_cpu_common_scratch_buffer_alloc(gsize size)
+{
+    gpointer rv = NULL;
+
+    G_LOCK(_firtree_cpu_common_scratch_pool);
+    GSList* i;
+    for(i=_firtree_cpu_common_scratch_pool; i; i=g_slist_next(i)) {
+        ScratchBuffer* entry = (ScratchBuffer*) i->data;
+        if(entry->size == size) {
+            rv = entry->buffer;
+            _firtree_cpu_common_scratch_pool_bytes -= size;
+            _firtree_cpu_common_scratch_pool = g_slist_delete_link(
+                    _firtree_cpu_common_scratch_pool, i);
+            g_slice_free(ScratchBuffer, entry);
+            break;
+        }
+    }
+    G_UNLOCK(_firtree_cpu_common_scratch_pool);
+
+    if(!rv) {
+        rv = g_malloc(size);
+    }
+
+    return rv;
+}
+
+void
+firtree_cpu_common_scratch_buffer_free(gpointer buffer, gsize size)
+{
+    if(!buffer) {
+        return;
+    }
+
+    G_LOCK(_firtree_cpu_common_scratch_pool);
+
+    /* Make room by dropping the least recently released buffers. */
+    while(_firtree_cpu_common_scratch_pool &&
+            (_firtree_cpu_common_scratch_pool_bytes + size >
+             SCRATCH_POOL_MAX_BYTES)) {
+        GSList* last = g_slist_last(_firtree_cpu_common_scratch_pool);
+        ScratchBuffer* entry = (ScratchBuffer*) last->data;
+        _firtree_cpu_common_scratch_pool_bytes -= entry->size;
+        g_free(entry->buffer);
+        g_slice_free(ScratchBuffer, entry);
+        _firtree_cpu_common_scratch_pool = g_slist_delete_link(
+                _firtree_cpu_common_scratch_pool, last);
+    }
+
+    if(size <= SCRATCH_POOL_MAX_BYTES) {
+        ScratchBuffer* entry = g_slice_new(ScratchBuffer);
+        entry->buffer = buffer;
+        entry->size = size;
+        _firtree_cpu_common_scratch_pool = g_slist_prepend(
+                _firtree_cpu_common_scratch_pool, entry);
+        _firtree_cpu_common_scratch_pool_bytes += size;
+        buffer = NULL;
+    }
+
+    G_UNLOCK(_firtree_cpu_common_scratch_pool);
+
+    g_free(buffer);
+}
+
 void*
 firtree_cpu_common_lazy_function_creator(const std::string& name) {
     if(name == "exp_f") {
@@ -36,6 +131,18 @@ firtree_cpu_common_lazy_function_creator(const std::string& name) {
     if(name == "firtree_lock_free_set_add_element") { 
         return (void*)firtree_lock_free_set_add_element;
     }
+    if(name == "firtree_cpu_common_set_reduce_output") { 
+        return (void*)firtree_cpu_common_set_reduce_output;
+    }
+    if(name == "firtree_cpu_common_reduce_emit") { 
+        return (void*)firtree_cpu_common_reduce_emit;
+    }
+    if(name == "firtree_lock_free_set_is_full") { 
+        return (void*)firtree_lock_free_set_is_full;
+    }
+    if(name == "firtree_tiled_file_sampler_fetch_block") {
+        return (void*)firtree_tiled_file_sampler_fetch_block;
+    }
     g_debug("Do not know what function to use for '%s'.", name.c_str());
     return NULL;
 }
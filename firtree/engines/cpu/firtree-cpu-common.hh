@@ -23,13 +23,60 @@
 #include <glib-object.h>
 
 #include <firtree/firtree.h>
+#include <firtree/firtree-sampler.h>
 #include <string>
 
+#include "firtree-cpu-reduce-engine.h"
+
 G_BEGIN_DECLS
 
 void*
 firtree_cpu_common_lazy_function_creator(const std::string& name);
 
+/* The set which emit() calls made by reduce kernels on the calling thread
+ * append to. These are called from within the JIT-ed reduce function. */
+void
+firtree_cpu_common_set_reduce_output(FirtreeLockFreeSet* set);
+
+void
+firtree_cpu_common_reduce_emit(gpointer element);
+
+/* A pool of scratch buffers for intermediate renders. Buffers released to
+ * the pool are handed out again to later requests of exactly the same size
+ * so that re-rendering a graph does not repeatedly allocate large buffers.
+ * Buffers are not zeroed. These may be called from any thread. */
+gpointer
+firtree_cpu_common_scratch_buffer_alloc(gsize size);
+
+void
+firtree_cpu_common_scratch_buffer_free(gpointer buffer, gsize size);
+
+/* Used by the renderer to interleave the slices of one or more reductions
+ * with those of a render. A request is begun with the same arguments as
+ * firtree_cpu_reduce_engine_run(), each 8-row slice is reduced once and the
+ * request is ended. Begin returns NULL if the engine cannot run. Otherwise
+ * the engine is locked against other reductions until the request is ended
+ * and so an engine may only take part once in each fused pass. If @view is
+ * non-NULL, kernel arguments which are @rendered and are only sampled at
+ * samplerCoord() read @view instead for the duration of the request. */
+struct FirtreeCpuReduceEngineRequest;
+
+FirtreeCpuReduceEngineRequest*
+firtree_cpu_reduce_engine_begin_fused_reduce (FirtreeCpuReduceEngine* self,
+        FirtreeLockFreeSet* set,
+        FirtreeVec4* extents,
+        guint width, guint height,
+        FirtreeSampler* rendered,
+        FirtreeSampler* view);
+
+void
+firtree_cpu_reduce_engine_fused_reduce_slice (FirtreeCpuReduceEngineRequest* request,
+        guint slice);
+
+void
+firtree_cpu_reduce_engine_end_fused_reduce (FirtreeCpuReduceEngine* self,
+        FirtreeCpuReduceEngineRequest* request);
+
 G_END_DECLS
 
 #endif /* _FIRTREE_CPU_COMMON */
@@ -22,6 +22,8 @@
 
 #include "firtree-cpu-jit.hh"
 
+#include <string.h>
+
 #include <llvm/Module.h>
 #include <llvm/ModuleProvider.h>
 #include <llvm/Support/MemoryBuffer.h>
@@ -98,15 +100,38 @@ static const char* _firtree_cpu_jit_function_names[] = {
     /* Rendering to the following formats is not supported */
 
     NULL, /* FIRTREE_FORMAT_L8 */
-    NULL, /* FIRTREE_FORMAT_I420_FOURCC */
-    NULL, /* FIRTREE_FORMAT_YV12_FOURCC */
+
+    /* These take a FirtreeCpuJitPlanes rather than a buffer. */
+    "render_FIRTREE_FORMAT_I420_FOURCC",
+    "render_FIRTREE_FORMAT_YV12_FOURCC",
 
     "render_FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED",
 
+    "render_FIRTREE_FORMAT_NV12_FOURCC",
+    "render_FIRTREE_FORMAT_NV21_FOURCC",
+    "render_FIRTREE_FORMAT_P010_FOURCC",
+
+    "render_FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED",
+    "render_FIRTREE_FORMAT_RGBA64",
+    "render_FIRTREE_FORMAT_RGBA64_PREMULTIPLIED",
+
+    NULL,
+};
+
+/* Indexed by FirtreeRenderMode. The render function for a mode and format
+ * is the one above with this inserted after "render_". */
+static const char* _firtree_cpu_jit_mode_prefixes[] = {
+    "",             /* FIRTREE_RENDER_MODE_OVER */
+    "replace_",     /* FIRTREE_RENDER_MODE_REPLACE */
+    "add_",         /* FIRTREE_RENDER_MODE_ADD */
+    "multiply_",    /* FIRTREE_RENDER_MODE_MULTIPLY */
+    "screen_",      /* FIRTREE_RENDER_MODE_SCREEN */
+
     NULL,
 };
 
 #define RENDER_FUNC_NAME(id) (_firtree_cpu_jit_function_names[(id)])
+#define RENDER_MODE_PREFIX(mode) (_firtree_cpu_jit_mode_prefixes[(mode)])
 
 static void _firtree_cpu_jit_optimise_module(llvm::Module* m,
         std::vector<const char*>& export_list);
@@ -115,6 +140,15 @@ typedef struct _FirtreeCpuJitPrivate FirtreeCpuJitPrivate;
 
 static llvm::ExecutionEngine*   _firtree_cpu_jit_global_llvm_engine = NULL;
 
+/* The execution engine is shared by every FirtreeCpuJit and is not thread
+ * safe. This lock protects it and the modules added to it. Generating the
+ * sampler functions fed to it is covered too since samplers and kernels
+ * cache their LLVM functions and analyses unguarded and a sampler graph may
+ * be shared between renderers on different threads. It is recursive since
+ * generating a function can itself query or compile other samplers. */
+static GStaticRecMutex _firtree_cpu_jit_global_llvm_lock =
+    G_STATIC_REC_MUTEX_INIT;
+
 struct _FirtreeCpuJitPrivate {
     llvm::ModuleProvider*       cached_llvm_module_provider;
     llvm::Function*             cached_llvm_function;
@@ -128,6 +162,7 @@ firtree_cpu_jit_get_compute_function (FirtreeCpuJit* self,
         const char* compute_function_name,
         llvm::Function* llvm_function,
         FirtreeKernelTarget target,
+        FirtreeAffineTransform* transform,
         FirtreeCpuJitLazyFunctionCreatorFunc lazy_creator_function);
 
 static void
@@ -138,10 +173,12 @@ firtree_cpu_jit_dispose (GObject *object)
     FirtreeCpuJitPrivate* p = GET_PRIVATE(cpu_jit); 
 
     if(p && p->cached_llvm_module_provider) {
+        firtree_cpu_jit_lock();
         if(_firtree_cpu_jit_global_llvm_engine) {
             _firtree_cpu_jit_global_llvm_engine->
                 deleteModuleProvider(p->cached_llvm_module_provider);
         }
+        firtree_cpu_jit_unlock();
         p->cached_llvm_module_provider = NULL;
     }
 
@@ -182,6 +219,18 @@ firtree_cpu_jit_new (void)
         g_object_new (FIRTREE_TYPE_CPU_JIT, NULL);
 }
 
+void
+firtree_cpu_jit_lock(void)
+{
+    g_static_rec_mutex_lock(&_firtree_cpu_jit_global_llvm_lock);
+}
+
+void
+firtree_cpu_jit_unlock(void)
+{
+    g_static_rec_mutex_unlock(&_firtree_cpu_jit_global_llvm_lock);
+}
+
 void
 firtree_cpu_jit_purge_cache(FirtreeCpuJit* self)
 {
@@ -196,6 +245,8 @@ firtree_cpu_jit_purge_cache(FirtreeCpuJit* self)
 FirtreeCpuJitRenderFunc
 firtree_cpu_jit_get_render_function_for_sampler(FirtreeCpuJit* self,
         FirtreeBufferFormat format,
+        FirtreeRenderMode mode,
+        gboolean stream,
         FirtreeSampler* sampler,
         FirtreeCpuJitLazyFunctionCreatorFunc lazy_creator_function)
 {
@@ -204,13 +255,37 @@ firtree_cpu_jit_get_render_function_for_sampler(FirtreeCpuJit* self,
         return NULL;
     }
 
-    const char* func_name = RENDER_FUNC_NAME(format);
+    if((mode < 0) || (mode >= FIRTREE_RENDER_MODE_LAST)) {
+        g_error("Invalid render mode: %i", mode);
+        return NULL;
+    }
+
+    const char* mode_prefix = RENDER_MODE_PREFIX(mode);
+    if(!stream && (mode == FIRTREE_RENDER_MODE_REPLACE)) {
+        mode_prefix = "replace_cached_";
+    }
+
+    gchar* func_name = NULL;
+    if(RENDER_FUNC_NAME(format)) {
+        func_name = g_strdup_printf("render_%s%s", mode_prefix,
+                RENDER_FUNC_NAME(format) + strlen("render_"));
+    }
+
+    /* The sampler's own transform maps output pixels into the sampler. */
+    FirtreeAffineTransform* transform = firtree_sampler_get_transform(sampler);
 
-    return (FirtreeCpuJitRenderFunc)
+    firtree_cpu_jit_lock();
+    FirtreeCpuJitRenderFunc rv = (FirtreeCpuJitRenderFunc)
         firtree_cpu_jit_get_compute_function(self,
             func_name, firtree_sampler_get_sample_function(sampler),
-            FIRTREE_KERNEL_TARGET_RENDER,
+            FIRTREE_KERNEL_TARGET_RENDER, transform,
             lazy_creator_function);
+    firtree_cpu_jit_unlock();
+
+    g_object_unref(transform);
+    g_free(func_name);
+
+    return rv;
 }
 
 FirtreeCpuJitReduceFunc
@@ -225,18 +300,23 @@ firtree_cpu_jit_get_reduce_function_for_kernel(FirtreeCpuJit* self,
 
     const char* func_name = "reduce";
 
+    firtree_cpu_jit_lock();
+
     llvm::Function* f = firtree_kernel_create_overall_function(kernel);
     if(!f) {
+        firtree_cpu_jit_unlock();
         return NULL;
     }
 
     FirtreeCpuJitReduceFunc rv = (FirtreeCpuJitReduceFunc)
         firtree_cpu_jit_get_compute_function(self,
-            func_name, f, FIRTREE_KERNEL_TARGET_REDUCE,
+            func_name, f, FIRTREE_KERNEL_TARGET_REDUCE, NULL,
             lazy_creator_function);
 
     delete f->getParent();
 
+    firtree_cpu_jit_unlock();
+
     return rv;
 }
 
@@ -245,6 +325,7 @@ firtree_cpu_jit_get_compute_function (FirtreeCpuJit* self,
         const char* compute_function_name,
         llvm::Function* llvm_function,
         FirtreeKernelTarget target,
+        FirtreeAffineTransform* transform,
         FirtreeCpuJitLazyFunctionCreatorFunc lazy_creator_function)
 {
     FirtreeCpuJitPrivate* p = GET_PRIVATE(self); 
@@ -281,6 +362,8 @@ firtree_cpu_jit_get_compute_function (FirtreeCpuJit* self,
     }
 #endif
 
+    firtree_cpu_jit_lock();
+
     /* create an LLVM module from the bitcode */
 #if FIRTREE_LLVM_AT_LEAST_2_6
     llvm::Module* m = llvm::ParseBitcodeFile(p->render_buffer_bitcode,
@@ -318,7 +401,12 @@ firtree_cpu_jit_get_compute_function (FirtreeCpuJit* self,
                     existing_llvm_render_function);
             std::vector<llvm::Value*> args;
             llvm::Function::arg_iterator AI = existing_llvm_render_function->arg_begin();
-            args.push_back(AI);
+            if(transform) {
+                args.push_back(firtree_engine_create_affine_transform_call(
+                            linked_module, transform, AI, bb));
+            } else {
+                args.push_back(AI);
+            }
             llvm::Value* sample_val = llvm::CallInst::Create(
                     new_sampler_func,
                     args.begin(), args.end(),
@@ -395,9 +483,53 @@ firtree_cpu_jit_get_compute_function (FirtreeCpuJit* self,
     p->cached_llvm_function = new_compute_func;
     g_assert(compute_function);
 
+    firtree_cpu_jit_unlock();
+
     return compute_function;
 }
 
+/* Once the kernel and the emit_*() builtins are inlined into reduce(), the
+ * emit calls may append to reduce()'s output argument directly rather than
+ * looking up the calling thread's output set on every element. Calls which
+ * were not inlined are left to firtree_cpu_common_reduce_emit(). */
+class BindReduceOutputPass : public Firtree::FunctionCallReplacementPass {
+    public:
+        static char ID;
+        BindReduceOutputPass() : Firtree::FunctionCallReplacementPass(&ID) { }
+
+    protected:
+        virtual bool interestedInCallToFunction(const std::string& name) {
+            return (name == "firtree_cpu_common_reduce_emit");
+        }
+
+        virtual llvm::Value* getReplacementForCallInst(llvm::CallInst& instruction) {
+            llvm::CallInst* call = &instruction;
+            llvm::Function* f = call->getParent()->getParent();
+            if((f->getName() != "reduce") || f->arg_empty()) {
+                return NULL;
+            }
+
+            llvm::Value* output = f->arg_begin();
+            llvm::Value* element = call->getOperand(1);
+
+            std::vector<const llvm::Type*> param_types;
+            param_types.push_back(output->getType());
+            param_types.push_back(element->getType());
+            llvm::FunctionType* add_type = llvm::FunctionType::get(
+                    FIRTREE_LLVM_VOID_TY, param_types, false);
+            llvm::Constant* add_element = f->getParent()->getOrInsertFunction(
+                    "firtree_lock_free_set_add_element", add_type);
+
+            std::vector<llvm::Value*> params;
+            params.push_back(output);
+            params.push_back(element);
+            return llvm::CallInst::Create(add_element, params.begin(),
+                    params.end(), "", call);
+        }
+};
+
+char BindReduceOutputPass::ID = 0;
+
 /* optimise a llvm module by internalising all but the
  * named function and agressively inlining. */
 static void _firtree_cpu_jit_optimise_module(llvm::Module* m,
@@ -415,11 +547,24 @@ static void _firtree_cpu_jit_optimise_module(llvm::Module* m,
     PM.add(new CanonicaliseCoglCallsPass());
 #endif
 
+    /* Retarget image buffer sampling to the format-specialised functions
+     * while they are still visible in the linked module. */
+    PM.add(new Firtree::SpecialiseImageBufferCallsPass());
+
     PM.add(llvm::createInternalizePass(export_list));
     PM.add(llvm::createFunctionInliningPass(32768)); 
 
     PM.add(llvm::createAggressiveDCEPass()); 
 
+    /* With everything inlined, collapse chains of sampler transforms into
+     * a single transform each and lower them to arithmetic. */
+    PM.add(llvm::createCFGSimplificationPass());
+    PM.add(llvm::createInstructionCombiningPass());
+    PM.add(new Firtree::AffineTransformFoldingPass());
+    PM.add(new Firtree::AffineTransformLoweringPass());
+    PM.add(new BindReduceOutputPass());
+    PM.add(llvm::createAggressiveDCEPass());
+
     firtree_engine_create_standard_optimization_passes(&PM, 3, 
                             /*OptimizeSize=*/ false,
                             /*UnitAtATime=*/ true,
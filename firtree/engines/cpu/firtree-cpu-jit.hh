@@ -81,6 +81,21 @@ typedef void (*FirtreeCpuJitRenderFunc) (unsigned char* buffer,
     unsigned int row_width, unsigned int num_rows,
     unsigned int row_stride, float* extents);
 
+/**
+ * FirtreeCpuJitPlanes:
+ * @planes: The first row of the Y, Cb and Cr planes to render into.
+ * @strides: The size in bytes of one row of each plane.
+ *
+ * The render functions for the 4:2:0 YCbCr formats are passed a pointer to
+ * one of these in place of the buffer. The Cb and Cr pointers may point into
+ * the same interleaved plane. The layout must match RenderPlanes in
+ * render-buffer.c.
+ */
+typedef struct {
+    unsigned char*  planes[3];
+    unsigned int    strides[3];
+} FirtreeCpuJitPlanes;
+
 typedef void (*FirtreeCpuJitReduceFunc) (gpointer output,
     unsigned int row_width, unsigned int num_rows,
     float* extents);
@@ -95,15 +110,44 @@ typedef void (*FirtreeCpuJitReduceFunc) (gpointer output,
 FirtreeCpuJit* 
 firtree_cpu_jit_new (void);
 
+/**
+ * firtree_cpu_jit_lock:
+ *
+ * Take the global lock which serialises use of LLVM by the CPU engine. The
+ * lock is recursive and is taken by the get_{reduce,render}_function calls
+ * while the sampler or kernel functions are generated and compiled.
+ *
+ * Samplers and kernels cache their LLVM functions and the results of
+ * analyses such as firtree_sampler_is_opaque() without locking of their own.
+ * Any query of a sampler graph which may be being compiled on another thread
+ * must therefore be made with this lock held.
+ */
+void
+firtree_cpu_jit_lock(void);
+
+/**
+ * firtree_cpu_jit_unlock:
+ *
+ * Release the lock taken by firtree_cpu_jit_lock().
+ */
+void
+firtree_cpu_jit_unlock(void);
+
 /**
  * firtree_cpu_jit_get_render_function_for_sampler:
  * 
  * Compile the sampler function of the passed sampler and return a pointer to
- * a renderer.
+ * a renderer which combines the samples with the buffer according to @mode.
+ * In FIRTREE_RENDER_MODE_REPLACE mode the renderer writes the samples into
+ * the buffer without reading what was there. Long rows are then written
+ * with non-temporal stores unless @stream is FALSE, which should be passed
+ * when the rendered pixels are to be read again straight away.
  */
 FirtreeCpuJitRenderFunc
 firtree_cpu_jit_get_render_function_for_sampler(FirtreeCpuJit* self,
         FirtreeBufferFormat format,
+        FirtreeRenderMode mode,
+        gboolean stream,
         FirtreeSampler* sampler,
         FirtreeCpuJitLazyFunctionCreatorFunc lazy_creator_function);
 
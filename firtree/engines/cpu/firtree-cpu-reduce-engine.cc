@@ -34,6 +34,9 @@
 
 #include <sstream>
 
+#include <float.h>
+#include <string.h>
+
 G_DEFINE_TYPE (FirtreeCpuReduceEngine, firtree_cpu_reduce_engine, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(o) \
@@ -41,22 +44,124 @@ G_DEFINE_TYPE (FirtreeCpuReduceEngine, firtree_cpu_reduce_engine, G_TYPE_OBJECT)
 
 typedef struct _FirtreeCpuReduceEnginePrivate FirtreeCpuReduceEnginePrivate;
 
+/* Per-frame state retained by the engine in streaming mode. */
+typedef struct {
+    FirtreeLockFreeSet*         set;        /* The elements emitted for this frame. */
+    FirtreeVec4                 sum;        /* Component-wise sum of elements. */
+    FirtreeVec4                 min;        /* Component-wise minimum of elements. */
+    FirtreeVec4                 max;        /* Component-wise maximum of elements. */
+    guint                       count;      /* Number of elements. */
+} FirtreeCpuReduceEngineFrame;
+
+/* Accumulated state over all frames in the streaming window. */
+typedef struct {
+    FirtreeVec4                 sum;
+    FirtreeVec4                 min;
+    FirtreeVec4                 max;
+    guint                       count;
+} FirtreeCpuReduceEngineAccumulator;
+
 struct _FirtreeCpuReduceEnginePrivate {
     FirtreeKernel*              kernel;
     gulong                      kernel_handler_id;
     FirtreeCpuJit*              jit;
 
     FirtreeCpuJitReduceFunc     cached_reduce_func;
+
+    /* Early-exit state. */
+    guint                       max_elements;
+    volatile gint               cancelled;
+
+    /* Deterministic mode writes each slice to its own set from this pool
+     * and concatenates them in slice order afterwards. */
+    gboolean                    deterministic;
+    GPtrArray*                  slice_sets;
+
+    /* Streaming state. The frames form a ring of stream_window+1 entries so
+     * that the most recently completed frame is never the one being written
+     * to. */
+    guint                       stream_window;
+    FirtreeCpuReduceEngineFrame* stream_frames;
+    guint                       stream_n_frames;
+    guint                       stream_next_frame;
+    guint                       stream_frames_seen;
+    FirtreeCpuReduceEngineAccumulator stream_running;
+
+    /* The accumulator as of the last completed frame. Protected by 
+     * stream_mutex since it may be read while the next frame is being
+     * reduced. */
+    FirtreeCpuReduceEngineAccumulator stream_published;
+    GMutex*                     stream_mutex;
+
+    /* Held from the start to the end of each reduction so that reductions
+     * from different threads do not share the JIT-ed function, the slice
+     * pool or the stream state. */
+    GMutex*                     run_mutex;
 };
 
 struct FirtreeCpuReduceEngineRequest {
     FirtreeCpuJitReduceFunc     func;
-    gpointer                    output;
+    FirtreeLockFreeSet*         output;
+    FirtreeLockFreeSet**        slice_outputs;  /* NULL or one set per slice. */
+    volatile gint*              cancelled;
+
+    /* With a limit in deterministic mode, the number of leading slices
+     * which have been reduced and how many more elements the output may
+     * take from them. Once the leading slices fill the output no later
+     * slice can contribute and so the remaining slices are skipped. */
+    volatile gint*              slice_done;     /* NULL or one per slice. */
+    volatile gint               prefix_slices;
+    volatile gint               prefix_remaining;
+    guint                       n_slices;
     unsigned int                row_width;
     unsigned int                num_rows;
     float                       extents[4];
+    gint                        old_max_element_count;
 };
 
+static void
+_firtree_cpu_reduce_engine_accumulator_reset(FirtreeCpuReduceEngineAccumulator* acc)
+{
+    acc->sum.x = acc->sum.y = acc->sum.z = acc->sum.w = 0.f;
+    acc->min.x = acc->min.y = acc->min.z = acc->min.w = FLT_MAX;
+    acc->max.x = acc->max.y = acc->max.z = acc->max.w = -FLT_MAX;
+    acc->count = 0;
+}
+
+/* release the ring of streaming frames, if any. */
+static void
+_firtree_cpu_reduce_engine_free_stream_frames(FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self);
+    guint i;
+
+    if(p->stream_frames) {
+        for(i=0; i<p->stream_n_frames; ++i) {
+            firtree_lock_free_set_free(p->stream_frames[i].set);
+        }
+        g_free(p->stream_frames);
+        p->stream_frames = NULL;
+    }
+    p->stream_n_frames = 0;
+}
+
+/* release the pool of per-slice sets used in deterministic mode. */
+static void
+_firtree_cpu_reduce_engine_free_slice_sets(FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self);
+    guint i;
+
+    if(p->slice_sets) {
+        for(i=0; i<p->slice_sets->len; ++i) {
+            firtree_lock_free_set_free((FirtreeLockFreeSet*)
+                    g_ptr_array_index(p->slice_sets, i));
+        }
+        g_ptr_array_free(p->slice_sets, TRUE);
+        p->slice_sets = NULL;
+    }
+}
+
 /* invalidate (and release) any cached LLVM modules/functions. This
  * will cause them to be re-generated when ..._get_function() is next
  * called. */
@@ -83,6 +188,27 @@ firtree_cpu_reduce_engine_dispose (GObject *object)
     }
 
     p->cached_reduce_func = NULL;
+
+    _firtree_cpu_reduce_engine_free_stream_frames(cpu_reduce_engine);
+    _firtree_cpu_reduce_engine_free_slice_sets(cpu_reduce_engine);
+}
+
+static void
+firtree_cpu_reduce_engine_finalize (GObject *object)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(object); 
+
+    if(p->stream_mutex) {
+        g_mutex_free(p->stream_mutex);
+        p->stream_mutex = NULL;
+    }
+
+    if(p->run_mutex) {
+        g_mutex_free(p->run_mutex);
+        p->run_mutex = NULL;
+    }
+
+    G_OBJECT_CLASS (firtree_cpu_reduce_engine_parent_class)->finalize (object);
 }
 
 static void
@@ -91,6 +217,7 @@ firtree_cpu_reduce_engine_class_init (FirtreeCpuReduceEngineClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
     g_type_class_add_private (klass, sizeof (FirtreeCpuReduceEnginePrivate));
     object_class->dispose = firtree_cpu_reduce_engine_dispose;
+    object_class->finalize = firtree_cpu_reduce_engine_finalize;
 }
 
 static void
@@ -100,6 +227,22 @@ firtree_cpu_reduce_engine_init (FirtreeCpuReduceEngine *self)
     p->kernel = NULL;
     p->jit = firtree_cpu_jit_new();
     p->cached_reduce_func = NULL;
+
+    p->max_elements = 0;
+    p->cancelled = 0;
+
+    p->deterministic = FALSE;
+    p->slice_sets = NULL;
+
+    p->stream_window = 1;
+    p->stream_frames = NULL;
+    p->stream_n_frames = 0;
+    p->stream_next_frame = 0;
+    p->stream_frames_seen = 0;
+    _firtree_cpu_reduce_engine_accumulator_reset(&p->stream_running);
+    _firtree_cpu_reduce_engine_accumulator_reset(&p->stream_published);
+    p->stream_mutex = g_mutex_new();
+    p->run_mutex = g_mutex_new();
 }
 
 FirtreeCpuReduceEngine*
@@ -145,6 +288,9 @@ firtree_cpu_reduce_engine_set_kernel (FirtreeCpuReduceEngine* self,
     }
 
     _firtree_cpu_reduce_engine_invalidate_llvm_cache(self);
+
+    /* Results from the old kernel have no meaning for the new one. */
+    firtree_cpu_reduce_engine_reset_stream(self);
 }
 
 FirtreeKernel*
@@ -174,9 +320,51 @@ firtree_cpu_reduce_engine_get_reduce_engine_func(FirtreeCpuReduceEngine* self)
     return p->cached_reduce_func;
 }
 
+/* Record that @slice of a deterministic, limited reduction has been reduced
+ * or skipped and extend the run of leading reduced slices as far as
+ * possible. Whichever thread moves the end of the run past a slice counts
+ * that slice's elements against the limit. */
+static void
+_firtree_cpu_reduce_engine_slice_done(FirtreeCpuReduceEngineRequest* request,
+        guint slice)
+{
+    if(!request->slice_done) {
+        return;
+    }
+
+    g_atomic_int_set(&(request->slice_done[slice]), 1);
+
+    while(TRUE) {
+        gint next = g_atomic_int_get(&(request->prefix_slices));
+        if((next >= (gint) request->n_slices) ||
+                !g_atomic_int_get(&(request->slice_done[next]))) {
+            return;
+        }
+        if(g_atomic_int_compare_and_exchange(&(request->prefix_slices),
+                    next, next + 1)) {
+            g_atomic_int_add(&(request->prefix_remaining),
+                    -firtree_lock_free_set_get_element_count(
+                        request->slice_outputs[next]));
+        }
+    }
+}
+
 static void
 _call_reduce_func(guint slice, FirtreeCpuReduceEngineRequest* request)
 {
+    FirtreeLockFreeSet* output = request->slice_outputs ?
+        request->slice_outputs[slice] : request->output;
+
+    /* Skip this slice if the reduction has been cancelled or if the output
+     * is already full. */
+    if(g_atomic_int_get(request->cancelled) || 
+            firtree_lock_free_set_is_full(output) ||
+            (request->slice_done &&
+             (g_atomic_int_get(&(request->prefix_remaining)) <= 0))) {
+        _firtree_cpu_reduce_engine_slice_done(request, slice);
+        return;
+    }
+
     guint start_row = slice << 3;
     guint n_rows = MIN(start_row+8, request->num_rows) - start_row;
 
@@ -185,7 +373,108 @@ _call_reduce_func(guint slice, FirtreeCpuReduceEngineRequest* request)
         request->extents[0], request->extents[1] + (dy * (float)start_row),
         request->extents[2], dy * (float)n_rows };
 
-    request->func(request->output, request->row_width, n_rows, extents);
+    request->func(output, request->row_width, n_rows, extents);
+
+    _firtree_cpu_reduce_engine_slice_done(request, slice);
+}
+
+/* Prepare a reduction of @set by @func. This is split from the reduction
+ * itself so that the renderer may interleave the slices of a reduction with
+ * those of a render. See firtree_cpu_reduce_engine_begin_fused_reduce(). The
+ * request must be released via _firtree_cpu_reduce_engine_end_reduce(). */
+static FirtreeCpuReduceEngineRequest*
+_firtree_cpu_reduce_engine_begin_reduce(FirtreeCpuReduceEngine* self,
+        FirtreeLockFreeSet* set,
+        FirtreeCpuJitReduceFunc func,  
+        unsigned int row_width, unsigned int num_rows,
+        float* extents) 
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    guint n_slices = (num_rows+7)>>3;
+    guint i;
+
+    FirtreeCpuReduceEngineRequest* request = 
+        g_slice_new(FirtreeCpuReduceEngineRequest);
+    request->func = func;
+    request->output = set;
+    request->slice_outputs = NULL;
+    request->cancelled = &(p->cancelled);
+    request->slice_done = NULL;
+    request->prefix_slices = 0;
+    request->prefix_remaining = 0;
+    request->n_slices = n_slices;
+    request->row_width = row_width;
+    request->num_rows = num_rows;
+    request->old_max_element_count = 
+        firtree_lock_free_set_get_max_element_count(set);
+    for(i=0; i<4; ++i) {
+        request->extents[i] = extents[i];
+    }
+
+    /* Bound the output for the duration of this reduction. */
+    if(p->max_elements > 0) {
+        firtree_lock_free_set_set_max_element_count(set, p->max_elements);
+    }
+
+    if(p->deterministic) {
+        /* Make sure the pool has enough sets of the right size. */
+        gsize element_size = firtree_lock_free_set_get_element_size(set);
+        if(p->slice_sets && (p->slice_sets->len > 0) &&
+                (firtree_lock_free_set_get_element_size((FirtreeLockFreeSet*)
+                    g_ptr_array_index(p->slice_sets, 0)) != element_size)) {
+            _firtree_cpu_reduce_engine_free_slice_sets(self);
+        }
+        if(!p->slice_sets) {
+            p->slice_sets = g_ptr_array_sized_new(n_slices);
+        }
+        while(p->slice_sets->len < n_slices) {
+            g_ptr_array_add(p->slice_sets, 
+                    firtree_lock_free_set_new(element_size));
+        }
+        for(i=0; i<n_slices; ++i) {
+            firtree_lock_free_set_set_max_element_count((FirtreeLockFreeSet*)
+                    g_ptr_array_index(p->slice_sets, i), p->max_elements);
+        }
+
+        request->slice_outputs = (FirtreeLockFreeSet**) p->slice_sets->pdata;
+
+        if(p->max_elements > 0) {
+            request->slice_done = g_new0(volatile gint, n_slices);
+            request->prefix_remaining = (gint) p->max_elements -
+                firtree_lock_free_set_get_element_count(set);
+        }
+    }
+
+    g_atomic_int_set(&(p->cancelled), 0);
+
+    return request;
+}
+
+static void
+_firtree_cpu_reduce_engine_end_reduce(FirtreeCpuReduceEngine* self,
+        FirtreeCpuReduceEngineRequest* request)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    FirtreeLockFreeSet* set = request->output;
+
+    if(p->deterministic) {
+        /* Concatenate the slices in order. This leaves each slice set empty
+         * ready for the next reduction. */
+        guint i, n_slices = (request->num_rows+7)>>3;
+        for(i=0; i<n_slices; ++i) {
+            firtree_lock_free_set_append_set(set, (FirtreeLockFreeSet*)
+                    g_ptr_array_index(p->slice_sets, i));
+        }
+    }
+
+    if(p->max_elements > 0) {
+        firtree_lock_free_set_set_max_element_count(set, 
+                request->old_max_element_count);
+    }
+
+    g_free((gpointer) request->slice_done);
+    g_slice_free(FirtreeCpuReduceEngineRequest, request);
 }
 
 static void
@@ -199,14 +488,55 @@ firtree_cpu_reduce_engine_perform_reduce(FirtreeCpuReduceEngine* self,
         return;
     }
 
-    FirtreeCpuReduceEngineRequest request = {
-        func, 
-        set,
-        row_width, num_rows,
-        { extents[0], extents[1], extents[2], extents[3] },
-    };
+    FirtreeCpuReduceEngineRequest* request = 
+        _firtree_cpu_reduce_engine_begin_reduce(self, set, func,
+                row_width, num_rows, extents);
+
+    threading_apply((num_rows+7)>>3, 
+            (ThreadingApplyFunc) _call_reduce_func, request);
+
+    _firtree_cpu_reduce_engine_end_reduce(self, request);
+}
 
-    threading_apply(((num_rows+7)>>3), (ThreadingApplyFunc) _call_reduce_func, &request);
+gsize
+firtree_cpu_reduce_engine_get_element_size (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    if(!p->kernel) {
+        return 0;
+    }
+
+    return firtree_kernel_get_emit_size(p->kernel);
+}
+
+/* Check that the elements emitted by the kernel will fit into @set. */
+static gboolean
+_firtree_cpu_reduce_engine_check_set(FirtreeCpuReduceEngine* self,
+        FirtreeLockFreeSet* set)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    GType emit_type = firtree_kernel_get_emit_type(p->kernel);
+    if(emit_type == G_TYPE_INVALID) {
+        g_warning("Reduce kernel emits values of more than one type.");
+        return FALSE;
+    }
+
+    if(emit_type == G_TYPE_NONE) {
+        return TRUE;
+    }
+
+    gsize element_size = firtree_kernel_get_emit_size(p->kernel);
+    if(firtree_lock_free_set_get_element_size(set) != element_size) {
+        g_warning("Output set has element size %u but the reduce kernel "
+                "emits %s values of size %u.",
+                (guint) firtree_lock_free_set_get_element_size(set),
+                g_type_name(emit_type), (guint) element_size);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 void
@@ -215,15 +545,409 @@ firtree_cpu_reduce_engine_run (FirtreeCpuReduceEngine* self,
         FirtreeVec4* extents,
         guint width, guint height)
 {
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->run_mutex);
+
     FirtreeCpuJitReduceFunc reduce_func = 
         firtree_cpu_reduce_engine_get_reduce_engine_func(self);
 
+    if(reduce_func && _firtree_cpu_reduce_engine_check_set(self, set)) {
+        firtree_cpu_reduce_engine_perform_reduce(self, set, reduce_func,
+                width, height, (float*)extents);
+    }
+
+    g_mutex_unlock(p->run_mutex);
+}
+
+/* Compile the kernel with @view bound in place of each argument which is
+ * @rendered and which is only sampled at samplerCoord(). The original
+ * arguments are restored once the function is compiled. Returns NULL if no
+ * argument could be rebound. The caller must hold run_mutex. */
+static FirtreeCpuJitReduceFunc
+_firtree_cpu_reduce_engine_get_fused_func(FirtreeCpuReduceEngine* self,
+        FirtreeSampler* rendered, FirtreeSampler* view)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    if(!p->kernel) {
+        return NULL;
+    }
+
+    GSList* rebound = NULL;
+    GValue sampler_val = { 0, };
+    g_value_init(&sampler_val, FIRTREE_TYPE_SAMPLER);
+    g_value_set_object(&sampler_val, view);
+
+    GQuark* args = firtree_kernel_list_arguments(p->kernel, NULL);
+    for(; args && *args; ++args) {
+        FirtreeKernelArgumentSpec* spec =
+            firtree_kernel_get_argument_spec(p->kernel, *args);
+        if(spec->type != FIRTREE_TYPE_SAMPLER) {
+            continue;
+        }
+
+        GValue* val = firtree_kernel_get_argument_value(p->kernel, *args);
+        if(!val || (g_value_get_object(val) != (GObject*)rendered)) {
+            continue;
+        }
+
+        /* Any other sample may read rows of the view which are not yet
+         * rendered. */
+        FirtreeVec2 sampler_radius, dest_radius;
+        if(!firtree_kernel_get_sample_footprint(p->kernel, *args,
+                    &sampler_radius, &dest_radius) ||
+                (sampler_radius.x != 0.f) || (sampler_radius.y != 0.f) ||
+                (dest_radius.x != 0.f) || (dest_radius.y != 0.f)) {
+            continue;
+        }
+
+        firtree_kernel_set_argument_value(p->kernel, *args, &sampler_val);
+        rebound = g_slist_prepend(rebound, GUINT_TO_POINTER(*args));
+    }
+
+    if(!rebound) {
+        g_value_unset(&sampler_val);
+        return NULL;
+    }
+
+    FirtreeCpuJitReduceFunc reduce_func = 
+        firtree_cpu_reduce_engine_get_reduce_engine_func(self);
+
+    /* The JIT keeps the compiled function until the kernel is next
+     * compiled, which cannot happen until run_mutex is released. */
+    g_value_set_object(&sampler_val, rendered);
+    GSList* arg;
+    for(arg = rebound; arg; arg = arg->next) {
+        firtree_kernel_set_argument_value(p->kernel,
+                GPOINTER_TO_UINT(arg->data), &sampler_val);
+    }
+    g_slist_free(rebound);
+    g_value_unset(&sampler_val);
+
+    _firtree_cpu_reduce_engine_invalidate_llvm_cache(self);
+
+    return reduce_func;
+}
+
+FirtreeCpuReduceEngineRequest*
+firtree_cpu_reduce_engine_begin_fused_reduce (FirtreeCpuReduceEngine* self,
+        FirtreeLockFreeSet* set,
+        FirtreeVec4* extents,
+        guint width, guint height,
+        FirtreeSampler* rendered,
+        FirtreeSampler* view)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    /* The engine stays locked until the fused reduction is ended. */
+    g_mutex_lock(p->run_mutex);
+
+    FirtreeCpuJitReduceFunc reduce_func = NULL;
+    if(rendered && view) {
+        reduce_func = _firtree_cpu_reduce_engine_get_fused_func(self,
+                rendered, view);
+    }
     if(!reduce_func) {
-        return;
+        reduce_func = firtree_cpu_reduce_engine_get_reduce_engine_func(self);
+    }
+
+    if(!reduce_func || !_firtree_cpu_reduce_engine_check_set(self, set)) {
+        g_mutex_unlock(p->run_mutex);
+        return NULL;
+    }
+
+    return _firtree_cpu_reduce_engine_begin_reduce(self, set, reduce_func,
+            width, height, (float*)extents);
+}
+
+void
+firtree_cpu_reduce_engine_fused_reduce_slice (FirtreeCpuReduceEngineRequest* request,
+        guint slice)
+{
+    _call_reduce_func(slice, request);
+}
+
+void
+firtree_cpu_reduce_engine_end_fused_reduce (FirtreeCpuReduceEngine* self,
+        FirtreeCpuReduceEngineRequest* request)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    _firtree_cpu_reduce_engine_end_reduce(self, request);
+
+    g_mutex_unlock(p->run_mutex);
+}
+
+void
+firtree_cpu_reduce_engine_set_max_elements (FirtreeCpuReduceEngine* self,
+        guint max_elements)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    p->max_elements = max_elements;
+}
+
+guint
+firtree_cpu_reduce_engine_get_max_elements (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    return p->max_elements;
+}
+
+void
+firtree_cpu_reduce_engine_set_deterministic (FirtreeCpuReduceEngine* self,
+        gboolean deterministic)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->run_mutex);
+
+    p->deterministic = deterministic;
+
+    if(!deterministic) {
+        _firtree_cpu_reduce_engine_free_slice_sets(self);
+    }
+
+    g_mutex_unlock(p->run_mutex);
+}
+
+gboolean
+firtree_cpu_reduce_engine_get_deterministic (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    return p->deterministic;
+}
+
+void
+firtree_cpu_reduce_engine_cancel (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    g_atomic_int_set(&(p->cancelled), 1);
+}
+
+/* Reset the stream. The caller must hold run_mutex. */
+static void
+_firtree_cpu_reduce_engine_reset_stream_unlocked (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    _firtree_cpu_reduce_engine_free_stream_frames(self);
+
+    p->stream_next_frame = 0;
+    p->stream_frames_seen = 0;
+    _firtree_cpu_reduce_engine_accumulator_reset(&p->stream_running);
+
+    g_mutex_lock(p->stream_mutex);
+    _firtree_cpu_reduce_engine_accumulator_reset(&p->stream_published);
+    g_mutex_unlock(p->stream_mutex);
+}
+
+void
+firtree_cpu_reduce_engine_set_stream_window (FirtreeCpuReduceEngine* self,
+        guint n_frames)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->run_mutex);
+
+    if(n_frames != p->stream_window) {
+        p->stream_window = n_frames;
+        _firtree_cpu_reduce_engine_reset_stream_unlocked(self);
+    }
+
+    g_mutex_unlock(p->run_mutex);
+}
+
+guint
+firtree_cpu_reduce_engine_get_stream_window (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    return p->stream_window;
+}
+
+void
+firtree_cpu_reduce_engine_reset_stream (FirtreeCpuReduceEngine* self)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->run_mutex);
+    _firtree_cpu_reduce_engine_reset_stream_unlocked(self);
+    g_mutex_unlock(p->run_mutex);
+}
+
+/* Compute the per-frame summary of the elements in frame->set. Elements with
+ * fewer than four components are treated as having zero in the remainder. */
+static void
+_firtree_cpu_reduce_engine_summarise_frame(FirtreeCpuReduceEngineFrame* frame,
+        GType emit_type)
+{
+    FirtreeCpuReduceEngineAccumulator acc;
+    _firtree_cpu_reduce_engine_accumulator_reset(&acc);
+
+    guint n_components = 4;
+    if((emit_type == G_TYPE_FLOAT) || (emit_type == G_TYPE_INT)) {
+        n_components = 1;
+    } else if(emit_type == FIRTREE_TYPE_VEC2) {
+        n_components = 2;
+    } else if(emit_type == FIRTREE_TYPE_VEC3) {
+        n_components = 3;
     }
 
-    firtree_cpu_reduce_engine_perform_reduce(self, set, reduce_func, width, height,
-            (float*)extents);
+    gpointer data = firtree_lock_free_set_get_first_element(frame->set);
+    while(data) {
+        FirtreeVec4 element = { 0.f, 0.f, 0.f, 0.f };
+        if(emit_type == G_TYPE_INT) {
+            element.x = (float)(*((gint32*)data));
+        } else {
+            memcpy(&element, data, n_components * sizeof(float));
+        }
+
+        acc.sum.x += element.x; acc.sum.y += element.y;
+        acc.sum.z += element.z; acc.sum.w += element.w;
+        acc.min.x = MIN(acc.min.x, element.x); acc.min.y = MIN(acc.min.y, element.y);
+        acc.min.z = MIN(acc.min.z, element.z); acc.min.w = MIN(acc.min.w, element.w);
+        acc.max.x = MAX(acc.max.x, element.x); acc.max.y = MAX(acc.max.y, element.y);
+        acc.max.z = MAX(acc.max.z, element.z); acc.max.w = MAX(acc.max.w, element.w);
+        ++acc.count;
+        data = firtree_lock_free_set_get_next_element(frame->set, data);
+    }
+
+    frame->sum = acc.sum;
+    frame->min = acc.min;
+    frame->max = acc.max;
+    frame->count = acc.count;
+}
+
+static FirtreeLockFreeSet*
+_firtree_cpu_reduce_engine_run_stream_unlocked (FirtreeCpuReduceEngine* self,
+        FirtreeVec4* extents,
+        guint width, guint height)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+    guint i;
+
+    FirtreeCpuJitReduceFunc reduce_func = 
+        firtree_cpu_reduce_engine_get_reduce_engine_func(self);
+
+    if(!reduce_func) {
+        return NULL;
+    }
+
+    GType emit_type = firtree_kernel_get_emit_type(p->kernel);
+    if(emit_type == G_TYPE_INVALID) {
+        g_warning("Reduce kernel emits values of more than one type.");
+        return NULL;
+    }
+
+    /* If the kernel has been re-compiled to emit a different type, the
+     * retained frames are meaningless. */
+    gsize element_size = MAX(1, firtree_kernel_get_emit_size(p->kernel));
+    if(p->stream_frames && 
+            (firtree_lock_free_set_get_element_size(p->stream_frames[0].set)
+             != element_size)) {
+        _firtree_cpu_reduce_engine_reset_stream_unlocked(self);
+    }
+
+    /* Lazily create the ring of frames. A window of zero means 'accumulate
+     * forever' and only needs a pair of frames for double-buffering. */
+    if(!p->stream_frames) {
+        p->stream_n_frames = MAX(p->stream_window, 1) + 1;
+        p->stream_frames = g_new0(FirtreeCpuReduceEngineFrame, p->stream_n_frames);
+        for(i=0; i<p->stream_n_frames; ++i) {
+            p->stream_frames[i].set = 
+                firtree_lock_free_set_new(element_size);
+        }
+    }
+
+    /* The frame slot we write to is never the most recent result and, since
+     * the ring is one larger than the window, holds the frame which is about
+     * to leave the window. Its memory is re-used for the new frame. */
+    FirtreeCpuReduceEngineFrame* frame = &(p->stream_frames[p->stream_next_frame]);
+    firtree_lock_free_set_clear(frame->set);
+
+    firtree_cpu_reduce_engine_perform_reduce(self, frame->set, reduce_func,
+            width, height, (float*)extents);
+    _firtree_cpu_reduce_engine_summarise_frame(frame, emit_type);
+
+    ++p->stream_frames_seen;
+    p->stream_next_frame = (p->stream_next_frame + 1) % p->stream_n_frames;
+
+    FirtreeCpuReduceEngineAccumulator* acc = &(p->stream_running);
+    if((p->stream_window == 0) || (p->stream_frames_seen <= p->stream_window)) {
+        /* Nothing to evict, fold the new frame in. */
+        acc->sum.x += frame->sum.x; acc->sum.y += frame->sum.y;
+        acc->sum.z += frame->sum.z; acc->sum.w += frame->sum.w;
+        acc->min.x = MIN(acc->min.x, frame->min.x); acc->min.y = MIN(acc->min.y, frame->min.y);
+        acc->min.z = MIN(acc->min.z, frame->min.z); acc->min.w = MIN(acc->min.w, frame->min.w);
+        acc->max.x = MAX(acc->max.x, frame->max.x); acc->max.y = MAX(acc->max.y, frame->max.y);
+        acc->max.z = MAX(acc->max.z, frame->max.z); acc->max.w = MAX(acc->max.w, frame->max.w);
+        acc->count += frame->count;
+    } else {
+        /* The evicted frame is the one we're about to write to next time
+         * around. Sums can be updated incrementally but the extrema must be
+         * recomputed over the window. */
+        FirtreeCpuReduceEngineFrame* evicted = 
+            &(p->stream_frames[p->stream_next_frame]);
+        acc->sum.x += frame->sum.x - evicted->sum.x;
+        acc->sum.y += frame->sum.y - evicted->sum.y;
+        acc->sum.z += frame->sum.z - evicted->sum.z;
+        acc->sum.w += frame->sum.w - evicted->sum.w;
+        acc->count = acc->count + frame->count - evicted->count;
+
+        FirtreeCpuReduceEngineAccumulator extrema;
+        _firtree_cpu_reduce_engine_accumulator_reset(&extrema);
+        for(i=0; i<p->stream_n_frames; ++i) {
+            FirtreeCpuReduceEngineFrame* f = &(p->stream_frames[i]);
+            if(f == evicted) {
+                continue;
+            }
+            extrema.min.x = MIN(extrema.min.x, f->min.x); extrema.min.y = MIN(extrema.min.y, f->min.y);
+            extrema.min.z = MIN(extrema.min.z, f->min.z); extrema.min.w = MIN(extrema.min.w, f->min.w);
+            extrema.max.x = MAX(extrema.max.x, f->max.x); extrema.max.y = MAX(extrema.max.y, f->max.y);
+            extrema.max.z = MAX(extrema.max.z, f->max.z); extrema.max.w = MAX(extrema.max.w, f->max.w);
+        }
+        acc->min = extrema.min;
+        acc->max = extrema.max;
+    }
+
+    /* Publish the new accumulator. */
+    g_mutex_lock(p->stream_mutex);
+    p->stream_published = *acc;
+    g_mutex_unlock(p->stream_mutex);
+
+    return frame->set;
+}
+
+FirtreeLockFreeSet*
+firtree_cpu_reduce_engine_run_stream (FirtreeCpuReduceEngine* self,
+        FirtreeVec4* extents,
+        guint width, guint height)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->run_mutex);
+    FirtreeLockFreeSet* rv = _firtree_cpu_reduce_engine_run_stream_unlocked(self,
+            extents, width, height);
+    g_mutex_unlock(p->run_mutex);
+
+    return rv;
+}
+
+guint
+firtree_cpu_reduce_engine_get_stream_accumulators (FirtreeCpuReduceEngine* self,
+        FirtreeVec4* sum, FirtreeVec4* min, FirtreeVec4* max)
+{
+    FirtreeCpuReduceEnginePrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->stream_mutex);
+    FirtreeCpuReduceEngineAccumulator acc = p->stream_published;
+    g_mutex_unlock(p->stream_mutex);
+
+    if(sum) { *sum = acc.sum; }
+    if(min) { *min = acc.min; }
+    if(max) { *max = acc.max; }
+
+    return acc.count;
 }
 
 GString*
@@ -235,8 +959,11 @@ firtree_debug_dump_cpu_reduce_engine_function(FirtreeCpuReduceEngine* self)
         return NULL;
     }
 
+    firtree_cpu_jit_lock();
+
     llvm::Function* f = firtree_kernel_create_overall_function(p->kernel);
     if(!f) {
+        firtree_cpu_jit_unlock();
         return NULL;
     }
     llvm::Module* m = f->getParent();
@@ -247,6 +974,8 @@ firtree_debug_dump_cpu_reduce_engine_function(FirtreeCpuReduceEngine* self)
 
     delete m;
 
+    firtree_cpu_jit_unlock();
+
     /* This is non-optimal, invlving a copy as it does but
      * production code shouldn't be using this function anyway. */
     return g_string_new(out.str().c_str());
@@ -99,6 +99,19 @@ firtree_cpu_reduce_engine_set_kernel (FirtreeCpuReduceEngine* self, FirtreeKerne
 FirtreeKernel*
 firtree_cpu_reduce_engine_get_kernel (FirtreeCpuReduceEngine* self);
 
+/**
+ * firtree_cpu_reduce_engine_get_element_size:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Retrieve the size of elements emitted by the associated kernel. This is
+ * the element size which should be passed to firtree_lock_free_set_new() when
+ * creating a set for firtree_cpu_reduce_engine_run().
+ *
+ * Returns: The element size in bytes or 0 if there is no valid kernel.
+ */
+gsize
+firtree_cpu_reduce_engine_get_element_size (FirtreeCpuReduceEngine* self);
+
 /**
  * firtree_cpu_reduce_engine_run:
  * @self: A FirtreeCpuReduceEngine object.
@@ -109,6 +122,10 @@ firtree_cpu_reduce_engine_get_kernel (FirtreeCpuReduceEngine* self);
  *
  * Excecute the reduce engine over the specified extents with the specified
  * width and height.
+ *
+ * The element size of @set must match that returned by
+ * firtree_cpu_reduce_engine_get_element_size(). If it does not, a warning is
+ * printed and nothing is emitted.
  */
 void
 firtree_cpu_reduce_engine_run (FirtreeCpuReduceEngine* self,
@@ -116,6 +133,161 @@ firtree_cpu_reduce_engine_run (FirtreeCpuReduceEngine* self,
         FirtreeVec4* extents,
         guint width, guint height);
 
+/**
+ * firtree_cpu_reduce_engine_set_max_elements:
+ * @self: A FirtreeCpuReduceEngine object.
+ * @max_elements: The maximum number of elements to emit or 0 for no limit.
+ *
+ * Bound the output of subsequent reductions. Once the output set holds
+ * @max_elements elements, further emit()-ed values are discarded and the
+ * engine stops visiting the remaining pixels. Setting @max_elements to 1 gives
+ * a fast 'does any pixel match' test.
+ *
+ * Note that, with a limit, which of the matching elements end up in the output
+ * is not defined unless the engine is in deterministic mode. See
+ * firtree_cpu_reduce_engine_set_deterministic().
+ */
+void
+firtree_cpu_reduce_engine_set_max_elements (FirtreeCpuReduceEngine* self,
+        guint max_elements);
+
+/**
+ * firtree_cpu_reduce_engine_get_max_elements:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Returns: The maximum number of elements a reduction will emit or 0 if there
+ * is no limit.
+ */
+guint
+firtree_cpu_reduce_engine_get_max_elements (FirtreeCpuReduceEngine* self);
+
+/**
+ * firtree_cpu_reduce_engine_set_deterministic:
+ * @self: A FirtreeCpuReduceEngine object.
+ * @deterministic: TRUE to make the order of emitted elements deterministic.
+ *
+ * By default the order of elements in the output of a reduction depends on
+ * the order in which threads happen to call emit(). In deterministic mode
+ * each slice of the image is reduced into a separate set and the sets are
+ * concatenated in slice order afterwards so that elements appear in
+ * row-major order of the pixel which emitted them. The cost is a small
+ * amount of extra memory per slice.
+ *
+ * In deterministic mode, a limit set via
+ * firtree_cpu_reduce_engine_set_max_elements() keeps the first elements in
+ * row-major order. Slices are then only skipped once every slice before
+ * them has been reduced and together they hold the limit. Slices already
+ * started on other threads still run to completion.
+ *
+ * To impose some other order on the output see firtree_lock_free_set_sort().
+ */
+void
+firtree_cpu_reduce_engine_set_deterministic (FirtreeCpuReduceEngine* self,
+        gboolean deterministic);
+
+/**
+ * firtree_cpu_reduce_engine_get_deterministic:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Returns: TRUE if the engine is in deterministic mode.
+ */
+gboolean
+firtree_cpu_reduce_engine_get_deterministic (FirtreeCpuReduceEngine* self);
+
+/**
+ * firtree_cpu_reduce_engine_cancel:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Request that the reduction currently running on @self stop as soon as
+ * possible. This may be called from any thread. Work already started on a
+ * slice of the image will finish but no new slices are started. The elements
+ * emitted so far are left in the output set.
+ *
+ * A cancellation request only applies to a reduction which is in progress;
+ * each call to firtree_cpu_reduce_engine_run() or
+ * firtree_cpu_reduce_engine_run_stream() clears any pending request.
+ */
+void
+firtree_cpu_reduce_engine_cancel (FirtreeCpuReduceEngine* self);
+
+/**
+ * firtree_cpu_reduce_engine_set_stream_window:
+ * @self: A FirtreeCpuReduceEngine object.
+ * @n_frames: The number of frames to accumulate over or 0 for no limit.
+ *
+ * Set the length of the sliding window used by
+ * firtree_cpu_reduce_engine_run_stream(). Changing the window resets any
+ * accumulated streaming state. The default window is a single frame.
+ */
+void
+firtree_cpu_reduce_engine_set_stream_window (FirtreeCpuReduceEngine* self,
+        guint n_frames);
+
+/**
+ * firtree_cpu_reduce_engine_get_stream_window:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Returns: The length of the streaming window in frames or 0 if the window is
+ * unbounded.
+ */
+guint
+firtree_cpu_reduce_engine_get_stream_window (FirtreeCpuReduceEngine* self);
+
+/**
+ * firtree_cpu_reduce_engine_reset_stream:
+ * @self: A FirtreeCpuReduceEngine object.
+ *
+ * Discard all accumulated streaming state and any retained frame output.
+ * This is done implicitly when the kernel associated with @self is changed.
+ */
+void
+firtree_cpu_reduce_engine_reset_stream (FirtreeCpuReduceEngine* self);
+
+/**
+ * firtree_cpu_reduce_engine_run_stream:
+ * @self: A FirtreeCpuReduceEngine object.
+ * @extents: The extents of the sampler to render.
+ * @width: The width in pixels.
+ * @height: The height in rows.
+ *
+ * Execute the reduce engine as with firtree_cpu_reduce_engine_run() but as
+ * one frame in a stream. The emitted elements are written to a set owned by
+ * the engine whose memory is re-used from frame to frame. The component-wise
+ * sum, minimum and maximum of all elements emitted over the streaming window
+ * are maintained incrementally and may be retrieved via
+ * firtree_cpu_reduce_engine_get_stream_accumulators(). Elements with fewer
+ * than four components contribute zero to the remaining components.
+ *
+ * The returned set remains valid until the next call to
+ * firtree_cpu_reduce_engine_run_stream() has completed and so may be read
+ * from another thread while the following frame is reduced. Calls from
+ * several threads are serialised.
+ *
+ * Returns: The set of elements emitted for this frame or NULL on error.
+ */
+FirtreeLockFreeSet*
+firtree_cpu_reduce_engine_run_stream (FirtreeCpuReduceEngine* self,
+        FirtreeVec4* extents,
+        guint width, guint height);
+
+/**
+ * firtree_cpu_reduce_engine_get_stream_accumulators:
+ * @self: A FirtreeCpuReduceEngine object.
+ * @sum: NULL or a location to write the component-wise sum of the elements.
+ * @min: NULL or a location to write the component-wise minimum of the elements.
+ * @max: NULL or a location to write the component-wise maximum of the elements.
+ *
+ * Retrieve the accumulated statistics for all elements emitted over the
+ * streaming window as of the last completed call to
+ * firtree_cpu_reduce_engine_run_stream(). This may safely be called while
+ * another thread is running the next frame.
+ *
+ * Returns: The number of elements emitted over the window.
+ */
+guint
+firtree_cpu_reduce_engine_get_stream_accumulators (FirtreeCpuReduceEngine* self,
+        FirtreeVec4* sum, FirtreeVec4* min, FirtreeVec4* max);
+
 /**
  * firtree_debug_dump_cpu_reduce_engine_function:
  * @engine: A FirtreeCpuReduceEngine.
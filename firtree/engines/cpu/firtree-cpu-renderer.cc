@@ -21,6 +21,7 @@
 #define __STDC_CONSTANT_MACROS
 
 #include <firtree/firtree-debug.h>
+#include <firtree/firtree-buffer-sampler.h>
 #include "firtree-cpu-renderer.h"
 #include "firtree-cpu-jit.hh"
 #include "firtree-cpu-common.hh"
@@ -33,6 +34,9 @@
 
 #include <sstream>
 
+#include <math.h>
+#include <string.h>
+
 G_DEFINE_TYPE (FirtreeCpuRenderer, firtree_cpu_renderer, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(o) \
@@ -42,11 +46,53 @@ typedef struct _FirtreeCpuRendererPrivate FirtreeCpuRendererPrivate;
 
 struct _FirtreeCpuRendererPrivate {
     FirtreeSampler*             sampler;
-    gulong                      sampler_handler_id;
     FirtreeCpuJit*              jit;
 
     FirtreeCpuJitRenderFunc     cached_render_func;
     FirtreeBufferFormat         cached_render_func_format;
+    FirtreeRenderMode           cached_render_func_mode;
+    gboolean                    cached_render_func_stream;
+
+    /* The mode set via firtree_cpu_renderer_set_render_mode(). */
+    FirtreeRenderMode           render_mode;
+
+    /* Kept between renders into Cogl textures of the same size. */
+    gpointer                    staging_buffer;
+    gsize                       staging_buffer_size;
+
+    /* Held for the duration of each render. The JIT keeps only the most
+     * recently requested render function so a render in one format must
+     * not overlap with a render in another from a different thread. */
+    GMutex*                     render_mutex;
+
+    /* Asynchronous renders in flight. inflight_sampler is the sampler,
+     * locked for as long as any render is in flight. callbacks_running
+     * counts the callbacks of finished renders which have yet to return. */
+    GMutex*                     inflight_mutex;
+    GCond*                      inflight_cond;
+    guint                       frames_in_flight;
+    guint                       callbacks_running;
+    guint                       max_frames_in_flight;
+    FirtreeSampler*             inflight_sampler;
+
+    /* The parts of the output, in output co-ordinates, which have changed
+     * since the last call to firtree_cpu_renderer_update_buffer(). Signals
+     * may arrive from any thread and so these are guarded by dirty_mutex.
+     * pending_regions counts ::region-changed signals whose
+     * ::contents-changed signal has yet to arrive. */
+    GMutex*                     dirty_mutex;
+    GArray*                     dirty_rects;
+    gboolean                    dirty_all;
+    guint                       pending_regions;
+
+    /* The arguments of the last successful call to
+     * firtree_cpu_renderer_update_buffer(). */
+    gpointer                    update_buffer;
+    FirtreeVec4                 update_extents;
+    guint                       update_width;
+    guint                       update_height;
+    guint                       update_stride;
+    FirtreeBufferFormat         update_format;
 };
 
 struct FirtreeCpuRendererRenderRequest {
@@ -56,8 +102,36 @@ struct FirtreeCpuRendererRenderRequest {
     unsigned int    num_rows;
     unsigned int    row_stride;
     float           extents[4];
+
+    /* Non-NULL when rendering into a 4:2:0 YCbCr buffer. */
+    FirtreeCpuJitPlanes* planes;
+
+    /* Reductions to run over each slice once it has been rendered. */
+    FirtreeCpuReduceEngineRequest** reduce_requests;
+    guint           n_reduce_requests;
 };
 
+/* The renders of firtree_cpu_renderer_render_batch(). Global slice i
+ * belongs to the request r with first_slices[r] <= i < first_slices[r+1]. */
+typedef struct {
+    FirtreeCpuRendererRenderRequest* requests;
+    guint*          first_slices;
+    guint           n_requests;
+} FirtreeCpuRendererBatch;
+
+/* A render queued by firtree_cpu_renderer_render_async(). */
+typedef struct {
+    FirtreeCpuRendererRenderRequest request;
+    FirtreeCpuJitPlanes             planes;
+    FirtreeCpuRenderer*             renderer;
+    FirtreeCpuRendererRenderCallback callback;
+    gpointer                        user_data;
+} FirtreeCpuRendererAsyncRender;
+
+/* Block until no more than @n_frames asynchronous renders are in flight. */
+static void
+_firtree_cpu_renderer_wait_for_frames(FirtreeCpuRenderer* self, guint n_frames);
+
 /* invalidate (and release) any cached LLVM modules/functions. This
  * will cause them to be re-generated when ..._get_function() is next
  * called. */
@@ -83,6 +157,44 @@ firtree_cpu_renderer_dispose (GObject *object)
     }
 
     p->cached_render_func = NULL;
+
+    firtree_cpu_common_scratch_buffer_free(p->staging_buffer,
+            p->staging_buffer_size);
+    p->staging_buffer = NULL;
+    p->staging_buffer_size = 0;
+}
+
+static void
+firtree_cpu_renderer_finalize (GObject *object)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(object); 
+
+    if(p->render_mutex) {
+        g_mutex_free(p->render_mutex);
+        p->render_mutex = NULL;
+    }
+
+    if(p->inflight_mutex) {
+        g_mutex_free(p->inflight_mutex);
+        p->inflight_mutex = NULL;
+    }
+
+    if(p->inflight_cond) {
+        g_cond_free(p->inflight_cond);
+        p->inflight_cond = NULL;
+    }
+
+    if(p->dirty_mutex) {
+        g_mutex_free(p->dirty_mutex);
+        p->dirty_mutex = NULL;
+    }
+
+    if(p->dirty_rects) {
+        g_array_free(p->dirty_rects, TRUE);
+        p->dirty_rects = NULL;
+    }
+
+    G_OBJECT_CLASS (firtree_cpu_renderer_parent_class)->finalize (object);
 }
 
 static void
@@ -91,6 +203,7 @@ firtree_cpu_renderer_class_init (FirtreeCpuRendererClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
     g_type_class_add_private (klass, sizeof (FirtreeCpuRendererPrivate));
     object_class->dispose = firtree_cpu_renderer_dispose;
+    object_class->finalize = firtree_cpu_renderer_finalize;
 }
 
 static void
@@ -100,6 +213,21 @@ firtree_cpu_renderer_init (FirtreeCpuRenderer *self)
     p->sampler = NULL;
     p->jit = firtree_cpu_jit_new();
     p->cached_render_func = NULL;
+    p->render_mode = FIRTREE_RENDER_MODE_OVER;
+    p->staging_buffer = NULL;
+    p->staging_buffer_size = 0;
+    p->render_mutex = g_mutex_new();
+    p->inflight_mutex = g_mutex_new();
+    p->inflight_cond = g_cond_new();
+    p->frames_in_flight = 0;
+    p->callbacks_running = 0;
+    p->max_frames_in_flight = 2;
+    p->inflight_sampler = NULL;
+    p->dirty_mutex = g_mutex_new();
+    p->dirty_rects = g_array_new(FALSE, FALSE, sizeof(FirtreeVec4));
+    p->dirty_all = TRUE;
+    p->pending_regions = 0;
+    p->update_buffer = NULL;
 }
 
 FirtreeCpuRenderer*
@@ -109,12 +237,118 @@ firtree_cpu_renderer_new (void)
         g_object_new (FIRTREE_TYPE_CPU_RENDERER, NULL);
 }
 
+/* The most rectangles kept in the dirty region. Beyond this they are
+ * merged into their bounding box. */
+#define MAX_DIRTY_RECTS 16
+
+/* Find the bounding box of the non-empty array of rectangles @rects. */
+static FirtreeVec4
+_firtree_cpu_renderer_get_bounds(GArray* rects)
+{
+    FirtreeVec4* rect = (FirtreeVec4*)rects->data;
+    float min_x = rect[0].x, min_y = rect[0].y;
+    float max_x = rect[0].x + rect[0].z;
+    float max_y = rect[0].y + rect[0].w;
+    guint i;
+    for(i=1; i<rects->len; ++i) {
+        min_x = MIN(min_x, rect[i].x);
+        min_y = MIN(min_y, rect[i].y);
+        max_x = MAX(max_x, rect[i].x + rect[i].z);
+        max_y = MAX(max_y, rect[i].y + rect[i].w);
+    }
+
+    FirtreeVec4 bounds = { min_x, min_y, max_x - min_x, max_y - min_y };
+    return bounds;
+}
+
+/* Add @rect to the dirty region. Must be called with dirty_mutex held. */
+static void
+_firtree_cpu_renderer_add_dirty_rect(FirtreeCpuRenderer* self,
+        const FirtreeVec4* rect)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    if(p->dirty_all || (rect->z <= 0.f) || (rect->w <= 0.f)) {
+        return;
+    }
+
+    if(firtree_sampler_extent_is_infinite(rect)) {
+        p->dirty_all = TRUE;
+        g_array_set_size(p->dirty_rects, 0);
+        return;
+    }
+
+    if(p->dirty_rects->len >= MAX_DIRTY_RECTS) {
+        FirtreeVec4 bounds = _firtree_cpu_renderer_get_bounds(p->dirty_rects);
+        g_array_set_size(p->dirty_rects, 0);
+        g_array_append_val(p->dirty_rects, bounds);
+    }
+
+    g_array_append_vals(p->dirty_rects, rect, 1);
+}
+
+/* Mark the whole output as dirty. */
+static void
+_firtree_cpu_renderer_invalidate_all(FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    g_mutex_lock(p->dirty_mutex);
+    p->dirty_all = TRUE;
+    g_array_set_size(p->dirty_rects, 0);
+    g_mutex_unlock(p->dirty_mutex);
+}
+
 static void
 firtree_cpu_renderer_sampler_module_changed_cb(gpointer sampler,
         gpointer data)
 {
     FirtreeCpuRenderer* self = FIRTREE_CPU_RENDERER(data);
     _firtree_cpu_renderer_invalidate_llvm_cache(self);
+    _firtree_cpu_renderer_invalidate_all(self);
+}
+
+static void
+firtree_cpu_renderer_sampler_extents_changed_cb(gpointer sampler,
+        gpointer data)
+{
+    _firtree_cpu_renderer_invalidate_all(FIRTREE_CPU_RENDERER(data));
+}
+
+static void
+firtree_cpu_renderer_sampler_region_changed_cb(FirtreeSampler* sampler,
+        FirtreeVec4* region, gpointer data)
+{
+    FirtreeCpuRenderer* self = FIRTREE_CPU_RENDERER(data);
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    firtree_cpu_jit_lock();
+    FirtreeVec4 rect = firtree_sampler_map_region_to_output(sampler, region);
+    firtree_cpu_jit_unlock();
+
+    g_mutex_lock(p->dirty_mutex);
+    _firtree_cpu_renderer_add_dirty_rect(self, &rect);
+    ++p->pending_regions;
+    g_mutex_unlock(p->dirty_mutex);
+}
+
+/* A change of contents which was not preceded by a ::region-changed signal
+ * may have changed anything. */
+static void
+firtree_cpu_renderer_sampler_contents_changed_cb(gpointer sampler,
+        gpointer data)
+{
+    FirtreeCpuRenderer* self = FIRTREE_CPU_RENDERER(data);
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    g_mutex_lock(p->dirty_mutex);
+    if(p->pending_regions > 0) {
+        --p->pending_regions;
+    } else {
+        p->dirty_all = TRUE;
+        g_array_set_size(p->dirty_rects, 0);
+    }
+    g_mutex_unlock(p->dirty_mutex);
 }
 
 void
@@ -123,9 +357,12 @@ firtree_cpu_renderer_set_sampler (FirtreeCpuRenderer* self,
 {
     FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
 
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+
     if(p->sampler) {
-        /* disconnect the original handler */
-        g_signal_handler_disconnect(p->sampler, p->sampler_handler_id);
+        /* disconnect the original handlers */
+        g_signal_handlers_disconnect_matched(p->sampler, G_SIGNAL_MATCH_DATA,
+                0, 0, NULL, NULL, self);
 
         g_object_unref(p->sampler);
         p->sampler = NULL;
@@ -135,12 +372,23 @@ firtree_cpu_renderer_set_sampler (FirtreeCpuRenderer* self,
         p->sampler = sampler;
         g_object_ref(p->sampler);
 
-        p->sampler_handler_id = g_signal_connect(p->sampler, 
-                "module-changed",
+        g_signal_connect(p->sampler, "module-changed",
                 G_CALLBACK(firtree_cpu_renderer_sampler_module_changed_cb), self);
+        g_signal_connect(p->sampler, "extents-changed",
+                G_CALLBACK(firtree_cpu_renderer_sampler_extents_changed_cb), self);
+        g_signal_connect(p->sampler, "region-changed",
+                G_CALLBACK(firtree_cpu_renderer_sampler_region_changed_cb), self);
+        g_signal_connect(p->sampler, "contents-changed",
+                G_CALLBACK(firtree_cpu_renderer_sampler_contents_changed_cb), self);
     }
 
     _firtree_cpu_renderer_invalidate_llvm_cache(self);
+
+    g_mutex_lock(p->dirty_mutex);
+    p->dirty_all = TRUE;
+    g_array_set_size(p->dirty_rects, 0);
+    p->pending_regions = 0;
+    g_mutex_unlock(p->dirty_mutex);
 }
 
 FirtreeSampler*
@@ -150,8 +398,58 @@ firtree_cpu_renderer_get_sampler (FirtreeCpuRenderer* self)
     return p->sampler;
 }
 
+/* Return the mode the render functions are compiled for. Compositing an
+ * opaque sampler over the buffer replaces what was there and so such a
+ * sampler is rendered without reading the buffer at all. */
+static FirtreeRenderMode
+_firtree_cpu_renderer_get_effective_render_mode(FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if(p->render_mode != FIRTREE_RENDER_MODE_OVER || !p->sampler) {
+        return p->render_mode;
+    }
+
+    firtree_cpu_jit_lock();
+    gboolean is_opaque = firtree_sampler_is_opaque(p->sampler);
+    firtree_cpu_jit_unlock();
+
+    return is_opaque ? FIRTREE_RENDER_MODE_REPLACE : p->render_mode;
+}
+
+/* Return TRUE if a render writes every pixel of its target so that the
+ * target need not be cleared first. This is not so for an opaque sampler
+ * with a finite extent since pixels outside of it are not rendered. */
+static gboolean
+_firtree_cpu_renderer_overwrites_target(FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if(p->render_mode == FIRTREE_RENDER_MODE_REPLACE) {
+        return TRUE;
+    }
+
+    if(!p->sampler) {
+        return FALSE;
+    }
+
+    firtree_cpu_jit_lock();
+    gboolean rv = firtree_sampler_is_opaque(p->sampler);
+    if(rv) {
+        FirtreeVec4 domain = firtree_sampler_get_output_extent(p->sampler);
+        rv = firtree_sampler_extent_is_infinite(&domain);
+    }
+    firtree_cpu_jit_unlock();
+
+    return rv;
+}
+
+/* Return the render function for @format. If @stream is FALSE the function
+ * keeps the pixels it writes in cache rather than streaming them to
+ * memory. */
 static FirtreeCpuJitRenderFunc
-firtree_cpu_renderer_get_renderer_func(FirtreeCpuRenderer* self, FirtreeBufferFormat format)
+firtree_cpu_renderer_get_renderer_func(FirtreeCpuRenderer* self,
+        FirtreeBufferFormat format, gboolean stream)
 {
     FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
 
@@ -160,13 +458,23 @@ firtree_cpu_renderer_get_renderer_func(FirtreeCpuRenderer* self, FirtreeBufferFo
         return NULL;
     }
 
-    if(p->cached_render_func && (p->cached_render_func_format == format)) {
+    FirtreeRenderMode mode = _firtree_cpu_renderer_get_effective_render_mode(self);
+
+    if(p->cached_render_func && (p->cached_render_func_format == format) &&
+            (p->cached_render_func_mode == mode) &&
+            (p->cached_render_func_stream == stream)) {
         return p->cached_render_func;
     }
 
+    /* The JIT releases the function in-flight renders are using. */
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+
     p->cached_render_func_format = format;
+    p->cached_render_func_mode = mode;
+    p->cached_render_func_stream = stream;
     p->cached_render_func = firtree_cpu_jit_get_render_function_for_sampler(p->jit,
-            format, p->sampler, firtree_cpu_common_lazy_function_creator);
+            format, mode, stream, p->sampler,
+            firtree_cpu_common_lazy_function_creator);
 
     return p->cached_render_func;
 }
@@ -180,8 +488,11 @@ firtree_debug_dump_cpu_renderer_function(FirtreeCpuRenderer* self)
         return NULL;
     }
 
+    firtree_cpu_jit_lock();
+
     llvm::Function* f = firtree_sampler_get_sample_function(p->sampler);
     if(!f) {
+        firtree_cpu_jit_unlock();
         return NULL;
     }
     llvm::Module* m = f->getParent();
@@ -190,6 +501,8 @@ firtree_debug_dump_cpu_renderer_function(FirtreeCpuRenderer* self)
 
     m->print(out, NULL);
 
+    firtree_cpu_jit_unlock();
+
     /* This is non-optimal, invlving a copy as it does but
      * production code shouldn't be using this function anyway. */
     return g_string_new(out.str().c_str());
@@ -205,16 +518,130 @@ _call_render_func(guint slice, FirtreeCpuRendererRenderRequest* request)
     float extents[] = { 
         request->extents[0], request->extents[1] + (dy * (float)start_row),
         request->extents[2], dy * (float)n_rows };
-    request->func(request->buffer + (start_row * request->row_stride),
-            request->row_width, n_rows,
-            request->row_stride, extents);
+
+    if(request->planes) {
+        /* Slices are a multiple of two rows so each starts on a chroma
+         * row. */
+        FirtreeCpuJitPlanes slice_planes = *(request->planes);
+        slice_planes.planes[0] += start_row * slice_planes.strides[0];
+        slice_planes.planes[1] += (start_row >> 1) * slice_planes.strides[1];
+        slice_planes.planes[2] += (start_row >> 1) * slice_planes.strides[2];
+        request->func((unsigned char*)&slice_planes,
+                request->row_width, n_rows,
+                request->row_stride, extents);
+    } else {
+        request->func(request->buffer + (start_row * request->row_stride),
+                request->row_width, n_rows,
+                request->row_stride, extents);
+    }
+
+    /* Reduce the same rows while their inputs are still in cache. */
+    guint i;
+    for(i=0; i<request->n_reduce_requests; ++i) {
+        firtree_cpu_reduce_engine_fused_reduce_slice(
+                request->reduce_requests[i], slice);
+    }
+}
+
+/* Find the range [*start, *end) of the @n pixels with centres at
+ * @origin + (i + 0.5) * @delta which lie within [@min, @max], allowing a one
+ * pixel margin for rounding. */
+static void
+_firtree_cpu_renderer_clip_span(float origin, float delta, guint n,
+        float min, float max, guint* start, guint* end)
+{
+    double first = floor(((min - origin) / delta) - 0.5) - 1.0;
+    double last = ceil(((max - origin) / delta) - 0.5) + 2.0;
+    *start = (guint) CLAMP(first, 0.0, (double)n);
+    *end = (guint) CLAMP(last, (double)(*start), (double)n);
+}
+
+/* Restrict a render of @num_rows rows of @row_width pixels covering @extents
+ * to the pixels which may lie within the output extent of the sampler of
+ * @self. Pixels outside of it would be composited with a transparent pixel
+ * and so are left alone. In FIRTREE_RENDER_MODE_REPLACE mode they must be
+ * made transparent and so nothing is clipped. The arguments are updated in
+ * place. Buffers with a @pixel_size of
+ * zero are only clipped vertically and planar buffers are clipped to pairs
+ * of rows so that each chroma row is still written whole.
+ *
+ * Returns FALSE if no pixels need rendering at all. */
+static gboolean
+_firtree_cpu_renderer_clip_to_sampler(FirtreeCpuRenderer* self,
+        unsigned char** buffer, unsigned int* row_width,
+        unsigned int* num_rows, unsigned int row_stride, guint pixel_size,
+        float* extents, FirtreeCpuJitPlanes* planes)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if(p->render_mode == FIRTREE_RENDER_MODE_REPLACE) {
+        return TRUE;
+    }
+
+    firtree_cpu_jit_lock();
+    FirtreeVec4 domain = firtree_sampler_get_output_extent(p->sampler);
+    firtree_cpu_jit_unlock();
+
+    if(firtree_sampler_extent_is_infinite(&domain)) {
+        return TRUE;
+    }
+
+    if((*row_width == 0) || (*num_rows == 0)) {
+        return TRUE;
+    }
+
+    float dx = extents[2] / (float)(*row_width);
+    float dy = extents[3] / (float)(*num_rows);
+    if((dx <= 0.f) || (dy <= 0.f)) {
+        return TRUE;
+    }
+
+    if((domain.z <= 0.f) || (domain.w <= 0.f)) {
+        return FALSE;
+    }
+
+    guint row0, row1, col0 = 0, col1 = *row_width;
+    _firtree_cpu_renderer_clip_span(extents[1], dy, *num_rows,
+            domain.y, domain.y + domain.w, &row0, &row1);
+
+    if(planes) {
+        row0 &= ~1u;
+        row1 = MIN((row1 + 1) & ~1u, *num_rows);
+    } else if(pixel_size > 0) {
+        _firtree_cpu_renderer_clip_span(extents[0], dx, *row_width,
+                domain.x, domain.x + domain.z, &col0, &col1);
+    }
+
+    if((row0 >= row1) || (col0 >= col1)) {
+        return FALSE;
+    }
+
+    if(planes) {
+        planes->planes[0] += row0 * planes->strides[0];
+        planes->planes[1] += (row0 >> 1) * planes->strides[1];
+        planes->planes[2] += (row0 >> 1) * planes->strides[2];
+    }
+
+    *buffer += (row0 * row_stride) + (col0 * pixel_size);
+
+    extents[0] += dx * (float)col0;
+    extents[1] += dy * (float)row0;
+    extents[2] = dx * (float)(col1 - col0);
+    extents[3] = dy * (float)(row1 - row0);
+
+    *row_width = col1 - col0;
+    *num_rows = row1 - row0;
+
+    return TRUE;
 }
 
 static gboolean
 firtree_cpu_renderer_perform_render(FirtreeCpuRenderer* self,
         FirtreeCpuJitRenderFunc func, unsigned char* buffer, unsigned int row_width, 
-        unsigned int num_rows, unsigned int row_stride, 
-        float* extents) 
+        unsigned int num_rows, unsigned int row_stride, guint pixel_size,
+        float* extents, FirtreeCpuJitPlanes* planes,
+        FirtreeCpuReduceEngineRequest** reduce_requests,
+        guint n_reduce_requests) 
 {
     FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
 
@@ -226,6 +653,21 @@ firtree_cpu_renderer_perform_render(FirtreeCpuRenderer* self,
         return FALSE;
     }
 
+    float clipped_extents[] = { extents[0], extents[1], extents[2], extents[3] };
+    FirtreeCpuJitPlanes clipped_planes;
+    if(planes) {
+        clipped_planes = *planes;
+        planes = &clipped_planes;
+    }
+
+    /* Reductions must see every pixel so only clip plain renders. */
+    if((n_reduce_requests == 0) &&
+            !_firtree_cpu_renderer_clip_to_sampler(self, &buffer,
+                &row_width, &num_rows, row_stride, pixel_size,
+                clipped_extents, planes)) {
+        return TRUE;
+    }
+
     if(!firtree_sampler_lock(p->sampler)) {
         g_debug("Failed to lock sampler.");
         return FALSE;
@@ -233,7 +675,9 @@ firtree_cpu_renderer_perform_render(FirtreeCpuRenderer* self,
 
     FirtreeCpuRendererRenderRequest request = {
         func, buffer, row_width, num_rows, row_stride,
-        { extents[0], extents[1], extents[2], extents[3] },
+        { clipped_extents[0], clipped_extents[1],
+          clipped_extents[2], clipped_extents[3] },
+        planes, reduce_requests, n_reduce_requests,
     };
 
     threading_apply(((num_rows+7)>>3), (ThreadingApplyFunc) _call_render_func, &request);
@@ -245,8 +689,8 @@ firtree_cpu_renderer_perform_render(FirtreeCpuRenderer* self,
 
 #if FIRTREE_HAVE_GDK_PIXBUF
 
-gboolean
-firtree_cpu_renderer_render_into_pixbuf (FirtreeCpuRenderer* self,
+static gboolean
+_firtree_cpu_renderer_render_into_pixbuf_unlocked(FirtreeCpuRenderer* self,
         FirtreeVec4* extents, GdkPixbuf* pixbuf)
 {
     FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
@@ -274,11 +718,11 @@ firtree_cpu_renderer_render_into_pixbuf (FirtreeCpuRenderer* self,
     if(gdk_pixbuf_get_has_alpha(pixbuf)) {
         /* GdkPixbufs use non-premultiplied alpha. */
         render = (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, 
-                FIRTREE_FORMAT_RGBA32);
+                FIRTREE_FORMAT_RGBA32, TRUE);
     } else {
         /* Use the render function optimised for ignored alpha. */
         render = (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, 
-                FIRTREE_FORMAT_RGB24);
+                FIRTREE_FORMAT_RGB24, TRUE);
     }
 
     if(!render) {
@@ -286,14 +730,30 @@ firtree_cpu_renderer_render_into_pixbuf (FirtreeCpuRenderer* self,
     }
 
     return firtree_cpu_renderer_perform_render(self, render,
-            pixels, width, height, stride, (float*)extents);
+            pixels, width, height, stride, channels, (float*)extents,
+            NULL, NULL, 0);
+}
+
+gboolean
+firtree_cpu_renderer_render_into_pixbuf (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, GdkPixbuf* pixbuf)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_into_pixbuf_unlocked(self,
+            extents, pixbuf);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
 }
 
 #endif
 
 #if FIRTREE_HAVE_CAIRO
-gboolean 
-firtree_cpu_renderer_render_into_cairo_surface (FirtreeCpuRenderer* self,
+static gboolean
+_firtree_cpu_renderer_render_into_cairo_surface_unlocked(FirtreeCpuRenderer* self,
         FirtreeVec4* extents, cairo_surface_t* surface)
 {
     if(!extents) { return FALSE; }
@@ -315,11 +775,11 @@ firtree_cpu_renderer_render_into_cairo_surface (FirtreeCpuRenderer* self,
     switch(format) {
         case CAIRO_FORMAT_ARGB32:
             render = (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, 
-                    FIRTREE_FORMAT_BGRA32_PREMULTIPLIED);
+                    FIRTREE_FORMAT_BGRA32_PREMULTIPLIED, TRUE);
             break;
         case CAIRO_FORMAT_RGB24:
             render = (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, 
-                    FIRTREE_FORMAT_BGRX32);
+                    FIRTREE_FORMAT_BGRX32, TRUE);
             break;
         default:
             g_debug("Invalid Cairo format.");
@@ -332,22 +792,134 @@ firtree_cpu_renderer_render_into_cairo_surface (FirtreeCpuRenderer* self,
     }
 
     return firtree_cpu_renderer_perform_render(self, render,
-            data, width, height, stride, (float*)extents);
+            data, width, height, stride, 4, (float*)extents, NULL, NULL, 0);
+}
+
+gboolean
+firtree_cpu_renderer_render_into_cairo_surface (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, cairo_surface_t* surface)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_into_cairo_surface_unlocked(self,
+            extents, surface);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
 }
 #endif
 
-gboolean 
-firtree_cpu_renderer_render_into_buffer (FirtreeCpuRenderer* self,
-        FirtreeVec4* extents,
-        gpointer buffer, guint width, guint height,
-        guint stride, FirtreeBufferFormat format)
+static FirtreeCpuJitRenderFunc
+firtree_cpu_renderer_get_buffer_renderer_func(FirtreeCpuRenderer* self,
+        FirtreeBufferFormat format, gboolean stream);
+
+#if FIRTREE_HAVE_CLUTTER
+static gboolean
+_firtree_cpu_renderer_render_into_cogl_texture_unlocked(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, CoglHandle texture)
 {
-    g_assert(self);
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
 
-    if(!buffer) { return FALSE; }
+    if(!extents) { return FALSE; }
+    if(!texture || !cogl_is_texture(texture)) { return FALSE; }
 
-    FirtreeCpuJitRenderFunc render = NULL;
+    guint width = cogl_texture_get_width(texture);
+    guint height = cogl_texture_get_height(texture);
+
+    /* Render in the texture's own format where possible so that Cogl
+     * need not convert on upload. */
+    CoglPixelFormat cogl_format = cogl_texture_get_format(texture);
+    FirtreeBufferFormat format = FIRTREE_FORMAT_LAST;
+
+    /* FIXME: This implicitly assumes a little-endian machine. */
+    switch(cogl_format) {
+        case COGL_PIXEL_FORMAT_RGBA_8888_PRE:
+            format = FIRTREE_FORMAT_RGBA32_PREMULTIPLIED;
+            break;
+        case COGL_PIXEL_FORMAT_BGRA_8888_PRE:
+            format = FIRTREE_FORMAT_BGRA32_PREMULTIPLIED;
+            break;
+        case COGL_PIXEL_FORMAT_RGBA_8888:
+            format = FIRTREE_FORMAT_RGBA32;
+            break;
+        case COGL_PIXEL_FORMAT_BGRA_8888:
+            format = FIRTREE_FORMAT_BGRA32;
+            break;
+        case COGL_PIXEL_FORMAT_RGB_888:
+            format = FIRTREE_FORMAT_RGB24;
+            break;
+        case COGL_PIXEL_FORMAT_BGR_888:
+            format = FIRTREE_FORMAT_BGR24;
+            break;
+        default:
+            g_debug("Rendering Cogl texture format %i via BGRA. May be slow.",
+                    cogl_format);
+            cogl_format = COGL_PIXEL_FORMAT_BGRA_8888_PRE;
+            format = FIRTREE_FORMAT_BGRA32_PREMULTIPLIED;
+            break;
+    }
+
+    guint pixel_size = firtree_engine_get_buffer_format_pixel_size(format);
+    guint stride = width * pixel_size;
+    gsize size = (gsize)stride * (gsize)height;
+
+    if(size != p->staging_buffer_size) {
+        firtree_cpu_common_scratch_buffer_free(p->staging_buffer,
+                p->staging_buffer_size);
+        p->staging_buffer = firtree_cpu_common_scratch_buffer_alloc(size);
+        p->staging_buffer_size = size;
+    }
+
+    FirtreeCpuJitRenderFunc render =
+        firtree_cpu_renderer_get_buffer_renderer_func(self, format, TRUE);
+    if(!render) {
+        return FALSE;
+    }
+
+    /* Renders are composited over the existing contents and the texture
+     * contents are not available without a readback so the texture is
+     * replaced by the render over a transparent background. Renders
+     * which write every pixel need no background. */
+    if(!_firtree_cpu_renderer_overwrites_target(self)) {
+        memset(p->staging_buffer, 0, size);
+    }
+
+    if(!firtree_cpu_renderer_perform_render(self, render,
+                (unsigned char*)p->staging_buffer, width, height, stride,
+                pixel_size, (float*)extents, NULL, NULL, 0)) {
+        return FALSE;
+    }
+
+    return cogl_texture_set_region(texture, 0, 0, 0, 0, width, height,
+            width, height, cogl_format, stride,
+            (const guchar*)p->staging_buffer);
+}
+
+gboolean
+firtree_cpu_renderer_render_into_cogl_texture (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, CoglHandle texture)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_into_cogl_texture_unlocked(self,
+            extents, texture);
+    g_mutex_unlock(p->render_mutex);
 
+    return rv;
+}
+#endif
+
+/* Return the render function for rendering into a buffer of format @format
+ * or NULL if that format may not be rendered into. @stream is as for
+ * firtree_cpu_renderer_get_renderer_func(). */
+static FirtreeCpuJitRenderFunc
+firtree_cpu_renderer_get_buffer_renderer_func(FirtreeCpuRenderer* self,
+        FirtreeBufferFormat format, gboolean stream)
+{
     switch(format) {
         case FIRTREE_FORMAT_ARGB32:
         case FIRTREE_FORMAT_ARGB32_PREMULTIPLIED:
@@ -364,20 +936,892 @@ firtree_cpu_renderer_render_into_buffer (FirtreeCpuRenderer* self,
         case FIRTREE_FORMAT_RGBX32:
         case FIRTREE_FORMAT_BGRX32:
         case FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED:
-            render = (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, format);
-            break;
+        case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+        case FIRTREE_FORMAT_RGBA64:
+        case FIRTREE_FORMAT_RGBA64_PREMULTIPLIED:
+        case FIRTREE_FORMAT_I420_FOURCC:
+        case FIRTREE_FORMAT_YV12_FOURCC:
+        case FIRTREE_FORMAT_NV12_FOURCC:
+        case FIRTREE_FORMAT_NV21_FOURCC:
+        case FIRTREE_FORMAT_P010_FOURCC:
+            return firtree_cpu_renderer_get_renderer_func(self, format, stream);
         default:
             g_warning("Attempt to render to buffer in unsupported format.");
-            return FALSE;
             break;
     }
 
+    return NULL;
+}
+
+/* Fill @planes with the location of each plane of a 4:2:0 YCbCr buffer.
+ * Returns FALSE if @format is not a YCbCr format. */
+static gboolean
+_firtree_cpu_renderer_get_ycbcr_planes(FirtreeBufferFormat format,
+        unsigned char* buffer, guint height, guint stride,
+        FirtreeCpuJitPlanes* planes)
+{
+    unsigned char* chroma = buffer + (height * stride);
+    guint chroma_size = (height * stride) >> 2;
+
+    planes->planes[0] = buffer;
+    planes->strides[0] = stride;
+    planes->strides[1] = planes->strides[2] = stride;
+
+    switch(format) {
+        case FIRTREE_FORMAT_I420_FOURCC:
+            planes->planes[1] = chroma;
+            planes->planes[2] = chroma + chroma_size;
+            planes->strides[1] = planes->strides[2] = stride >> 1;
+            break;
+        case FIRTREE_FORMAT_YV12_FOURCC:
+            planes->planes[1] = chroma + chroma_size;
+            planes->planes[2] = chroma;
+            planes->strides[1] = planes->strides[2] = stride >> 1;
+            break;
+        case FIRTREE_FORMAT_NV12_FOURCC:
+            planes->planes[1] = chroma;
+            planes->planes[2] = chroma + 1;
+            break;
+        case FIRTREE_FORMAT_NV21_FOURCC:
+            planes->planes[1] = chroma + 1;
+            planes->planes[2] = chroma;
+            break;
+        case FIRTREE_FORMAT_P010_FOURCC:
+            planes->planes[1] = chroma;
+            planes->planes[2] = chroma + 2;
+            break;
+        default:
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Return the planes to pass to firtree_cpu_renderer_perform_render() for a
+ * buffer of @format, which is NULL for packed formats. Sets @ok to FALSE if
+ * the buffer cannot be rendered into. */
+static FirtreeCpuJitPlanes*
+_firtree_cpu_renderer_prepare_planes(FirtreeBufferFormat format,
+        unsigned char* buffer, guint width, guint height, guint stride,
+        FirtreeCpuJitPlanes* planes, gboolean* ok)
+{
+    *ok = TRUE;
+
+    if(!_firtree_cpu_renderer_get_ycbcr_planes(format, buffer, height,
+                stride, planes)) {
+        return NULL;
+    }
+
+    /* Each chroma sample is written from a complete 2x2 quad. */
+    if((width & 1) || (height & 1)) {
+        g_debug("YCbCr buffers must have an even width and height.");
+        *ok = FALSE;
+    }
+
+    return planes;
+}
+
+static gboolean
+_firtree_cpu_renderer_render_into_buffer_unlocked(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format)
+{
+    g_assert(self);
+
+    if(!buffer) { return FALSE; }
+
+    FirtreeCpuJitPlanes planes_storage;
+    gboolean ok;
+    FirtreeCpuJitPlanes* planes = _firtree_cpu_renderer_prepare_planes(
+            format, (unsigned char*)buffer, width, height, stride,
+            &planes_storage, &ok);
+    if(!ok) {
+        return FALSE;
+    }
+
+    FirtreeCpuJitRenderFunc render = 
+        firtree_cpu_renderer_get_buffer_renderer_func(self, format, TRUE);
+
     if(!render) {
         return FALSE;
     }
 
     return firtree_cpu_renderer_perform_render(self, render,
-            (unsigned char*)buffer, width, height, stride, (float*)extents);
+            (unsigned char*)buffer, width, height, stride,
+            firtree_engine_get_buffer_format_pixel_size(format),
+            (float*)extents, planes, NULL, 0);
+}
+
+gboolean
+firtree_cpu_renderer_render_into_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_into_buffer_unlocked(self,
+            extents, buffer, width, height, stride, format);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+static gboolean
+_firtree_cpu_renderer_render_and_reduce_into_buffer_unlocked(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuReduceEngine** reduce_engines,
+        FirtreeLockFreeSet** sets,
+        guint n_reduce_engines)
+{
+    g_assert(self);
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if(!buffer) { return FALSE; }
+    if(!extents) { return FALSE; }
+    if((n_reduce_engines > 0) && (!reduce_engines || !sets)) { return FALSE; }
+
+    FirtreeCpuJitPlanes planes_storage;
+    gboolean ok;
+    FirtreeCpuJitPlanes* planes = _firtree_cpu_renderer_prepare_planes(
+            format, (unsigned char*)buffer, width, height, stride,
+            &planes_storage, &ok);
+    if(!ok) {
+        return FALSE;
+    }
+
+    /* The reductions read the rows of each slice straight after they are
+     * rendered so they must not be streamed past the cache. */
+    FirtreeCpuJitRenderFunc render = 
+        firtree_cpu_renderer_get_buffer_renderer_func(self, format,
+                n_reduce_engines == 0);
+
+    if(!render) {
+        return FALSE;
+    }
+
+    /* Reduce kernels which sample the renderer's sampler at samplerCoord()
+     * read the pixels just rendered into @buffer rather than evaluate the
+     * sampler again. This needs each pixel of the buffer to be the one the
+     * reduction visits. */
+    FirtreeBufferSampler* view = NULL;
+    if((n_reduce_engines > 0) && !planes && p->sampler &&
+            (extents->x == 0.f) && (extents->y == 0.f) &&
+            (extents->z == (float)width) && (extents->w == (float)height)) {
+        view = firtree_buffer_sampler_new();
+        firtree_buffer_sampler_set_interpolation_mode(view,
+                FIRTREE_INTERPOLATION_NEAREST);
+        firtree_buffer_sampler_set_buffer_no_copy(view, buffer,
+                width, height, stride, format);
+    }
+
+    /* Prepare each reduction. This compiles any reduce kernels which need
+     * it so it must happen before the pass starts. */
+    FirtreeCpuReduceEngineRequest** requests = 
+        g_new0(FirtreeCpuReduceEngineRequest*, MAX(1, n_reduce_engines));
+    gboolean rv = TRUE;
+    guint i;
+    for(i=0; i<n_reduce_engines; ++i) {
+        requests[i] = firtree_cpu_reduce_engine_begin_fused_reduce(
+                reduce_engines[i], sets[i], extents, width, height,
+                p->sampler, view ? FIRTREE_SAMPLER(view) : NULL);
+        if(!requests[i]) {
+            rv = FALSE;
+            break;
+        }
+    }
+
+    if(rv) {
+        rv = firtree_cpu_renderer_perform_render(self, render,
+                (unsigned char*)buffer, width, height, stride,
+                firtree_engine_get_buffer_format_pixel_size(format),
+                (float*)extents, planes, requests, n_reduce_engines);
+    }
+
+    for(i=0; i<n_reduce_engines; ++i) {
+        if(requests[i]) {
+            firtree_cpu_reduce_engine_end_fused_reduce(reduce_engines[i], 
+                    requests[i]);
+        }
+    }
+    g_free(requests);
+
+    if(view) {
+        g_object_unref(view);
+    }
+
+    return rv;
+}
+
+gboolean
+firtree_cpu_renderer_render_and_reduce_into_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuReduceEngine** reduce_engines,
+        FirtreeLockFreeSet** sets,
+        guint n_reduce_engines)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_and_reduce_into_buffer_unlocked(self,
+            extents, buffer, width, height,
+            stride, format, reduce_engines, sets, n_reduce_engines);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+static void
+_call_batch_render_func(guint slice, FirtreeCpuRendererBatch* batch)
+{
+    /* Find the request this slice belongs to. */
+    guint lo = 0, hi = batch->n_requests;
+    while(hi - lo > 1) {
+        guint mid = (lo + hi) >> 1;
+        if(batch->first_slices[mid] <= slice) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    _call_render_func(slice - batch->first_slices[lo], 
+            &(batch->requests[lo]));
+}
+
+static gboolean
+_firtree_cpu_renderer_render_batch_unlocked(FirtreeCpuRenderer* self,
+        FirtreeCpuRendererBatchJob* jobs, guint n_jobs,
+        FirtreeBufferFormat format)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+    guint i;
+
+    if(!p->sampler) { return FALSE; }
+    if(n_jobs == 0) { return TRUE; }
+    if(!jobs) { return FALSE; }
+
+    FirtreeCpuJitRenderFunc render =
+        firtree_cpu_renderer_get_buffer_renderer_func(self, format, TRUE);
+    if(!render) {
+        return FALSE;
+    }
+
+    guint pixel_size = firtree_engine_get_buffer_format_pixel_size(format);
+    gboolean rv = TRUE;
+
+    FirtreeCpuRendererBatch batch;
+    batch.requests = g_new(FirtreeCpuRendererRenderRequest, n_jobs);
+    batch.first_slices = g_new(guint, n_jobs + 1);
+    batch.n_requests = 0;
+    FirtreeCpuJitPlanes* planes = g_new(FirtreeCpuJitPlanes, n_jobs);
+
+    guint n_slices = 0;
+    for(i=0; i<n_jobs; ++i) {
+        FirtreeCpuRendererBatchJob* job = &(jobs[i]);
+        FirtreeCpuRendererRenderRequest* request = 
+            &(batch.requests[batch.n_requests]);
+
+        if(!job->buffer) {
+            rv = FALSE;
+            continue;
+        }
+
+        gboolean ok;
+        request->planes = _firtree_cpu_renderer_prepare_planes(format,
+                (unsigned char*)job->buffer, job->width, job->height,
+                job->stride, &(planes[batch.n_requests]), &ok);
+        if(!ok) {
+            rv = FALSE;
+            continue;
+        }
+
+        request->func = render;
+        request->buffer = (unsigned char*)job->buffer;
+        request->row_width = job->width;
+        request->num_rows = job->height;
+        request->row_stride = job->stride;
+        request->extents[0] = job->extents.x;
+        request->extents[1] = job->extents.y;
+        request->extents[2] = job->extents.z;
+        request->extents[3] = job->extents.w;
+        request->reduce_requests = NULL;
+        request->n_reduce_requests = 0;
+
+        if(!_firtree_cpu_renderer_clip_to_sampler(self,
+                    &(request->buffer), &(request->row_width),
+                    &(request->num_rows), request->row_stride, pixel_size,
+                    request->extents, request->planes)) {
+            /* Nothing to render. */
+            continue;
+        }
+
+        batch.first_slices[batch.n_requests] = n_slices;
+        n_slices += (request->num_rows+7)>>3;
+        ++batch.n_requests;
+    }
+    batch.first_slices[batch.n_requests] = n_slices;
+
+    if(n_slices > 0) {
+        if(firtree_sampler_lock(p->sampler)) {
+            threading_apply(n_slices,
+                    (ThreadingApplyFunc) _call_batch_render_func, &batch);
+            firtree_sampler_unlock(p->sampler);
+        } else {
+            g_debug("Failed to lock sampler.");
+            rv = FALSE;
+        }
+    }
+
+    g_free(planes);
+    g_free(batch.first_slices);
+    g_free(batch.requests);
+
+    return rv;
+}
+
+gboolean
+firtree_cpu_renderer_render_batch (FirtreeCpuRenderer* self,
+        FirtreeCpuRendererBatchJob* jobs, guint n_jobs,
+        FirtreeBufferFormat format)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_batch_unlocked(self,
+            jobs, n_jobs, format);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+/* Fill @job with the render of the pixels [@x0, @x1) x [@y0, @y1) of a
+ * buffer of @width by @height pixels which covers @extents. */
+static void
+_firtree_cpu_renderer_get_region_job(FirtreeVec4* extents,
+        unsigned char* buffer, guint width, guint height, guint stride,
+        guint pixel_size, guint x0, guint y0, guint x1, guint y1,
+        FirtreeCpuRendererBatchJob* job)
+{
+    float dx = extents->z / (float)width;
+    float dy = extents->w / (float)height;
+
+    job->extents.x = extents->x + (dx * (float)x0);
+    job->extents.y = extents->y + (dy * (float)y0);
+    job->extents.z = dx * (float)(x1 - x0);
+    job->extents.w = dy * (float)(y1 - y0);
+    job->buffer = buffer + (y0 * stride) + (x0 * pixel_size);
+    job->width = x1 - x0;
+    job->height = y1 - y0;
+    job->stride = stride;
+}
+
+static gboolean
+_firtree_cpu_renderer_render_region_into_buffer_unlocked(
+        FirtreeCpuRenderer* self, FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        guint x, guint y, guint region_width, guint region_height)
+{
+    if(!buffer) { return FALSE; }
+    if(!extents) { return FALSE; }
+
+    guint pixel_size = firtree_engine_get_buffer_format_pixel_size(format);
+    if(pixel_size == 0) {
+        g_debug("Only packed formats may be rendered a region at a time.");
+        return FALSE;
+    }
+
+    if((x >= width) || (y >= height)) {
+        return TRUE;
+    }
+    guint x1 = x + MIN(region_width, width - x);
+    guint y1 = y + MIN(region_height, height - y);
+    if((x1 == x) || (y1 == y)) {
+        return TRUE;
+    }
+
+    FirtreeCpuRendererBatchJob job;
+    _firtree_cpu_renderer_get_region_job(extents, (unsigned char*)buffer,
+            width, height, stride, pixel_size, x, y, x1, y1, &job);
+
+    return _firtree_cpu_renderer_render_batch_unlocked(self, &job, 1, format);
+}
+
+gboolean
+firtree_cpu_renderer_render_region_into_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        guint x, guint y, guint region_width, guint region_height)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_render_region_into_buffer_unlocked(
+            self, extents, buffer, width, height, stride, format,
+            x, y, region_width, region_height);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+void
+firtree_cpu_renderer_invalidate (FirtreeCpuRenderer* self,
+        FirtreeVec4* region)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    if(!region) {
+        _firtree_cpu_renderer_invalidate_all(self);
+        return;
+    }
+
+    g_mutex_lock(p->dirty_mutex);
+    _firtree_cpu_renderer_add_dirty_rect(self, region);
+    g_mutex_unlock(p->dirty_mutex);
+}
+
+gboolean
+firtree_cpu_renderer_get_dirty_extent (FirtreeCpuRenderer* self,
+        FirtreeVec4* extent)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+    gboolean rv = TRUE;
+
+    g_mutex_lock(p->dirty_mutex);
+    if(p->dirty_all) {
+        FirtreeVec4 infinite =
+            { -0.5 * G_MAXFLOAT, -0.5 * G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+        *extent = infinite;
+    } else if(p->dirty_rects->len == 0) {
+        rv = FALSE;
+    } else {
+        *extent = _firtree_cpu_renderer_get_bounds(p->dirty_rects);
+    }
+    g_mutex_unlock(p->dirty_mutex);
+
+    return rv;
+}
+
+/* The size in pixels of the square tiles which
+ * firtree_cpu_renderer_update_buffer() re-renders. */
+#define UPDATE_TILE_SIZE 64
+
+/* Clear and re-render the tiles of @buffer which overlap any of @rects. */
+static gboolean
+_firtree_cpu_renderer_update_tiles(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, unsigned char* buffer,
+        guint width, guint height, guint stride, FirtreeBufferFormat format,
+        guint pixel_size, GArray* rects)
+{
+    guint tiles_x = (width + UPDATE_TILE_SIZE - 1) / UPDATE_TILE_SIZE;
+    guint tiles_y = (height + UPDATE_TILE_SIZE - 1) / UPDATE_TILE_SIZE;
+    guint8* dirty = g_new0(guint8, tiles_x * tiles_y);
+
+    float dx = extents->z / (float)width;
+    float dy = extents->w / (float)height;
+
+    guint i, tx, ty;
+    for(i=0; i<rects->len; ++i) {
+        FirtreeVec4* rect = &g_array_index(rects, FirtreeVec4, i);
+        guint col0, col1, row0, row1;
+        _firtree_cpu_renderer_clip_span(extents->x, dx, width,
+                rect->x, rect->x + rect->z, &col0, &col1);
+        _firtree_cpu_renderer_clip_span(extents->y, dy, height,
+                rect->y, rect->y + rect->w, &row0, &row1);
+        if((col0 >= col1) || (row0 >= row1)) {
+            continue;
+        }
+
+        guint tx1 = (col1 + UPDATE_TILE_SIZE - 1) / UPDATE_TILE_SIZE;
+        guint ty1 = (row1 + UPDATE_TILE_SIZE - 1) / UPDATE_TILE_SIZE;
+        for(ty=row0 / UPDATE_TILE_SIZE; ty<ty1; ++ty) {
+            for(tx=col0 / UPDATE_TILE_SIZE; tx<tx1; ++tx) {
+                dirty[(ty * tiles_x) + tx] = 1;
+            }
+        }
+    }
+
+    /* Each run of dirty tiles along a row of tiles is rendered as one
+     * job of the batch. */
+    gboolean clear = !_firtree_cpu_renderer_overwrites_target(self);
+    GArray* jobs = g_array_new(FALSE, FALSE,
+            sizeof(FirtreeCpuRendererBatchJob));
+    for(ty=0; ty<tiles_y; ++ty) {
+        tx = 0;
+        while(tx < tiles_x) {
+            if(!dirty[(ty * tiles_x) + tx]) {
+                ++tx;
+                continue;
+            }
+
+            guint first_tile = tx;
+            while((tx < tiles_x) && dirty[(ty * tiles_x) + tx]) {
+                ++tx;
+            }
+
+            guint x0 = first_tile * UPDATE_TILE_SIZE;
+            guint x1 = MIN(tx * UPDATE_TILE_SIZE, width);
+            guint y0 = ty * UPDATE_TILE_SIZE;
+            guint y1 = MIN(y0 + UPDATE_TILE_SIZE, height);
+
+            /* Renders are composited over the existing contents unless
+             * they overwrite every pixel. */
+            guint row;
+            for(row=y0; clear && (row<y1); ++row) {
+                memset(buffer + (row * stride) + (x0 * pixel_size), 0,
+                        (x1 - x0) * pixel_size);
+            }
+
+            FirtreeCpuRendererBatchJob job;
+            _firtree_cpu_renderer_get_region_job(extents, buffer,
+                    width, height, stride, pixel_size, x0, y0, x1, y1, &job);
+            g_array_append_val(jobs, job);
+        }
+    }
+
+    gboolean rv = _firtree_cpu_renderer_render_batch_unlocked(self,
+            (FirtreeCpuRendererBatchJob*)jobs->data, jobs->len, format);
+
+    g_array_free(jobs, TRUE);
+    g_free(dirty);
+
+    return rv;
+}
+
+static gboolean
+_firtree_cpu_renderer_update_buffer_unlocked(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self);
+
+    if(!buffer) { return FALSE; }
+    if(!extents) { return FALSE; }
+    if(!p->sampler) { return FALSE; }
+
+    guint pixel_size = firtree_engine_get_buffer_format_pixel_size(format);
+    if(pixel_size == 0) {
+        g_debug("Only packed formats may be updated a region at a time.");
+        return FALSE;
+    }
+
+    /* Take the dirty region. Changes which arrive while rendering are
+     * left for the next update. */
+    g_mutex_lock(p->dirty_mutex);
+    gboolean dirty_all = p->dirty_all;
+    GArray* rects = p->dirty_rects;
+    p->dirty_rects = g_array_new(FALSE, FALSE, sizeof(FirtreeVec4));
+    p->dirty_all = FALSE;
+    g_mutex_unlock(p->dirty_mutex);
+
+    gboolean same_buffer = (p->update_buffer == buffer) &&
+        (p->update_extents.x == extents->x) &&
+        (p->update_extents.y == extents->y) &&
+        (p->update_extents.z == extents->z) &&
+        (p->update_extents.w == extents->w) &&
+        (p->update_width == width) && (p->update_height == height) &&
+        (p->update_stride == stride) && (p->update_format == format);
+
+    gboolean overwrites = _firtree_cpu_renderer_overwrites_target(self);
+    gboolean rv;
+    if(dirty_all || !same_buffer || (width == 0) || (height == 0) ||
+            (extents->z <= 0.f) || (extents->w <= 0.f)) {
+        /* Renders are composited over the existing contents unless they
+         * overwrite every pixel. */
+        guint row;
+        for(row=0; (row<height) && !overwrites; ++row) {
+            memset((unsigned char*)buffer + (row * stride), 0,
+                    width * pixel_size);
+        }
+
+        rv = _firtree_cpu_renderer_render_into_buffer_unlocked(self,
+                extents, buffer, width, height, stride, format);
+    } else {
+        rv = _firtree_cpu_renderer_update_tiles(self, extents,
+                (unsigned char*)buffer, width, height, stride, format,
+                pixel_size, rects);
+    }
+
+    g_array_free(rects, TRUE);
+
+    if(rv) {
+        p->update_buffer = buffer;
+        p->update_extents = *extents;
+        p->update_width = width;
+        p->update_height = height;
+        p->update_stride = stride;
+        p->update_format = format;
+    } else {
+        /* The buffer is in an unknown state. */
+        p->update_buffer = NULL;
+    }
+
+    return rv;
+}
+
+gboolean
+firtree_cpu_renderer_update_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    _firtree_cpu_renderer_wait_for_frames(self, 0);
+    gboolean rv = _firtree_cpu_renderer_update_buffer_unlocked(self,
+            extents, buffer, width, height, stride, format);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+static void
+_firtree_cpu_renderer_wait_for_frames(FirtreeCpuRenderer* self, guint n_frames)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->inflight_mutex);
+    while(p->frames_in_flight > n_frames) {
+        g_cond_wait(p->inflight_cond, p->inflight_mutex);
+    }
+    g_mutex_unlock(p->inflight_mutex);
+}
+
+/* The renderer whose render callback the current thread is running. */
+static GStaticPrivate _firtree_cpu_renderer_in_callback = G_STATIC_PRIVATE_INIT;
+
+/* Called from the worker thread which rendered the last slice of @render.
+ * The frame is retired before the callback is called so that the callback
+ * may wait for or queue renders via the same renderer. */
+static void
+_firtree_cpu_renderer_async_render_done(FirtreeCpuRendererAsyncRender* render)
+{
+    FirtreeCpuRenderer* self = render->renderer;
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+    FirtreeSampler* unlocked_sampler = NULL;
+
+    /* The sampler is unlocked with the mutex held so that a render queued
+     * meanwhile cannot lock it first. */
+    g_mutex_lock(p->inflight_mutex);
+    --p->frames_in_flight;
+    if(p->frames_in_flight == 0) {
+        unlocked_sampler = p->inflight_sampler;
+        p->inflight_sampler = NULL;
+        firtree_sampler_unlock(unlocked_sampler);
+    }
+    if(render->callback) {
+        ++p->callbacks_running;
+    }
+    g_cond_broadcast(p->inflight_cond);
+    g_mutex_unlock(p->inflight_mutex);
+
+    if(unlocked_sampler) {
+        g_object_unref(unlocked_sampler);
+    }
+
+    if(render->callback) {
+        gpointer outer = g_static_private_get(
+                &_firtree_cpu_renderer_in_callback);
+        g_static_private_set(&_firtree_cpu_renderer_in_callback, self, NULL);
+        render->callback(self, TRUE, render->user_data);
+        g_static_private_set(&_firtree_cpu_renderer_in_callback, outer, NULL);
+
+        g_mutex_lock(p->inflight_mutex);
+        --p->callbacks_running;
+        g_cond_broadcast(p->inflight_cond);
+        g_mutex_unlock(p->inflight_mutex);
+    }
+
+    g_slice_free(FirtreeCpuRendererAsyncRender, render);
+    g_object_unref(self);
+}
+
+/* A slice of a render which turned out to have nothing to render. */
+static void
+_skip_render_func(guint slice, FirtreeCpuRendererRenderRequest* request)
+{
+}
+
+static gboolean
+_firtree_cpu_renderer_render_async_unlocked(FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuRendererRenderCallback callback,
+        gpointer user_data)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if(!buffer) { return FALSE; }
+    if(!extents) { return FALSE; }
+    if(!p->sampler) { return FALSE; }
+
+    FirtreeCpuRendererAsyncRender* render = 
+        g_slice_new(FirtreeCpuRendererAsyncRender);
+    FirtreeCpuRendererRenderRequest* request = &(render->request);
+
+    gboolean ok;
+    request->planes = _firtree_cpu_renderer_prepare_planes(
+            format, (unsigned char*)buffer, width, height, stride,
+            &(render->planes), &ok);
+    request->func = ok ? 
+        firtree_cpu_renderer_get_buffer_renderer_func(self, format, TRUE) : NULL;
+    if(!request->func) {
+        g_slice_free(FirtreeCpuRendererAsyncRender, render);
+        return FALSE;
+    }
+
+    request->buffer = (unsigned char*)buffer;
+    request->row_width = width;
+    request->num_rows = height;
+    request->row_stride = stride;
+    request->extents[0] = extents->x; request->extents[1] = extents->y;
+    request->extents[2] = extents->z; request->extents[3] = extents->w;
+    request->reduce_requests = NULL;
+    request->n_reduce_requests = 0;
+
+    /* With nothing to render the frame is still queued so that @callback is
+     * called from a worker, in order, as for any other frame. */
+    gboolean empty = !_firtree_cpu_renderer_clip_to_sampler(self,
+            &(request->buffer), &(request->row_width), &(request->num_rows),
+            stride, firtree_engine_get_buffer_format_pixel_size(format),
+            request->extents, request->planes);
+
+    /* Wait for a free slot. The sampler is locked by the first render to be
+     * in flight and stays locked until the last has finished. Frames queued
+     * back to back therefore share one lock and see the state of the
+     * sampler graph as it was when the first of them was queued. */
+    g_mutex_lock(p->inflight_mutex);
+    while(p->frames_in_flight >= MAX(1, p->max_frames_in_flight)) {
+        g_cond_wait(p->inflight_cond, p->inflight_mutex);
+    }
+    if(p->frames_in_flight == 0) {
+        if(!firtree_sampler_lock(p->sampler)) {
+            g_mutex_unlock(p->inflight_mutex);
+            g_debug("Failed to lock sampler.");
+            g_slice_free(FirtreeCpuRendererAsyncRender, render);
+            return FALSE;
+        }
+        p->inflight_sampler = FIRTREE_SAMPLER(g_object_ref(p->sampler));
+    }
+    ++p->frames_in_flight;
+    g_mutex_unlock(p->inflight_mutex);
+
+    render->renderer = FIRTREE_CPU_RENDERER(g_object_ref(self));
+    render->callback = callback;
+    render->user_data = user_data;
+
+    if(empty) {
+        threading_apply_async(1,
+                (ThreadingApplyFunc) _skip_render_func, request,
+                (ThreadingDoneFunc) _firtree_cpu_renderer_async_render_done,
+                render);
+    } else {
+        threading_apply_async((request->num_rows+7)>>3,
+                (ThreadingApplyFunc) _call_render_func, request,
+                (ThreadingDoneFunc) _firtree_cpu_renderer_async_render_done,
+                render);
+    }
+
+    return TRUE;
+}
+
+gboolean
+firtree_cpu_renderer_render_async (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuRendererRenderCallback callback,
+        gpointer user_data)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->render_mutex);
+    gboolean rv = _firtree_cpu_renderer_render_async_unlocked(self,
+            extents, buffer, width, height, stride, format,
+            callback, user_data);
+    g_mutex_unlock(p->render_mutex);
+
+    return rv;
+}
+
+void
+firtree_cpu_renderer_wait (FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    /* A callback waiting from within itself only waits for the others. */
+    guint own_callbacks = (g_static_private_get(
+                &_firtree_cpu_renderer_in_callback) == self) ? 1 : 0;
+
+    g_mutex_lock(p->inflight_mutex);
+    while((p->frames_in_flight > 0) ||
+            (p->callbacks_running > own_callbacks)) {
+        g_cond_wait(p->inflight_cond, p->inflight_mutex);
+    }
+    g_mutex_unlock(p->inflight_mutex);
+}
+
+void
+firtree_cpu_renderer_set_max_frames_in_flight (FirtreeCpuRenderer* self,
+        guint n_frames)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    g_mutex_lock(p->inflight_mutex);
+    p->max_frames_in_flight = MAX(1, n_frames);
+    g_cond_broadcast(p->inflight_cond);
+    g_mutex_unlock(p->inflight_mutex);
+}
+
+guint
+firtree_cpu_renderer_get_max_frames_in_flight (FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+    return p->max_frames_in_flight;
+}
+
+void
+firtree_cpu_renderer_set_render_mode (FirtreeCpuRenderer* self,
+        FirtreeRenderMode mode)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+
+    if((mode < 0) || (mode >= FIRTREE_RENDER_MODE_LAST)) {
+        g_warning("Invalid render mode: %i", mode);
+        return;
+    }
+
+    g_mutex_lock(p->render_mutex);
+    if(mode != p->render_mode) {
+        p->render_mode = mode;
+
+        /* Pixels outside of the sampler's extent are now treated
+         * differently. */
+        _firtree_cpu_renderer_invalidate_all(self);
+    }
+    g_mutex_unlock(p->render_mutex);
+}
+
+FirtreeRenderMode
+firtree_cpu_renderer_get_render_mode (FirtreeCpuRenderer* self)
+{
+    FirtreeCpuRendererPrivate* p = GET_PRIVATE(self); 
+    return p->render_mode;
 }
 
 GString* 
@@ -387,7 +1831,7 @@ firtree_debug_dump_cpu_renderer_asm(FirtreeCpuRenderer* self, FirtreeBufferForma
 
     FirtreeCpuJitRenderFunc render =
         (FirtreeCpuJitRenderFunc)firtree_cpu_renderer_get_renderer_func(self, 
-                format);
+                format, TRUE);
 
     if(!render)
         return NULL;
@@ -24,6 +24,7 @@
 
 #include <firtree/firtree.h>
 #include <firtree/firtree-sampler.h>
+#include <firtree/engines/cpu/firtree-cpu-reduce-engine.h>
 
 #if FIRTREE_HAVE_CAIRO
 #   include <cairo/cairo.h>
@@ -33,12 +34,19 @@
 #   include <gdk-pixbuf/gdk-pixbuf.h>
 #endif
 
+#if FIRTREE_HAVE_CLUTTER
+#   include <cogl/cogl.h>
+#endif
+
 /**
  * SECTION:firtree-cpu-render
  * @short_description: A rendering engine which uses a CPU JIT.
  * @include: firtree/engines/cpu/firtree-cpu-render.h
  *
  * A rendering engine which uses a CPU JIT.
+ *
+ * A renderer may be used from several threads. Renders through the same
+ * renderer are serialised while separate renderers may render concurrently.
  */
 
 G_BEGIN_DECLS
@@ -126,6 +134,27 @@ firtree_cpu_renderer_render_into_cairo_surface (FirtreeCpuRenderer* self,
 
 #endif
 
+#if FIRTREE_HAVE_CLUTTER
+
+/**
+ * firtree_cpu_renderer_render_into_cogl_texture:
+ * @self: A FirtreeCpuRenderer object.
+ * @extents: The extents of the sampler to render.
+ * @texture: A handle to the Cogl texture to render into.
+ *
+ * Render the engine's sampler into the passed texture, replacing its
+ * contents. The render is made into a staging buffer in the texture's own
+ * pixel format, which is kept for the next render of the same size, and
+ * uploaded to the texture in one call.
+ *
+ * Returns: TRUE if rendereding succeeded.
+ */
+gboolean
+firtree_cpu_renderer_render_into_cogl_texture (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents, CoglHandle texture);
+
+#endif
+
 /**
  * firtree_cpu_renderer_set_sampler:
  * @self: A FirtreeCpuRenderer object.
@@ -159,6 +188,10 @@ firtree_cpu_renderer_get_sampler (FirtreeCpuRenderer* self);
  *
  * Render directly into a buffer in memory.
  *
+ * For the 4:2:0 YCbCr formats, @stride is the stride of the luma plane and
+ * @width and @height must be even. The chroma of each 2x2 block of pixels
+ * is the average of the rendered colours.
+ *
  * Returns: TRUE if rendereding succeeded.
  */
 gboolean 
@@ -167,6 +200,300 @@ firtree_cpu_renderer_render_into_buffer (FirtreeCpuRenderer* self,
         gpointer buffer, guint width, guint height,
         guint stride, FirtreeBufferFormat format);
 
+/**
+ * firtree_cpu_renderer_render_and_reduce_into_buffer:
+ * @self: A FirtreeCpuRenderer.
+ * @extents: The extents of the sampler to render.
+ * @buffer: The location of the buffer in memory.
+ * @width: The buffer width in pixels.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row in bytes.
+ * @format: The format of the buffer.
+ * @reduce_engines: An array of @n_reduce_engines reduce engines.
+ * @sets: An array of @n_reduce_engines sets, one per reduce engine.
+ * @n_reduce_engines: The number of reduce engines.
+ *
+ * Render directly into a buffer as firtree_cpu_renderer_render_into_buffer()
+ * does and, in the same pass, run each reduce engine as
+ * firtree_cpu_reduce_engine_run() would over the same @extents, @width and
+ * @height, appending to the corresponding set in @sets.
+ *
+ * The image is processed in slices of a few rows. Each slice is rendered and
+ * then reduced by every engine before the next is started so that the input
+ * images and the rendered rows are still in cache when the reduce kernels
+ * read them.
+ *
+ * If @extents is (0, 0, @width, @height) and @format is not a planar YCbCr
+ * format, a reduce kernel argument bound to the renderer's sampler which is
+ * only sampled at samplerCoord() reads the pixels just rendered into @buffer
+ * instead of evaluating the sampler again. The reduction then sees the
+ * rendered pixels as stored in @format. The argument is bound to the
+ * renderer's sampler again once the reduce kernels are compiled. Reduce
+ * kernels which sample the renderer's sampler in any other way evaluate it
+ * themselves.
+ *
+ * Each reduce engine may appear in @reduce_engines only once.
+ *
+ * Returns: TRUE if rendering succeeded and all of the reductions were run.
+ */
+gboolean 
+firtree_cpu_renderer_render_and_reduce_into_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuReduceEngine** reduce_engines,
+        FirtreeLockFreeSet** sets,
+        guint n_reduce_engines);
+
+/**
+ * FirtreeCpuRendererBatchJob:
+ * @extents: The extents of the sampler to render.
+ * @buffer: The location of the buffer in memory.
+ * @width: The buffer width in pixels.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row in bytes.
+ *
+ * One of the renders performed by firtree_cpu_renderer_render_batch().
+ */
+typedef struct {
+    FirtreeVec4     extents;
+    gpointer        buffer;
+    guint           width;
+    guint           height;
+    guint           stride;
+} FirtreeCpuRendererBatchJob;
+
+/**
+ * firtree_cpu_renderer_render_batch:
+ * @self: A FirtreeCpuRenderer.
+ * @jobs: An array of @n_jobs renders to perform.
+ * @n_jobs: The number of renders in @jobs.
+ * @format: The format of every buffer in @jobs.
+ *
+ * Perform each render in @jobs as firtree_cpu_renderer_render_into_buffer()
+ * would. The slices of all of the renders are scheduled on the thread pool
+ * together with one barrier at the end so that batches of small images, such
+ * as thumbnails or tiles, keep every core busy.
+ *
+ * Returns: TRUE if every render succeeded.
+ */
+gboolean
+firtree_cpu_renderer_render_batch (FirtreeCpuRenderer* self,
+        FirtreeCpuRendererBatchJob* jobs, guint n_jobs,
+        FirtreeBufferFormat format);
+
+/**
+ * firtree_cpu_renderer_render_region_into_buffer:
+ * @self: A FirtreeCpuRenderer.
+ * @extents: The extents of the sampler covered by the whole buffer.
+ * @buffer: The location of the buffer in memory.
+ * @width: The buffer width in pixels.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row in bytes.
+ * @format: The format of the buffer.
+ * @x: The column of the top-left pixel of the region to render.
+ * @y: The row of the top-left pixel of the region to render.
+ * @region_width: The width of the region in pixels.
+ * @region_height: The height of the region in rows.
+ *
+ * Render the pixels of the rectangle with its top-left at (@x, @y) as
+ * firtree_cpu_renderer_render_into_buffer() would render them into the
+ * whole buffer and leave the rest of the buffer alone. The region is
+ * clipped to the buffer. Planar YCbCr formats are not supported.
+ *
+ * Returns: TRUE if rendering succeeded.
+ */
+gboolean
+firtree_cpu_renderer_render_region_into_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        guint x, guint y, guint region_width, guint region_height);
+
+/**
+ * firtree_cpu_renderer_invalidate:
+ * @self: A FirtreeCpuRenderer.
+ * @region: NULL or a (minx, miny, width, height) rectangle in output
+ * co-ordinates.
+ *
+ * Mark @region, or the whole output if @region is NULL, as needing to be
+ * re-rendered by the next call to firtree_cpu_renderer_update_buffer().
+ * This is only needed for changes which the renderer is not told of by its
+ * sampler's signals, such as the buffer passed to
+ * firtree_cpu_renderer_update_buffer() being modified by the caller.
+ */
+void
+firtree_cpu_renderer_invalidate (FirtreeCpuRenderer* self,
+        FirtreeVec4* region);
+
+/**
+ * firtree_cpu_renderer_get_dirty_extent:
+ * @self: A FirtreeCpuRenderer.
+ * @extent: Filled with the bounds of the dirty region.
+ *
+ * Find the bounds, in output co-ordinates, of the part of the output which
+ * has changed since the last call to firtree_cpu_renderer_update_buffer().
+ * If the whole output has changed @extent is the infinite extent.
+ *
+ * Returns: FALSE if nothing has changed.
+ */
+gboolean
+firtree_cpu_renderer_get_dirty_extent (FirtreeCpuRenderer* self,
+        FirtreeVec4* extent);
+
+/**
+ * firtree_cpu_renderer_update_buffer:
+ * @self: A FirtreeCpuRenderer.
+ * @extents: The extents of the sampler to render.
+ * @buffer: The location of the buffer in memory.
+ * @width: The buffer width in pixels.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row in bytes.
+ * @format: The format of the buffer.
+ *
+ * Bring a persistent render of the sampler up to date. @buffer is taken to
+ * hold the render of the sampler over a transparent background made by the
+ * last call to this function with the same arguments. Only the tiles of
+ * @buffer which overlap the dirty region are cleared and re-rendered.
+ *
+ * The renderer tracks the dirty region from its sampler's signals. A
+ * sampler which emits FirtreeSampler::region-changed, such as a
+ * #FirtreeBufferSampler updated via firtree_buffer_sampler_update_region(),
+ * dirties only the part of the output which samples that region through
+ * the kernels in between. Any other change, or a call with different
+ * arguments, re-renders the whole buffer.
+ *
+ * Planar YCbCr formats are not supported.
+ *
+ * Returns: TRUE if rendering succeeded.
+ */
+gboolean
+firtree_cpu_renderer_update_buffer (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format);
+
+/**
+ * FirtreeCpuRendererRenderCallback:
+ * @renderer: The FirtreeCpuRenderer which performed the render.
+ * @success: TRUE if the render succeeded.
+ * @user_data: The user data passed to firtree_cpu_renderer_render_async().
+ *
+ * A function called once an asynchronous render has finished.
+ */
+typedef void (*FirtreeCpuRendererRenderCallback) (FirtreeCpuRenderer* renderer,
+        gboolean success, gpointer user_data);
+
+/**
+ * firtree_cpu_renderer_render_async:
+ * @self: A FirtreeCpuRenderer.
+ * @extents: The extents of the sampler to render.
+ * @buffer: The location of the buffer in memory.
+ * @width: The buffer width in pixels.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row in bytes.
+ * @format: The format of the buffer.
+ * @callback: NULL or a function to call once the render has finished.
+ * @user_data: Data to pass to @callback.
+ *
+ * Queue a render into a buffer as firtree_cpu_renderer_render_into_buffer()
+ * would and return without waiting for it. @buffer must remain valid until
+ * the render has finished.
+ *
+ * Up to firtree_cpu_renderer_get_max_frames_in_flight() renders may be in
+ * flight at once and the slices of one may be rendered alongside those of
+ * the next. If that many renders are already in flight, this function
+ * blocks until one has finished.
+ *
+ * @callback is called from a worker thread, even if there is nothing to
+ * render, once the render has finished. It may queue further renders, wait
+ * for others or render synchronously via @self.
+ *
+ * The sampler is locked when the first render is queued and unlocked once
+ * no render is in flight. Renders queued back to back share that lock and
+ * so changes made at lock time, such as the refresh of a
+ * FirtreeCpuCachingSampler, are only picked up when the queue drains. The
+ * sampler graph should not be modified until firtree_cpu_renderer_wait()
+ * has returned. Synchronous renders via @self wait for renders in flight to
+ * finish first.
+ *
+ * Returns: TRUE if the render was queued. If FALSE is returned, @callback
+ * is not called.
+ */
+gboolean
+firtree_cpu_renderer_render_async (FirtreeCpuRenderer* self,
+        FirtreeVec4* extents,
+        gpointer buffer, guint width, guint height,
+        guint stride, FirtreeBufferFormat format,
+        FirtreeCpuRendererRenderCallback callback,
+        gpointer user_data);
+
+/**
+ * firtree_cpu_renderer_wait:
+ * @self: A FirtreeCpuRenderer.
+ *
+ * Block until every render queued via firtree_cpu_renderer_render_async()
+ * has finished and its callback has returned. If called from such a
+ * callback, that callback is not waited for.
+ */
+void
+firtree_cpu_renderer_wait (FirtreeCpuRenderer* self);
+
+/**
+ * firtree_cpu_renderer_set_max_frames_in_flight:
+ * @self: A FirtreeCpuRenderer.
+ * @n_frames: The maximum number of asynchronous renders in flight.
+ *
+ * Set the number of renders queued via firtree_cpu_renderer_render_async()
+ * which may be in flight at once. A value of 0 is treated as 1. The default
+ * is 2 which allows the start of one frame to overlap the end of the
+ * previous one.
+ */
+void
+firtree_cpu_renderer_set_max_frames_in_flight (FirtreeCpuRenderer* self,
+        guint n_frames);
+
+/**
+ * firtree_cpu_renderer_get_max_frames_in_flight:
+ * @self: A FirtreeCpuRenderer.
+ *
+ * Returns: The maximum number of asynchronous renders which may be in
+ * flight at once.
+ */
+guint
+firtree_cpu_renderer_get_max_frames_in_flight (FirtreeCpuRenderer* self);
+
+/**
+ * firtree_cpu_renderer_set_render_mode:
+ * @self: A FirtreeCpuRenderer.
+ * @mode: How renders are combined with the existing contents of their
+ * target.
+ *
+ * Set the FirtreeRenderMode of renders by @self. The default,
+ * %FIRTREE_RENDER_MODE_OVER, composites each render over its target. In
+ * %FIRTREE_RENDER_MODE_REPLACE mode the target is overwritten without being
+ * read, which roughly halves the memory traffic of a render, and there is no
+ * need to clear it beforehand. The remaining modes blend the render with the
+ * target as the cairo operators of the same name. Each mode is compiled into
+ * its own render loop and so none is slower than the others.
+ *
+ * Samplers whose output is known to be opaque, such as kernels which always
+ * return an alpha of 1, are rendered without reading the target in
+ * %FIRTREE_RENDER_MODE_OVER mode.
+ */
+void
+firtree_cpu_renderer_set_render_mode (FirtreeCpuRenderer* self,
+        FirtreeRenderMode mode);
+
+/**
+ * firtree_cpu_renderer_get_render_mode:
+ * @self: A FirtreeCpuRenderer.
+ *
+ * Returns: The mode set via firtree_cpu_renderer_set_render_mode().
+ */
+FirtreeRenderMode
+firtree_cpu_renderer_get_render_mode (FirtreeCpuRenderer* self);
+
 /**
  * firtree_debug_dump_cpu_renderer_function:
  * @engine: A FirtreeCpuRenderer.
@@ -21,6 +21,65 @@ extern vec4 sampler_render_function(vec2 dest_coord);
 /* leverage some of our builtins. */
 extern vec4 premultiply_v4(vec4);
 extern vec4 unpremultiply_v4(vec4);
+extern float sin_f(float);
+
+/* Convert between IEEE 754 half and single precision floats. The JIT's
+ * target description has no half-precision instructions so these are done
+ * with integer operations. Conversion to half rounds to nearest even and
+ * saturates to infinity. */
+typedef union {
+    uint32_t    u;
+    float       f;
+} float_bits;
+
+G_INLINE_FUNC
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = ((uint32_t)(h & 0x8000)) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    float_bits v;
+
+    if(exponent == 0) {
+        /* zero or subnormal */
+        v.f = (float)mantissa * (1.f / 16777216.f);
+        v.u |= sign;
+    } else if(exponent == 0x1f) {
+        /* infinity or NaN */
+        v.u = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        v.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    return v.f;
+}
+
+G_INLINE_FUNC
+uint16_t float_to_half(float f)
+{
+    float_bits v;
+    v.f = f;
+    uint16_t sign = (v.u >> 16) & 0x8000;
+    uint32_t abs_u = v.u & 0x7fffffff;
+
+    if(abs_u > 0x7f800000) {
+        /* NaN */
+        return sign | 0x7e00;
+    }
+    if(abs_u >= 0x477ff000) {
+        /* rounds to a magnitude larger than 65504 */
+        return sign | 0x7c00;
+    }
+    if(abs_u < 0x38800000) {
+        /* subnormal or zero, in units of 2^-24 */
+        v.u = abs_u;
+        return sign | (uint16_t)(v.f * 16777216.f + 0.5f);
+    }
+
+    /* Rebias the exponent and round the mantissa to nearest even. */
+    return sign | (uint16_t)((abs_u - 0x38000000 + 0x0fff +
+                ((abs_u >> 13) & 1)) >> 13);
+}
 
 /* Unpack a pixel from a memory location into a vector. */
 G_INLINE_FUNC
@@ -32,6 +91,25 @@ vec4 unpack_pixel(void* p, FirtreeBufferFormat format)
         return rv;
     }
 
+    if(format == FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED) {
+        uint16_t* hp = (uint16_t*)p;
+        vec4 rv = { half_to_float(hp[0]), half_to_float(hp[1]),
+            half_to_float(hp[2]), half_to_float(hp[3]) };
+        return rv;
+    }
+
+    if((format == FIRTREE_FORMAT_RGBA64) ||
+            (format == FIRTREE_FORMAT_RGBA64_PREMULTIPLIED)) {
+        uint16_t* wp = (uint16_t*)p;
+        vec4 rv = { wp[0], wp[1], wp[2], wp[3] };
+        vec4 scale = { 1.f/65535.f, 1.f/65535.f, 1.f/65535.f, 1.f/65535.f };
+        rv *= scale;
+        if(format == FIRTREE_FORMAT_RGBA64) {
+            return premultiply_v4(rv);
+        }
+        return rv;
+    }
+
     /* The components */
     guint8 x=0, y=0, z=0, w=0;
 
@@ -144,6 +222,32 @@ void pack_pixel(vec4 pixel, void* p, FirtreeBufferFormat format)
         return;
     }
 
+    if(format == FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED) {
+        uint16_t* hp = (uint16_t*)p;
+        hp[0] = float_to_half(ELEMENT(pixel, 0));
+        hp[1] = float_to_half(ELEMENT(pixel, 1));
+        hp[2] = float_to_half(ELEMENT(pixel, 2));
+        hp[3] = float_to_half(ELEMENT(pixel, 3));
+        return;
+    }
+
+    if((format == FIRTREE_FORMAT_RGBA64) ||
+            (format == FIRTREE_FORMAT_RGBA64_PREMULTIPLIED)) {
+        float a = ELEMENT(pixel, 3);
+        if((format == FIRTREE_FORMAT_RGBA64) && (a > 0.f)) {
+            pixel = unpremultiply_v4(pixel);
+        }
+        uint16_t* wp = (uint16_t*)p;
+        int i;
+        for(i=0; i<4; ++i) {
+            float v = ELEMENT(pixel, i);
+            if(v < 0.f) { v = 0.f; }
+            if(v > 1.f) { v = 1.f; }
+            wp[i] = (uint16_t)(v * 65535.f + 0.5f);
+        }
+        return;
+    }
+
     /* The components */
     guint8 r=0, g=0, b=0, a=0, pr=0, pg=0, pb=0;
     pr = (gint)(ELEMENT(pixel, 0) * 255.f) & 0xff;
@@ -277,6 +381,9 @@ SAMPLE_FUNCTION(4, FIRTREE_FORMAT_BGRX32)
 SAMPLE_FUNCTION(1, FIRTREE_FORMAT_L8)
 
 SAMPLE_FUNCTION(16, FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED)
+SAMPLE_FUNCTION(8, FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED)
+SAMPLE_FUNCTION(8, FIRTREE_FORMAT_RGBA64)
+SAMPLE_FUNCTION(8, FIRTREE_FORMAT_RGBA64_PREMULTIPLIED)
 
 /* Image buffer specialist sampler functions */
 G_INLINE_FUNC
@@ -330,8 +437,8 @@ vec4 sample_FIRTREE_FORMAT_YV12_FOURCC(uint8_t* buffer,
     uint8_t* p_u_pixel = buffer + (height*stride) + ((height*stride)>>2) + (x>>1) + (y>>1)*(stride>>1);
 
     gint Y = (gint)(*p_y_pixel) - 16;
-    gint V = (gint)(*p_u_pixel) - 128;
-    gint U = (gint)(*p_v_pixel) - 128;
+    gint U = (gint)(*p_u_pixel) - 128;
+    gint V = (gint)(*p_v_pixel) - 128;
 
     gint r = (9535 * Y + 13074 * V            ) >> 13;
     gint g = (9535 * Y -  6660 * V -  3203 * U) >> 13;
@@ -345,6 +452,122 @@ vec4 sample_FIRTREE_FORMAT_YV12_FOURCC(uint8_t* buffer,
     return pixel_vec;
 }
 
+/* Load a luma or chroma sample scaled to the 8-bit code range. Samples are
+ * either one byte or a little-endian 16-bit value holding 10 significant
+ * bits at the top. */
+G_INLINE_FUNC
+float load_ycbcr_sample(uint8_t* p, unsigned int sample_size)
+{
+    if(sample_size == 2) {
+        uint16_t v = (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+        return (float)(v >> 6) * 0.25f;
+    }
+    return (float)(*p);
+}
+
+/* Store a sample given in the 8-bit code range, see load_ycbcr_sample(). */
+G_INLINE_FUNC
+void store_ycbcr_sample(uint8_t* p, unsigned int sample_size, float v)
+{
+    if(sample_size == 2) {
+        int i = (int)(v * 4.f + 0.5f);
+        if(i > 1023) { i = 1023; } if(i < 0) { i = 0; }
+        i <<= 6;
+        p[0] = i & 0xff;
+        p[1] = (i >> 8) & 0xff;
+        return;
+    }
+    int i = (int)(v + 0.5f);
+    if(i > 255) { i = 255; } if(i < 0) { i = 0; }
+    *p = i;
+}
+
+G_INLINE_FUNC
+vec4 clamp_unit_v4(vec4 v)
+{
+    int i;
+    for(i=0; i<4; ++i) {
+        if(ELEMENT(v, i) < 0.f) { ELEMENT(v, i) = 0.f; }
+        if(ELEMENT(v, i) > 1.f) { ELEMENT(v, i) = 1.f; }
+    }
+    return v;
+}
+
+G_INLINE_FUNC
+vec4 splat(float v)
+{
+    vec4 rv = { v, v, v, v };
+    return rv;
+}
+
+/* BT.601 studio range YCbCr (in the 8-bit code range) to opaque RGBA. */
+G_INLINE_FUNC
+vec4 ycbcr_to_rgba(float y, float cb, float cr)
+{
+    y = 1.164f * (y - 16.f);
+    cb -= 128.f;
+    cr -= 128.f;
+    vec4 rv = {
+        y + 1.596f * cr,
+        y - 0.813f * cr - 0.391f * cb,
+        y + 2.018f * cb,
+        255.f };
+    vec4 scale = { 1.f/255.f, 1.f/255.f, 1.f/255.f, 1.f/255.f };
+    return clamp_unit_v4(rv * scale);
+}
+
+/* Sample a semi-planar 4:2:0 buffer. cb_offset and cr_offset give the
+ * position of each chroma sample within an interleaved pair. */
+G_INLINE_FUNC
+vec4 sample_semi_planar(uint8_t* buffer,
+        unsigned int width, unsigned int height, unsigned int stride,
+        vec2 location, unsigned int sample_size,
+        unsigned int cb_offset, unsigned int cr_offset)
+{
+    vec4 rv = { 0, 0, 0, 0 };
+    int x = (int)(ELEMENT(location, 0));
+    int y = (int)(ELEMENT(location, 1));
+    if(ELEMENT(location, 0) < 0.f) { x--; } /* implement */
+    if(ELEMENT(location, 1) < 0.f) { y--; } /* floor()   */
+    if((x < 0) || (x >= width)) { return rv; }
+    if((y < 0) || (y >= height)) { return rv; }
+
+    uint8_t* p_y_pixel = buffer + (x * sample_size) + (y * stride);
+    uint8_t* p_chroma = buffer + (height * stride) +
+        ((x >> 1) * 2 * sample_size) + ((y >> 1) * stride);
+
+    return ycbcr_to_rgba(load_ycbcr_sample(p_y_pixel, sample_size),
+            load_ycbcr_sample(p_chroma + cb_offset, sample_size),
+            load_ycbcr_sample(p_chroma + cr_offset, sample_size));
+}
+
+G_INLINE_FUNC
+vec4 sample_FIRTREE_FORMAT_NV12_FOURCC(uint8_t* buffer,
+        unsigned int width, unsigned int height, unsigned int stride,
+        vec2 location)
+{
+    return sample_semi_planar(buffer, width, height, stride, location,
+            1, 0, 1);
+}
+
+G_INLINE_FUNC
+vec4 sample_FIRTREE_FORMAT_NV21_FOURCC(uint8_t* buffer,
+        unsigned int width, unsigned int height, unsigned int stride,
+        vec2 location)
+{
+    return sample_semi_planar(buffer, width, height, stride, location,
+            1, 1, 0);
+}
+
+G_INLINE_FUNC
+vec4 sample_FIRTREE_FORMAT_P010_FOURCC(uint8_t* buffer,
+        unsigned int width, unsigned int height, unsigned int stride,
+        vec2 location)
+{
+    return sample_semi_planar(buffer, width, height, stride, location,
+            2, 0, 2);
+}
+
 vec4 sample_image_buffer_nn(uint8_t* buffer,
         FirtreeBufferFormat format,
         unsigned int width, unsigned int height, unsigned int stride,
@@ -406,6 +629,24 @@ vec4 sample_image_buffer_nn(uint8_t* buffer,
         case FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED:
             return sample_FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED(buffer,
                     width, height, stride, location);
+        case FIRTREE_FORMAT_NV12_FOURCC:
+            return sample_FIRTREE_FORMAT_NV12_FOURCC(buffer,
+                    width, height, stride, location);
+        case FIRTREE_FORMAT_NV21_FOURCC:
+            return sample_FIRTREE_FORMAT_NV21_FOURCC(buffer,
+                    width, height, stride, location);
+        case FIRTREE_FORMAT_P010_FOURCC:
+            return sample_FIRTREE_FORMAT_P010_FOURCC(buffer,
+                    width, height, stride, location);
+        case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+            return sample_FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED(buffer,
+                    width, height, stride, location);
+        case FIRTREE_FORMAT_RGBA64:
+            return sample_FIRTREE_FORMAT_RGBA64(buffer,
+                    width, height, stride, location);
+        case FIRTREE_FORMAT_RGBA64_PREMULTIPLIED:
+            return sample_FIRTREE_FORMAT_RGBA64_PREMULTIPLIED(buffer,
+                    width, height, stride, location);
         default:
             /* do nothing */
             break;
@@ -458,9 +699,525 @@ vec4 sample_image_buffer_lerp(uint8_t* buffer,
     return rv;
 }
 
-/* Macros to make writing rendering functions easier */
-#define RENDER_FUNCTION(pix_size, format)                               \
-void render_##format(unsigned char* buffer,                             \
+/* Format-specialised versions of sample_image_buffer_nn() and
+ * sample_image_buffer_lerp(). They take the same arguments as the generic
+ * functions but ignore the format. Firtree::SpecialiseImageBufferCallsPass
+ * retargets calls with a constant format to these so that the format
+ * dispatch is removed at link time rather than relying on it being folded
+ * after inlining.
+ *
+ * The bilinear sampler performs a single bounds check for the whole 2x2
+ * neighbourhood. When it passes, both rows are addressed from one row
+ * pointer and the four pixels are unpacked without any further checks. Only
+ * samples straddling the edge of the image take the per-pixel checked
+ * path. */
+#define SPECIALISED_SAMPLE_FUNCTIONS(pix_size, format)                  \
+vec4 sample_image_buffer_nn_##format(uint8_t* buffer,                   \
+        FirtreeBufferFormat unused_format,                              \
+        unsigned int width, unsigned int height, unsigned int stride,   \
+        vec2 location)                                                  \
+{                                                                       \
+    return sample_##format(buffer, width, height, stride, location);    \
+}                                                                       \
+                                                                        \
+vec4 sample_image_buffer_lerp_##format(uint8_t* buffer,                 \
+        FirtreeBufferFormat unused_format,                              \
+        unsigned int width, unsigned int height, unsigned int stride,   \
+        vec2 location)                                                  \
+{                                                                       \
+    vec2 offset = {-0.5f, -0.5f};                                       \
+    location += offset;                                                 \
+    int x = (int)(ELEMENT(location, 0));                                \
+    int y = (int)(ELEMENT(location, 1));                                \
+    if(ELEMENT(location, 0) < 0.f) { x--; } /* implement */             \
+    if(ELEMENT(location, 1) < 0.f) { y--; } /* floor()   */             \
+                                                                        \
+    vec4 bl, br, tl, tr;                                                \
+    if((x >= 0) && (x + 1 < (int)width) &&                              \
+            (y >= 0) && (y + 1 < (int)height)) {                        \
+        uint8_t* row0 = buffer + (y * stride) + (x * pix_size);         \
+        uint8_t* row1 = row0 + stride;                                  \
+        bl = unpack_pixel(row0, format);                                \
+        br = unpack_pixel(row0 + pix_size, format);                     \
+        tl = unpack_pixel(row1, format);                                \
+        tr = unpack_pixel(row1 + pix_size, format);                     \
+    } else {                                                            \
+        vec2 bl_loc = { x, y };                                         \
+        vec2 br_loc = { x+1, y };                                       \
+        vec2 tl_loc = { x, y+1 };                                       \
+        vec2 tr_loc = { x+1, y+1 };                                     \
+        bl = sample_##format(buffer, width, height, stride, bl_loc);    \
+        br = sample_##format(buffer, width, height, stride, br_loc);    \
+        tl = sample_##format(buffer, width, height, stride, tl_loc);    \
+        tr = sample_##format(buffer, width, height, stride, tr_loc);    \
+    }                                                                   \
+                                                                        \
+    float lambda_x = ELEMENT(location, 0) - (float)x;                   \
+    float lambda_y = ELEMENT(location, 1) - (float)y;                   \
+                                                                        \
+    vec4 one = { 1, 1, 1, 1 };                                          \
+    vec4 lambda_x_vec = { lambda_x, lambda_x, lambda_x, lambda_x };     \
+    vec4 lambda_y_vec = { lambda_y, lambda_y, lambda_y, lambda_y };     \
+                                                                        \
+    vec4 at = lambda_x_vec * tr + (one - lambda_x_vec) * tl;            \
+    vec4 ab = lambda_x_vec * br + (one - lambda_x_vec) * bl;            \
+                                                                        \
+    return lambda_y_vec * at + (one - lambda_y_vec) * ab;               \
+}
+
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_ARGB32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_ARGB32_PREMULTIPLIED)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_XRGB32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_RGBA32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_RGBA32_PREMULTIPLIED)
+
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_ABGR32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_ABGR32_PREMULTIPLIED)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_XBGR32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_BGRA32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_BGRA32_PREMULTIPLIED)
+
+SPECIALISED_SAMPLE_FUNCTIONS(3, FIRTREE_FORMAT_RGB24)
+SPECIALISED_SAMPLE_FUNCTIONS(3, FIRTREE_FORMAT_BGR24)
+
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_RGBX32)
+SPECIALISED_SAMPLE_FUNCTIONS(4, FIRTREE_FORMAT_BGRX32)
+
+SPECIALISED_SAMPLE_FUNCTIONS(1, FIRTREE_FORMAT_L8)
+
+SPECIALISED_SAMPLE_FUNCTIONS(16, FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED)
+SPECIALISED_SAMPLE_FUNCTIONS(8, FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED)
+SPECIALISED_SAMPLE_FUNCTIONS(8, FIRTREE_FORMAT_RGBA64)
+SPECIALISED_SAMPLE_FUNCTIONS(8, FIRTREE_FORMAT_RGBA64_PREMULTIPLIED)
+
+/* Separable resampling filters. The weights along each axis are computed
+ * once per sample. Each row of the footprint is then reduced with the
+ * horizontal weights before the rows are combined with the vertical weights,
+ * so an n x n filter evaluates 2n weights rather than n^2. The filter is
+ * widened by scale_x and scale_y (see firtree_engine_get_filter_scale()) so
+ * that it covers the footprint of a shrunken output pixel. */
+#define FILTER_BICUBIC      0
+#define FILTER_LANCZOS3     1
+
+/* These must match the limit in firtree_engine_get_filter_scale(). A
+ * Lanczos-3 filter at the maximum scale has 6 * 8 + 1 taps. */
+#define MAX_FILTER_SCALE    8.f
+#define MAX_FILTER_TAPS     64
+
+G_INLINE_FUNC
+int floor_to_int(float v)
+{
+    int i = (int)v; /* rounds towards zero */
+    if(v < (float)i) { i--; }
+    return i;
+}
+
+G_INLINE_FUNC
+unsigned int format_pixel_size(FirtreeBufferFormat format)
+{
+    switch(format) {
+        case FIRTREE_FORMAT_RGB24:
+        case FIRTREE_FORMAT_BGR24:
+            return 3;
+        case FIRTREE_FORMAT_L8:
+            return 1;
+        case FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED:
+            return 16;
+        case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+        case FIRTREE_FORMAT_RGBA64:
+        case FIRTREE_FORMAT_RGBA64_PREMULTIPLIED:
+            return 8;
+        case FIRTREE_FORMAT_I420_FOURCC:
+        case FIRTREE_FORMAT_YV12_FOURCC:
+        case FIRTREE_FORMAT_NV12_FOURCC:
+        case FIRTREE_FORMAT_NV21_FOURCC:
+        case FIRTREE_FORMAT_P010_FOURCC:
+            /* planar */
+            return 0;
+        default:
+            break;
+    }
+    return 4;
+}
+
+G_INLINE_FUNC
+float filter_weight(int filter, float x)
+{
+    if(x < 0.f) { x = -x; }
+
+    if(filter == FILTER_BICUBIC) {
+        /* Keys' cubic convolution kernel with a = -0.5. */
+        if(x < 1.f) { return ((1.5f * x - 2.5f) * x) * x + 1.f; }
+        if(x < 2.f) { return ((-0.5f * x + 2.5f) * x - 4.f) * x + 2.f; }
+        return 0.f;
+    }
+
+    /* Lanczos-3, sinc(x) * sinc(x / 3). */
+    if(x >= 3.f) { return 0.f; }
+    if(x < 1e-5f) { return 1.f; }
+    float px = 3.14159265f * x;
+    return 3.f * sin_f(px) * sin_f(px * (1.f/3.f)) / (px * px);
+}
+
+/* Fill weights with the taps along one axis of a filter centred on centre
+ * which fall within [0, limit). Returns the number of taps and sets *first
+ * to the index of the pixel the first tap applies to. Like the image
+ * resamplers in most toolkits, the weights are normalised over the pixels
+ * inside the image so that edges are not darkened by the transparent
+ * pixels beyond them. */
+G_INLINE_FUNC
+int filter_taps(int filter, float centre, float scale, int limit,
+        int* first, float* weights)
+{
+    float support = ((filter == FILTER_BICUBIC) ? 2.f : 3.f) * scale;
+
+    /* Pixel i has its centre at i + 0.5. */
+    float c = centre - 0.5f;
+    int lo = floor_to_int(c - support) + 1;
+    int hi = floor_to_int(c + support);
+    if(lo < 0) { lo = 0; }
+    if(hi >= limit) { hi = limit - 1; }
+
+    int n = hi - lo + 1;
+    if(n > MAX_FILTER_TAPS) { n = MAX_FILTER_TAPS; }
+
+    float inv_scale = 1.f / scale;
+    float sum = 0.f;
+    int i;
+    for(i=0; i<n; ++i) {
+        float w = filter_weight(filter, ((float)(lo + i) - c) * inv_scale);
+        weights[i] = w;
+        sum += w;
+    }
+
+    if(sum != 0.f) {
+        float norm = 1.f / sum;
+        for(i=0; i<n; ++i) { weights[i] *= norm; }
+    }
+
+    *first = lo;
+    return n;
+}
+
+G_INLINE_FUNC
+vec4 sample_image_buffer_filtered(int filter,
+        uint8_t* buffer,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height, unsigned int stride,
+        float scale_x, float scale_y,
+        vec2 location)
+{
+    vec4 rv = { 0, 0, 0, 0 };
+
+    /* As with the other sampling modes, the image is transparent outside
+     * of its extent. */
+    if((ELEMENT(location, 0) < 0.f) || (ELEMENT(location, 0) >= width) ||
+       (ELEMENT(location, 1) < 0.f) || (ELEMENT(location, 1) >= height)) {
+        return rv;
+    }
+
+    float weights_x[MAX_FILTER_TAPS];
+    float weights_y[MAX_FILTER_TAPS];
+    int x0, y0;
+    int nx = filter_taps(filter, ELEMENT(location, 0), scale_x, width,
+            &x0, weights_x);
+    int ny = filter_taps(filter, ELEMENT(location, 1), scale_y, height,
+            &y0, weights_y);
+
+    unsigned int pix_size = format_pixel_size(format);
+
+    int i, j;
+    for(j=0; j<ny; ++j) {
+        int y = y0 + j;
+        vec4 row = { 0, 0, 0, 0 };
+
+        if(pix_size > 0) {
+            uint8_t* pixel = buffer + (y * stride) + (x0 * pix_size);
+            for(i=0; i<nx; ++i, pixel += pix_size) {
+                float w = weights_x[i];
+                vec4 w_vec = { w, w, w, w };
+                row += w_vec * unpack_pixel(pixel, format);
+            }
+        } else {
+            for(i=0; i<nx; ++i) {
+                float w = weights_x[i];
+                vec4 w_vec = { w, w, w, w };
+                vec2 loc = { (float)(x0 + i) + 0.5f, (float)y + 0.5f };
+                row += w_vec * sample_image_buffer_nn(buffer, format,
+                        width, height, stride, loc);
+            }
+        }
+
+        float w = weights_y[j];
+        vec4 w_vec = { w, w, w, w };
+        rv += w_vec * row;
+    }
+
+    /* The negative lobes of the filters can overshoot. Keep integer sources
+     * within the range they can represent and premultiplied colour within
+     * alpha. Floating point sources may legitimately exceed one. */
+    if((format != FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED) &&
+            (format != FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED)) {
+        float a = ELEMENT(rv, 3);
+        if(a > 1.f) { a = 1.f; }
+        if(a < 0.f) { a = 0.f; }
+        ELEMENT(rv, 3) = a;
+        for(i=0; i<3; ++i) {
+            float v = ELEMENT(rv, i);
+            if(v > a) { v = a; }
+            if(v < 0.f) { v = 0.f; }
+            ELEMENT(rv, i) = v;
+        }
+    }
+
+    return rv;
+}
+
+vec4 sample_image_buffer_bicubic(uint8_t* buffer,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height, unsigned int stride,
+        float scale_x, float scale_y,
+        vec2 location)
+{
+    return sample_image_buffer_filtered(FILTER_BICUBIC, buffer, format,
+            width, height, stride, scale_x, scale_y, location);
+}
+
+vec4 sample_image_buffer_lanczos3(uint8_t* buffer,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height, unsigned int stride,
+        float scale_x, float scale_y,
+        vec2 location)
+{
+    return sample_image_buffer_filtered(FILTER_LANCZOS3, buffer, format,
+            width, height, stride, scale_x, scale_y, location);
+}
+
+#define CACHE_LINE_SIZE         64
+
+/* Hint that the pixel @rows_ahead rows below @location will be sampled
+ * soon. Buffer samplers whose transform maps output rows onto buffer rows
+ * call this before each sample so that the rows needed by the next output
+ * row are fetched while the current one is rendered. The previous sample
+ * along the row was @x_step pixels to the left of @location and so only
+ * the first sample falling within each cache line issues a prefetch. Planar
+ * buffers and pixels outside of the buffer are ignored. */
+void prefetch_image_buffer(uint8_t* buffer,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height, unsigned int stride,
+        int rows_ahead, float x_step, vec2 location)
+{
+    unsigned int pix_size = format_pixel_size(format);
+    int x = floor_to_int(ELEMENT(location, 0));
+    int y = floor_to_int(ELEMENT(location, 1)) + rows_ahead;
+
+    if((pix_size == 0) || (x < 0) || (x >= (int)width) ||
+            (y < 0) || (y >= (int)height)) {
+        return;
+    }
+
+    uintptr_t row = (uintptr_t)(buffer + (y * stride));
+    uintptr_t line = (row + (x * pix_size)) / CACHE_LINE_SIZE;
+
+    int prev_x = floor_to_int(ELEMENT(location, 0) - x_step);
+    if((prev_x >= 0) && (prev_x < (int)width) &&
+            (((row + (prev_x * pix_size)) / CACHE_LINE_SIZE) == line)) {
+        return;
+    }
+
+    __builtin_prefetch((void*)(line * CACHE_LINE_SIZE), 0, 3);
+}
+
+/* Tiled image sampling. Pixels are copied out of a FirtreeTiledFileSampler's
+ * tile cache a 2x2 block at a time so that no pointer into a tile outlives
+ * the reference which stops the tile from being unmapped. Pixel (i,j) of the
+ * block is stored at block + (j * TILED_BLOCK_STRIDE) + (i * pixel size).
+ * Pixels outside of the image are left untouched. */
+#define TILED_BLOCK_STRIDE 32
+
+extern void firtree_tiled_file_sampler_fetch_block(void* handle,
+        int x, int y, uint8_t* block);
+
+vec4 sample_tiled_image_nn(void* handle,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height,
+        vec2 location)
+{
+    vec4 rv = { 0, 0, 0, 0 };
+    int x = (int)(ELEMENT(location, 0));
+    int y = (int)(ELEMENT(location, 1));
+    if(ELEMENT(location, 0) < 0.f) { x--; } /* implement */
+    if(ELEMENT(location, 1) < 0.f) { y--; } /* floor()   */
+    if((x < 0) || (x >= width)) { return rv; }
+    if((y < 0) || (y >= height)) { return rv; }
+
+    uint8_t block[2 * TILED_BLOCK_STRIDE];
+    firtree_tiled_file_sampler_fetch_block(handle, x, y, block);
+
+    vec2 origin = { 0, 0 };
+    return sample_image_buffer_nn(block, format, 1, 1,
+            TILED_BLOCK_STRIDE, origin);
+}
+
+vec4 sample_tiled_image_lerp(void* handle,
+        FirtreeBufferFormat format,
+        unsigned int width, unsigned int height,
+        vec2 location)
+{
+    vec4 zero = { 0, 0, 0, 0 };
+    vec2 offset = {-0.5f, -0.5f};
+    location += offset;
+    int x = (int)(ELEMENT(location, 0)); /* default rounding is */
+    int y = (int)(ELEMENT(location, 1)); /* towards zero        */
+
+    /* Correct rounding to rounding down. */
+    if(ELEMENT(location, 0) < 0.f) { x--; }
+    if(ELEMENT(location, 1) < 0.f) { y--; }
+
+    if((x < -1) || (x >= (int)width)) { return zero; }
+    if((y < -1) || (y >= (int)height)) { return zero; }
+
+    uint8_t block[2 * TILED_BLOCK_STRIDE];
+    firtree_tiled_file_sampler_fetch_block(handle, x, y, block);
+
+    /* Only sample those pixels of the block which lie within the image. */
+    int left = (x >= 0);
+    int right = (x + 1 < (int)width);
+    int bottom = (y >= 0);
+    int top = (y + 1 < (int)height);
+
+    vec2 bl_loc = { 0, 0 };
+    vec4 bl = (left && bottom) ? sample_image_buffer_nn(block, format,
+            2, 2, TILED_BLOCK_STRIDE, bl_loc) : zero;
+    vec2 br_loc = { 1, 0 };
+    vec4 br = (right && bottom) ? sample_image_buffer_nn(block, format,
+            2, 2, TILED_BLOCK_STRIDE, br_loc) : zero;
+    vec2 tl_loc = { 0, 1 };
+    vec4 tl = (left && top) ? sample_image_buffer_nn(block, format,
+            2, 2, TILED_BLOCK_STRIDE, tl_loc) : zero;
+    vec2 tr_loc = { 1, 1 };
+    vec4 tr = (right && top) ? sample_image_buffer_nn(block, format,
+            2, 2, TILED_BLOCK_STRIDE, tr_loc) : zero;
+
+    float lambda_x = ELEMENT(location, 0) - (float)x;
+    float lambda_y = ELEMENT(location, 1) - (float)y;
+
+    vec4 one = { 1, 1, 1, 1 };
+    vec4 lambda_x_vec = { lambda_x, lambda_x, lambda_x, lambda_x };
+    vec4 lambda_y_vec = { lambda_y, lambda_y, lambda_y, lambda_y };
+
+    vec4 at = lambda_x_vec * tr + (one - lambda_x_vec) * tl;
+    vec4 ab = lambda_x_vec * br + (one - lambda_x_vec) * bl;
+
+    vec4 rv = lambda_y_vec * at + (one - lambda_y_vec) * ab;
+
+    return rv;
+}
+
+/* Combine the premultiplied sample @s with the premultiplied existing
+ * contents @d of the buffer according to the FirtreeRenderMode @mode. @sa
+ * and @da are the alphas of @s and @d. Each lane is combined separately so
+ * that this serves for a whole RGBA pixel, with the alphas splatted across
+ * the vector, as well as for one component of four pixels. @mode is always
+ * a constant and so all but one case is optimised away. Sums are not
+ * clamped here so that floating point targets keep values above 1. */
+G_INLINE_FUNC
+vec4 composite_v4(vec4 s, vec4 d, vec4 sa, vec4 da, int mode)
+{
+    vec4 one = splat(1.f);
+
+    switch(mode) {
+        case FIRTREE_RENDER_MODE_REPLACE:
+            return s;
+        case FIRTREE_RENDER_MODE_ADD:
+            return s + d;
+        case FIRTREE_RENDER_MODE_MULTIPLY:
+            return (s * d) + (s * (one - da)) + (d * (one - sa));
+        case FIRTREE_RENDER_MODE_SCREEN:
+            return s + d - (s * d);
+        default:
+            /* FIRTREE_RENDER_MODE_OVER */
+            return s + ((one - sa) * d);
+    }
+}
+
+/* Return non-zero if @format stores 8-bit components. These wrap rather
+ * than saturate in pack_pixel() and so must be clamped first when a result
+ * may exceed 1. */
+G_INLINE_FUNC
+int format_is_8bit(FirtreeBufferFormat format)
+{
+    switch(format) {
+        case FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED:
+        case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+        case FIRTREE_FORMAT_RGBA64:
+        case FIRTREE_FORMAT_RGBA64_PREMULTIPLIED:
+            return 0;
+        default:
+            break;
+    }
+    return 1;
+}
+
+/* Rows at least this long are written with non-temporal stores in
+ * FIRTREE_RENDER_MODE_REPLACE. Such targets are several megabytes at any
+ * useful height and would only evict the samplers' inputs from the cache. */
+#define STREAM_MIN_ROW_BYTES    8192
+
+/* Return non-zero if a pixel of size @pix_size may be written with
+ * stream_pixel(). */
+G_INLINE_FUNC
+int can_stream_pixel(unsigned int pix_size)
+{
+#if defined(__SSE2__)
+    return (pix_size == 4) || (pix_size == 16);
+#else
+    return 0;
+#endif
+}
+
+/* As pack_pixel() but bypassing the cache. @p must be aligned to
+ * @pix_size. */
+G_INLINE_FUNC
+void stream_pixel(vec4 pixel, void* p, FirtreeBufferFormat format,
+        unsigned int pix_size)
+{
+#if defined(__SSE2__)
+    if(pix_size == 4) {
+        uint32_t word;
+        pack_pixel(pixel, &word, format);
+        __builtin_ia32_movnti((int*)p, (int)word);
+        return;
+    }
+    if(pix_size == 16) {
+        /* FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED is stored as is. */
+        __builtin_ia32_movntps((float*)p, pixel);
+        return;
+    }
+#endif
+    pack_pixel(pixel, p, format);
+}
+
+/* Order the non-temporal stores before whatever signals the end of the
+ * render to other threads. */
+G_INLINE_FUNC
+void stream_fence(void)
+{
+#if defined(__SSE2__)
+    __builtin_ia32_sfence();
+#endif
+}
+
+/* Macros to make writing rendering functions easier. There is a function
+ * for each format and FirtreeRenderMode. In FIRTREE_RENDER_MODE_REPLACE,
+ * which is also used for opaque samplers, the buffer is only written to.
+ * The whole cache lines of long rows are then streamed to memory. The
+ * partial lines at either end are written normally so that the
+ * write-combining buffers only ever flush complete lines. The
+ * render_replace_cached_*() functions never stream so that the rows they
+ * write stay in cache for reductions run over them straight afterwards. */
+#define RENDER_LOOP(name, pix_size, format, mode, may_stream)           \
+void name(unsigned char* buffer,                                        \
         unsigned int width, unsigned int height,                        \
         unsigned int row_stride, float* extents)                        \
 {                                                                       \
@@ -469,24 +1226,62 @@ void render_##format(unsigned char* buffer,                             \
     float y = extents[1];                                               \
     float dx = extents[2] / (float)width;                               \
     float dy = extents[3] / (float)height;                              \
+    int stream = may_stream && (mode == FIRTREE_RENDER_MODE_REPLACE) && \
+        can_stream_pixel(pix_size) &&                                   \
+        (width * pix_size >= STREAM_MIN_ROW_BYTES);                     \
     start_x += 0.5f*dx; y += 0.5f*dy;                                   \
     for(row=0; row<height; ++row, y+=dy) {                              \
         unsigned char* pixel = buffer + (row * row_stride);             \
+        unsigned char* stream_start = pixel;                            \
+        unsigned char* stream_end = pixel;                              \
+        if(stream && (((uintptr_t)pixel % pix_size) == 0)) {            \
+            uintptr_t end = (uintptr_t)(pixel + (width * pix_size));    \
+            stream_start = (unsigned char*)(((uintptr_t)pixel +         \
+                        CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1)); \
+            stream_end = (unsigned char*)(end & ~(CACHE_LINE_SIZE - 1));\
+        }                                                               \
         float x = start_x;                                              \
         for(col=0; col<width; ++col, pixel+=pix_size, x+=dx) {          \
-            vec4 in_vec = unpack_pixel(pixel, format);                  \
             vec2 dest_coord = {x, y};                                   \
             vec4 sample_vec = sampler_render_function(dest_coord);      \
-            float one_minus_alpha = 1.f - ELEMENT(sample_vec, 3);       \
-            vec4 one_minus_alpha_vec = {                                \
-                one_minus_alpha, one_minus_alpha,                       \
-                one_minus_alpha, one_minus_alpha };                     \
-            vec4 out_vec = sample_vec + one_minus_alpha_vec * in_vec;   \
+            if(mode == FIRTREE_RENDER_MODE_REPLACE) {                   \
+                if((pixel >= stream_start) && (pixel < stream_end)) {   \
+                    stream_pixel(sample_vec, pixel, format, pix_size);  \
+                } else {                                                \
+                    pack_pixel(sample_vec, pixel, format);              \
+                }                                                       \
+                continue;                                               \
+            }                                                           \
+            vec4 in_vec = unpack_pixel(pixel, format);                  \
+            vec4 out_vec = composite_v4(sample_vec, in_vec,             \
+                    splat(ELEMENT(sample_vec, 3)),                      \
+                    splat(ELEMENT(in_vec, 3)), mode);                   \
+            if((mode == FIRTREE_RENDER_MODE_ADD) &&                     \
+                    format_is_8bit(format)) {                           \
+                out_vec = clamp_unit_v4(out_vec);                       \
+            }                                                           \
             pack_pixel(out_vec, pixel, format);                         \
         }                                                               \
     }                                                                   \
+    if(stream) {                                                        \
+        stream_fence();                                                 \
+    }                                                                   \
 }                                                                       \
 
+#define RENDER_FUNCTION(pix_size, format)                               \
+RENDER_LOOP(render_##format, pix_size, format,                          \
+        FIRTREE_RENDER_MODE_OVER, 0)                                    \
+RENDER_LOOP(render_replace_##format, pix_size, format,                  \
+        FIRTREE_RENDER_MODE_REPLACE, 1)                                 \
+RENDER_LOOP(render_replace_cached_##format, pix_size, format,           \
+        FIRTREE_RENDER_MODE_REPLACE, 0)                                 \
+RENDER_LOOP(render_add_##format, pix_size, format,                      \
+        FIRTREE_RENDER_MODE_ADD, 0)                                     \
+RENDER_LOOP(render_multiply_##format, pix_size, format,                 \
+        FIRTREE_RENDER_MODE_MULTIPLY, 0)                                \
+RENDER_LOOP(render_screen_##format, pix_size, format,                   \
+        FIRTREE_RENDER_MODE_SCREEN, 0)                                  \
+
 RENDER_FUNCTION(4, FIRTREE_FORMAT_ARGB32)
 RENDER_FUNCTION(4, FIRTREE_FORMAT_ARGB32_PREMULTIPLIED)
 RENDER_FUNCTION(4, FIRTREE_FORMAT_XRGB32)
@@ -506,15 +1301,176 @@ RENDER_FUNCTION(4, FIRTREE_FORMAT_RGBX32)
 RENDER_FUNCTION(4, FIRTREE_FORMAT_BGRX32)
 
 RENDER_FUNCTION(16, FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED)
+RENDER_FUNCTION(8, FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED)
+RENDER_FUNCTION(8, FIRTREE_FORMAT_RGBA64)
+RENDER_FUNCTION(8, FIRTREE_FORMAT_RGBA64_PREMULTIPLIED)
+
+/* Rendering into 4:2:0 YCbCr formats. Since the image is split into slices
+ * and the chroma planes are not at a fixed offset from the luma rows of a
+ * slice, the buffer argument of these render functions points to a
+ * RenderPlanes structure giving the first row of each plane for the slice.
+ * This must match FirtreeCpuJitPlanes in firtree-cpu-jit.hh. The chroma
+ * planes share a stride and successive chroma samples are chroma_step bytes
+ * apart so that the planar and semi-planar formats differ only in the
+ * plane pointers and step.
+ *
+ * Each 2x2 quad of pixels is rendered together, one pixel per vector lane,
+ * so that the colour conversion for the four pixels is vectorised and the
+ * shared chroma sample is computed from their average colour. The width and
+ * height of the slice must be even. Nothing is streamed so the
+ * render_replace_cached_*() functions are the same as render_replace_*(). */
+typedef struct {
+    unsigned char*  planes[3];      /* Y, Cb, Cr */
+    unsigned int    strides[3];
+} RenderPlanes;
+
+G_INLINE_FUNC
+float sum_v4(vec4 v)
+{
+    return ELEMENT(v, 0) + ELEMENT(v, 1) + ELEMENT(v, 2) + ELEMENT(v, 3);
+}
+
+G_INLINE_FUNC
+void render_ycbcr_quad(uint8_t* luma0, uint8_t* luma1,
+        uint8_t* cb_p, uint8_t* cr_p, unsigned int sample_size,
+        float x, float y, float dx, float dy, int mode)
+{
+    /* Existing contents, which the samples are composited with. When
+     * replacing them they are never read. */
+    vec4 r = splat(0.f), g = splat(0.f), b = splat(0.f);
+    if(mode != FIRTREE_RENDER_MODE_REPLACE) {
+        vec4 luma = {
+            load_ycbcr_sample(luma0, sample_size),
+            load_ycbcr_sample(luma0 + sample_size, sample_size),
+            load_ycbcr_sample(luma1, sample_size),
+            load_ycbcr_sample(luma1 + sample_size, sample_size) };
+        float cb = load_ycbcr_sample(cb_p, sample_size) - 128.f;
+        float cr = load_ycbcr_sample(cr_p, sample_size) - 128.f;
+
+        vec4 inv_255 = splat(1.f/255.f);
+        vec4 l = splat(1.164f) * (luma - splat(16.f));
+        r = clamp_unit_v4((l + splat(1.596f * cr)) * inv_255);
+        g = clamp_unit_v4((l - splat(0.813f * cr + 0.391f * cb)) * inv_255);
+        b = clamp_unit_v4((l + splat(2.018f * cb)) * inv_255);
+    }
+
+    vec2 c0 = { x, y };
+    vec2 c1 = { x + dx, y };
+    vec2 c2 = { x, y + dy };
+    vec2 c3 = { x + dx, y + dy };
+    vec4 s0 = sampler_render_function(c0);
+    vec4 s1 = sampler_render_function(c1);
+    vec4 s2 = sampler_render_function(c2);
+    vec4 s3 = sampler_render_function(c3);
+
+    vec4 s_r = { ELEMENT(s0, 0), ELEMENT(s1, 0), ELEMENT(s2, 0), ELEMENT(s3, 0) };
+    vec4 s_g = { ELEMENT(s0, 1), ELEMENT(s1, 1), ELEMENT(s2, 1), ELEMENT(s3, 1) };
+    vec4 s_b = { ELEMENT(s0, 2), ELEMENT(s1, 2), ELEMENT(s2, 2), ELEMENT(s3, 2) };
+    vec4 s_a = { ELEMENT(s0, 3), ELEMENT(s1, 3), ELEMENT(s2, 3), ELEMENT(s3, 3) };
+
+    /* The existing contents are opaque. */
+    vec4 d_a = splat(1.f);
+    r = clamp_unit_v4(composite_v4(s_r, r, s_a, d_a, mode));
+    g = clamp_unit_v4(composite_v4(s_g, g, s_a, d_a, mode));
+    b = clamp_unit_v4(composite_v4(s_b, b, s_a, d_a, mode));
+
+    vec4 y_out = splat(16.f) + splat(65.481f) * r + splat(128.553f) * g +
+        splat(24.966f) * b;
+    store_ycbcr_sample(luma0, sample_size, ELEMENT(y_out, 0));
+    store_ycbcr_sample(luma0 + sample_size, sample_size, ELEMENT(y_out, 1));
+    store_ycbcr_sample(luma1, sample_size, ELEMENT(y_out, 2));
+    store_ycbcr_sample(luma1 + sample_size, sample_size, ELEMENT(y_out, 3));
+
+    float r_avg = 0.25f * sum_v4(r);
+    float g_avg = 0.25f * sum_v4(g);
+    float b_avg = 0.25f * sum_v4(b);
+    store_ycbcr_sample(cb_p, sample_size,
+            128.f - 37.797f * r_avg - 74.203f * g_avg + 112.f * b_avg);
+    store_ycbcr_sample(cr_p, sample_size,
+            128.f + 112.f * r_avg - 93.786f * g_avg - 18.214f * b_avg);
+}
+
+#define RENDER_YCBCR_LOOP(name, sample_size, chroma_step, mode)        \
+void name(unsigned char* buffer,                                        \
+        unsigned int width, unsigned int height,                        \
+        unsigned int row_stride, float* extents)                        \
+{                                                                       \
+    RenderPlanes* planes = (RenderPlanes*)buffer;                       \
+    unsigned int row, col;                                              \
+    float start_x = extents[0];                                         \
+    float y = extents[1];                                               \
+    float dx = extents[2] / (float)width;                               \
+    float dy = extents[3] / (float)height;                              \
+    start_x += 0.5f*dx; y += 0.5f*dy;                                   \
+    for(row=0; row<height; row+=2, y+=2.f*dy) {                         \
+        uint8_t* luma0 = planes->planes[0] + (row * planes->strides[0]); \
+        uint8_t* luma1 = luma0 + planes->strides[0];                    \
+        uint8_t* cb = planes->planes[1] + ((row>>1) * planes->strides[1]); \
+        uint8_t* cr = planes->planes[2] + ((row>>1) * planes->strides[2]); \
+        float x = start_x;                                              \
+        for(col=0; col<width; col+=2, x+=2.f*dx,                        \
+                luma0+=2*sample_size, luma1+=2*sample_size,             \
+                cb+=chroma_step, cr+=chroma_step) {                     \
+            render_ycbcr_quad(luma0, luma1, cb, cr, sample_size,        \
+                    x, y, dx, dy, mode);                                \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+
+#define RENDER_YCBCR_FUNCTION(sample_size, chroma_step, format)        \
+RENDER_YCBCR_LOOP(render_##format, sample_size, chroma_step,            \
+        FIRTREE_RENDER_MODE_OVER)                                       \
+RENDER_YCBCR_LOOP(render_replace_##format, sample_size, chroma_step,    \
+        FIRTREE_RENDER_MODE_REPLACE)                                    \
+RENDER_YCBCR_LOOP(render_replace_cached_##format, sample_size,          \
+        chroma_step, FIRTREE_RENDER_MODE_REPLACE)                       \
+RENDER_YCBCR_LOOP(render_add_##format, sample_size, chroma_step,        \
+        FIRTREE_RENDER_MODE_ADD)                                        \
+RENDER_YCBCR_LOOP(render_multiply_##format, sample_size, chroma_step,   \
+        FIRTREE_RENDER_MODE_MULTIPLY)                                   \
+RENDER_YCBCR_LOOP(render_screen_##format, sample_size, chroma_step,     \
+        FIRTREE_RENDER_MODE_SCREEN)                                     \
+
+RENDER_YCBCR_FUNCTION(1, 1, FIRTREE_FORMAT_I420_FOURCC)
+RENDER_YCBCR_FUNCTION(1, 1, FIRTREE_FORMAT_YV12_FOURCC)
+RENDER_YCBCR_FUNCTION(1, 2, FIRTREE_FORMAT_NV12_FOURCC)
+RENDER_YCBCR_FUNCTION(1, 2, FIRTREE_FORMAT_NV21_FOURCC)
+RENDER_YCBCR_FUNCTION(2, 4, FIRTREE_FORMAT_P010_FOURCC)
 
 /* This is the function that performs a reduction. */
 
 extern void sampler_reduce_function(vec2 dest_coord);
 
-FirtreeLockFreeSet* g_reduce_output;
+/* These are implemented by the engine. The output set is per-thread so
+ * that slices of a reduction may be written to different sets. When the
+ * emit_*() calls are inlined into reduce(), the JIT rewrites them to add to
+ * reduce()'s output directly and the per-thread set is not consulted. */
+extern void firtree_cpu_common_set_reduce_output(FirtreeLockFreeSet* output);
+extern void firtree_cpu_common_reduce_emit(void* element);
+
+/* The emit() builtins. Each stores only as many bytes as its type needs. The
+ * reduce engine ensures that the output set's element size matches. */
+
+extern void emit_f(float val) {
+    firtree_cpu_common_reduce_emit(&val);
+}
+
+extern void emit_i(int32_t val) {
+    firtree_cpu_common_reduce_emit(&val);
+}
+
+extern void emit_v2(vec2 val) {
+    float packed[2] = { ELEMENT(val, 0), ELEMENT(val, 1) };
+    firtree_cpu_common_reduce_emit(packed);
+}
+
+extern void emit_v3(vec4 val) {
+    float packed[3] = { ELEMENT(val, 0), ELEMENT(val, 1), ELEMENT(val, 2) };
+    firtree_cpu_common_reduce_emit(packed);
+}
 
 extern void emit_v4(vec4 val) {
-    firtree_lock_free_set_add_element(g_reduce_output, &val);
+    firtree_cpu_common_reduce_emit(&val);
 }
 
 void reduce(FirtreeLockFreeSet* output, unsigned int width,
@@ -526,9 +1482,13 @@ void reduce(FirtreeLockFreeSet* output, unsigned int width,
     float dx = extents[2] / (float)width;
     float dy = extents[3] / (float)height;
     start_x += 0.5f*dx; y += 0.5f*dy;
-    g_reduce_output = output;
+    firtree_cpu_common_set_reduce_output(output);
     for(row=0; row<height; ++row, y+=dy) {
         float x = start_x;
+        /* Stop early if the output can accept no more elements. */
+        if(firtree_lock_free_set_is_full(output)) {
+            return;
+        }
         for(col=0; col<width; ++col, x+=dx) {
             vec2 dest_coord = {x, y};
             sampler_reduce_function(dest_coord);
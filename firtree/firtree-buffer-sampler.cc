@@ -32,9 +32,11 @@
 #include <firtree/firtree.h>
 
 #include "internal/firtree-engine-intl.hh"
+#include "internal/firtree-image-pyramid-intl.hh"
 #include "internal/firtree-sampler-intl.hh"
 #include "firtree-buffer-sampler.h"
 
+#include <math.h>
 #include <string.h>
 
 /**
@@ -44,6 +46,12 @@
  *
  * A FirtreeBufferSampler is a FirtreeSampler which knows how to sample from
  * a buffer in memory. 
+ *
+ * If firtree_buffer_sampler_set_use_pyramid() is used to enable the image
+ * pyramid, successively half-sized copies of the buffer are built as they
+ * are needed and the one which best matches the scale of the sampler's
+ * transform is sampled from. This makes rendering a shrunken copy of a
+ * large buffer faster and reduces aliasing.
  */
 
 /**
@@ -66,7 +74,7 @@ G_DEFINE_TYPE(FirtreeBufferSampler, firtree_buffer_sampler,
 
 struct _FirtreeBufferSamplerPrivate 
 {
-	gboolean do_interp;
+	FirtreeInterpolationMode interp_mode;
 	 llvm::Function * cached_function;
 	gpointer cached_buffer;
 	guint cached_buffer_len;
@@ -75,6 +83,7 @@ struct _FirtreeBufferSamplerPrivate
 	guint cached_stride;
 	FirtreeBufferFormat cached_format;
 	gboolean free_cached_buffer;
+	FirtreeImagePyramid *pyramid;
 };
 
 llvm::Function *
@@ -111,6 +120,53 @@ _firtree_buffer_sampler_invalidate_llvm_cache(FirtreeBufferSampler * self)
 	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
 }
 
+/* discard any pyramid levels built from the old buffer contents. The
+ * LLVM cache refers to the levels and so is invalidated as well. */
+static void
+_firtree_buffer_sampler_invalidate_pyramid(FirtreeBufferSampler * self)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (p && p->pyramid) {
+		firtree_image_pyramid_reset(p->pyramid);
+		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+	}
+}
+
+/* Called once a new buffer has been set. The sampler function is
+ * re-generated if @invalidate is set or if an image pyramid must be
+ * rebuilt. Otherwise the function still applies but the pixels it reads
+ * have changed, and so ::contents-changed is emitted for caches and dirty
+ * tracking even when the new frame has the same geometry as the last. */
+static void
+_firtree_buffer_sampler_buffer_changed(FirtreeBufferSampler * self,
+				       gboolean invalidate)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (p->pyramid) {
+		firtree_image_pyramid_reset(p->pyramid);
+		invalidate = TRUE;
+	}
+
+	if (invalidate) {
+		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+	} else {
+		firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
+	}
+}
+
+/* the pyramid level depends on the transform so re-generate the sample
+ * function when it changes. */
+static void
+firtree_buffer_sampler_transform_changed(FirtreeSampler * self)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (p && (p->pyramid ||
+		  firtree_engine_interpolation_mode_is_filtered(p->interp_mode))) {
+		_firtree_buffer_sampler_invalidate_llvm_cache
+		    (FIRTREE_BUFFER_SAMPLER(self));
+	}
+}
+
 static void firtree_buffer_sampler_dispose(GObject * object)
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(object);
@@ -130,6 +186,12 @@ static void firtree_buffer_sampler_dispose(GObject * object)
 		p->cached_buffer_len = 0;
 	}
 
+	/* dispose of any pyramid levels */
+	if (p->pyramid) {
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
+
 	G_OBJECT_CLASS(firtree_buffer_sampler_parent_class)->dispose(object);
 }
 
@@ -147,6 +209,8 @@ static void firtree_buffer_sampler_class_init(FirtreeBufferSamplerClass * klass)
 	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
 
 	sampler_class->get_extent = firtree_buffer_sampler_get_extent;
+	sampler_class->transform_changed =
+	    firtree_buffer_sampler_transform_changed;
 
 	sampler_class->intl_vtable = &_firtree_buffer_sampler_class_vtable;
 
@@ -157,11 +221,12 @@ static void firtree_buffer_sampler_class_init(FirtreeBufferSamplerClass * klass)
 static void firtree_buffer_sampler_init(FirtreeBufferSampler * self)
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
-	p->do_interp = FALSE;
+	p->interp_mode = FIRTREE_INTERPOLATION_NEAREST;
 	p->cached_function = NULL;
 	p->cached_buffer = NULL;
 	p->free_cached_buffer = FALSE;
 	p->cached_buffer_len = 0;
+	p->pyramid = NULL;
 }
 
 /**
@@ -192,7 +257,7 @@ gboolean
 firtree_buffer_sampler_get_do_interpolation(FirtreeBufferSampler * self)
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
-	return p->do_interp;
+	return p->interp_mode != FIRTREE_INTERPOLATION_NEAREST;
 }
 
 /**
@@ -201,19 +266,106 @@ firtree_buffer_sampler_get_do_interpolation(FirtreeBufferSampler * self)
  * @do_interp: A flag indicating if interpolation is performed.
  *
  * Set a flag which indicates if the sampler should attempt linear interpolation
- * of the pixel values.
+ * of the pixel values. This selects either FIRTREE_INTERPOLATION_LINEAR or
+ * FIRTREE_INTERPOLATION_NEAREST as the interpolation mode.
  */
 void
 firtree_buffer_sampler_set_do_interpolation(FirtreeBufferSampler * self,
 					    gboolean do_interp)
+{
+	firtree_buffer_sampler_set_interpolation_mode(self, do_interp ?
+	    FIRTREE_INTERPOLATION_LINEAR : FIRTREE_INTERPOLATION_NEAREST);
+}
+
+/**
+ * firtree_buffer_sampler_get_interpolation_mode:
+ * @self:  A FirtreeBufferSampler.
+ *
+ * Get the method used to find values between pixels. See
+ * firtree_buffer_sampler_set_interpolation_mode().
+ *
+ * Returns: The interpolation mode.
+ */
+FirtreeInterpolationMode
+firtree_buffer_sampler_get_interpolation_mode(FirtreeBufferSampler * self)
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
-	if (do_interp != p->do_interp) {
-		p->do_interp = do_interp;
+	return p->interp_mode;
+}
+
+/**
+ * firtree_buffer_sampler_set_interpolation_mode:
+ * @self:  A FirtreeBufferSampler.
+ * @mode: The interpolation mode.
+ *
+ * Set the method used to find values between pixels. The bicubic and
+ * Lanczos modes filter the buffer with a separable kernel which is widened
+ * when the sampler's transform is a pure scale which shrinks the buffer.
+ * Shrinking by more than a factor of eight should be combined with the image
+ * pyramid.
+ */
+void
+firtree_buffer_sampler_set_interpolation_mode(FirtreeBufferSampler * self,
+					      FirtreeInterpolationMode mode)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (mode != p->interp_mode) {
+		p->interp_mode = mode;
 		_firtree_buffer_sampler_invalidate_llvm_cache(self);
 	}
 }
 
+/**
+ * firtree_buffer_sampler_get_use_pyramid:
+ * @self:  A FirtreeBufferSampler.
+ *
+ * Get a flag which indicates if the sampler samples from an image pyramid.
+ * See firtree_buffer_sampler_set_use_pyramid().
+ *
+ * Returns: A flag indicating if an image pyramid is used.
+ */
+gboolean
+firtree_buffer_sampler_get_use_pyramid(FirtreeBufferSampler * self)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	return p->pyramid != NULL;
+}
+
+/**
+ * firtree_buffer_sampler_set_use_pyramid:
+ * @self:  A FirtreeBufferSampler.
+ * @use_pyramid: A flag indicating if an image pyramid is used.
+ *
+ * Set a flag which indicates if the sampler should sample from an image
+ * pyramid. When set, the sampler samples from a copy of the buffer which
+ * has been box-filtered down by a power of two chosen so that one pixel of
+ * the copy is no larger than the area the sampler's transform maps an
+ * output pixel onto. Copies are built the first time they are needed.
+ *
+ * Copies are taken of the buffer contents. If a buffer passed to
+ * firtree_buffer_sampler_set_buffer_no_copy() is modified, it must be passed
+ * again for the modification to be seen.
+ */
+void
+firtree_buffer_sampler_set_use_pyramid(FirtreeBufferSampler * self,
+				       gboolean use_pyramid)
+{
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (use_pyramid == (p->pyramid != NULL)) {
+		return;
+	}
+
+	if (use_pyramid) {
+		p->pyramid = firtree_image_pyramid_new();
+		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+	} else {
+		/* invalidate the cache first since it refers to the levels. */
+		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
+}
+
 /**
  * firtree_buffer_sampler_set_buffer:
  * @self: A FirtreeBufferSampler
@@ -226,6 +378,10 @@ firtree_buffer_sampler_set_do_interpolation(FirtreeBufferSampler * self,
  * Associate an in-memory buffer with this sampler. The buffer must be
  * valid for the lifetime of the sampler or until 
  * firtree_buffer_sampler_set_buffer() is called again. 
+ *
+ * The sampler emits ::contents-changed even if the new buffer has the same
+ * geometry and format as the last, so caching samplers and renderers which
+ * track changes pick up each new frame.
  */
 void
 firtree_buffer_sampler_set_buffer(FirtreeBufferSampler * self,
@@ -234,12 +390,9 @@ firtree_buffer_sampler_set_buffer(FirtreeBufferSampler * self,
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
 
-	guint required_size = height * stride;
-
-	if ((format == FIRTREE_FORMAT_I420_FOURCC) ||
-	    (format == FIRTREE_FORMAT_YV12_FOURCC)) {
-		required_size += (height * stride) >> 1;
-	}
+	guint required_size =
+	    firtree_engine_get_buffer_size(format, height, stride);
+	gboolean invalidate = FALSE;
 
 	if (!p->cached_buffer || (required_size != p->cached_buffer_len)) {
 		/* dispose of any cached buffer */
@@ -255,13 +408,13 @@ firtree_buffer_sampler_set_buffer(FirtreeBufferSampler * self,
 		p->cached_buffer_len = required_size;
 		p->cached_buffer = g_slice_alloc(required_size);
 
-		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+		invalidate = TRUE;
 	}
 
 	/* Also invalidate if the width/height/stride/format has changed. */
 	if ((p->cached_width != width) || (p->cached_height != height) ||
 	    (p->cached_stride != stride) || (p->cached_format != format)) {
-		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+		invalidate = TRUE;
 	}
 
 	p->cached_width = width;
@@ -272,6 +425,8 @@ firtree_buffer_sampler_set_buffer(FirtreeBufferSampler * self,
 
 	/* copy the data */
 	memcpy(p->cached_buffer, buffer, required_size);
+
+	_firtree_buffer_sampler_buffer_changed(self, invalidate);
 }
 
 /**
@@ -297,12 +452,10 @@ firtree_buffer_sampler_set_buffer_no_copy(FirtreeBufferSampler * self,
 {
 	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
 
-	guint required_size = height * stride;
+	guint required_size =
+	    firtree_engine_get_buffer_size(format, height, stride);
 
-	if ((format == FIRTREE_FORMAT_I420_FOURCC) ||
-	    (format == FIRTREE_FORMAT_YV12_FOURCC)) {
-		required_size += (height * stride) >> 1;
-	}
+	gboolean invalidate = FALSE;
 
 	if (p->cached_buffer != buffer) {
 		if (p->cached_buffer) {
@@ -314,13 +467,13 @@ firtree_buffer_sampler_set_buffer_no_copy(FirtreeBufferSampler * self,
 			p->cached_buffer_len = 0;
 		}
 
-		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+		invalidate = TRUE;
 	}
 
 	/* Also invalidate if the width/height/stride/format has changed. */
 	if ((p->cached_width != width) || (p->cached_height != height) ||
 	    (p->cached_stride != stride) || (p->cached_format != format)) {
-		_firtree_buffer_sampler_invalidate_llvm_cache(self);
+		invalidate = TRUE;
 	}
 
 	p->cached_buffer = buffer;
@@ -330,6 +483,8 @@ firtree_buffer_sampler_set_buffer_no_copy(FirtreeBufferSampler * self,
 	p->cached_stride = stride;
 	p->cached_format = format;
 	p->free_cached_buffer = FALSE;
+
+	_firtree_buffer_sampler_buffer_changed(self, invalidate);
 }
 
 /**
@@ -345,6 +500,102 @@ void firtree_buffer_sampler_unset_buffer(FirtreeBufferSampler * self)
 					  FIRTREE_FORMAT_LAST);
 }
 
+/* The widest support of the filtered interpolation modes in pixels. */
+#define MAX_FILTER_RADIUS 3.f
+
+/**
+ * firtree_buffer_sampler_update_region:
+ * @self: A FirtreeBufferSampler
+ * @data: The new pixels or NULL if the buffer has been modified in place.
+ * @x: The column of the top-left pixel of the region.
+ * @y: The row of the top-left pixel of the region.
+ * @width: The width of the region in pixels.
+ * @height: The height of the region in rows.
+ * @stride: The size of one row of @data in bytes.
+ *
+ * Replace a rectangle of the buffer associated with @self by the rows of
+ * @data, which must be in the buffer's format. If @data is NULL, the caller
+ * has already changed those pixels in place, as may be done with a buffer
+ * set via firtree_buffer_sampler_set_buffer_no_copy(). Planar buffers may
+ * only be changed in place.
+ *
+ * Unlike setting the buffer again this does not re-generate the sampler's
+ * function and emits ::region-changed for the region, grown to allow for
+ * interpolation, before ::contents-changed. Renderers which track changed
+ * regions then only re-render the part of their output which the region
+ * affects. If the image pyramid is in use its levels are rebuilt and the
+ * whole sampler is considered changed.
+ */
+void
+firtree_buffer_sampler_update_region(FirtreeBufferSampler * self,
+				     gconstpointer data, guint x, guint y,
+				     guint width, guint height, guint stride)
+{
+	g_return_if_fail(FIRTREE_IS_BUFFER_SAMPLER(self));
+
+	FirtreeBufferSamplerPrivate *p = GET_PRIVATE(self);
+	if (!p->cached_buffer) {
+		return;
+	}
+
+	/* Clip to the buffer. */
+	if ((x >= p->cached_width) || (y >= p->cached_height)) {
+		return;
+	}
+	width = MIN(width, p->cached_width - x);
+	height = MIN(height, p->cached_height - y);
+	if ((width == 0) || (height == 0)) {
+		return;
+	}
+
+	if (data) {
+		guint pixel_size =
+		    firtree_engine_get_buffer_format_pixel_size
+		    (p->cached_format);
+		if (pixel_size == 0) {
+			g_warning("Planar buffers may only be updated in "
+				  "place.");
+			return;
+		}
+
+		guint row;
+		for (row = 0; row < height; ++row) {
+			memcpy((guchar *) p->cached_buffer +
+			       ((y + row) * p->cached_stride) +
+			       (x * pixel_size),
+			       (const guchar *)data + (row * stride),
+			       width * pixel_size);
+		}
+	}
+
+	if (p->pyramid) {
+		_firtree_buffer_sampler_invalidate_pyramid(self);
+		return;
+	}
+
+	FirtreeVec4 region = { x, y, width, height };
+
+	/* The bicubic and Lanczos filters reach several pixels away,
+	 * further when widened by the transform. */
+	if (firtree_engine_interpolation_mode_is_filtered(p->interp_mode)) {
+		FirtreeAffineTransform *transform =
+		    firtree_sampler_get_transform(FIRTREE_SAMPLER(self));
+		float scale_x, scale_y;
+		firtree_engine_get_filter_scale(transform, 0, &scale_x,
+						&scale_y);
+		g_object_unref(transform);
+
+		float radius = MAX_FILTER_RADIUS * MAX(scale_x, scale_y);
+		region.x -= radius;
+		region.y -= radius;
+		region.z += 2.f * radius;
+		region.w += 2.f * radius;
+	}
+
+	firtree_sampler_contents_changed_in_region(FIRTREE_SAMPLER(self),
+						   &region);
+}
+
 llvm::Function *
 firtree_buffer_sampler_get_sample_function(FirtreeSampler * self)
 {
@@ -359,6 +610,10 @@ firtree_buffer_sampler_get_sample_function(FirtreeSampler * self)
 	    (FIRTREE_BUFFER_SAMPLER(self));
 }
 
+/* Buffers smaller than this are assumed to stay in cache and are not
+ * prefetched. */
+#define PREFETCH_MIN_BUFFER_SIZE (1 << 20)
+
 /* Create the sampler function */
 llvm::Function *
 _firtree_buffer_sampler_create_sample_function(FirtreeBufferSampler * self)
@@ -376,6 +631,50 @@ _firtree_buffer_sampler_create_sample_function(FirtreeBufferSampler * self)
 	int stride = p->cached_stride;
 	FirtreeBufferFormat firtree_format = p->cached_format;
 
+	FirtreeAffineTransform *transform =
+	    firtree_sampler_get_transform(FIRTREE_SAMPLER(self));
+
+	/* If the transform shrinks the buffer, sample from a pre-filtered
+	 * level of the pyramid instead. */
+	guint level_index = 0;
+	if (p->pyramid) {
+		FirtreeImagePyramidLevel base =
+		    { data, width, height, stride, firtree_format };
+		FirtreeImagePyramidLevel level;
+
+		level_index =
+		    firtree_image_pyramid_select_level(p->pyramid, transform,
+						       &base, &level);
+
+		data = (unsigned char *)(level.data);
+		width = level.width;
+		height = level.height;
+		stride = level.stride;
+	}
+
+	/* The bicubic and Lanczos filters are widened to match the scale of
+	 * the transform. */
+	float filter_scale_x, filter_scale_y;
+	firtree_engine_get_filter_scale(transform, level_index,
+					&filter_scale_x, &filter_scale_y);
+
+	/* Large buffers whose rows are sampled in order are prefetched a few
+	 * rows ahead. The filters reach too far for this to be worthwhile. */
+	gint prefetch_rows = 0;
+	float prefetch_step = 0.f;
+	if (!firtree_engine_interpolation_mode_is_filtered(p->interp_mode) &&
+	    (firtree_engine_get_buffer_format_pixel_size(firtree_format) > 0)
+	    && ((guint) (height * stride) >= PREFETCH_MIN_BUFFER_SIZE)) {
+		prefetch_rows =
+		    firtree_engine_get_prefetch_rows(transform, level_index);
+
+		/* Successive samples along a row are this many pixels of
+		 * the level apart. */
+		prefetch_step =
+		    transform->m11 * ldexpf(1.f, -(gint) level_index);
+	}
+	g_object_unref(transform);
+
 	_firtree_buffer_sampler_invalidate_llvm_cache(self);
 
 #if FIRTREE_LLVM_AT_LEAST_2_6
@@ -387,8 +686,8 @@ _firtree_buffer_sampler_create_sample_function(FirtreeBufferSampler * self)
 	/* declare the sample_image_buffer() function which will be implemented
 	 * by the engine. */
 	llvm::Function * sample_buffer_func =
-	    firtree_engine_create_sample_image_buffer_prototype(m,
-								p->do_interp);
+	    firtree_engine_create_sample_image_buffer_filtered_prototype
+	    (m, p->interp_mode);
 	g_assert(sample_buffer_func);
 
 	/* declare the sample() function which we shall implement. */
@@ -426,13 +725,47 @@ _firtree_buffer_sampler_create_sample_function(FirtreeBufferSampler * self)
 	llvm::BasicBlock * bb = llvm::BasicBlock::Create("entry", sample_func);
 #endif
 
+	llvm::Value * location = sample_func->arg_begin();
+	if (level_index > 0) {
+		location =
+		    firtree_image_pyramid_create_level_location(m, level_index,
+								location, bb);
+	}
+
+	if (prefetch_rows != 0) {
+		llvm::Function * prefetch_func =
+		    firtree_engine_create_prefetch_image_buffer_prototype(m);
+
+		std::vector < llvm::Value * >prefetch_args;
+		prefetch_args.push_back(llvm_data);
+		prefetch_args.push_back(llvm_format);
+		prefetch_args.push_back(llvm_width);
+		prefetch_args.push_back(llvm_height);
+		prefetch_args.push_back(llvm_stride);
+		prefetch_args.push_back(llvm::ConstantInt::get
+					(FIRTREE_LLVM_INT32_TY,
+					 (int64_t) prefetch_rows, true));
+		prefetch_args.push_back(llvm::ConstantFP::get
+					(FIRTREE_LLVM_FLOAT_TY,
+					 prefetch_step));
+		prefetch_args.push_back(location);
+		llvm::CallInst::Create(prefetch_func, prefetch_args.begin(),
+				       prefetch_args.end(), "", bb);
+	}
+
 	std::vector < llvm::Value * >func_args;
 	func_args.push_back(llvm_data);
 	func_args.push_back(llvm_format);
 	func_args.push_back(llvm_width);
 	func_args.push_back(llvm_height);
 	func_args.push_back(llvm_stride);
-	func_args.push_back(sample_func->arg_begin());
+	if (firtree_engine_interpolation_mode_is_filtered(p->interp_mode)) {
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_x));
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_y));
+	}
+	func_args.push_back(location);
 
 	llvm::Value * ret_val = llvm::CallInst::Create(sample_buffer_func,
 						       func_args.begin(),
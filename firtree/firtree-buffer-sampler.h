@@ -59,6 +59,20 @@ void			 firtree_buffer_sampler_set_do_interpolation
 							(FirtreeBufferSampler 	*self,
 							 gboolean		 do_interp);
 
+FirtreeInterpolationMode firtree_buffer_sampler_get_interpolation_mode
+							(FirtreeBufferSampler 	*self);
+
+void			 firtree_buffer_sampler_set_interpolation_mode
+							(FirtreeBufferSampler 	*self,
+							 FirtreeInterpolationMode mode);
+
+gboolean		 firtree_buffer_sampler_get_use_pyramid
+							(FirtreeBufferSampler 	*self);
+
+void			 firtree_buffer_sampler_set_use_pyramid
+							(FirtreeBufferSampler 	*self,
+							 gboolean		 use_pyramid);
+
 void			 firtree_buffer_sampler_set_buffer
 							(FirtreeBufferSampler 	*self,
 				 			 gpointer		 buffer, 
@@ -78,6 +92,15 @@ void			 firtree_buffer_sampler_set_buffer_no_copy
 void			 firtree_buffer_sampler_unset_buffer
 							(FirtreeBufferSampler * self);
 
+void			 firtree_buffer_sampler_update_region
+							(FirtreeBufferSampler	*self,
+							 gconstpointer		 data,
+							 guint			 x,
+							 guint			 y,
+							 guint			 width,
+							 guint			 height,
+							 guint			 stride);
+
 G_END_DECLS
 
 #endif				/* __FIRTREE_BUFFER_SAMPLER_H__ */
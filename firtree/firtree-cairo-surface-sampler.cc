@@ -29,6 +29,7 @@
 #include <common/uuid.h>
 
 #include "internal/firtree-engine-intl.hh"
+#include "internal/firtree-image-pyramid-intl.hh"
 #include "internal/firtree-sampler-intl.hh"
 #include "firtree-cairo-surface-sampler.h"
 
@@ -43,6 +44,10 @@ G_DEFINE_TYPE(FirtreeCairoSurfaceSampler, firtree_cairo_surface_sampler, FIRTREE
  *
  * A FirtreeCairoSurfaceSampler is a FirtreeSampler which knows how to sample from
  * a Cairo image surface.
+ *
+ * Shrunken renders of large surfaces can be made faster and less aliased by
+ * enabling the image pyramid via
+ * firtree_cairo_surface_sampler_set_use_pyramid().
  */
 
 /**
@@ -61,8 +66,9 @@ G_DEFINE_TYPE(FirtreeCairoSurfaceSampler, firtree_cairo_surface_sampler, FIRTREE
 struct _FirtreeCairoSurfaceSamplerPrivate 
 {
 	cairo_surface_t *cairo_surface;
-	gboolean do_interp;
+	FirtreeInterpolationMode interp_mode;
 	 llvm::Function * cached_function;
+	FirtreeImagePyramid *pyramid;
 };
 
 llvm::Function *
@@ -104,6 +110,19 @@ _firtree_cairo_surface_sampler_invalidate_llvm_cache(FirtreeCairoSurfaceSampler
 	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
 }
 
+/* the pyramid level depends on the transform so re-generate the sample
+ * function when it changes. */
+static void
+firtree_cairo_surface_sampler_transform_changed(FirtreeSampler * self)
+{
+	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
+	if (p && (p->pyramid ||
+		  firtree_engine_interpolation_mode_is_filtered(p->interp_mode))) {
+		_firtree_cairo_surface_sampler_invalidate_llvm_cache
+		    (FIRTREE_CAIRO_SURFACE_SAMPLER(self));
+	}
+}
+
 static void firtree_cairo_surface_sampler_dispose(GObject * object)
 {
 	G_OBJECT_CLASS(firtree_cairo_surface_sampler_parent_class)->dispose
@@ -114,6 +133,13 @@ static void firtree_cairo_surface_sampler_dispose(GObject * object)
 
 	/* dispose of any LLVM modules we might have. */
 	_firtree_cairo_surface_sampler_invalidate_llvm_cache((FirtreeCairoSurfaceSampler *) object);
+
+	/* dispose of any pyramid levels. */
+	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(object);
+	if (p->pyramid) {
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
 }
 
 static FirtreeSamplerIntlVTable _firtree_cairo_surface_sampler_class_vtable;
@@ -133,6 +159,8 @@ firtree_cairo_surface_sampler_class_init(FirtreeCairoSurfaceSamplerClass *
 	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
 
 	sampler_class->get_extent = firtree_cairo_surface_sampler_get_extent;
+	sampler_class->transform_changed =
+	    firtree_cairo_surface_sampler_transform_changed;
 
 	sampler_class->intl_vtable =
 	    &_firtree_cairo_surface_sampler_class_vtable;
@@ -146,8 +174,9 @@ firtree_cairo_surface_sampler_init(FirtreeCairoSurfaceSampler * self)
 {
 	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
 	p->cairo_surface = NULL;
-	p->do_interp = FALSE;
+	p->interp_mode = FIRTREE_INTERPOLATION_NEAREST;
 	p->cached_function = NULL;
+	p->pyramid = NULL;
 }
 
 /**
@@ -195,6 +224,10 @@ firtree_cairo_surface_sampler_set_cairo_surface(FirtreeCairoSurfaceSampler *
 	}
 
 	_firtree_cairo_surface_sampler_invalidate_llvm_cache(self);
+	if (p->pyramid) {
+		firtree_image_pyramid_reset(p->pyramid);
+	}
+
 	firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
 }
 
@@ -233,7 +266,7 @@ firtree_cairo_surface_sampler_get_do_interpolation(FirtreeCairoSurfaceSampler *
 						   self)
 {
 	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
-	return p->do_interp;
+	return p->interp_mode != FIRTREE_INTERPOLATION_NEAREST;
 }
 
 /**
@@ -242,20 +275,110 @@ firtree_cairo_surface_sampler_get_do_interpolation(FirtreeCairoSurfaceSampler *
  * @do_interp: A flag indicating if interpolation is performed.
  *
  * Set a flag which indicates if the sampler should attempt linear interpolation
- * of the pixel values.
+ * of the pixel values. This selects either FIRTREE_INTERPOLATION_LINEAR or
+ * FIRTREE_INTERPOLATION_NEAREST as the interpolation mode.
  */
 void
 firtree_cairo_surface_sampler_set_do_interpolation(FirtreeCairoSurfaceSampler *
 						   self,
 						   gboolean do_interp)
+{
+	firtree_cairo_surface_sampler_set_interpolation_mode(self, do_interp ?
+	    FIRTREE_INTERPOLATION_LINEAR : FIRTREE_INTERPOLATION_NEAREST);
+}
+
+/**
+ * firtree_cairo_surface_sampler_get_interpolation_mode:
+ * @self:  A FirtreeCairoSurfaceSampler.
+ *
+ * Get the method used to find values between pixels. See
+ * firtree_cairo_surface_sampler_set_interpolation_mode().
+ *
+ * Returns: The interpolation mode.
+ */
+FirtreeInterpolationMode
+firtree_cairo_surface_sampler_get_interpolation_mode(FirtreeCairoSurfaceSampler
+						     * self)
+{
+	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
+	return p->interp_mode;
+}
+
+/**
+ * firtree_cairo_surface_sampler_set_interpolation_mode:
+ * @self:  A FirtreeCairoSurfaceSampler.
+ * @mode: The interpolation mode.
+ *
+ * Set the method used to find values between pixels. The bicubic and
+ * Lanczos modes filter the surface with a separable kernel which is widened
+ * when the sampler's transform is a pure scale which shrinks the surface.
+ * Shrinking by more than a factor of eight should be combined with the image
+ * pyramid.
+ */
+void
+firtree_cairo_surface_sampler_set_interpolation_mode(FirtreeCairoSurfaceSampler
+						     * self,
+						     FirtreeInterpolationMode mode)
 {
 	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
-	if (do_interp != p->do_interp) {
-		p->do_interp = do_interp;
+	if (mode != p->interp_mode) {
+		p->interp_mode = mode;
 		_firtree_cairo_surface_sampler_invalidate_llvm_cache(self);
 	}
 }
 
+/**
+ * firtree_cairo_surface_sampler_get_use_pyramid:
+ * @self:  A FirtreeCairoSurfaceSampler.
+ *
+ * Get a flag which indicates if the sampler samples from an image pyramid.
+ * See firtree_cairo_surface_sampler_set_use_pyramid().
+ *
+ * Returns: A flag indicating if an image pyramid is used.
+ */
+gboolean
+firtree_cairo_surface_sampler_get_use_pyramid(FirtreeCairoSurfaceSampler *
+					      self)
+{
+	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
+	return p->pyramid != NULL;
+}
+
+/**
+ * firtree_cairo_surface_sampler_set_use_pyramid:
+ * @self:  A FirtreeCairoSurfaceSampler.
+ * @use_pyramid: A flag indicating if an image pyramid is used.
+ *
+ * Set a flag which indicates if the sampler should sample from an image
+ * pyramid. When set, the sampler samples from a copy of the surface which
+ * has been box-filtered down by a power of two chosen so that one pixel of
+ * the copy is no larger than the area the sampler's transform maps an
+ * output pixel onto. Copies are built the first time they are needed.
+ *
+ * Since copies are taken, the surface must be passed to
+ * firtree_cairo_surface_sampler_set_cairo_surface() again after drawing on
+ * it for the changes to be seen.
+ */
+void
+firtree_cairo_surface_sampler_set_use_pyramid(FirtreeCairoSurfaceSampler *
+					      self, gboolean use_pyramid)
+{
+	FirtreeCairoSurfaceSamplerPrivate *p = GET_PRIVATE(self);
+	if (use_pyramid == (p->pyramid != NULL)) {
+		return;
+	}
+
+	if (use_pyramid) {
+		p->pyramid = firtree_image_pyramid_new();
+		_firtree_cairo_surface_sampler_invalidate_llvm_cache(self);
+	} else {
+		/* invalidate the cache first since it refers to the levels. */
+		_firtree_cairo_surface_sampler_invalidate_llvm_cache(self);
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
+}
+
 llvm::Function *
 firtree_cairo_surface_sampler_get_sample_function(FirtreeSampler * self)
 {
@@ -325,6 +448,36 @@ _firtree_cairo_surface_sampler_create_sample_function(FirtreeCairoSurfaceSampler
 	#error Unknown endianness.
 #endif
 
+	FirtreeAffineTransform *transform =
+	    firtree_sampler_get_transform(FIRTREE_SAMPLER(self));
+
+	/* If the transform shrinks the surface, sample from a pre-filtered
+	 * level of the pyramid instead. */
+	guint level_index = 0;
+	if (p->pyramid) {
+		cairo_surface_flush(p->cairo_surface);
+
+		FirtreeImagePyramidLevel base =
+		    { data, width, height, stride, firtree_format };
+		FirtreeImagePyramidLevel level;
+
+		level_index =
+		    firtree_image_pyramid_select_level(p->pyramid, transform,
+						       &base, &level);
+
+		data = (unsigned char *)(level.data);
+		width = level.width;
+		height = level.height;
+		stride = level.stride;
+	}
+
+	/* The bicubic and Lanczos filters are widened to match the scale of
+	 * the transform. */
+	float filter_scale_x, filter_scale_y;
+	firtree_engine_get_filter_scale(transform, level_index,
+					&filter_scale_x, &filter_scale_y);
+	g_object_unref(transform);
+
 	_firtree_cairo_surface_sampler_invalidate_llvm_cache(self);
 
 #if FIRTREE_LLVM_AT_LEAST_2_6
@@ -337,8 +490,8 @@ _firtree_cairo_surface_sampler_create_sample_function(FirtreeCairoSurfaceSampler
 	/* declare the sample_image_buffer() function which will be implemented
 	 * by the engine. */
 	llvm::Function * sample_buffer_func =
-	    firtree_engine_create_sample_image_buffer_prototype(m,
-								p->do_interp);
+	    firtree_engine_create_sample_image_buffer_filtered_prototype
+	    (m, p->interp_mode);
 	g_assert(sample_buffer_func);
 
 	/* declare the sample() function which we shall implement. */
@@ -372,13 +525,26 @@ _firtree_cairo_surface_sampler_create_sample_function(FirtreeCairoSurfaceSampler
 	llvm::BasicBlock * bb = llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT 
 			"entry", sample_func);
 
+	llvm::Value * location = sample_func->arg_begin();
+	if (level_index > 0) {
+		location =
+		    firtree_image_pyramid_create_level_location(m, level_index,
+								location, bb);
+	}
+
 	std::vector < llvm::Value * >func_args;
 	func_args.push_back(llvm_data);
 	func_args.push_back(llvm_format);
 	func_args.push_back(llvm_width);
 	func_args.push_back(llvm_height);
 	func_args.push_back(llvm_stride);
-	func_args.push_back(sample_func->arg_begin());
+	if (firtree_engine_interpolation_mode_is_filtered(p->interp_mode)) {
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_x));
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_y));
+	}
+	func_args.push_back(location);
 
 	llvm::Value * ret_val = llvm::CallInst::Create(sample_buffer_func,
 						       func_args.begin(),
@@ -70,6 +70,20 @@ void				 firtree_cairo_surface_sampler_set_do_interpolation
 									(FirtreeCairoSurfaceSampler 	*self,
 									 gboolean do_interp);
 
+FirtreeInterpolationMode	 firtree_cairo_surface_sampler_get_interpolation_mode
+									(FirtreeCairoSurfaceSampler 	*self);
+
+void				 firtree_cairo_surface_sampler_set_interpolation_mode
+									(FirtreeCairoSurfaceSampler 	*self,
+									 FirtreeInterpolationMode mode);
+
+gboolean			 firtree_cairo_surface_sampler_get_use_pyramid
+									(FirtreeCairoSurfaceSampler	*self);
+
+void				 firtree_cairo_surface_sampler_set_use_pyramid
+									(FirtreeCairoSurfaceSampler 	*self,
+									 gboolean use_pyramid);
+
 G_END_DECLS
 
 #endif				/* FIRTREE_HAVE_CAIRO */
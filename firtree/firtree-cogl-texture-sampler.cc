@@ -67,12 +67,115 @@ struct _FirtreeCoglTextureSamplerPrivate {
 	ClutterTexture *clutter_texture;
 	 llvm::Function * cached_function;
 
+	gulong pixbuf_change_handler_id;
+
+	/* The readback of the texture referenced by the compiled function.
+	 * It is re-read in place when the texture contents change. */
 	guchar *cached_data;
 	guint cached_data_size;
 	guint cached_data_stride;
+	guint cached_data_width;
+	guint cached_data_height;
 	FirtreeBufferFormat cached_data_format;
+	CoglPixelFormat cached_data_cogl_format;
+
+	/* The number of renders holding the sampler lock. The readback is
+	 * only replaced or released once this drops to zero. */
+	GMutex *render_mutex;
+	GCond *render_cond;
+	guint n_renders;
 };
 
+/* Readback buffers are pooled so that replacing a texture with one of the
+ * same size and format, as happens every frame with video, re-uses memory.
+ * The pool never holds more than this many bytes of free buffers. */
+#define READBACK_POOL_MAX_BYTES (32 << 20)
+
+typedef struct {
+	guchar *data;
+	guint size;
+	FirtreeBufferFormat format;
+} ReadbackBuffer;
+
+G_LOCK_DEFINE_STATIC(_firtree_cogl_texture_sampler_readback_pool);
+static GSList *_firtree_cogl_texture_sampler_readback_pool = NULL;
+static guint _firtree_cogl_texture_sampler_readback_pool_bytes = 0;
+
+static guchar *_firtree_cogl_texture_sampler_readback_alloc(guint size,
+							    FirtreeBufferFormat
+							    format)
+{
+	guchar *rv = NULL;
+
+	G_LOCK(_firtree_cogl_texture_sampler_readback_pool);
+	GSList *i;
+	for (i = _firtree_cogl_texture_sampler_readback_pool; i;
+	     i = g_slist_next(i)) {
+		ReadbackBuffer *entry = (ReadbackBuffer *) i->data;
+		if ((entry->size == size) && (entry->format == format)) {
+			rv = entry->data;
+			_firtree_cogl_texture_sampler_readback_pool_bytes -=
+			    size;
+			_firtree_cogl_texture_sampler_readback_pool =
+			    g_slist_delete_link
+			    (_firtree_cogl_texture_sampler_readback_pool, i);
+			g_slice_free(ReadbackBuffer, entry);
+			break;
+		}
+	}
+	G_UNLOCK(_firtree_cogl_texture_sampler_readback_pool);
+
+	if (!rv) {
+		rv = (guchar *) g_malloc(size);
+	}
+
+	return rv;
+}
+
+static void _firtree_cogl_texture_sampler_readback_free(guchar * data,
+							guint size,
+							FirtreeBufferFormat
+							format)
+{
+	if (!data) {
+		return;
+	}
+
+	G_LOCK(_firtree_cogl_texture_sampler_readback_pool);
+
+	/* Make room by dropping the least recently released buffers. */
+	while (_firtree_cogl_texture_sampler_readback_pool &&
+	       (_firtree_cogl_texture_sampler_readback_pool_bytes + size >
+		READBACK_POOL_MAX_BYTES)) {
+		GSList *last =
+		    g_slist_last(_firtree_cogl_texture_sampler_readback_pool);
+		ReadbackBuffer *entry = (ReadbackBuffer *) last->data;
+		_firtree_cogl_texture_sampler_readback_pool_bytes -=
+		    entry->size;
+		g_free(entry->data);
+		g_slice_free(ReadbackBuffer, entry);
+		_firtree_cogl_texture_sampler_readback_pool =
+		    g_slist_delete_link
+		    (_firtree_cogl_texture_sampler_readback_pool, last);
+	}
+
+	if (size <= READBACK_POOL_MAX_BYTES) {
+		ReadbackBuffer *entry = g_slice_new(ReadbackBuffer);
+		entry->data = data;
+		entry->size = size;
+		entry->format = format;
+		_firtree_cogl_texture_sampler_readback_pool =
+		    g_slist_prepend(_firtree_cogl_texture_sampler_readback_pool,
+				    entry);
+		_firtree_cogl_texture_sampler_readback_pool_bytes += size;
+		data = NULL;
+	}
+
+	G_UNLOCK(_firtree_cogl_texture_sampler_readback_pool);
+
+	g_free(data);
+}
+
 llvm::Function *
 firtree_cogl_texture_sampler_get_sample_function(FirtreeSampler * self);
 
@@ -101,6 +204,21 @@ firtree_cogl_texture_surface_sampler_get_extent(FirtreeSampler * self)
 	return rv;
 }
 
+gboolean firtree_cogl_texture_sampler_lock(FirtreeSampler * self);
+
+void firtree_cogl_texture_sampler_unlock(FirtreeSampler * self);
+
+/* Block until no render is reading the readback. Must be called with
+ * render_mutex held. */
+static void
+_firtree_cogl_texture_sampler_wait_for_renders(FirtreeCoglTextureSamplerPrivate
+					       * p)
+{
+	while (p->n_renders > 0) {
+		g_cond_wait(p->render_cond, p->render_mutex);
+	}
+}
+
 /* invalidate (and release) any cached LLVM modules/functions. This
  * will cause them to be re-generated when ..._get_function() is next
  * called. */
@@ -115,11 +233,18 @@ _firtree_cogl_texture_sampler_invalidate_llvm_cache(FirtreeCoglTextureSampler *
 	}
 
 	if (p && p->cached_data) {
-		g_slice_free1(p->cached_data_size, p->cached_data);
+		g_mutex_lock(p->render_mutex);
+		_firtree_cogl_texture_sampler_wait_for_renders(p);
+		_firtree_cogl_texture_sampler_readback_free(p->cached_data,
+							    p->cached_data_size,
+							    p->cached_data_format);
 		p->cached_data = NULL;
 		p->cached_data_size = 0;
 		p->cached_data_stride = 0;
+		p->cached_data_width = 0;
+		p->cached_data_height = 0;
 		p->cached_data_format = FIRTREE_FORMAT_LAST;
+		g_mutex_unlock(p->render_mutex);
 	}
 
 	firtree_sampler_module_changed(FIRTREE_SAMPLER(self));
@@ -137,6 +262,16 @@ static void firtree_cogl_texture_sampler_dispose(GObject * object)
 	_firtree_cogl_texture_sampler_invalidate_llvm_cache((FirtreeCoglTextureSampler *) object);
 }
 
+static void firtree_cogl_texture_sampler_finalize(GObject * object)
+{
+	FirtreeCoglTextureSamplerPrivate *p = GET_PRIVATE(object);
+	g_mutex_free(p->render_mutex);
+	g_cond_free(p->render_cond);
+
+	G_OBJECT_CLASS(firtree_cogl_texture_sampler_parent_class)->finalize
+	    (object);
+}
+
 static FirtreeSamplerIntlVTable _firtree_cogl_texture_sampler_class_vtable;
 
 static void
@@ -148,12 +283,15 @@ firtree_cogl_texture_sampler_class_init(FirtreeCoglTextureSamplerClass * klass)
 				 sizeof(FirtreeCoglTextureSamplerPrivate));
 
 	object_class->dispose = firtree_cogl_texture_sampler_dispose;
+	object_class->finalize = firtree_cogl_texture_sampler_finalize;
 
 	/* override the sampler virtual functions with our own */
 	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
 
 	sampler_class->get_extent =
 	    firtree_cogl_texture_surface_sampler_get_extent;
+	sampler_class->lock = firtree_cogl_texture_sampler_lock;
+	sampler_class->unlock = firtree_cogl_texture_sampler_unlock;
 
 	sampler_class->intl_vtable =
 	    &_firtree_cogl_texture_sampler_class_vtable;
@@ -168,10 +306,17 @@ static void firtree_cogl_texture_sampler_init(FirtreeCoglTextureSampler * self)
 	p->cogl_texture = NULL;
 	p->clutter_texture = NULL;
 	p->cached_function = NULL;
+	p->pixbuf_change_handler_id = 0;
 	p->cached_data = NULL;
 	p->cached_data_size = 0;
 	p->cached_data_stride = 0;
+	p->cached_data_width = 0;
+	p->cached_data_height = 0;
 	p->cached_data_format = FIRTREE_FORMAT_LAST;
+	p->cached_data_cogl_format = COGL_PIXEL_FORMAT_ANY;
+	p->render_mutex = g_mutex_new();
+	p->render_cond = g_cond_new();
+	p->n_renders = 0;
 }
 
 /**
@@ -189,6 +334,13 @@ FirtreeCoglTextureSampler *firtree_cogl_texture_sampler_new(void)
 	    g_object_new(FIRTREE_TYPE_COGL_TEXTURE_SAMPLER, NULL);
 }
 
+static void
+_firtree_cogl_texture_sampler_pixbuf_change_cb(ClutterTexture * texture,
+					       FirtreeCoglTextureSampler * self)
+{
+	firtree_cogl_texture_sampler_update_contents(self);
+}
+
 /**
  * firtree_cogl_texture_sampler_set_cogl_texture:
  * @self: A FirtreeCoglTextureSampler.
@@ -213,6 +365,8 @@ firtree_cogl_texture_sampler_set_cogl_texture(FirtreeCoglTextureSampler * self,
 	}
 
 	if (p->clutter_texture) {
+		g_signal_handler_disconnect(p->clutter_texture,
+					    p->pixbuf_change_handler_id);
 		g_object_unref(p->clutter_texture);
 		p->clutter_texture = NULL;
 	}
@@ -277,6 +431,8 @@ void firtree_cogl_texture_sampler_set_clutter_texture(FirtreeCoglTextureSampler
 	}
 
 	if (p->clutter_texture) {
+		g_signal_handler_disconnect(p->clutter_texture,
+					    p->pixbuf_change_handler_id);
 		g_object_unref(p->clutter_texture);
 		p->clutter_texture = NULL;
 	}
@@ -284,6 +440,13 @@ void firtree_cogl_texture_sampler_set_clutter_texture(FirtreeCoglTextureSampler
 	if (texture) {
 		g_object_ref(texture);
 		p->clutter_texture = texture;
+
+		/* Re-read the texture in place when its image is replaced. */
+		p->pixbuf_change_handler_id =
+		    g_signal_connect(texture, "pixbuf-change",
+				     G_CALLBACK
+				     (_firtree_cogl_texture_sampler_pixbuf_change_cb),
+				     self);
 	}
 
 	_firtree_cogl_texture_sampler_invalidate_llvm_cache(self);
@@ -312,6 +475,50 @@ ClutterTexture
 	return p->clutter_texture;
 }
 
+/* Find the format in which to read back @texture and the corresponding
+ * Firtree buffer format and row stride. */
+static void
+_firtree_cogl_texture_sampler_get_readback_format(CoglHandle texture,
+						  CoglPixelFormat * format,
+						  FirtreeBufferFormat *
+						  firtree_format,
+						  guint * stride)
+{
+	*format = cogl_texture_get_format(texture);
+	*stride = cogl_texture_get_rowstride(texture);
+
+	/* FIXME: This implicitly assumes a little-endian machine. */
+
+	switch (*format) {
+	case COGL_PIXEL_FORMAT_BGRA_8888:
+		*firtree_format = FIRTREE_FORMAT_BGRA32;
+		break;
+	case COGL_PIXEL_FORMAT_BGRA_8888_PRE:
+		*firtree_format = FIRTREE_FORMAT_BGRA32_PREMULTIPLIED;
+		break;
+	case COGL_PIXEL_FORMAT_RGBA_8888:
+		*firtree_format = FIRTREE_FORMAT_RGBA32;
+		break;
+	case COGL_PIXEL_FORMAT_RGBA_8888_PRE:
+		*firtree_format = FIRTREE_FORMAT_RGBA32_PREMULTIPLIED;
+		break;
+	case COGL_PIXEL_FORMAT_RGB_888:
+		*firtree_format = FIRTREE_FORMAT_RGB24;
+		break;
+	case COGL_PIXEL_FORMAT_BGR_888:
+		*firtree_format = FIRTREE_FORMAT_BGR24;
+		break;
+	default:
+		g_debug
+		    ("Warning, converting Cogl texture format from %i. May be slow.",
+		     *format);
+		*format = COGL_PIXEL_FORMAT_BGRA_8888;
+		*firtree_format = FIRTREE_FORMAT_ARGB32;
+		*stride = 4 * cogl_texture_get_width(texture);
+		break;
+	}
+}
+
 /**
  * firtree_cogl_texture_sampler_get_data:
  * @self: A FirtreeCoglTextureSampler instance.
@@ -352,42 +559,12 @@ firtree_cogl_texture_sampler_get_data(FirtreeCoglTextureSampler * self,
 		return p->cached_data_size;
 	}
 
-	guint width = cogl_texture_get_width(texture);
-	guint stride = cogl_texture_get_rowstride(texture);
-	CoglPixelFormat format = cogl_texture_get_format(texture);
-
+	CoglPixelFormat format = COGL_PIXEL_FORMAT_ANY;
 	FirtreeBufferFormat firtree_format = FIRTREE_FORMAT_LAST;
-
-	/* FIXME: This implicitly assumes a little-endian machine. */
-
-	switch (format) {
-	case COGL_PIXEL_FORMAT_BGRA_8888:
-		firtree_format = FIRTREE_FORMAT_BGRA32;
-		break;
-	case COGL_PIXEL_FORMAT_BGRA_8888_PRE:
-		firtree_format = FIRTREE_FORMAT_BGRA32_PREMULTIPLIED;
-		break;
-	case COGL_PIXEL_FORMAT_RGBA_8888:
-		firtree_format = FIRTREE_FORMAT_RGBA32;
-		break;
-	case COGL_PIXEL_FORMAT_RGBA_8888_PRE:
-		firtree_format = FIRTREE_FORMAT_RGBA32_PREMULTIPLIED;
-		break;
-	case COGL_PIXEL_FORMAT_RGB_888:
-		firtree_format = FIRTREE_FORMAT_RGB24;
-		break;
-	case COGL_PIXEL_FORMAT_BGR_888:
-		firtree_format = FIRTREE_FORMAT_BGR24;
-		break;
-	default:
-		g_debug
-		    ("Warning, converting Cogl texture format from %i. May be slow.",
-		     format);
-		format = COGL_PIXEL_FORMAT_BGRA_8888;
-		firtree_format = FIRTREE_FORMAT_ARGB32;
-		stride = 4 * width;
-		break;
-	}
+	guint stride = 0;
+	_firtree_cogl_texture_sampler_get_readback_format(texture, &format,
+							  &firtree_format,
+							  &stride);
 
 	guint data_size = cogl_texture_get_data(texture,
 						format, stride, NULL);
@@ -408,8 +585,13 @@ firtree_cogl_texture_sampler_get_data(FirtreeCoglTextureSampler * self,
 
 	p->cached_data_size = data_size;
 	p->cached_data_stride = stride;
+	p->cached_data_width = cogl_texture_get_width(texture);
+	p->cached_data_height = cogl_texture_get_height(texture);
 	p->cached_data_format = firtree_format;
-	p->cached_data = (guchar *) g_slice_alloc(p->cached_data_size);
+	p->cached_data_cogl_format = format;
+	p->cached_data =
+	    _firtree_cogl_texture_sampler_readback_alloc(data_size,
+							 firtree_format);
 	cogl_texture_get_data(texture, format, stride, p->cached_data);
 
 	*data = p->cached_data;
@@ -417,6 +599,85 @@ firtree_cogl_texture_sampler_get_data(FirtreeCoglTextureSampler * self,
 	return p->cached_data_size;
 }
 
+/**
+ * firtree_cogl_texture_sampler_update_contents:
+ * @self: A FirtreeCoglTextureSampler.
+ *
+ * Notify @self that the contents of its texture have changed. If the size
+ * and format of the texture are unchanged, the texture is read back into the
+ * same memory as before and renderers need not re-compile their functions.
+ * This first waits for any render reading @self to finish. Otherwise this is
+ * equivalent to setting the texture again.
+ *
+ * This is called automatically when the image of a texture set via
+ * firtree_cogl_texture_sampler_set_clutter_texture() is replaced.
+ */
+void
+firtree_cogl_texture_sampler_update_contents(FirtreeCoglTextureSampler * self)
+{
+	FirtreeCoglTextureSamplerPrivate *p = GET_PRIVATE(self);
+	CoglHandle texture =
+	    firtree_cogl_texture_sampler_get_cogl_texture(self);
+
+	if (!p->cached_data) {
+		/* Nothing has been read back yet. */
+		firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
+		return;
+	}
+
+	CoglPixelFormat format = COGL_PIXEL_FORMAT_ANY;
+	FirtreeBufferFormat firtree_format = FIRTREE_FORMAT_LAST;
+	guint stride = 0;
+	if (texture) {
+		_firtree_cogl_texture_sampler_get_readback_format(texture,
+								  &format,
+								  &firtree_format,
+								  &stride);
+	}
+
+	if (!texture ||
+	    (cogl_texture_get_width(texture) != p->cached_data_width) ||
+	    (cogl_texture_get_height(texture) != p->cached_data_height) ||
+	    (format != p->cached_data_cogl_format) ||
+	    (stride != p->cached_data_stride)) {
+		_firtree_cogl_texture_sampler_invalidate_llvm_cache(self);
+		firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
+		return;
+	}
+
+	/* Renders in flight read the readback directly. */
+	g_mutex_lock(p->render_mutex);
+	_firtree_cogl_texture_sampler_wait_for_renders(p);
+	cogl_texture_get_data(texture, format, stride, p->cached_data);
+	g_mutex_unlock(p->render_mutex);
+
+	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
+}
+
+/* Renders hold the lock while they read the readback. */
+gboolean firtree_cogl_texture_sampler_lock(FirtreeSampler * self)
+{
+	FirtreeCoglTextureSamplerPrivate *p = GET_PRIVATE(self);
+
+	g_mutex_lock(p->render_mutex);
+	++p->n_renders;
+	g_mutex_unlock(p->render_mutex);
+
+	return TRUE;
+}
+
+void firtree_cogl_texture_sampler_unlock(FirtreeSampler * self)
+{
+	FirtreeCoglTextureSamplerPrivate *p = GET_PRIVATE(self);
+
+	g_mutex_lock(p->render_mutex);
+	g_assert(p->n_renders > 0);
+	if (--p->n_renders == 0) {
+		g_cond_broadcast(p->render_cond);
+	}
+	g_mutex_unlock(p->render_mutex);
+}
+
 llvm::Function *
 firtree_cogl_texture_sampler_get_sample_function(FirtreeSampler * self)
 {
@@ -71,6 +71,9 @@ void				 firtree_cogl_texture_sampler_set_clutter_texture
 ClutterTexture 			*firtree_cogl_texture_sampler_get_clutter_texture
 									(FirtreeCoglTextureSampler 	*self);
 
+void				 firtree_cogl_texture_sampler_update_contents
+									(FirtreeCoglTextureSampler 	*self);
+
 G_END_DECLS
 
 #endif				/* FIRTREE_HAVE_CLUTTER */
@@ -40,6 +40,8 @@
 
 #include <firtree/firtree-vector.h>
 
+#include <math.h>
+
 llvm::Function *
 firtree_engine_create_sample_image_buffer_prototype(llvm::Module * module,
 						    gboolean interp)
@@ -96,6 +98,223 @@ firtree_engine_create_sample_cogl_texture_prototype(llvm::Module * module)
 	return f;
 }
 
+llvm::Function *
+firtree_engine_create_sample_image_buffer_filtered_prototype(llvm::Module *
+							     module,
+							     FirtreeInterpolationMode
+							     mode)
+{
+	const char *function_name = NULL;
+
+	switch (mode) {
+	case FIRTREE_INTERPOLATION_BICUBIC:
+		function_name = "sample_image_buffer_bicubic";
+		break;
+	case FIRTREE_INTERPOLATION_LANCZOS3:
+		function_name = "sample_image_buffer_lanczos3";
+		break;
+	default:
+		return firtree_engine_create_sample_image_buffer_prototype
+		    (module, mode == FIRTREE_INTERPOLATION_LINEAR);
+	}
+
+	g_assert(module);
+	if (module->getFunction(function_name) != NULL) {
+		return module->getFunction(function_name);
+	}
+
+	std::vector < const llvm::Type * >params;
+	params.push_back(llvm::PointerType::getUnqual(FIRTREE_LLVM_INT8_TY));	/* buffer */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* format */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* width */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* height */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* stride */
+	params.push_back(FIRTREE_LLVM_FLOAT_TY);	/* scale_x */
+	params.push_back(FIRTREE_LLVM_FLOAT_TY);	/* scale_y */
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* location */
+	llvm::FunctionType * ft = llvm::FunctionType::get(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4),	/* ret. type */
+							  params, false);
+	llvm::Function * f =
+	    llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+				   function_name, module);
+
+	g_assert(f);
+
+	return f;
+}
+
+gboolean
+firtree_engine_interpolation_mode_is_filtered(FirtreeInterpolationMode mode)
+{
+	return (mode == FIRTREE_INTERPOLATION_BICUBIC) ||
+	    (mode == FIRTREE_INTERPOLATION_LANCZOS3);
+}
+
+/* The widest a filter may be stretched. Beyond this the taps per sample
+ * grow too quickly and an image pyramid should be used instead. This must
+ * match MAX_FILTER_SCALE in the CPU engine. */
+#define MAX_FILTER_SCALE 8.f
+
+void
+firtree_engine_get_filter_scale(FirtreeAffineTransform * transform,
+				guint level_index, float *scale_x,
+				float *scale_y)
+{
+	*scale_x = *scale_y = 1.f;
+
+	if (!transform || (transform->m12 != 0.f) || (transform->m21 != 0.f)) {
+		return;
+	}
+
+	/* Pyramid level n has already been shrunk by 2^n. */
+	float level_scale = ldexpf(1.f, -(gint) level_index);
+
+	*scale_x = CLAMP(fabsf(transform->m11) * level_scale, 1.f,
+			 MAX_FILTER_SCALE);
+	*scale_y = CLAMP(fabsf(transform->m22) * level_scale, 1.f,
+			 MAX_FILTER_SCALE);
+}
+
+llvm::Function *
+firtree_engine_create_sample_tiled_image_prototype(llvm::Module * module,
+						   gboolean interp)
+{
+	static const char *nn_function_name = "sample_tiled_image_nn";
+	static const char *interp_function_name = "sample_tiled_image_lerp";
+	const char *function_name =
+	    interp ? interp_function_name : nn_function_name;
+
+	g_assert(module);
+	if (module->getFunction(function_name) != NULL) {
+		return module->getFunction(function_name);
+	}
+
+	std::vector < const llvm::Type * >params;
+	params.push_back(llvm::PointerType::getUnqual(FIRTREE_LLVM_INT8_TY));	/* handle */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* format */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* width */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* height */
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* location */
+	llvm::FunctionType * ft = llvm::FunctionType::get(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4),	/* ret. type */
+							  params, false);
+	llvm::Function * f =
+	    llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+				   function_name, module);
+
+	g_assert(f);
+
+	return f;
+}
+
+llvm::Function *
+firtree_engine_create_prefetch_image_buffer_prototype(llvm::Module * module)
+{
+	static const char *function_name = "prefetch_image_buffer";
+
+	g_assert(module);
+	if (module->getFunction(function_name) != NULL) {
+		return module->getFunction(function_name);
+	}
+
+	std::vector < const llvm::Type * >params;
+	params.push_back(llvm::PointerType::getUnqual(FIRTREE_LLVM_INT8_TY));	/* buffer */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* format */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* width */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* height */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* stride */
+	params.push_back(FIRTREE_LLVM_INT32_TY);	/* rows_ahead */
+	params.push_back(FIRTREE_LLVM_FLOAT_TY);	/* x_step */
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* location */
+	llvm::FunctionType * ft = llvm::FunctionType::get(FIRTREE_LLVM_VOID_TY,	/* ret. type */
+							  params, false);
+	llvm::Function * f =
+	    llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+				   function_name, module);
+
+	g_assert(f);
+
+	return f;
+}
+
+/* Never prefetch further ahead than this. Beyond it the rows are unlikely
+ * to still be in cache when they are sampled. */
+#define MAX_PREFETCH_ROWS 8
+
+gint
+firtree_engine_get_prefetch_rows(FirtreeAffineTransform * transform,
+				 guint level_index)
+{
+	if (!transform || (transform->m12 != 0.f) ||
+	    (transform->m21 != 0.f) || (transform->m22 == 0.f)) {
+		return 0;
+	}
+
+	/* Pyramid level n has already been shrunk by 2^n. */
+	float step = fabsf(transform->m22) * ldexpf(1.f, -(gint) level_index);
+
+	/* The next output row interpolates between the rows 'step' and
+	 * 'step + 1' below the current sample. */
+	gint rows = MIN((gint) ceilf(step) + 1, MAX_PREFETCH_ROWS);
+
+	return (transform->m22 > 0.f) ? rows : -rows;
+}
+
+guint firtree_engine_get_buffer_format_pixel_size(FirtreeBufferFormat format)
+{
+	switch (format) {
+	case FIRTREE_FORMAT_ARGB32:
+	case FIRTREE_FORMAT_ARGB32_PREMULTIPLIED:
+	case FIRTREE_FORMAT_XRGB32:
+	case FIRTREE_FORMAT_RGBA32:
+	case FIRTREE_FORMAT_RGBA32_PREMULTIPLIED:
+	case FIRTREE_FORMAT_ABGR32:
+	case FIRTREE_FORMAT_ABGR32_PREMULTIPLIED:
+	case FIRTREE_FORMAT_XBGR32:
+	case FIRTREE_FORMAT_BGRA32:
+	case FIRTREE_FORMAT_BGRA32_PREMULTIPLIED:
+	case FIRTREE_FORMAT_RGBX32:
+	case FIRTREE_FORMAT_BGRX32:
+		return 4;
+	case FIRTREE_FORMAT_RGB24:
+	case FIRTREE_FORMAT_BGR24:
+		return 3;
+	case FIRTREE_FORMAT_L8:
+		return 1;
+	case FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED:
+		return 16;
+	case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+	case FIRTREE_FORMAT_RGBA64:
+	case FIRTREE_FORMAT_RGBA64_PREMULTIPLIED:
+		return 8;
+	default:
+		/* planar formats do not have a pixel size. */
+		break;
+	}
+	return 0;
+}
+
+guint
+firtree_engine_get_buffer_size(FirtreeBufferFormat format, guint height,
+			       guint stride)
+{
+	guint size = height * stride;
+
+	switch (format) {
+	case FIRTREE_FORMAT_I420_FOURCC:
+	case FIRTREE_FORMAT_YV12_FOURCC:
+	case FIRTREE_FORMAT_NV12_FOURCC:
+	case FIRTREE_FORMAT_NV21_FOURCC:
+	case FIRTREE_FORMAT_P010_FOURCC:
+		/* 4:2:0 chroma planes */
+		size += size >> 1;
+		break;
+	default:
+		break;
+	}
+
+	return size;
+}
+
 llvm::Function *
 firtree_engine_create_sample_function_prototype(llvm::Module * module)
 {
@@ -146,6 +365,314 @@ firtree_engine_create_reduce_function_prototype(llvm::Module * module)
 	return f;
 }
 
+llvm::Function *
+firtree_engine_create_affine_transform_prototype(llvm::Module * module)
+{
+	static const char *function_name = "affine_transform";
+
+	g_assert(module);
+	if (module->getFunction(function_name) != NULL) {
+		return module->getFunction(function_name);
+	}
+
+	std::vector < const llvm::Type * >params;
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* linear */
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* translation */
+	params.push_back(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4));	/* location */
+	llvm::FunctionType * ft = llvm::FunctionType::get(llvm::VectorType::get(FIRTREE_LLVM_FLOAT_TY, 4),	/* ret. type */
+							  params, false);
+	llvm::Function * f =
+	    llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+				   function_name, module);
+
+	g_assert(f);
+
+	/* Allow unused calls to be removed. */
+	f->setDoesNotAccessMemory();
+
+	return f;
+}
+
+static llvm::Constant *_firtree_engine_vec4_constant(float x, float y,
+						     float z, float w)
+{
+	std::vector < llvm::Constant * >vec_vals;
+	vec_vals.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+						 (double)x));
+	vec_vals.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+						 (double)y));
+	vec_vals.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+						 (double)z));
+	vec_vals.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+						 (double)w));
+	return llvm::ConstantVector::get(vec_vals);
+}
+
+/* Extract the elements of a constant 4-vector into @elements. Returns FALSE
+ * if @value is not a constant. */
+static gboolean _firtree_engine_get_vec4_constant(llvm::Value * value,
+						  float *elements)
+{
+	if (llvm::isa < llvm::ConstantAggregateZero > (value)) {
+		elements[0] = elements[1] = elements[2] = elements[3] = 0.f;
+		return TRUE;
+	}
+
+	llvm::ConstantVector * vec =
+	    llvm::dyn_cast < llvm::ConstantVector > (value);
+	if (!vec || (vec->getNumOperands() != 4)) {
+		return FALSE;
+	}
+
+	for (guint i = 0; i < 4; ++i) {
+		llvm::ConstantFP * elem =
+		    llvm::dyn_cast < llvm::ConstantFP > (vec->getOperand(i));
+		if (!elem) {
+			return FALSE;
+		}
+		elements[i] = elem->getValueAPF().convertToFloat();
+	}
+
+	return TRUE;
+}
+
+/* Read the transform passed to a call of affine_transform(). */
+static gboolean
+_firtree_engine_get_affine_transform_call_transform(llvm::CallInst * call,
+						    FirtreeAffineTransform *
+						    transform)
+{
+	float linear[4], translation[4];
+
+	if (!_firtree_engine_get_vec4_constant(call->getOperand(1), linear) ||
+	    !_firtree_engine_get_vec4_constant(call->getOperand(2),
+					       translation)) {
+		return FALSE;
+	}
+
+	firtree_affine_transform_set_elements(transform,
+					      linear[0], linear[2],
+					      linear[1], linear[3],
+					      translation[0], translation[1]);
+
+	return TRUE;
+}
+
+static llvm::Value *
+_firtree_engine_create_affine_transform_call(llvm::Module * module,
+					     FirtreeAffineTransform * transform,
+					     llvm::Value * location,
+					     llvm::Instruction * insert_before,
+					     llvm::BasicBlock * insert_at_end)
+{
+	llvm::Function * affine_func =
+	    firtree_engine_create_affine_transform_prototype(module);
+
+	std::vector < llvm::Value * >args;
+	args.push_back(_firtree_engine_vec4_constant(transform->m11,
+						     transform->m21,
+						     transform->m12,
+						     transform->m22));
+	args.push_back(_firtree_engine_vec4_constant(transform->tx,
+						     transform->ty, 0.f, 0.f));
+	args.push_back(location);
+
+	if (insert_before) {
+		return llvm::CallInst::Create(affine_func, args.begin(),
+					      args.end(), "transformed",
+					      insert_before);
+	}
+
+	return llvm::CallInst::Create(affine_func, args.begin(), args.end(),
+				      "transformed", insert_at_end);
+}
+
+llvm::Value *
+firtree_engine_create_affine_transform_call(llvm::Module * module,
+					    FirtreeAffineTransform * transform,
+					    llvm::Value * location,
+					    llvm::BasicBlock * bb)
+{
+	if (firtree_affine_transform_is_identity(transform)) {
+		return location;
+	}
+
+	return _firtree_engine_create_affine_transform_call(module, transform,
+							    location, NULL,
+							    bb);
+}
+
+namespace Firtree {
+
+char AffineTransformFoldingPass::ID = 0;
+
+bool
+AffineTransformFoldingPass::interestedInCallToFunction(const std::string & name)
+{
+	return (name == "affine_transform");
+}
+
+llvm::Value *
+AffineTransformFoldingPass::getReplacementForCallInst(llvm::CallInst & instruction)
+{
+	llvm::CallInst * outer_call = &instruction;
+	llvm::CallInst * inner_call =
+	    llvm::dyn_cast < llvm::CallInst > (outer_call->getOperand(3));
+
+	if (!inner_call || (inner_call->getCalledFunction() !=
+			    outer_call->getCalledFunction())) {
+		return NULL;
+	}
+
+	FirtreeAffineTransform *outer = firtree_affine_transform_new();
+	FirtreeAffineTransform *inner = firtree_affine_transform_new();
+	llvm::Value *rv = NULL;
+
+	if (_firtree_engine_get_affine_transform_call_transform(outer_call,
+								outer) &&
+	    _firtree_engine_get_affine_transform_call_transform(inner_call,
+								inner)) {
+		/* The inner transform is applied first. */
+		firtree_affine_transform_append_transform(inner, outer);
+		llvm::Module * m =
+		    outer_call->getParent()->getParent()->getParent();
+		rv = _firtree_engine_create_affine_transform_call(m, inner,
+								  inner_call->
+								  getOperand(3),
+								  outer_call,
+								  NULL);
+	}
+
+	g_object_unref(outer);
+	g_object_unref(inner);
+
+	return rv;
+}
+
+char AffineTransformLoweringPass::ID = 0;
+
+bool
+AffineTransformLoweringPass::interestedInCallToFunction(const std::string & name)
+{
+	return (name == "affine_transform");
+}
+
+llvm::Value *
+AffineTransformLoweringPass::getReplacementForCallInst(llvm::CallInst & instruction)
+{
+	llvm::CallInst * call = &instruction;
+	llvm::Value * location = call->getOperand(3);
+
+	FirtreeAffineTransform *transform = firtree_affine_transform_new();
+	if (!_firtree_engine_get_affine_transform_call_transform(call,
+								 transform)) {
+		g_error("Transforms passed to affine_transform() must be "
+			"constant.");
+	}
+
+	llvm::Value * rv = location;
+
+	/* rv = location.xxxx * (m11, m21) + location.yyyy * (m12, m22) */
+	if ((transform->m11 != 1.f) || (transform->m12 != 0.f) ||
+	    (transform->m21 != 0.f) || (transform->m22 != 1.f)) {
+		const llvm::Type * vec_ty = location->getType();
+		llvm::Value * undef = llvm::UndefValue::get(vec_ty);
+
+		std::vector < llvm::Constant * >x_mask(4,
+			llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY, 0));
+		std::vector < llvm::Constant * >y_mask(4,
+			llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY, 1));
+
+		llvm::Value * xxxx =
+		    new llvm::ShuffleVectorInst(location, undef,
+						llvm::ConstantVector::
+						get(x_mask), "xxxx", call);
+		llvm::Value * yyyy =
+		    new llvm::ShuffleVectorInst(location, undef,
+						llvm::ConstantVector::
+						get(y_mask), "yyyy", call);
+
+		llvm::Value * col1 =
+		    llvm::BinaryOperator::Create(llvm::Instruction::Mul, xxxx,
+						 _firtree_engine_vec4_constant
+						 (transform->m11,
+						  transform->m21, 0.f, 0.f),
+						 "col1", call);
+		llvm::Value * col2 =
+		    llvm::BinaryOperator::Create(llvm::Instruction::Mul, yyyy,
+						 _firtree_engine_vec4_constant
+						 (transform->m12,
+						  transform->m22, 0.f, 0.f),
+						 "col2", call);
+		rv = llvm::BinaryOperator::Create(llvm::Instruction::Add, col1,
+						  col2, "linear", call);
+	}
+
+	/* rv = rv + (tx, ty) */
+	if ((transform->tx != 0.f) || (transform->ty != 0.f)) {
+		rv = llvm::BinaryOperator::Create(llvm::Instruction::Add, rv,
+						  _firtree_engine_vec4_constant
+						  (transform->tx,
+						   transform->ty, 0.f, 0.f),
+						  "translated", call);
+	}
+
+	g_object_unref(transform);
+
+	return rv;
+}
+
+char SpecialiseImageBufferCallsPass::ID = 0;
+
+bool
+SpecialiseImageBufferCallsPass::interestedInCallToFunction(const std::string &
+							    name)
+{
+	return (name == "sample_image_buffer_nn") ||
+	    (name == "sample_image_buffer_lerp");
+}
+
+llvm::Value *
+SpecialiseImageBufferCallsPass::getReplacementForCallInst(llvm::CallInst &
+							   instruction)
+{
+	llvm::CallInst * call = &instruction;
+	llvm::ConstantInt * format =
+	    llvm::dyn_cast < llvm::ConstantInt > (call->getOperand(2));
+	if (!format) {
+		return NULL;
+	}
+
+	GEnumClass *enum_class =
+	    (GEnumClass *) g_type_class_ref(FIRTREE_TYPE_BUFFER_FORMAT);
+	GEnumValue *value = g_enum_get_value(enum_class,
+					     (gint) format->getZExtValue());
+	if (!value) {
+		g_type_class_unref(enum_class);
+		return NULL;
+	}
+
+	std::string name = call->getCalledFunction()->getName();
+	name += "_";
+	name += value->value_name;
+	g_type_class_unref(enum_class);
+
+	llvm::Module * m = call->getParent()->getParent()->getParent();
+	llvm::Function * specialised = m->getFunction(name);
+	if (!specialised || specialised->isDeclaration() ||
+	    (specialised->getFunctionType() !=
+	     call->getCalledFunction()->getFunctionType())) {
+		return NULL;
+	}
+
+	std::vector < llvm::Value * >params(call->op_begin() + 1,
+					     call->op_end());
+	return llvm::CallInst::Create(specialised, params.begin(),
+				      params.end(), "", call);
+}
+
+} /* namespace Firtree */
+
 llvm::Value *
 firtree_engine_get_constant_for_kernel_argument(GValue * kernel_arg)
 {
@@ -0,0 +1,369 @@
+/* firtree-image-pyramid.cc */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#define __STDC_LIMIT_MACROS
+#define __STDC_CONSTANT_MACROS
+
+#include <math.h>
+#include <string.h>
+
+#include "internal/firtree-engine-intl.hh"
+#include "internal/firtree-image-pyramid-intl.hh"
+
+/* The maximum number of levels, including the original image. This allows
+ * for images up to 2^31 pixels along a side. */
+#define MAX_LEVELS 32
+
+struct _FirtreeImagePyramid {
+	/* The image the levels were built from. */
+	FirtreeImagePyramidLevel base;
+
+	/* levels[0] is the base image, levels[1] .. levels[n_levels-1] are
+	 * owned by the pyramid. */
+	FirtreeImagePyramidLevel levels[MAX_LEVELS];
+	guint n_levels;
+};
+
+FirtreeImagePyramid *firtree_image_pyramid_new(void)
+{
+	FirtreeImagePyramid *pyramid = g_slice_new0(FirtreeImagePyramid);
+	pyramid->n_levels = 1;
+	return pyramid;
+}
+
+void firtree_image_pyramid_free(FirtreeImagePyramid * pyramid)
+{
+	if (!pyramid) {
+		return;
+	}
+
+	firtree_image_pyramid_reset(pyramid);
+	g_slice_free(FirtreeImagePyramid, pyramid);
+}
+
+void firtree_image_pyramid_reset(FirtreeImagePyramid * pyramid)
+{
+	for (guint i = 1; i < pyramid->n_levels; ++i) {
+		FirtreeImagePyramidLevel *level = &(pyramid->levels[i]);
+		g_slice_free1(level->stride * level->height, level->data);
+		level->data = NULL;
+	}
+	pyramid->n_levels = 1;
+	memset(&(pyramid->base), 0, sizeof(FirtreeImagePyramidLevel));
+}
+
+/* Return the byte offset of the alpha channel within a pixel if format
+ * has an alpha channel which is not premultiplied into the colour channels
+ * or -1 otherwise. */
+static gint _firtree_image_pyramid_unpremultiplied_alpha(FirtreeBufferFormat
+							 format)
+{
+	switch (format) {
+	case FIRTREE_FORMAT_ARGB32:
+	case FIRTREE_FORMAT_ABGR32:
+		return 0;
+	case FIRTREE_FORMAT_RGBA32:
+	case FIRTREE_FORMAT_BGRA32:
+		return 3;
+	default:
+		break;
+	}
+	return -1;
+}
+
+gboolean firtree_image_pyramid_format_is_supported(FirtreeBufferFormat format)
+{
+	switch (format) {
+	case FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED:
+	case FIRTREE_FORMAT_RGBA64:
+		/* no reducer for these */
+		return FALSE;
+	default:
+		break;
+	}
+	return firtree_engine_get_buffer_format_pixel_size(format) != 0;
+}
+
+/* Box filter a row of 8-bit components. r0 and r1 are the two source rows
+ * (which may be the same row at the bottom edge of an image with an odd
+ * number of rows). The loops have no dependencies between iterations so
+ * that the compiler is free to vectorise them. */
+static void
+_firtree_image_pyramid_reduce_row_8(guint8 * out, const guint8 * r0,
+				    const guint8 * r1, guint out_width,
+				    guint src_width, guint pix_size)
+{
+	guint n_pairs = src_width >> 1;
+	guint n_bytes = n_pairs * pix_size;
+
+	for (guint x = 0; x < n_pairs; ++x) {
+		guint o = x * 2 * pix_size;
+		for (guint c = 0; c < pix_size; ++c, ++o) {
+			out[(x * pix_size) + c] =
+			    (guint8) ((r0[o] + r0[o + pix_size] +
+				       r1[o] + r1[o + pix_size] + 2) >> 2);
+		}
+	}
+
+	/* An odd final column is averaged with itself. */
+	if (out_width > n_pairs) {
+		guint o = (src_width - 1) * pix_size;
+		for (guint c = 0; c < pix_size; ++c) {
+			out[n_bytes + c] =
+			    (guint8) ((r0[o + c] + r1[o + c] + 1) >> 1);
+		}
+	}
+}
+
+/* As _firtree_image_pyramid_reduce_row_8() but weights the colour channels
+ * by alpha so that the colour of fully transparent pixels does not bleed
+ * into their neighbours. */
+static void
+_firtree_image_pyramid_reduce_row_8_alpha(guint8 * out, const guint8 * r0,
+					  const guint8 * r1, guint out_width,
+					  guint src_width, guint alpha)
+{
+	for (guint x = 0; x < out_width; ++x) {
+		guint o0 = x * 8;
+		guint o1 = ((2 * x + 1) < src_width) ? o0 + 4 : o0;
+		const guint8 *p[4] = { r0 + o0, r0 + o1, r1 + o0, r1 + o1 };
+
+		guint alpha_sum = p[0][alpha] + p[1][alpha] +
+		    p[2][alpha] + p[3][alpha];
+
+		for (guint c = 0; c < 4; ++c) {
+			guint v;
+			if (c == alpha) {
+				v = (alpha_sum + 2) >> 2;
+			} else if (alpha_sum == 0) {
+				v = (p[0][c] + p[1][c] + p[2][c] + p[3][c] +
+				     2) >> 2;
+			} else {
+				v = (p[0][c] * p[0][alpha] +
+				     p[1][c] * p[1][alpha] +
+				     p[2][c] * p[2][alpha] +
+				     p[3][c] * p[3][alpha] +
+				     (alpha_sum >> 1)) / alpha_sum;
+			}
+			out[(x * 4) + c] = (guint8) v;
+		}
+	}
+}
+
+/* Box filter a row of 16-bit RGBA components. */
+static void
+_firtree_image_pyramid_reduce_row_16(guint16 * out, const guint16 * r0,
+				     const guint16 * r1, guint out_width,
+				     guint src_width)
+{
+	guint n_pairs = src_width >> 1;
+	guint n_components = n_pairs * 4;
+
+	for (guint i = 0; i < n_components; ++i) {
+		guint o = ((i >> 2) * 8) + (i & 3);
+		out[i] = (guint16) (((guint32) r0[o] + r0[o + 4] +
+				     r1[o] + r1[o + 4] + 2) >> 2);
+	}
+
+	if (out_width > n_pairs) {
+		guint o = (src_width - 1) * 4;
+		for (guint c = 0; c < 4; ++c) {
+			out[n_components + c] =
+			    (guint16) (((guint32) r0[o + c] + r1[o + c] +
+					1) >> 1);
+		}
+	}
+}
+
+/* Box filter a row of floating point components. */
+static void
+_firtree_image_pyramid_reduce_row_f32(float *out, const float *r0,
+				      const float *r1, guint out_width,
+				      guint src_width)
+{
+	guint n_pairs = src_width >> 1;
+	guint n_floats = n_pairs * 4;
+
+	for (guint i = 0; i < n_floats; ++i) {
+		guint o = ((i >> 2) * 8) + (i & 3);
+		out[i] = 0.25f * (r0[o] + r0[o + 4] + r1[o] + r1[o + 4]);
+	}
+
+	if (out_width > n_pairs) {
+		guint o = (src_width - 1) * 4;
+		for (guint c = 0; c < 4; ++c) {
+			out[n_floats + c] = 0.5f * (r0[o + c] + r1[o + c]);
+		}
+	}
+}
+
+/* Build dest, a level half the size of src, by applying a 2x2 box filter. */
+static void
+_firtree_image_pyramid_reduce(FirtreeImagePyramidLevel * dest,
+			      const FirtreeImagePyramidLevel * src)
+{
+	guint pix_size = firtree_engine_get_buffer_format_pixel_size(src->format);
+	gint alpha = _firtree_image_pyramid_unpremultiplied_alpha(src->format);
+
+	dest->width = (src->width + 1) >> 1;
+	dest->height = (src->height + 1) >> 1;
+	dest->format = src->format;
+
+	/* Keep rows 4-byte aligned like cairo and GdkPixbuf do. */
+	dest->stride = ((dest->width * pix_size) + 3) & ~3;
+	dest->data = g_slice_alloc(dest->stride * dest->height);
+
+	for (guint y = 0; y < dest->height; ++y) {
+		guint src_y0 = 2 * y;
+		guint src_y1 = ((src_y0 + 1) < src->height) ? src_y0 + 1 : src_y0;
+
+		const guint8 *r0 = (const guint8 *)(src->data) +
+		    (src_y0 * src->stride);
+		const guint8 *r1 = (const guint8 *)(src->data) +
+		    (src_y1 * src->stride);
+		guint8 *out = (guint8 *) (dest->data) + (y * dest->stride);
+
+		if (pix_size == 16) {
+			_firtree_image_pyramid_reduce_row_f32((float *)out,
+							      (const float *)
+							      r0,
+							      (const float *)
+							      r1, dest->width,
+							      src->width);
+		} else if (pix_size == 8) {
+			_firtree_image_pyramid_reduce_row_16((guint16 *) out,
+							     (const guint16 *)
+							     r0,
+							     (const guint16 *)
+							     r1, dest->width,
+							     src->width);
+		} else if (alpha >= 0) {
+			_firtree_image_pyramid_reduce_row_8_alpha(out, r0, r1,
+								  dest->width,
+								  src->width,
+								  alpha);
+		} else {
+			_firtree_image_pyramid_reduce_row_8(out, r0, r1,
+							    dest->width,
+							    src->width,
+							    pix_size);
+		}
+	}
+}
+
+/* Work out which level best matches the footprint of one output pixel
+ * in the image. */
+static guint
+_firtree_image_pyramid_level_for_transform(FirtreeAffineTransform * transform,
+					   const FirtreeImagePyramidLevel *
+					   base)
+{
+	if (!transform) {
+		return 0;
+	}
+
+	/* The footprint of an output pixel is the longer of the images of the
+	 * unit vectors in x and y. */
+	float sx = sqrtf((transform->m11 * transform->m11) +
+			 (transform->m21 * transform->m21));
+	float sy = sqrtf((transform->m12 * transform->m12) +
+			 (transform->m22 * transform->m22));
+	float footprint = MAX(sx, sy);
+
+	/* Choose the finest level whose pixels are no larger than the
+	 * footprint, stopping when the level is a single pixel. */
+	guint index = 0;
+	guint width = base->width;
+	guint height = base->height;
+	while ((footprint >= 2.f) && (index + 1 < MAX_LEVELS) &&
+	       ((width > 1) || (height > 1))) {
+		footprint *= 0.5f;
+		width = (width + 1) >> 1;
+		height = (height + 1) >> 1;
+		++index;
+	}
+
+	return index;
+}
+
+guint
+firtree_image_pyramid_select_level(FirtreeImagePyramid * pyramid,
+				   FirtreeAffineTransform * transform,
+				   const FirtreeImagePyramidLevel * base,
+				   FirtreeImagePyramidLevel * level)
+{
+	*level = *base;
+
+	if (!firtree_image_pyramid_format_is_supported(base->format) ||
+	    !base->data || (base->width == 0) || (base->height == 0)) {
+		return 0;
+	}
+
+	/* Throw away levels built from a different image. */
+	if ((pyramid->base.data != base->data) ||
+	    (pyramid->base.width != base->width) ||
+	    (pyramid->base.height != base->height) ||
+	    (pyramid->base.stride != base->stride) ||
+	    (pyramid->base.format != base->format)) {
+		firtree_image_pyramid_reset(pyramid);
+		pyramid->base = *base;
+	}
+	pyramid->levels[0] = *base;
+
+	guint index =
+	    _firtree_image_pyramid_level_for_transform(transform, base);
+
+	/* Lazily build any levels which don't yet exist. */
+	while (pyramid->n_levels <= index) {
+		_firtree_image_pyramid_reduce(&(pyramid->
+						levels[pyramid->n_levels]),
+					      &(pyramid->
+						levels[pyramid->n_levels -
+						       1]));
+		++pyramid->n_levels;
+	}
+
+	*level = pyramid->levels[index];
+	return index;
+}
+
+llvm::Value *
+firtree_image_pyramid_create_level_location(llvm::Module * module,
+					    guint level_index,
+					    llvm::Value * location,
+					    llvm::BasicBlock * bb)
+{
+	/* The pixel (x, y) of level n covers the square from (x, y) * 2^n
+	 * to (x + 1, y + 1) * 2^n in the original image. */
+	float scale = ldexpf(1.f, -(gint) level_index);
+
+	FirtreeAffineTransform *transform = firtree_affine_transform_new();
+	firtree_affine_transform_set_scaling_by(transform, scale, scale);
+
+	llvm::Value * rv =
+	    firtree_engine_create_affine_transform_call(module, transform,
+							location, bb);
+
+	g_object_unref(transform);
+
+	return rv;
+}
+
+/* vim:sw=8:ts=8:tw=78:noet:cindent
+ */
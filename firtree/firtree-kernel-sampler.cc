@@ -58,6 +58,7 @@ struct _FirtreeKernelSamplerPrivate {
 	gulong kernel_mod_ch_handler_id;
 	gulong kernel_arg_ch_handler_id;
 	gulong kernel_cont_ch_handler_id;
+	gulong kernel_reg_ch_handler_id;
 	llvm::Function * cached_function;
 };
 
@@ -68,6 +69,14 @@ firtree_kernel_sampler_get_param(FirtreeSampler * self, guint param,
 llvm::Function *
 firtree_kernel_sampler_get_sample_function(FirtreeSampler * self);
 
+FirtreeVec4 firtree_kernel_sampler_get_extent(FirtreeSampler * self);
+
+gboolean firtree_kernel_sampler_is_opaque(FirtreeSampler * self);
+
+gboolean firtree_kernel_sampler_lock(FirtreeSampler * self);
+
+void firtree_kernel_sampler_unlock(FirtreeSampler * self);
+
 /* invalidate (and release) any cached LLVM modules/functions. This
  * will cause them to be re-generated when ..._get_function() is next
  * called. */
@@ -108,11 +117,17 @@ static void firtree_kernel_sampler_class_init(FirtreeKernelSamplerClass * klass)
 	/* override the sampler virtual functions with our own */
 	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
 
+	sampler_class->get_extent = firtree_kernel_sampler_get_extent;
+	sampler_class->lock = firtree_kernel_sampler_lock;
+	sampler_class->unlock = firtree_kernel_sampler_unlock;
+
 	sampler_class->intl_vtable = &_firtree_kernel_sampler_class_vtable;
 	sampler_class->intl_vtable->get_param =
 	    firtree_kernel_sampler_get_param;
 	sampler_class->intl_vtable->get_sample_function =
 	    firtree_kernel_sampler_get_sample_function;
+	sampler_class->intl_vtable->is_opaque =
+	    firtree_kernel_sampler_is_opaque;
 }
 
 static void firtree_kernel_sampler_init(FirtreeKernelSampler * self)
@@ -142,6 +157,7 @@ _firteee_kernel_sampler_module_changed_cb(FirtreeKernel * kernel,
 					  FirtreeKernelSampler * self)
 {
 	_firtree_kernel_sampler_invalidate_llvm_cache(self);
+	firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
 }
 
 static void
@@ -155,6 +171,7 @@ _firteee_kernel_sampler_argument_changed_cb(FirtreeKernel * kernel,
 		/* If the argument is static, we need to force a new function. */
 		_firtree_kernel_sampler_invalidate_llvm_cache(self);
 	}
+	firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
 	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
 }
 
@@ -165,6 +182,16 @@ _firteee_kernel_sampler_contents_changed_cb(FirtreeKernel * kernel,
 	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
 }
 
+/* The kernel's output space is our sampler space so the region is passed on
+ * as it is. The kernel's ::contents-changed signal follows. */
+static void
+_firteee_kernel_sampler_region_changed_cb(FirtreeKernel * kernel,
+					  FirtreeVec4 * region,
+					  FirtreeKernelSampler * self)
+{
+	firtree_sampler_region_changed(FIRTREE_SAMPLER(self), region);
+}
+
 /**
  * firtree_kernel_sampler_set_kernel:
  * @self: A FirtreeKernelSampler.
@@ -190,6 +217,8 @@ firtree_kernel_sampler_set_kernel(FirtreeKernelSampler * self,
 					    p->kernel_arg_ch_handler_id);
 		g_signal_handler_disconnect(p->kernel,
 					    p->kernel_cont_ch_handler_id);
+		g_signal_handler_disconnect(p->kernel,
+					    p->kernel_reg_ch_handler_id);
 		g_object_unref(p->kernel);
 		p->kernel = NULL;
 	}
@@ -224,6 +253,11 @@ firtree_kernel_sampler_set_kernel(FirtreeKernelSampler * self,
 				     G_CALLBACK
 				     (_firteee_kernel_sampler_contents_changed_cb),
 				     self);
+		p->kernel_reg_ch_handler_id =
+		    g_signal_connect(kernel, "region-changed",
+				     G_CALLBACK
+				     (_firteee_kernel_sampler_region_changed_cb),
+				     self);
 	}
 
 	_firtree_kernel_sampler_invalidate_llvm_cache(self);
@@ -274,7 +308,143 @@ firtree_kernel_sampler_get_sample_function(FirtreeSampler * self)
 		return NULL;
 	}
 
-	return firtree_kernel_create_overall_function(p->kernel);
+	p->cached_function = firtree_kernel_create_overall_function(p->kernel);
+	return p->cached_function;
+}
+
+/* The extent of a kernel sampler is only known if the kernel is transparent
+ * wherever all of its sampler arguments are. In that case it is the union of
+ * their output extents. */
+FirtreeVec4 firtree_kernel_sampler_get_extent(FirtreeSampler * self)
+{
+	FirtreeKernelSamplerPrivate *p = GET_PRIVATE(self);
+	FirtreeVec4 infinite =
+	    FIRTREE_SAMPLER_CLASS(firtree_kernel_sampler_parent_class)->
+	    get_extent(self);
+
+	if (!p->kernel || !firtree_kernel_preserves_transparency(p->kernel)) {
+		return infinite;
+	}
+
+	gboolean have_extent = FALSE;
+	float min_x = 0.f, min_y = 0.f, max_x = 0.f, max_y = 0.f;
+
+	GQuark *args = firtree_kernel_list_arguments(p->kernel, NULL);
+	for (; args && *args; ++args) {
+		FirtreeKernelArgumentSpec *spec =
+		    firtree_kernel_get_argument_spec(p->kernel, *args);
+		if (spec->type != FIRTREE_TYPE_SAMPLER) {
+			continue;
+		}
+
+		FirtreeSampler *sampler = (FirtreeSampler *)
+		    g_value_get_object(firtree_kernel_get_argument_value
+				       (p->kernel, *args));
+		FirtreeVec4 extent = firtree_sampler_get_output_extent(sampler);
+
+		if (firtree_sampler_extent_is_infinite(&extent)) {
+			return infinite;
+		}
+
+		if ((extent.z <= 0.f) || (extent.w <= 0.f)) {
+			continue;
+		}
+
+		if (!have_extent) {
+			min_x = extent.x;
+			min_y = extent.y;
+			max_x = extent.x + extent.z;
+			max_y = extent.y + extent.w;
+			have_extent = TRUE;
+		} else {
+			min_x = MIN(min_x, extent.x);
+			min_y = MIN(min_y, extent.y);
+			max_x = MAX(max_x, extent.x + extent.z);
+			max_y = MAX(max_y, extent.y + extent.w);
+		}
+	}
+
+	FirtreeVec4 rv = { min_x, min_y, max_x - min_x, max_y - min_y };
+	return rv;
+}
+
+/* A kernel sampler is opaque if its kernel is. Such a kernel does not
+ * preserve transparency and so the sampler's extent is infinite. */
+gboolean firtree_kernel_sampler_is_opaque(FirtreeSampler * self)
+{
+	FirtreeKernelSamplerPrivate *p = GET_PRIVATE(self);
+
+	if (!p->kernel || !firtree_kernel_is_valid(p->kernel)) {
+		return FALSE;
+	}
+
+	return firtree_kernel_is_opaque(p->kernel);
+}
+
+/* Return the sampler bound to the @index-th sampler argument of @kernel
+ * counting from zero or NULL if there are no more. */
+static FirtreeSampler *_firtree_kernel_sampler_get_input(FirtreeKernel * kernel,
+							 guint index)
+{
+	GQuark *args = firtree_kernel_list_arguments(kernel, NULL);
+	for (; args && *args; ++args) {
+		FirtreeKernelArgumentSpec *spec =
+		    firtree_kernel_get_argument_spec(kernel, *args);
+		if (spec->type != FIRTREE_TYPE_SAMPLER) {
+			continue;
+		}
+		if (index == 0) {
+			GValue *val =
+			    firtree_kernel_get_argument_value(kernel, *args);
+			return val ? (FirtreeSampler *) g_value_get_object(val)
+			    : NULL;
+		}
+		--index;
+	}
+	return NULL;
+}
+
+/* The samplers a kernel samples from are compiled into its function and so
+ * must be locked along with it. */
+gboolean firtree_kernel_sampler_lock(FirtreeSampler * self)
+{
+	FirtreeKernelSamplerPrivate *p = GET_PRIVATE(self);
+	if (!p->kernel) {
+		return TRUE;
+	}
+
+	guint i = 0;
+	FirtreeSampler *input;
+	while (NULL != (input = _firtree_kernel_sampler_get_input(p->kernel, i))) {
+		if (!firtree_sampler_lock(input)) {
+			/* unlock the inputs locked so far. */
+			while (i > 0) {
+				--i;
+				firtree_sampler_unlock
+				    (_firtree_kernel_sampler_get_input
+				     (p->kernel, i));
+			}
+			return FALSE;
+		}
+		++i;
+	}
+
+	return TRUE;
+}
+
+void firtree_kernel_sampler_unlock(FirtreeSampler * self)
+{
+	FirtreeKernelSamplerPrivate *p = GET_PRIVATE(self);
+	if (!p->kernel) {
+		return;
+	}
+
+	guint i = 0;
+	FirtreeSampler *input;
+	while (NULL != (input = _firtree_kernel_sampler_get_input(p->kernel, i))) {
+		firtree_sampler_unlock(input);
+		++i;
+	}
 }
 
 /* vim:sw=8:ts=8:tw=78:noet:cindent
@@ -16,6 +16,10 @@
 #include <llvm/Analysis/LoopPass.h>
 #include <llvm/Target/TargetData.h>
 
+#include <set>
+
+#include <math.h>
+
 #include "internal/firtree-kernel-intl.hh"
 #include "internal/firtree-sampler-intl.hh"
 #include "internal/firtree-engine-intl.hh"
@@ -85,11 +89,18 @@ enum {
 	ARGUMENT_CHANGED,
 	MODULE_CHANGED,
 	CONTENTS_CHANGED,
+	REGION_CHANGED,
 	LAST_SIGNAL
 };
 
 static guint _firtree_kernel_signals[LAST_SIGNAL] = { 0 };
 
+/* The kernel language parser and the reference counted initialisation of its
+ * symbol tables use global state. Compiling, creating and destroying
+ * CompiledKernel instances is serialised by this lock so that kernels may be
+ * compiled from several threads. */
+G_LOCK_DEFINE_STATIC(_firtree_kernel_frontend);
+
 G_DEFINE_TYPE(FirtreeKernel, firtree_kernel, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), FIRTREE_TYPE_KERNEL, FirtreeKernelPrivate))
@@ -103,8 +114,30 @@ struct _FirtreeKernelPrivate {
 	GArray *arg_names;
 	GData *arg_spec_list;
 	GData *arg_value_list;
+
+	/* Cached result of firtree_kernel_preserves_transparency() or -1 if
+	 * it needs re-computing. */
+	gint preserves_transparency;
+
+	/* Cached result of firtree_kernel_is_opaque() or -1 if it needs
+	 * re-computing. */
+	gint is_opaque;
+
+	/* Cached results of firtree_kernel_get_sample_footprint() keyed by
+	 * argument name. */
+	GData *footprint_list;
 };
 
+/* The result of firtree_kernel_get_sample_footprint() for one argument. */
+typedef struct {
+	gboolean known;
+	FirtreeVec2 sampler_radius;
+	FirtreeVec2 dest_radius;
+
+	/* TRUE if every offset is a whole number of pixels. */
+	gboolean whole_pixels;
+} _FirtreeKernelFootprint;
+
 static GType
 _firtree_kernel_type_specifier_to_gtype(KernelTypeSpecifier type_spec)
 {
@@ -147,6 +180,9 @@ static void _firtree_kernel_reset_compile_status(FirtreeKernel * self)
 {
 	FirtreeKernelPrivate *p = GET_PRIVATE(self);
 	p->compile_status = FALSE;
+	p->preserves_transparency = -1;
+	p->is_opaque = -1;
+	g_datalist_clear(&(p->footprint_list));
 	if (p->arg_names) {
 		g_array_free(p->arg_names, TRUE);
 		p->arg_names = NULL;
@@ -166,7 +202,9 @@ static void firtree_kernel_dispose(GObject * object)
 	_firtree_kernel_reset_compile_status(FIRTREE_KERNEL(object));
 
 	if (p->compiled_kernel) {
+		G_LOCK(_firtree_kernel_frontend);
 		FIRTREE_SAFE_RELEASE(p->compiled_kernel);
+		G_UNLOCK(_firtree_kernel_frontend);
 		p->compiled_kernel = NULL;
 	}
 
@@ -186,6 +224,7 @@ static void firtree_kernel_class_init(FirtreeKernelClass * klass)
 	klass->argument_changed = NULL;
 	klass->module_changed = NULL;
 	klass->contents_changed = NULL;
+	klass->region_changed = NULL;
 
 	param_spec = g_param_spec_boolean("compile-status",
 					  "A flag indicating the success of the last compilation.",
@@ -257,6 +296,25 @@ static void firtree_kernel_class_init(FirtreeKernelClass * klass)
 			 G_STRUCT_OFFSET(FirtreeKernelClass, contents_changed),
 			 NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE,
 			 0);
+
+    /**
+     * FirtreeKernel::region-changed:
+     * @kernel: The kernel whose output has changed.
+     * @region: A #FirtreeVec4 bounding the part of the output which changed.
+     *
+     * Emitted before the ::contents-changed signal which results from
+     * a sampler argument emitting FirtreeSampler::region-changed if
+     * the part of the kernel's output which may have changed can be
+     * bounded. @region is a (minx, miny, width, height) rectangle in the
+     * kernel's output space.
+     */
+	_firtree_kernel_signals[REGION_CHANGED] =
+	    g_signal_new("region-changed",
+			 G_OBJECT_CLASS_TYPE(klass),
+			 G_SIGNAL_RUN_FIRST,
+			 G_STRUCT_OFFSET(FirtreeKernelClass, region_changed),
+			 NULL, NULL, g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE,
+			 1, FIRTREE_TYPE_VEC4);
 }
 
 static void firtree_kernel_init(FirtreeKernel * self)
@@ -270,6 +328,7 @@ static void firtree_kernel_init(FirtreeKernel * self)
 	p->arg_names = NULL;
 	g_datalist_init(&(p->arg_spec_list));
 	g_datalist_init(&(p->arg_value_list));
+	g_datalist_init(&(p->footprint_list));
 
 	_firtree_kernel_reset_compile_status(self);
 }
@@ -318,6 +377,10 @@ static void _firtree_kernel_arg_spec_destroy_func(gpointer data)
  * Note: The source lines are simply concatenated, no implicit newline
  * characters are inserted.
  *
+ * Different kernels may be compiled from several threads at once although
+ * parsing is serialised internally. A single kernel should not be compiled
+ * from two threads at the same time.
+ *
  * Returns: a flag indicating whether the compilation was successful.
  */
 gboolean
@@ -327,6 +390,8 @@ firtree_kernel_compile_from_source(FirtreeKernel * self,
 {
 	FirtreeKernelPrivate *p = GET_PRIVATE(self);
 
+	G_LOCK(_firtree_kernel_frontend);
+
 	/* Create a CompiledKernel object if necessary. */
 	if (!p->compiled_kernel) {
 		p->compiled_kernel = CompiledKernel::Create();
@@ -335,6 +400,9 @@ firtree_kernel_compile_from_source(FirtreeKernel * self,
 	_firtree_kernel_reset_compile_status(self);
 
 	p->compile_status = p->compiled_kernel->Compile(lines, n_lines);
+
+	G_UNLOCK(_firtree_kernel_frontend);
+
 	if (!p->compile_status) {
 		firtree_kernel_module_changed(self);
 		return p->compile_status;
@@ -560,6 +628,86 @@ _firtree_kernel_sampler_contents_changed_cb(FirtreeSampler * sampler,
 	}
 }
 
+/* Grow the (minx, miny, width, height) rectangle @rect by @radius along
+ * each axis. */
+static void _firtree_kernel_pad_rect(FirtreeVec4 * rect, FirtreeVec2 radius)
+{
+	rect->x -= radius.x;
+	rect->y -= radius.y;
+	rect->z += 2.f * radius.x;
+	rect->w += 2.f * radius.y;
+}
+
+/* Map a changed region of @sampler to the region of our output which may
+ * have changed. Nothing is emitted if any argument bound to @sampler samples
+ * it in a way we cannot bound and so the ::contents-changed signal which
+ * follows is treated as changing the whole output. Each emission of this
+ * handler is matched by one of _firtree_kernel_sampler_contents_changed_cb()
+ * since they are connected together. */
+static void
+_firtree_kernel_sampler_region_changed_cb(FirtreeSampler * sampler,
+					  FirtreeVec4 * region,
+					  FirtreeKernel * self)
+{
+	if (!FIRTREE_IS_KERNEL(self) || !region) {
+		return;
+	}
+
+	gboolean have_region = FALSE;
+	float min_x = 0.f, min_y = 0.f, max_x = 0.f, max_y = 0.f;
+
+	GQuark *args = firtree_kernel_list_arguments(self, NULL);
+	for (; args && *args; ++args) {
+		FirtreeKernelArgumentSpec *spec =
+		    firtree_kernel_get_argument_spec(self, *args);
+		if (spec->type != FIRTREE_TYPE_SAMPLER) {
+			continue;
+		}
+
+		GValue *val = firtree_kernel_get_argument_value(self, *args);
+		if (!val || (g_value_get_object(val) != (gpointer) sampler)) {
+			continue;
+		}
+
+		FirtreeVec2 sampler_radius, dest_radius;
+		if (!firtree_kernel_get_sample_footprint(self, *args,
+							 &sampler_radius,
+							 &dest_radius)) {
+			return;
+		}
+
+		/* Samples are taken at samplerTransform(s, destCoord() + d) + e
+		 * and so the output changes wherever that lies in @region. */
+		FirtreeVec4 changed = *region;
+		_firtree_kernel_pad_rect(&changed, sampler_radius);
+		changed = firtree_sampler_map_region_to_output(sampler, &changed);
+		if (firtree_sampler_extent_is_infinite(&changed)) {
+			return;
+		}
+		_firtree_kernel_pad_rect(&changed, dest_radius);
+
+		if (!have_region) {
+			min_x = changed.x;
+			min_y = changed.y;
+			max_x = changed.x + changed.z;
+			max_y = changed.y + changed.w;
+			have_region = TRUE;
+		} else {
+			min_x = MIN(min_x, changed.x);
+			min_y = MIN(min_y, changed.y);
+			max_x = MAX(max_x, changed.x + changed.z);
+			max_y = MAX(max_y, changed.y + changed.w);
+		}
+	}
+
+	if (have_region) {
+		FirtreeVec4 changed = { min_x, min_y, max_x - min_x,
+			max_y - min_y
+		};
+		firtree_kernel_region_changed(self, &changed);
+	}
+}
+
 /**
  * firtree_kernel_set_argument_value:
  * @self: A FirtreeKernel instance.
@@ -612,6 +760,10 @@ firtree_kernel_set_argument_value(FirtreeKernel * self,
 					 G_CALLBACK
 					 (_firtree_kernel_sampler_module_changed_cb),
 					 self);
+			g_signal_connect(new_sampler, "region-changed",
+					 G_CALLBACK
+					 (_firtree_kernel_sampler_region_changed_cb),
+					 self);
 			g_signal_connect(new_sampler, "contents-changed",
 					 G_CALLBACK
 					 (_firtree_kernel_sampler_contents_changed_cb),
@@ -645,6 +797,9 @@ firtree_kernel_set_argument_value(FirtreeKernel * self,
 void firtree_kernel_argument_changed(FirtreeKernel * self, GQuark arg_name)
 {
 	g_return_if_fail(FIRTREE_IS_KERNEL(self));
+	GET_PRIVATE(self)->preserves_transparency = -1;
+	GET_PRIVATE(self)->is_opaque = -1;
+	g_datalist_clear(&(GET_PRIVATE(self)->footprint_list));
 	g_signal_emit(self, _firtree_kernel_signals[ARGUMENT_CHANGED], arg_name,
 		      g_quark_to_string(arg_name));
 }
@@ -705,6 +860,13 @@ void firtree_kernel_contents_changed(FirtreeKernel * self)
 	g_signal_emit(self, _firtree_kernel_signals[CONTENTS_CHANGED], 0);
 }
 
+void firtree_kernel_region_changed(FirtreeKernel * self, FirtreeVec4 * region)
+{
+	g_return_if_fail(FIRTREE_IS_KERNEL(self));
+	g_signal_emit(self, _firtree_kernel_signals[REGION_CHANGED], 0,
+		      region);
+}
+
 /**
  * firtree_kernel_get_return_type:
  * @self: A FirtreeKernel instance.
@@ -757,6 +919,124 @@ FirtreeKernelTarget firtree_kernel_get_target(FirtreeKernel * self)
 	return FIRTREE_KERNEL_TARGET_INVALID;
 }
 
+/* Record in @emit_type the type emitted by any call to an emit() builtin within
+ * @f or any function @f calls. @emit_type should be initialised to G_TYPE_NONE
+ * and is set to G_TYPE_INVALID if more than one type is emitted. */
+static void
+_firtree_kernel_find_emit_type(llvm::Function * f,
+			       std::set < llvm::Function * >&visited,
+			       GType * emit_type)
+{
+	if (visited.count(f)) {
+		return;
+	}
+	visited.insert(f);
+
+	for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb) {
+		for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end();
+		     ++i) {
+			llvm::CallInst * call =
+			    llvm::dyn_cast < llvm::CallInst > (i);
+			if (!call) {
+				continue;
+			}
+
+			llvm::Function * callee = call->getCalledFunction();
+			if (!callee) {
+				continue;
+			}
+
+			if (!callee->isDeclaration()) {
+				_firtree_kernel_find_emit_type(callee, visited,
+							       emit_type);
+				continue;
+			}
+
+#if FIRTREE_LLVM_AT_LEAST_2_6
+			std::string name = callee->getName().str();
+#else
+			std::string name = callee->getName();
+#endif
+			GType call_type = G_TYPE_NONE;
+			if (name == "emit_f") {
+				call_type = G_TYPE_FLOAT;
+			} else if (name == "emit_i") {
+				call_type = G_TYPE_INT;
+			} else if (name == "emit_v2") {
+				call_type = FIRTREE_TYPE_VEC2;
+			} else if (name == "emit_v3") {
+				call_type = FIRTREE_TYPE_VEC3;
+			} else if (name == "emit_v4") {
+				call_type = FIRTREE_TYPE_VEC4;
+			} else {
+				continue;
+			}
+
+			if (*emit_type == G_TYPE_NONE) {
+				*emit_type = call_type;
+			} else if (*emit_type != call_type) {
+				*emit_type = G_TYPE_INVALID;
+			}
+		}
+	}
+}
+
+/**
+ * firtree_kernel_get_emit_type:
+ * @self:  A FirtreeKernel instance.
+ *
+ * A reduce kernel may emit() values of type float, int, vec2, vec3 or vec4.
+ * All of the emit() calls within a kernel must be of the same type so that
+ * the output may be stored compactly.
+ *
+ * Returns: The GType of values emitted by the kernel, G_TYPE_NONE if the
+ * kernel never emits a value or is not a reduce kernel and G_TYPE_INVALID if 
+ * the kernel emits values of more than one type.
+ */
+GType firtree_kernel_get_emit_type(FirtreeKernel * self)
+{
+	if (firtree_kernel_get_target(self) != FIRTREE_KERNEL_TARGET_REDUCE) {
+		return G_TYPE_NONE;
+	}
+
+	llvm::Function * f = firtree_kernel_get_function(self);
+	if (!f) {
+		return G_TYPE_NONE;
+	}
+
+	GType emit_type = G_TYPE_NONE;
+	std::set < llvm::Function * >visited;
+	_firtree_kernel_find_emit_type(f, visited, &emit_type);
+
+	return emit_type;
+}
+
+/**
+ * firtree_kernel_get_emit_size:
+ * @self:  A FirtreeKernel instance.
+ *
+ * Returns: The size, in bytes, of each value emitted by the kernel or 0 if
+ * firtree_kernel_get_emit_type() does not return a valid type.
+ */
+gsize firtree_kernel_get_emit_size(FirtreeKernel * self)
+{
+	GType emit_type = firtree_kernel_get_emit_type(self);
+
+	if (emit_type == G_TYPE_FLOAT) {
+		return sizeof(float);
+	} else if (emit_type == G_TYPE_INT) {
+		return sizeof(gint32);
+	} else if (emit_type == FIRTREE_TYPE_VEC2) {
+		return sizeof(FirtreeVec2);
+	} else if (emit_type == FIRTREE_TYPE_VEC3) {
+		return sizeof(FirtreeVec3);
+	} else if (emit_type == FIRTREE_TYPE_VEC4) {
+		return sizeof(FirtreeVec4);
+	}
+
+	return 0;
+}
+
 llvm::Function * firtree_kernel_get_function(FirtreeKernel * self)
 {
 	FirtreeKernelPrivate *p = GET_PRIVATE(self);
@@ -816,8 +1096,25 @@ firtree_kernel_implement_transform_function(FirtreeKernel * self,
 					    get(FIRTREE_LLVM_INT32_TY, arg_quark,
 						false), id_bb);
 			} else {
-				g_error
-				    ("Non-identity transforms not yet implemented.");
+				/* The transform is emitted as a call to
+				 * affine_transform() with constant arguments
+				 * which the engine folds with any enclosing
+				 * transforms before lowering. */
+				llvm::BasicBlock * trans_bb =
+				    llvm::BasicBlock::
+				    Create(FIRTREE_LLVM_CONTEXT "transform",
+					   transform_func);
+				llvm::Value * trans_val =
+				    firtree_engine_create_affine_transform_call
+				    (transform_func->getParent(), transform,
+				     const_cast < llvm::Value * >(input_vector),
+				     trans_bb);
+				llvm::ReturnInst::Create(FIRTREE_LLVM_CONTEXT
+							 trans_val, trans_bb);
+				sampler_switch->
+				    addCase(llvm::ConstantInt::
+					    get(FIRTREE_LLVM_INT32_TY, arg_quark,
+						false), trans_bb);
 			}
 
 			g_object_unref(transform);
@@ -926,6 +1223,47 @@ static void _firtree_kernel_aggressive_inline(llvm::Function * f)
 	PM.run(*m);
 }
 
+/* Append the values of the arguments of @self to @arguments. Sampler
+ * arguments are passed as their quark. */
+static void
+_firtree_kernel_append_argument_values(FirtreeKernel * self,
+				       std::vector < llvm::Value * >&arguments)
+{
+	guint n_arguments = 0;
+	GQuark *arg_list = firtree_kernel_list_arguments(self, &n_arguments);
+
+	for (guint arg_i = 0; arg_i < n_arguments; ++arg_i) {
+		GQuark arg_quark = arg_list[arg_i];
+		FirtreeKernelArgumentSpec *arg_spec =
+		    firtree_kernel_get_argument_spec(self, arg_quark);
+		g_assert(arg_spec);
+
+		if (!arg_spec->is_static) {
+			g_error
+			    ("FIXME: Non-static argument support not yet written.");
+		} else {
+			GValue *kernel_arg =
+			    firtree_kernel_get_argument_value(self,
+							      arg_quark);
+			g_assert(kernel_arg);
+
+			/* Can't use a switch here because the FIRTREE_TYPE_SAMPLER macro
+			 * doesn't expand to a constant. */
+			if (arg_spec->type == FIRTREE_TYPE_SAMPLER) {
+				llvm::Value * arg_quark_val =
+				    llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+							   arg_quark, false);
+				arguments.push_back(arg_quark_val);
+			} else {
+				arguments.
+				    push_back
+				    (firtree_engine_get_constant_for_kernel_argument
+				     (kernel_arg));
+			}
+		}
+	}
+}
+
 llvm::Function * firtree_kernel_create_overall_function(FirtreeKernel * self)
 {
 	if (!firtree_kernel_is_valid(self)) {
@@ -1067,36 +1405,7 @@ llvm::Function * firtree_kernel_create_overall_function(FirtreeKernel * self)
 		++ai;
 	}
 
-	for (guint arg_i = 0; arg_i < n_arguments; ++arg_i) {
-		GQuark arg_quark = arg_list[arg_i];
-		FirtreeKernelArgumentSpec *arg_spec =
-		    firtree_kernel_get_argument_spec(self, arg_quark);
-		g_assert(arg_spec);
-
-		if (!arg_spec->is_static) {
-			g_error
-			    ("FIXME: Non-static argument support not yet written.");
-		} else {
-			GValue *kernel_arg =
-			    firtree_kernel_get_argument_value(self,
-							      arg_quark);
-			g_assert(kernel_arg);
-
-			/* Can't use a switch here because the FIRTREE_TYPE_SAMPLER macro
-			 * doesn't expand to a constant. */
-			if (arg_spec->type == FIRTREE_TYPE_SAMPLER) {
-				llvm::Value * arg_quark_val =
-				    llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
-							   arg_quark, false);
-				arguments.push_back(arg_quark_val);
-			} else {
-				arguments.
-				    push_back
-				    (firtree_engine_get_constant_for_kernel_argument
-				     (kernel_arg));
-			}
-		}
-	}
+	_firtree_kernel_append_argument_values(self, arguments);
 
 	llvm::Value * function_call =
 	    llvm::CallInst::Create(new_kernel_func, arguments.begin(),
@@ -1120,5 +1429,568 @@ llvm::Function * firtree_kernel_create_overall_function(FirtreeKernel * self)
 	return f;
 }
 
+/* Return TRUE if every call to sample() in @m is of the form
+ * sample(s, samplerTransform(s, @dest_coord)). */
+static gboolean
+_firtree_kernel_only_samples_at_dest_coord(llvm::Module * m,
+					   llvm::Value * dest_coord)
+{
+	llvm::Function * sample_f = m->getFunction("sample_sv2");
+	llvm::Function * trans_f = m->getFunction("samplerTransform_sv2");
+
+	if (!sample_f) {
+		return TRUE;
+	}
+
+	for (llvm::Value::use_iterator i = sample_f->use_begin();
+	     i != sample_f->use_end(); ++i) {
+		llvm::CallInst * call = llvm::dyn_cast < llvm::CallInst > (*i);
+		if (!call || (call->getCalledFunction() != sample_f)) {
+			return FALSE;
+		}
+
+		/* Operand 0 is the callee. */
+		llvm::CallInst * coord =
+		    llvm::dyn_cast < llvm::CallInst > (call->getOperand(2));
+		if (!coord || !trans_f ||
+		    (coord->getCalledFunction() != trans_f)) {
+			return FALSE;
+		}
+
+		if ((coord->getOperand(1) != call->getOperand(1)) ||
+		    (coord->getOperand(2) != dest_coord)) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Wrap a copy of the kernel with its arguments substituted in, as in
+ * firtree_kernel_create_overall_function() but leaving sample() and
+ * samplerTransform() unimplemented, and inline it. The first argument of the
+ * returned function is destCoord(). Ownership of the function's module passes
+ * to the caller. Returns NULL if the kernel cannot be analysed. */
+static llvm::Function *_firtree_kernel_create_analysis_function(FirtreeKernel *
+								 self)
+{
+	if (!firtree_kernel_is_valid(self) ||
+	    (firtree_kernel_get_target(self) != FIRTREE_KERNEL_TARGET_RENDER)) {
+		return NULL;
+	}
+
+	llvm::Function * kernel_func = firtree_kernel_get_function(self);
+	if (!kernel_func) {
+		return NULL;
+	}
+
+	/* Non-static arguments cannot be substituted in. */
+	GQuark *args = firtree_kernel_list_arguments(self, NULL);
+	for (; args && *args; ++args) {
+		if (!firtree_kernel_get_argument_spec(self, *args)->is_static) {
+			return NULL;
+		}
+	}
+
+	llvm::Module * m = llvm::CloneModule(kernel_func->getParent());
+	llvm::Function * new_kernel_func =
+	    m->getFunction(kernel_func->getName());
+	g_assert(new_kernel_func);
+
+	llvm::Function * f = firtree_engine_create_sample_function_prototype(m);
+	llvm::BasicBlock * bb =
+	    llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT "entry", f);
+
+	std::vector < llvm::Value * >arguments;
+	arguments.push_back(f->arg_begin());
+	_firtree_kernel_append_argument_values(self, arguments);
+
+	llvm::Value * function_call =
+	    llvm::CallInst::Create(new_kernel_func, arguments.begin(),
+				   arguments.end(), "", bb);
+	llvm::ReturnInst::Create(FIRTREE_LLVM_CONTEXT function_call, bb);
+
+	_firtree_kernel_aggressive_inline(f);
+
+	return f;
+}
+
+static gboolean
+_firtree_kernel_compute_preserves_transparency(FirtreeKernel * self)
+{
+	llvm::Function * f = _firtree_kernel_create_analysis_function(self);
+	if (!f) {
+		return FALSE;
+	}
+
+	llvm::Module * m = f->getParent();
+	llvm::Value * dest_coord = f->arg_begin();
+
+	gboolean rv = _firtree_kernel_only_samples_at_dest_coord(m, dest_coord);
+
+	if (rv) {
+		/* Make every sample transparent and see if the kernel output
+		 * folds to transparent too. */
+		llvm::Function * sample_f = m->getFunction("sample_sv2");
+		if (sample_f) {
+			while (!sample_f->use_empty()) {
+				llvm::CallInst * call =
+				    llvm::cast < llvm::CallInst >
+				    (sample_f->use_back());
+				call->replaceAllUsesWith(llvm::Constant::
+							 getNullValue(call->
+								      getType
+								      ()));
+				call->eraseFromParent();
+			}
+		}
+
+		llvm::PassManager PM;
+		PM.add(new llvm::TargetData(m));
+		PM.add(llvm::createInstructionCombiningPass());
+		PM.add(llvm::createSCCPPass());
+		PM.add(llvm::createCFGSimplificationPass());
+		PM.add(llvm::createInstructionCombiningPass());
+		PM.run(*m);
+
+		rv = FALSE;
+		if (f->size() == 1) {
+			llvm::ReturnInst * ret = llvm::dyn_cast < llvm::ReturnInst >
+			    (f->getEntryBlock().getTerminator());
+			llvm::Constant * ret_val = ret ?
+			    llvm::dyn_cast < llvm::Constant >
+			    (ret->getReturnValue()) : NULL;
+			rv = ret_val && ret_val->isNullValue();
+		}
+	}
+
+	delete m;
+
+	return rv;
+}
+
+gboolean firtree_kernel_preserves_transparency(FirtreeKernel * self)
+{
+	FirtreeKernelPrivate *p = GET_PRIVATE(self);
+
+	if (p->preserves_transparency < 0) {
+		p->preserves_transparency =
+		    _firtree_kernel_compute_preserves_transparency(self) ? 1 : 0;
+	}
+
+	return p->preserves_transparency;
+}
+
+
+/* The number of taps assumed for a call to sample() inside a loop. */
+#define LOOP_TAP_ESTIMATE 8
+
+/* Return TRUE if @bb lies on a cycle in the control flow graph. */
+static gboolean _firtree_kernel_block_in_loop(llvm::BasicBlock * bb)
+{
+	std::set < llvm::BasicBlock * >visited;
+	std::vector < llvm::BasicBlock * >stack;
+
+	llvm::TerminatorInst * term = bb->getTerminator();
+	for (unsigned i = 0; term && (i < term->getNumSuccessors()); ++i) {
+		stack.push_back(term->getSuccessor(i));
+	}
+
+	while (!stack.empty()) {
+		llvm::BasicBlock * next = stack.back();
+		stack.pop_back();
+
+		if (next == bb) {
+			return TRUE;
+		}
+		if (!visited.insert(next).second) {
+			continue;
+		}
+
+		term = next->getTerminator();
+		for (unsigned i = 0; term && (i < term->getNumSuccessors());
+		     ++i) {
+			stack.push_back(term->getSuccessor(i));
+		}
+	}
+
+	return FALSE;
+}
+
+guint firtree_kernel_get_sample_count(FirtreeKernel * self, GQuark arg_name)
+{
+	llvm::Function * f = _firtree_kernel_create_analysis_function(self);
+	if (!f) {
+		return 0;
+	}
+
+	llvm::Module * m = f->getParent();
+	llvm::Function * sample_f = m->getFunction("sample_sv2");
+
+	guint rv = 0;
+	if (sample_f) {
+		std::set < llvm::Value * >coords;
+		for (llvm::Value::use_iterator i = sample_f->use_begin();
+		     i != sample_f->use_end(); ++i) {
+			llvm::CallInst * call =
+			    llvm::dyn_cast < llvm::CallInst > (*i);
+			if (!call) {
+				continue;
+			}
+
+			/* Operand 0 is the callee. */
+			llvm::ConstantInt * sampler_id =
+			    llvm::dyn_cast < llvm::ConstantInt >
+			    (call->getOperand(1));
+			if (!sampler_id ||
+			    (sampler_id->getZExtValue() != arg_name)) {
+				continue;
+			}
+
+			if (_firtree_kernel_block_in_loop(call->getParent())) {
+				rv += LOOP_TAP_ESTIMATE;
+			} else if (coords.insert(call->getOperand(2)).second) {
+				rv += 1;
+			}
+		}
+	}
+
+	delete m;
+
+	return rv;
+}
+
+/* Read a constant 2-vector from @value into @vec. Returns FALSE if @value
+ * is not a constant. */
+static gboolean
+_firtree_kernel_get_constant_vec2(llvm::Value * value, FirtreeVec2 * vec)
+{
+	if (llvm::isa < llvm::ConstantAggregateZero > (value)) {
+		vec->x = vec->y = 0.f;
+		return TRUE;
+	}
+
+	llvm::ConstantVector * cv =
+	    llvm::dyn_cast < llvm::ConstantVector > (value);
+	if (!cv || (cv->getNumOperands() != 2)) {
+		return FALSE;
+	}
+
+	float elements[2];
+	for (unsigned i = 0; i < 2; ++i) {
+		llvm::ConstantFP * element =
+		    llvm::dyn_cast < llvm::ConstantFP > (cv->getOperand(i));
+		if (!element) {
+			return FALSE;
+		}
+		elements[i] = element->getValueAPF().convertToFloat();
+	}
+
+	vec->x = elements[0];
+	vec->y = elements[1];
+	return TRUE;
+}
+
+/* Strip any additions and subtractions of constant 2-vectors from @value,
+ * accumulating the total offset in @offset. Returns what is left. */
+static llvm::Value *_firtree_kernel_strip_constant_offset(llvm::Value * value,
+							  FirtreeVec2 * offset)
+{
+	offset->x = offset->y = 0.f;
+
+	llvm::BinaryOperator * op;
+	while (NULL != (op = llvm::dyn_cast < llvm::BinaryOperator > (value))) {
+		float sign;
+		switch (op->getOpcode()) {
+		case llvm::Instruction::Add:
+#if FIRTREE_LLVM_AT_LEAST_2_6
+		case llvm::Instruction::FAdd:
+#endif
+			sign = 1.f;
+			break;
+		case llvm::Instruction::Sub:
+#if FIRTREE_LLVM_AT_LEAST_2_6
+		case llvm::Instruction::FSub:
+#endif
+			sign = -1.f;
+			break;
+		default:
+			return value;
+		}
+
+		FirtreeVec2 c;
+		if (_firtree_kernel_get_constant_vec2(op->getOperand(1), &c)) {
+			value = op->getOperand(0);
+		} else if ((sign > 0.f) &&
+			   _firtree_kernel_get_constant_vec2(op->getOperand(0),
+							     &c)) {
+			value = op->getOperand(1);
+		} else {
+			return value;
+		}
+
+		offset->x += sign * c.x;
+		offset->y += sign * c.y;
+	}
+
+	return value;
+}
+
+/* Return TRUE if @v is a whole number. */
+static gboolean _firtree_kernel_is_whole(float v)
+{
+	return floorf(v) == v;
+}
+
+/* Return TRUE if every call to sample() for the sampler @arg_name in @m is
+ * of the form sample(s, samplerTransform(s, @dest_coord + d) + e) for
+ * constant vectors d and e. The largest magnitudes of their components are
+ * written to @dest_radius and @sampler_radius. @whole_pixels is set to
+ * whether every component of every d and e is a whole number. */
+static gboolean
+_firtree_kernel_compute_sample_footprint(llvm::Module * m,
+					 llvm::Value * dest_coord,
+					 GQuark arg_name,
+					 FirtreeVec2 * sampler_radius,
+					 FirtreeVec2 * dest_radius,
+					 gboolean * whole_pixels)
+{
+	llvm::Function * sample_f = m->getFunction("sample_sv2");
+	llvm::Function * trans_f = m->getFunction("samplerTransform_sv2");
+
+	sampler_radius->x = sampler_radius->y = 0.f;
+	dest_radius->x = dest_radius->y = 0.f;
+	*whole_pixels = TRUE;
+
+	if (!sample_f) {
+		return TRUE;
+	}
+
+	for (llvm::Value::use_iterator i = sample_f->use_begin();
+	     i != sample_f->use_end(); ++i) {
+		llvm::CallInst * call = llvm::dyn_cast < llvm::CallInst > (*i);
+		if (!call || (call->getCalledFunction() != sample_f)) {
+			return FALSE;
+		}
+
+		/* Operand 0 is the callee. */
+		llvm::ConstantInt * sampler_id =
+		    llvm::dyn_cast < llvm::ConstantInt > (call->getOperand(1));
+		if (!sampler_id) {
+			return FALSE;
+		}
+		if (sampler_id->getZExtValue() != arg_name) {
+			continue;
+		}
+
+		FirtreeVec2 e, d;
+		llvm::CallInst * coord = llvm::dyn_cast < llvm::CallInst >
+		    (_firtree_kernel_strip_constant_offset
+		     (call->getOperand(2), &e));
+		if (!coord || !trans_f ||
+		    (coord->getCalledFunction() != trans_f) ||
+		    (coord->getOperand(1) != call->getOperand(1))) {
+			return FALSE;
+		}
+
+		if (_firtree_kernel_strip_constant_offset(coord->getOperand(2),
+							  &d) != dest_coord) {
+			return FALSE;
+		}
+
+		sampler_radius->x = MAX(sampler_radius->x, fabsf(e.x));
+		sampler_radius->y = MAX(sampler_radius->y, fabsf(e.y));
+		dest_radius->x = MAX(dest_radius->x, fabsf(d.x));
+		dest_radius->y = MAX(dest_radius->y, fabsf(d.y));
+
+		if (!_firtree_kernel_is_whole(d.x) ||
+		    !_firtree_kernel_is_whole(d.y) ||
+		    !_firtree_kernel_is_whole(e.x) ||
+		    !_firtree_kernel_is_whole(e.y)) {
+			*whole_pixels = FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void _firtree_kernel_footprint_destroy_func(gpointer footprint)
+{
+	g_slice_free(_FirtreeKernelFootprint, footprint);
+}
+
+/* Return the cached footprint of @arg_name, computing it if need be. */
+static _FirtreeKernelFootprint *_firtree_kernel_get_footprint(FirtreeKernel *
+							      self,
+							      GQuark arg_name)
+{
+	FirtreeKernelPrivate *p = GET_PRIVATE(self);
+
+	_FirtreeKernelFootprint *footprint = (_FirtreeKernelFootprint *)
+	    g_datalist_id_get_data(&p->footprint_list, arg_name);
+
+	if (!footprint) {
+		footprint = g_slice_new0(_FirtreeKernelFootprint);
+
+		llvm::Function * f =
+		    _firtree_kernel_create_analysis_function(self);
+		if (f) {
+			footprint->known =
+			    _firtree_kernel_compute_sample_footprint
+			    (f->getParent(), f->arg_begin(), arg_name,
+			     &footprint->sampler_radius,
+			     &footprint->dest_radius,
+			     &footprint->whole_pixels);
+			delete f->getParent();
+		}
+
+		g_datalist_id_set_data_full(&p->footprint_list, arg_name,
+					    footprint,
+					    _firtree_kernel_footprint_destroy_func);
+	}
+
+	return footprint;
+}
+
+gboolean
+firtree_kernel_get_sample_footprint(FirtreeKernel * self, GQuark arg_name,
+				    FirtreeVec2 * sampler_radius,
+				    FirtreeVec2 * dest_radius)
+{
+	_FirtreeKernelFootprint *footprint =
+	    _firtree_kernel_get_footprint(self, arg_name);
+
+	*sampler_radius = footprint->sampler_radius;
+	*dest_radius = footprint->dest_radius;
+
+	return footprint->known;
+}
+
+gboolean
+firtree_kernel_samples_whole_pixels(FirtreeKernel * self, GQuark arg_name)
+{
+	_FirtreeKernelFootprint *footprint =
+	    _firtree_kernel_get_footprint(self, arg_name);
+
+	return footprint->known && footprint->whole_pixels;
+}
+
+/* Return TRUE if element @lane of the vector @value is known to be 1. */
+static gboolean
+_firtree_kernel_lane_is_one(llvm::Value * value, unsigned lane, guint depth)
+{
+	/* Give up on long chains and cycles of PHI nodes. */
+	if (depth > 32) {
+		return FALSE;
+	}
+
+	if (llvm::ConstantVector * cv =
+	    llvm::dyn_cast < llvm::ConstantVector > (value)) {
+		llvm::ConstantFP * element =
+		    llvm::dyn_cast < llvm::ConstantFP > (cv->getOperand(lane));
+		return element && element->isExactlyValue(1.0);
+	}
+
+	if (llvm::InsertElementInst * insert =
+	    llvm::dyn_cast < llvm::InsertElementInst > (value)) {
+		llvm::ConstantInt * index =
+		    llvm::dyn_cast < llvm::ConstantInt > (insert->getOperand(2));
+		if (!index) {
+			return FALSE;
+		}
+		if (index->getZExtValue() != lane) {
+			return _firtree_kernel_lane_is_one(insert->getOperand(0),
+							   lane, depth + 1);
+		}
+		llvm::ConstantFP * element =
+		    llvm::dyn_cast < llvm::ConstantFP > (insert->getOperand(1));
+		return element && element->isExactlyValue(1.0);
+	}
+
+	if (llvm::ShuffleVectorInst * shuffle =
+	    llvm::dyn_cast < llvm::ShuffleVectorInst > (value)) {
+		int source = shuffle->getMaskValue(lane);
+		if (source < 0) {
+			return FALSE;
+		}
+		unsigned n_elements = llvm::cast < llvm::VectorType >
+		    (shuffle->getOperand(0)->getType())->getNumElements();
+		if ((unsigned)source < n_elements) {
+			return _firtree_kernel_lane_is_one(shuffle->getOperand(0),
+							   source, depth + 1);
+		}
+		return _firtree_kernel_lane_is_one(shuffle->getOperand(1),
+						   source - n_elements,
+						   depth + 1);
+	}
+
+	if (llvm::SelectInst * select =
+	    llvm::dyn_cast < llvm::SelectInst > (value)) {
+		return _firtree_kernel_lane_is_one(select->getTrueValue(),
+						   lane, depth + 1) &&
+		    _firtree_kernel_lane_is_one(select->getFalseValue(),
+						lane, depth + 1);
+	}
+
+	if (llvm::PHINode * phi = llvm::dyn_cast < llvm::PHINode > (value)) {
+		for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+			if (!_firtree_kernel_lane_is_one(phi->getIncomingValue(i),
+							 lane, depth + 1)) {
+				return FALSE;
+			}
+		}
+		return phi->getNumIncomingValues() > 0;
+	}
+
+	return FALSE;
+}
+
+static gboolean _firtree_kernel_compute_is_opaque(FirtreeKernel * self)
+{
+	llvm::Function * f = _firtree_kernel_create_analysis_function(self);
+	if (!f) {
+		return FALSE;
+	}
+
+	llvm::Module * m = f->getParent();
+
+	/* Fold away as much of the computation of the alpha component as
+	 * possible. Samples are left in place since nothing is known about
+	 * their values. */
+	llvm::PassManager PM;
+	PM.add(new llvm::TargetData(m));
+	PM.add(llvm::createInstructionCombiningPass());
+	PM.add(llvm::createSCCPPass());
+	PM.add(llvm::createCFGSimplificationPass());
+	PM.add(llvm::createInstructionCombiningPass());
+	PM.run(*m);
+
+	gboolean rv = TRUE;
+	for (llvm::Function::iterator bb = f->begin(); rv && (bb != f->end());
+	     ++bb) {
+		llvm::ReturnInst * ret =
+		    llvm::dyn_cast < llvm::ReturnInst > (bb->getTerminator());
+		if (ret) {
+			rv = _firtree_kernel_lane_is_one(ret->getReturnValue(),
+							 3, 0);
+		}
+	}
+
+	delete m;
+
+	return rv;
+}
+
+gboolean firtree_kernel_is_opaque(FirtreeKernel * self)
+{
+	FirtreeKernelPrivate *p = GET_PRIVATE(self);
+
+	if (p->is_opaque < 0) {
+		p->is_opaque = _firtree_kernel_compute_is_opaque(self) ? 1 : 0;
+	}
+
+	return p->is_opaque;
+}
+
 /* vim:sw=8:ts=8:tw=78:noet:cindent
  */
@@ -22,6 +22,8 @@
 
 #include <glib-object.h>
 
+#include <firtree/firtree-vector.h>
+
 G_BEGIN_DECLS
 
 #define FIRTREE_TYPE_KERNEL firtree_kernel_get_type()
@@ -71,6 +73,9 @@ struct _FirtreeKernelClass
 	void 		(*module_changed) 	(FirtreeKernel 	*kernel);
 
 	void 		(*contents_changed) 	(FirtreeKernel 	*kernel);
+
+	void 		(*region_changed) 	(FirtreeKernel 	*kernel,
+						 FirtreeVec4	*region);
 };
 
 GType 		  firtree_kernel_get_type		(void);
@@ -117,6 +122,10 @@ GType		  firtree_kernel_get_return_type	(FirtreeKernel	 *self);
 
 FirtreeKernelTarget  	firtree_kernel_get_target	(FirtreeKernel	 *self);
 
+GType		  firtree_kernel_get_emit_type		(FirtreeKernel	 *self);
+
+gsize		  firtree_kernel_get_emit_size		(FirtreeKernel	 *self);
+
 G_END_DECLS
 
 #endif				/* __FIRTREE_KERNEL_H__ */
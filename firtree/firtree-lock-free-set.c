@@ -19,6 +19,9 @@
 
 #include "firtree-lock-free-set.h"
 
+#include <common/system-info.h>
+#include <common/threading.h>
+
 /**
  * SECTION:firtree-lock-free-set
  * @short_description: Lock-free data structure for storing a equal sized
@@ -30,8 +33,10 @@
  * assumes that the contents of memory the element value is copied from does
  * not change over the lifetime of the firtree_lock_free_set_add_element() call.
  *
- * Once added, an element cannot be removed. The FirtreeLockFreeSet structure is designed
- * to only ever be added to.
+ * Once added, an element cannot be removed individually. The FirtreeLockFreeSet
+ * structure is designed to only ever be added to although all elements may be
+ * discarded at once via firtree_lock_free_set_clear() which allows a set to be
+ * re-used without releasing its memory.
  *
  * Concurrent access is only supported by the firtree_lock_free_set_add_element() call.
  */
@@ -53,6 +58,15 @@ struct _FirtreeLockFreeSet {
 	gpointer tail;
 	gsize element_size;
 	gint element_count;
+
+	/* If max_element_count is positive, elements are only added while
+	 * reserved_count is less than it. */
+	gint max_element_count;
+	gint reserved_count;
+
+	/* Nodes released by firtree_lock_free_set_clear() which are
+	 * waiting to be re-used. */
+	gpointer free_list;
 };
 
 #define LF_NODE_TO_DATA(node) ((gpointer)((guint8*)(node)+sizeof(FirtreeLockFreeSetNode)))
@@ -62,7 +76,20 @@ static inline
     FirtreeLockFreeSetNode *
 _firtree_lock_free_set_new_node(FirtreeLockFreeSet * set)
 {
-	FirtreeLockFreeSetNode *node = (FirtreeLockFreeSetNode *)
+	/* Try to pop a node from the free list first. Nodes are only ever
+	 * pushed onto the free list by firtree_lock_free_set_clear() which
+	 * is not thread-safe so there is no ABA problem here. */
+	FirtreeLockFreeSetNode *node = g_atomic_pointer_get(&(set->free_list));
+	while (node != NULL) {
+		if (g_atomic_pointer_compare_and_exchange
+		    (&(set->free_list), node, node->next)) {
+			node->next = NULL;
+			return node;
+		}
+		node = g_atomic_pointer_get(&(set->free_list));
+	}
+
+	node = (FirtreeLockFreeSetNode *)
 	    g_slice_alloc(set->element_size + sizeof(FirtreeLockFreeSetNode));
 	node->next = NULL;
 	return node;
@@ -82,6 +109,9 @@ FirtreeLockFreeSet *firtree_lock_free_set_new(gsize element_size)
 
 	set->element_size = element_size;
 	g_atomic_int_set(&(set->element_count), 0);
+	g_atomic_int_set(&(set->max_element_count), 0);
+	g_atomic_int_set(&(set->reserved_count), 0);
+	g_atomic_pointer_set(&(set->free_list), NULL);
 
 	/* We always keep an element 'in hand' to copy to. This makes the
 	 * CAS locking simpler. */
@@ -109,10 +139,119 @@ void firtree_lock_free_set_free(FirtreeLockFreeSet * set)
 					       set->head, 0);
 	}
 
-	set->head = set->tail = NULL;
+	if (set->free_list != NULL) {
+		g_slice_free_chain_with_offset(set->element_size +
+					       sizeof(FirtreeLockFreeSetNode),
+					       set->free_list, 0);
+	}
+
+	set->head = set->tail = set->free_list = NULL;
 	g_free(set);
 }
 
+/**
+ * firtree_lock_free_set_clear:
+ * @set: A FirtreeLockFreeSet structure.
+ *
+ * Remove all elements from @set. The memory used by the elements is retained
+ * by the set and re-used by subsequent calls to
+ * firtree_lock_free_set_add_element() so that a set which is repeatedly
+ * filled and cleared does not churn the allocator.
+ *
+ * Note: This call is not thread-safe and must not be made concurrently with
+ * any other call on @set.
+ */
+void firtree_lock_free_set_clear(FirtreeLockFreeSet * set)
+{
+	g_assert(set != NULL);
+
+	if (firtree_lock_free_set_get_element_count(set) == 0) {
+		return;
+	}
+
+	/* The chain runs from head to the tail node 'in hand'. Splice the
+	 * whole chain onto the front of the free list. */
+	FirtreeLockFreeSetNode *tail = set->tail;
+	tail->next = set->free_list;
+	set->free_list = set->head;
+
+	/* Take a fresh node 'in hand'. */
+	FirtreeLockFreeSetNode *node = _firtree_lock_free_set_new_node(set);
+	g_atomic_pointer_set(&(set->head), node);
+	g_atomic_pointer_set(&(set->tail), node);
+	g_atomic_int_set(&(set->element_count), 0);
+	g_atomic_int_set(&(set->reserved_count), 0);
+}
+
+/**
+ * firtree_lock_free_set_get_element_size:
+ * @set: A FirtreeLockFreeSet structure.
+ *
+ * Returns: The size, in bytes, of each element of @set as passed to
+ * firtree_lock_free_set_new().
+ */
+gsize firtree_lock_free_set_get_element_size(FirtreeLockFreeSet * set)
+{
+	return set->element_size;
+}
+
+/**
+ * firtree_lock_free_set_set_max_element_count:
+ * @set: A FirtreeLockFreeSet structure.
+ * @max_element_count: The maximum number of elements or 0 for no limit.
+ *
+ * Limit the number of elements which may be added to @set. Once the set holds
+ * @max_element_count elements, subsequent calls to
+ * firtree_lock_free_set_add_element() silently discard their element. The
+ * limit is exact even when elements are added concurrently.
+ *
+ * Note: This call is not thread-safe and must not be made concurrently with
+ * any other call on @set.
+ */
+void
+firtree_lock_free_set_set_max_element_count(FirtreeLockFreeSet * set,
+					    gint max_element_count)
+{
+	g_assert(set != NULL);
+
+	g_atomic_int_set(&(set->max_element_count), MAX(0, max_element_count));
+	g_atomic_int_set(&(set->reserved_count),
+			 firtree_lock_free_set_get_element_count(set));
+}
+
+/**
+ * firtree_lock_free_set_get_max_element_count:
+ * @set: A FirtreeLockFreeSet structure.
+ *
+ * Returns: The maximum number of elements @set may hold or 0 if there is no
+ * limit.
+ */
+gint firtree_lock_free_set_get_max_element_count(FirtreeLockFreeSet * set)
+{
+	return g_atomic_int_get(&(set->max_element_count));
+}
+
+/**
+ * firtree_lock_free_set_is_full:
+ * @set: A FirtreeLockFreeSet structure.
+ *
+ * Determine if @set has reached the limit set by
+ * firtree_lock_free_set_set_max_element_count(). This call is thread-safe and
+ * is cheap enough to poll periodically from code which adds elements.
+ *
+ * Returns: TRUE if no more elements may be added to @set.
+ */
+gboolean firtree_lock_free_set_is_full(FirtreeLockFreeSet * set)
+{
+	gint max_element_count = g_atomic_int_get(&(set->max_element_count));
+
+	if (max_element_count <= 0) {
+		return FALSE;
+	}
+
+	return g_atomic_int_get(&(set->reserved_count)) >= max_element_count;
+}
+
 /**
  * firtree_lock_free_set_add_element:
  * @set: A FirtreeLockFreeSet structure.
@@ -120,6 +259,8 @@ void firtree_lock_free_set_free(FirtreeLockFreeSet * set)
  *
  * A new element is added to the set and it's data is copied from the @element
  * pointer. The number of bytes copied is specified in the firtree_lock_free_set_new() call.
+ * If the set is full (see firtree_lock_free_set_set_max_element_count()) the
+ * element is discarded.
  *
  * Note: This is the only method on FirtreeLockFreeSet which is thread-safe. Other calls must
  * be surrounded by appropriate locking if concurrent access is expected.
@@ -127,6 +268,18 @@ void firtree_lock_free_set_free(FirtreeLockFreeSet * set)
 void
 firtree_lock_free_set_add_element(FirtreeLockFreeSet * set, gpointer element)
 {
+	/* If the set is bounded, reserve a slot for this element. */
+	gint max_element_count = g_atomic_int_get(&(set->max_element_count));
+	if (max_element_count > 0) {
+		if (g_atomic_int_get(&(set->reserved_count)) >= max_element_count) {
+			return;
+		}
+		if (g_atomic_int_exchange_and_add(&(set->reserved_count), 1) >=
+		    max_element_count) {
+			return;
+		}
+	}
+
 	/* Create a new node 'in hand' which will be used in the next call. */
 	FirtreeLockFreeSetNode *new_node = _firtree_lock_free_set_new_node(set);
 
@@ -209,5 +362,337 @@ gint firtree_lock_free_set_get_element_count(FirtreeLockFreeSet * set)
 	return g_atomic_int_get(&(set->element_count));
 }
 
+/* Discard all but the first @n_keep elements of @set. @n_keep must be at
+ * least one and less than the number of elements in @set. */
+static void
+_firtree_lock_free_set_truncate(FirtreeLockFreeSet * set, gint n_keep)
+{
+	FirtreeLockFreeSetNode *tail = set->tail;
+	FirtreeLockFreeSetNode *last = set->head;
+	gint i;
+
+	for (i = 1; i < n_keep; ++i) {
+		last = last->next;
+	}
+
+	/* The node after the last kept one becomes the new node 'in hand'
+	 * and the remainder go onto the free list. */
+	FirtreeLockFreeSetNode *in_hand = last->next;
+	if (in_hand != tail) {
+		tail->next = set->free_list;
+		set->free_list = in_hand->next;
+	}
+	in_hand->next = NULL;
+
+	set->tail = in_hand;
+	g_atomic_int_set(&(set->element_count), n_keep);
+	g_atomic_int_set(&(set->reserved_count), n_keep);
+}
+
+/**
+ * firtree_lock_free_set_append_set:
+ * @dest: A FirtreeLockFreeSet structure.
+ * @src: A FirtreeLockFreeSet structure with the same element size as @dest.
+ *
+ * Move all the elements of @src onto the end of @dest leaving @src empty. The
+ * elements of @src keep their relative order and follow those already in
+ * @dest. This takes constant time unless @dest has a maximum element count
+ * which @src would exceed, in which case the excess elements of @src are
+ * discarded.
+ *
+ * Note: This call is not thread-safe and must not be made concurrently with
+ * any other call on @dest or @src.
+ */
+void
+firtree_lock_free_set_append_set(FirtreeLockFreeSet * dest,
+				 FirtreeLockFreeSet * src)
+{
+	g_assert(dest != NULL);
+	g_assert(src != NULL);
+	g_assert(dest->element_size == src->element_size);
+
+	gint n_src = firtree_lock_free_set_get_element_count(src);
+	if (n_src == 0) {
+		return;
+	}
+
+	gint n_dest = firtree_lock_free_set_get_element_count(dest);
+	gint max_element_count = dest->max_element_count;
+	if (max_element_count > 0) {
+		gint remaining = max_element_count - n_dest;
+		if (remaining <= 0) {
+			firtree_lock_free_set_clear(src);
+			return;
+		}
+		if (n_src > remaining) {
+			_firtree_lock_free_set_truncate(src, remaining);
+			n_src = remaining;
+		}
+	}
+
+	/* Move the first element of src into the node 'in hand' of dest and
+	 * hang the rest of src's chain off it. */
+	FirtreeLockFreeSetNode *dest_in_hand = dest->tail;
+	FirtreeLockFreeSetNode *src_head = src->head;
+	memcpy(LF_NODE_TO_DATA(dest_in_hand), LF_NODE_TO_DATA(src_head),
+	       dest->element_size);
+	dest_in_hand->next = src_head->next;
+	dest->tail = src->tail;
+	g_atomic_int_set(&(dest->element_count), n_dest + n_src);
+	g_atomic_int_set(&(dest->reserved_count), n_dest + n_src);
+
+	/* The old head of src becomes its node 'in hand'. */
+	src_head->next = NULL;
+	src->head = src->tail = src_head;
+	g_atomic_int_set(&(src->element_count), 0);
+	g_atomic_int_set(&(src->reserved_count), 0);
+}
+
+typedef struct {
+	GCompareDataFunc compare;
+	gpointer user_data;
+
+	FirtreeLockFreeSetNode **nodes;
+	FirtreeLockFreeSetNode **scratch;
+	gint n_nodes;
+
+	/* The sorted run length used for the current chunk/merge pass. */
+	gint run_length;
+
+	/* For unique sorting, a flag per node marking duplicates. */
+	guint8 *is_duplicate;
+} FirtreeLockFreeSetSortContext;
+
+static gint
+_firtree_lock_free_set_node_compare(gconstpointer a, gconstpointer b,
+				    gpointer data)
+{
+	FirtreeLockFreeSetSortContext *context =
+	    (FirtreeLockFreeSetSortContext *) data;
+	return context->compare(LF_NODE_TO_DATA(*(FirtreeLockFreeSetNode **) a),
+				LF_NODE_TO_DATA(*(FirtreeLockFreeSetNode **) b),
+				context->user_data);
+}
+
+/* Stably merge the sorted ranges [@lo, @mid) and [@mid, @hi) of @in into
+ * the same range of @out. An element of the second range is only taken
+ * first if it is strictly less than that of the first. */
+static void
+_firtree_lock_free_set_merge(FirtreeLockFreeSetNode ** in,
+			     FirtreeLockFreeSetNode ** out,
+			     gint lo, gint mid, gint hi,
+			     FirtreeLockFreeSetSortContext * context)
+{
+	gint a = lo, b = mid, o = lo;
+
+	while ((a < mid) && (b < hi)) {
+		if (_firtree_lock_free_set_node_compare(&(in[b]), &(in[a]),
+							context) < 0) {
+			out[o++] = in[b++];
+		} else {
+			out[o++] = in[a++];
+		}
+	}
+	while (a < mid) {
+		out[o++] = in[a++];
+	}
+	while (b < hi) {
+		out[o++] = in[b++];
+	}
+}
+
+/* The length of the blocks insertion sorted before merging. */
+#define SORT_INSERTION_LENGTH 16
+
+/* Sort run number @i in place. The merge passes rely on each run keeping
+ * equal elements in their original order. g_qsort_with_data() only
+ * guarantees that from GLib 2.32 and so the run is merge sorted here,
+ * using the corresponding range of the scratch array. */
+static void
+_firtree_lock_free_set_sort_run(guint i,
+				FirtreeLockFreeSetSortContext * context)
+{
+	gint start = i * context->run_length;
+	gint n = MIN(context->run_length, context->n_nodes - start);
+	FirtreeLockFreeSetNode **src = context->nodes + start;
+	FirtreeLockFreeSetNode **dst = context->scratch + start;
+	gint block, j, width;
+
+	/* Insertion sort short blocks. Elements only move past strictly
+	 * greater ones. */
+	for (block = 0; block < n; block += SORT_INSERTION_LENGTH) {
+		gint end = MIN(block + SORT_INSERTION_LENGTH, n);
+		for (j = block + 1; j < end; ++j) {
+			FirtreeLockFreeSetNode *node = src[j];
+			gint k = j;
+			while ((k > block) &&
+			       (_firtree_lock_free_set_node_compare
+				(&node, &(src[k - 1]), context) < 0)) {
+				src[k] = src[k - 1];
+				--k;
+			}
+			src[k] = node;
+		}
+	}
+
+	/* Merge the blocks pairwise, alternating between the arrays. */
+	for (width = SORT_INSERTION_LENGTH; width < n; width *= 2) {
+		gint lo;
+		for (lo = 0; lo < n; lo += 2 * width) {
+			_firtree_lock_free_set_merge(src, dst, lo,
+						     MIN(lo + width, n),
+						     MIN(lo + 2 * width, n),
+						     context);
+		}
+
+		FirtreeLockFreeSetNode **tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != context->nodes + start) {
+		memcpy(context->nodes + start, src,
+		       n * sizeof(FirtreeLockFreeSetNode *));
+	}
+}
+
+/* Merge runs 2*@i and 2*@i+1 from nodes into scratch. The merge is stable. */
+static void
+_firtree_lock_free_set_merge_runs(guint i,
+				  FirtreeLockFreeSetSortContext * context)
+{
+	gint start = 2 * i * context->run_length;
+	gint mid = MIN(start + context->run_length, context->n_nodes);
+	gint end = MIN(start + 2 * context->run_length, context->n_nodes);
+
+	_firtree_lock_free_set_merge(context->nodes, context->scratch,
+				     start, mid, end, context);
+}
+
+/* Mark duplicates within run @i of the sorted nodes. */
+static void
+_firtree_lock_free_set_mark_duplicates(guint i,
+				       FirtreeLockFreeSetSortContext * context)
+{
+	gint start = MAX(1, i * context->run_length);
+	gint end = MIN((i + 1) * context->run_length, context->n_nodes);
+	gint j;
+
+	for (j = start; j < end; ++j) {
+		context->is_duplicate[j] =
+		    (_firtree_lock_free_set_node_compare(&(context->nodes[j - 1]),
+							 &(context->nodes[j]),
+							 context) == 0);
+	}
+}
+
+/**
+ * firtree_lock_free_set_sort:
+ * @set: A FirtreeLockFreeSet structure.
+ * @compare: A function which compares two elements.
+ * @user_data: Data to pass to @compare.
+ * @unique: If TRUE, only the first of each run of equal elements is kept.
+ *
+ * Sort the elements of @set in place according to @compare. The sort is
+ * stable and the work is spread over the available CPU cores. Elements are
+ * not copied; the set is re-linked in sorted order.
+ *
+ * @compare may be called concurrently from multiple threads.
+ *
+ * Note: This call is not thread-safe and must not be made concurrently with
+ * any other call on @set.
+ */
+void
+firtree_lock_free_set_sort(FirtreeLockFreeSet * set,
+			   GCompareDataFunc compare, gpointer user_data,
+			   gboolean unique)
+{
+	g_assert(set != NULL);
+	g_assert(compare != NULL);
+
+	gint n_nodes = firtree_lock_free_set_get_element_count(set);
+	if (n_nodes < 2) {
+		return;
+	}
+
+	FirtreeLockFreeSetSortContext context;
+	context.compare = compare;
+	context.user_data = user_data;
+	context.n_nodes = n_nodes;
+	context.nodes = g_new(FirtreeLockFreeSetNode *, n_nodes);
+	context.scratch = g_new(FirtreeLockFreeSetNode *, n_nodes);
+	context.is_duplicate = NULL;
+
+	/* Gather the nodes. */
+	FirtreeLockFreeSetNode *tail = set->tail;
+	FirtreeLockFreeSetNode *node = set->head;
+	gint i;
+	for (i = 0; i < n_nodes; ++i) {
+		context.nodes[i] = node;
+		node = node->next;
+	}
+	g_assert(node == tail);
+
+	/* Sort one run per core and then merge runs pairwise in parallel. */
+	guint n_runs = MAX(1, system_info_cpu_cores());
+	context.run_length = (n_nodes + n_runs - 1) / n_runs;
+	n_runs = (n_nodes + context.run_length - 1) / context.run_length;
+	threading_apply(n_runs,
+			(ThreadingApplyFunc) _firtree_lock_free_set_sort_run,
+			&context);
+
+	while (context.run_length < n_nodes) {
+		guint n_merges =
+		    (n_nodes + 2 * context.run_length -
+		     1) / (2 * context.run_length);
+		threading_apply(n_merges, (ThreadingApplyFunc)
+				_firtree_lock_free_set_merge_runs, &context);
+
+		FirtreeLockFreeSetNode **tmp = context.nodes;
+		context.nodes = context.scratch;
+		context.scratch = tmp;
+		context.run_length *= 2;
+	}
+
+	if (unique) {
+		context.is_duplicate = g_new0(guint8, n_nodes);
+		n_runs = MAX(1, system_info_cpu_cores());
+		context.run_length = (n_nodes + n_runs - 1) / n_runs;
+		n_runs = (n_nodes + context.run_length - 1) / context.run_length;
+		threading_apply(n_runs, (ThreadingApplyFunc)
+				_firtree_lock_free_set_mark_duplicates,
+				&context);
+	}
+
+	/* Re-link the set in sorted order. Duplicates go onto the free list. */
+	FirtreeLockFreeSetNode *head = NULL;
+	FirtreeLockFreeSetNode *last = NULL;
+	gint n_kept = 0;
+	for (i = 0; i < n_nodes; ++i) {
+		node = context.nodes[i];
+		if (context.is_duplicate && context.is_duplicate[i]) {
+			node->next = set->free_list;
+			set->free_list = node;
+			continue;
+		}
+		if (last) {
+			last->next = node;
+		} else {
+			head = node;
+		}
+		last = node;
+		++n_kept;
+	}
+	last->next = tail;
+
+	set->head = head;
+	g_atomic_int_set(&(set->element_count), n_kept);
+	g_atomic_int_set(&(set->reserved_count), n_kept);
+
+	g_free(context.nodes);
+	g_free(context.scratch);
+	g_free(context.is_duplicate);
+}
+
 /* vim:sw=8:ts=8:tw=78:noet:cindent
  */
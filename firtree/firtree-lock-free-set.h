@@ -30,6 +30,8 @@ FirtreeLockFreeSet 	*firtree_lock_free_set_new	(gsize element_size);
 
 void			 firtree_lock_free_set_free	(FirtreeLockFreeSet 	*set);
 
+void			 firtree_lock_free_set_clear	(FirtreeLockFreeSet 	*set);
+
 void			 firtree_lock_free_set_add_element
 							(FirtreeLockFreeSet 	*set,
 							 gpointer		 element);
@@ -44,6 +46,27 @@ gpointer		 firtree_lock_free_set_get_next_element
 gint			 firtree_lock_free_set_get_element_count
 							(FirtreeLockFreeSet 	*set);
 
+gsize			 firtree_lock_free_set_get_element_size
+							(FirtreeLockFreeSet 	*set);
+
+void			 firtree_lock_free_set_set_max_element_count
+							(FirtreeLockFreeSet 	*set,
+							 gint			 max_element_count);
+
+gint			 firtree_lock_free_set_get_max_element_count
+							(FirtreeLockFreeSet 	*set);
+
+gboolean		 firtree_lock_free_set_is_full	(FirtreeLockFreeSet 	*set);
+
+void			 firtree_lock_free_set_append_set
+							(FirtreeLockFreeSet 	*dest,
+							 FirtreeLockFreeSet 	*src);
+
+void			 firtree_lock_free_set_sort	(FirtreeLockFreeSet 	*set,
+							 GCompareDataFunc	 compare,
+							 gpointer		 user_data,
+							 gboolean		 unique);
+
 G_END_DECLS
 
 #endif				/* __FIRTREE_LOCK_FREE_H__ */
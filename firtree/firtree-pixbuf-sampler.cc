@@ -29,6 +29,7 @@
 #include <common/uuid.h>
 
 #include "internal/firtree-engine-intl.hh"
+#include "internal/firtree-image-pyramid-intl.hh"
 #include "internal/firtree-sampler-intl.hh"
 #include "firtree-pixbuf-sampler.h"
 #include "firtree-types.h"
@@ -40,6 +41,9 @@
  *
  * A FirtreePixbufSampler is a FirtreeSampler which knows how to sample from
  * a GdkPixbuf.
+ *
+ * Shrunken renders of large pixbufs can be made faster and less aliased by
+ * enabling the image pyramid via firtree_pixbuf_sampler_set_use_pyramid().
  */
 
 /**
@@ -62,8 +66,9 @@ G_DEFINE_TYPE(FirtreePixbufSampler, firtree_pixbuf_sampler,
 
 struct _FirtreePixbufSamplerPrivate {
 	GdkPixbuf *pixbuf;
-	gboolean do_interp;
+	FirtreeInterpolationMode interp_mode;
 	 llvm::Function * cached_function;
+	FirtreeImagePyramid *pyramid;
 };
 
 llvm::Function *
@@ -103,6 +108,18 @@ _firtree_pixbuf_sampler_invalidate_llvm_cache(FirtreePixbufSampler * self)
 	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
 }
 
+/* the pyramid level depends on the transform so re-generate the sample
+ * function when it changes. */
+static void firtree_pixbuf_sampler_transform_changed(FirtreeSampler * self)
+{
+	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
+	if (p && (p->pyramid ||
+		  firtree_engine_interpolation_mode_is_filtered(p->interp_mode))) {
+		_firtree_pixbuf_sampler_invalidate_llvm_cache
+		    (FIRTREE_PIXBUF_SAMPLER(self));
+	}
+}
+
 static void firtree_pixbuf_sampler_dispose(GObject * object)
 {
 	G_OBJECT_CLASS(firtree_pixbuf_sampler_parent_class)->dispose(object);
@@ -114,6 +131,13 @@ static void firtree_pixbuf_sampler_dispose(GObject * object)
 	/* dispose of any LLVM modules we might have. */
 	_firtree_pixbuf_sampler_invalidate_llvm_cache((FirtreePixbufSampler *)
 						      object);
+
+	/* dispose of any pyramid levels. */
+	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(object);
+	if (p->pyramid) {
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
 }
 
 static FirtreeSamplerIntlVTable _firtree_pixbuf_sampler_class_vtable;
@@ -130,6 +154,8 @@ static void firtree_pixbuf_sampler_class_init(FirtreePixbufSamplerClass * klass)
 	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
 
 	sampler_class->get_extent = firtree_puxbuf_surface_sampler_get_extent;
+	sampler_class->transform_changed =
+	    firtree_pixbuf_sampler_transform_changed;
 
 	sampler_class->intl_vtable = &_firtree_pixbuf_sampler_class_vtable;
 
@@ -141,8 +167,9 @@ static void firtree_pixbuf_sampler_init(FirtreePixbufSampler * self)
 {
 	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
 	p->pixbuf = NULL;
-	p->do_interp = FALSE;
+	p->interp_mode = FIRTREE_INTERPOLATION_NEAREST;
 	p->cached_function = NULL;
+	p->pyramid = NULL;
 }
 
 /**
@@ -189,6 +216,9 @@ firtree_pixbuf_sampler_set_pixbuf(FirtreePixbufSampler * self,
 	}
 
 	_firtree_pixbuf_sampler_invalidate_llvm_cache(self);
+	if (p->pyramid) {
+		firtree_image_pyramid_reset(p->pyramid);
+	}
 
 	firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
 }
@@ -225,7 +255,7 @@ gboolean
 firtree_pixbuf_sampler_get_do_interpolation(FirtreePixbufSampler * self)
 {
 	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
-	return p->do_interp;
+	return p->interp_mode != FIRTREE_INTERPOLATION_NEAREST;
 }
 
 /**
@@ -234,19 +264,105 @@ firtree_pixbuf_sampler_get_do_interpolation(FirtreePixbufSampler * self)
  * @do_interpolation: A flag indicating if interpolation is performed.
  *
  * Set a flag which indicates if the sampler should attempt linear interpolation
- * of the pixel values.
+ * of the pixel values. This selects either FIRTREE_INTERPOLATION_LINEAR or
+ * FIRTREE_INTERPOLATION_NEAREST as the interpolation mode.
  */
 void
 firtree_pixbuf_sampler_set_do_interpolation(FirtreePixbufSampler * self,
 					    gboolean do_interpolation)
+{
+	firtree_pixbuf_sampler_set_interpolation_mode(self, do_interpolation ?
+	    FIRTREE_INTERPOLATION_LINEAR : FIRTREE_INTERPOLATION_NEAREST);
+}
+
+/**
+ * firtree_pixbuf_sampler_get_interpolation_mode:
+ * @self:  A FirtreePixbufSampler.
+ *
+ * Get the method used to find values between pixels. See
+ * firtree_pixbuf_sampler_set_interpolation_mode().
+ *
+ * Returns: The interpolation mode.
+ */
+FirtreeInterpolationMode
+firtree_pixbuf_sampler_get_interpolation_mode(FirtreePixbufSampler * self)
+{
+	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
+	return p->interp_mode;
+}
+
+/**
+ * firtree_pixbuf_sampler_set_interpolation_mode:
+ * @self:  A FirtreePixbufSampler.
+ * @mode: The interpolation mode.
+ *
+ * Set the method used to find values between pixels. The bicubic and
+ * Lanczos modes filter the pixbuf with a separable kernel which is widened
+ * when the sampler's transform is a pure scale which shrinks the pixbuf.
+ * Shrinking by more than a factor of eight should be combined with the image
+ * pyramid.
+ */
+void
+firtree_pixbuf_sampler_set_interpolation_mode(FirtreePixbufSampler * self,
+					      FirtreeInterpolationMode mode)
 {
 	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
-	if (do_interpolation != p->do_interp) {
-		p->do_interp = do_interpolation;
+	if (mode != p->interp_mode) {
+		p->interp_mode = mode;
 		_firtree_pixbuf_sampler_invalidate_llvm_cache(self);
 	}
 }
 
+/**
+ * firtree_pixbuf_sampler_get_use_pyramid:
+ * @self:  A FirtreePixbufSampler.
+ *
+ * Get a flag which indicates if the sampler samples from an image pyramid.
+ * See firtree_pixbuf_sampler_set_use_pyramid().
+ *
+ * Returns: A flag indicating if an image pyramid is used.
+ */
+gboolean firtree_pixbuf_sampler_get_use_pyramid(FirtreePixbufSampler * self)
+{
+	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
+	return p->pyramid != NULL;
+}
+
+/**
+ * firtree_pixbuf_sampler_set_use_pyramid:
+ * @self:  A FirtreePixbufSampler.
+ * @use_pyramid: A flag indicating if an image pyramid is used.
+ *
+ * Set a flag which indicates if the sampler should sample from an image
+ * pyramid. When set, the sampler samples from a copy of the pixbuf which
+ * has been box-filtered down by a power of two chosen so that one pixel of
+ * the copy is no larger than the area the sampler's transform maps an
+ * output pixel onto. Copies are built the first time they are needed.
+ *
+ * Since copies are taken, the pixbuf must be passed to
+ * firtree_pixbuf_sampler_set_pixbuf() again after modifying it for the
+ * changes to be seen.
+ */
+void
+firtree_pixbuf_sampler_set_use_pyramid(FirtreePixbufSampler * self,
+				       gboolean use_pyramid)
+{
+	FirtreePixbufSamplerPrivate *p = GET_PRIVATE(self);
+	if (use_pyramid == (p->pyramid != NULL)) {
+		return;
+	}
+
+	if (use_pyramid) {
+		p->pyramid = firtree_image_pyramid_new();
+		_firtree_pixbuf_sampler_invalidate_llvm_cache(self);
+	} else {
+		/* invalidate the cache first since it refers to the levels. */
+		_firtree_pixbuf_sampler_invalidate_llvm_cache(self);
+		firtree_image_pyramid_free(p->pyramid);
+		p->pyramid = NULL;
+	}
+}
+
 llvm::Function *
 firtree_pixbuf_sampler_get_sample_function(FirtreeSampler * self)
 {
@@ -282,8 +398,8 @@ _firtree_pixbuf_sampler_create_sample_function(FirtreePixbufSampler * self)
 	/* declare the sample_image_buffer() function which will be implemented
 	 * by the engine. */
 	llvm::Function * sample_buffer_func =
-	    firtree_engine_create_sample_image_buffer_prototype(m,
-								p->do_interp);
+	    firtree_engine_create_sample_image_buffer_filtered_prototype
+	    (m, p->interp_mode);
 	g_assert(sample_buffer_func);
 
 	/* declare the sample() function which we shall implement. */
@@ -306,6 +422,34 @@ _firtree_pixbuf_sampler_create_sample_function(FirtreePixbufSampler * self)
 	FirtreeBufferFormat firtree_format =
 	    (channels == 3) ? FIRTREE_FORMAT_RGB24 : FIRTREE_FORMAT_RGBA32;
 
+	FirtreeAffineTransform *transform =
+	    firtree_sampler_get_transform(FIRTREE_SAMPLER(self));
+
+	/* If the transform shrinks the pixbuf, sample from a pre-filtered
+	 * level of the pyramid instead. */
+	guint level_index = 0;
+	if (p->pyramid) {
+		FirtreeImagePyramidLevel base =
+		    { data, width, height, stride, firtree_format };
+		FirtreeImagePyramidLevel level;
+
+		level_index =
+		    firtree_image_pyramid_select_level(p->pyramid, transform,
+						       &base, &level);
+
+		data = (guchar *) (level.data);
+		width = level.width;
+		height = level.height;
+		stride = level.stride;
+	}
+
+	/* The bicubic and Lanczos filters are widened to match the scale of
+	 * the transform. */
+	float filter_scale_x, filter_scale_y;
+	firtree_engine_get_filter_scale(transform, level_index,
+					&filter_scale_x, &filter_scale_y);
+	g_object_unref(transform);
+
 	llvm::Value * llvm_width = llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
 							  (uint64_t) width,
 							  false);
@@ -332,13 +476,26 @@ _firtree_pixbuf_sampler_create_sample_function(FirtreePixbufSampler * self)
 	llvm::BasicBlock * bb = llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT "entry", 
 			sample_func);
 
+	llvm::Value * location = sample_func->arg_begin();
+	if (level_index > 0) {
+		location =
+		    firtree_image_pyramid_create_level_location(m, level_index,
+								location, bb);
+	}
+
 	std::vector < llvm::Value * >func_args;
 	func_args.push_back(llvm_data);
 	func_args.push_back(llvm_format);
 	func_args.push_back(llvm_width);
 	func_args.push_back(llvm_height);
 	func_args.push_back(llvm_stride);
-	func_args.push_back(sample_func->arg_begin());
+	if (firtree_engine_interpolation_mode_is_filtered(p->interp_mode)) {
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_x));
+		func_args.push_back(llvm::ConstantFP::get(FIRTREE_LLVM_FLOAT_TY,
+							  filter_scale_y));
+	}
+	func_args.push_back(location);
 
 	llvm::Value * ret_val = llvm::CallInst::Create(sample_buffer_func,
 						       func_args.begin(),
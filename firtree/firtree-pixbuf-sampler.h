@@ -24,6 +24,7 @@
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <firtree/firtree-sampler.h>
+#include <firtree/firtree-types.h>
 
 G_BEGIN_DECLS
 
@@ -64,6 +65,20 @@ void			 firtree_pixbuf_sampler_set_do_interpolation
 								(FirtreePixbufSampler 	*self,
 								 gboolean		 do_interpolation);
 
+FirtreeInterpolationMode firtree_pixbuf_sampler_get_interpolation_mode
+								(FirtreePixbufSampler 	*self);
+
+void			 firtree_pixbuf_sampler_set_interpolation_mode
+								(FirtreePixbufSampler 	*self,
+								 FirtreeInterpolationMode mode);
+
+gboolean		 firtree_pixbuf_sampler_get_use_pyramid
+								(FirtreePixbufSampler 	*self);
+
+void			 firtree_pixbuf_sampler_set_use_pyramid
+								(FirtreePixbufSampler 	*self,
+								 gboolean		 use_pyramid);
+
 G_END_DECLS
 
 #endif				/* ___FIRTREE_PIXBUF_SAMPLER_H__ */
@@ -56,6 +56,13 @@
  * signal when the internal LLVM function which describes it has changed. It will
  * emit a ::contents-changed signal when the contents of the sampler have changed and
  * should be re-rendered by interested parties.
+ *
+ * If only part of the sampler has changed, the ::contents-changed signal is
+ * preceded by a ::region-changed signal giving the rectangle, in sampler
+ * co-ordinates, outside of which the values sampled from it are unchanged.
+ * See firtree_sampler_contents_changed_in_region(). Kernels map such a region
+ * through the offsets at which they sample each argument so that a renderer
+ * can re-render just the part of its output which is affected.
  */
 
 /**
@@ -84,6 +91,7 @@ enum {
 	MODULE_CHANGED,
 	EXTENTS_CHANGED,
 	TRANSFORM_CHANGED,
+	REGION_CHANGED,
 	LAST_SIGNAL
 };
 
@@ -95,6 +103,7 @@ G_DEFINE_TYPE(FirtreeSampler, firtree_sampler, G_TYPE_OBJECT)
 
 struct _FirtreeSamplerPrivate {
 	llvm::Function * transform_function;
+	FirtreeAffineTransform *transform;
 };
 
 gboolean
@@ -104,6 +113,8 @@ firtree_sampler_get_param_default(FirtreeSampler * self, guint param,
 llvm::Function *
 firtree_sampler_get_sample_function_default(FirtreeSampler * self);
 
+gboolean firtree_sampler_is_opaque_default(FirtreeSampler * self);
+
 FirtreeVec4 firtree_sampler_get_extent_default(FirtreeSampler * self);
 
 gboolean firtree_sampler_lock_default(FirtreeSampler * self);
@@ -124,6 +135,12 @@ static void firtree_sampler_dispose(GObject * object)
 	G_OBJECT_CLASS(firtree_sampler_parent_class)->dispose(object);
 
 	_firtree_sampler_invalidate_llvm_cache((FirtreeSampler *) object);
+
+	FirtreeSamplerPrivate *p = GET_PRIVATE(object);
+	if (p && p->transform) {
+		g_object_unref(p->transform);
+		p->transform = NULL;
+	}
 }
 
 static FirtreeSamplerIntlVTable _firtree_sampler_class_vtable;
@@ -140,6 +157,7 @@ static void firtree_sampler_class_init(FirtreeSamplerClass * klass)
 	klass->module_changed = NULL;
 	klass->extents_changed = NULL;
 	klass->transform_changed = NULL;
+	klass->region_changed = NULL;
 
 	klass->get_extent = firtree_sampler_get_extent_default;
 	klass->lock = firtree_sampler_lock_default;
@@ -149,6 +167,7 @@ static void firtree_sampler_class_init(FirtreeSamplerClass * klass)
 	klass->intl_vtable->get_param = firtree_sampler_get_param_default;
 	klass->intl_vtable->get_sample_function =
 	    firtree_sampler_get_sample_function_default;
+	klass->intl_vtable->is_opaque = firtree_sampler_is_opaque_default;
 
     /**
      * FirtreeSampler::contents-changed:
@@ -211,6 +230,24 @@ static void firtree_sampler_class_init(FirtreeSamplerClass * klass)
 			 G_STRUCT_OFFSET(FirtreeSamplerClass,
 					 transform_changed), NULL, NULL,
 			 g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
+    /**
+     * FirtreeSampler::region-changed:
+     * @sampler: The sampler whose contents has changed.
+     * @region: A #FirtreeVec4 bounding the part of @sampler which changed.
+     *
+     * Emitted immediately before ::contents-changed when only the
+     * (minx, miny, width, height) rectangle @region, in sampler
+     * co-ordinates, has changed. A ::contents-changed signal which is not
+     * preceded by this signal means that the whole sampler has changed.
+     */
+	_firtree_sampler_signals[REGION_CHANGED] =
+	    g_signal_new("region-changed",
+			 G_OBJECT_CLASS_TYPE(klass),
+			 G_SIGNAL_RUN_FIRST,
+			 G_STRUCT_OFFSET(FirtreeSamplerClass, region_changed),
+			 NULL, NULL, g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE,
+			 1, FIRTREE_TYPE_VEC4);
 }
 
 static void firtree_sampler_init(FirtreeSampler * self)
@@ -218,6 +255,7 @@ static void firtree_sampler_init(FirtreeSampler * self)
 	FirtreeSamplerPrivate *p = GET_PRIVATE(self);
 
 	p->transform_function = NULL;
+	p->transform = NULL;
 }
 
 /**
@@ -269,7 +307,48 @@ FirtreeVec4 firtree_sampler_get_extent(FirtreeSampler * self)
  */
 FirtreeAffineTransform *firtree_sampler_get_transform(FirtreeSampler * self)
 {
-	return firtree_affine_transform_new();
+	FirtreeSamplerPrivate *p = GET_PRIVATE(self);
+	if (!p->transform) {
+		return firtree_affine_transform_new();
+	}
+	return firtree_affine_transform_clone(p->transform);
+}
+
+/**
+ * firtree_sampler_set_transform:
+ * @self: An instantiated FirtreeSampler object.
+ * @transform: A FirtreeAffineTransform or NULL for the identity.
+ *
+ * Set the transform which maps points from the output space of the sampler
+ * to the sampler space. See firtree_sampler_get_transform(). A copy of
+ * @transform is taken so later changes to it have no effect unless this is
+ * called again.
+ *
+ * The transform is compiled into the functions of any kernels which sample
+ * from @self and so changing it causes them to be re-generated. A renderer
+ * applies the transform of its sampler to each output pixel's location.
+ *
+ * This emits ::transform-changed followed by ::module-changed.
+ */
+void
+firtree_sampler_set_transform(FirtreeSampler * self,
+			      FirtreeAffineTransform * transform)
+{
+	g_return_if_fail(FIRTREE_IS_SAMPLER(self));
+
+	FirtreeSamplerPrivate *p = GET_PRIVATE(self);
+
+	if (p->transform) {
+		g_object_unref(p->transform);
+		p->transform = NULL;
+	}
+
+	if (transform && !firtree_affine_transform_is_identity(transform)) {
+		p->transform = firtree_affine_transform_clone(transform);
+	}
+
+	firtree_sampler_transform_changed(self);
+	firtree_sampler_module_changed(self);
 }
 
 /**
@@ -284,6 +363,32 @@ void firtree_sampler_contents_changed(FirtreeSampler * self)
 	g_signal_emit(self, _firtree_sampler_signals[CONTENTS_CHANGED], 0);
 }
 
+/**
+ * firtree_sampler_contents_changed_in_region:
+ * @self: A FirtreeSampler object.
+ * @region: The (minx, miny, width, height) rectangle, in sampler
+ * co-ordinates, which has changed.
+ *
+ * Emit the ::region-changed signal followed by the ::contents-changed
+ * signal. Listeners which do not track regions see the same signal as from
+ * firtree_sampler_contents_changed().
+ */
+void
+firtree_sampler_contents_changed_in_region(FirtreeSampler * self,
+					   FirtreeVec4 * region)
+{
+	g_return_if_fail(FIRTREE_IS_SAMPLER(self));
+	g_return_if_fail(region != NULL);
+	firtree_sampler_region_changed(self, region);
+	g_signal_emit(self, _firtree_sampler_signals[CONTENTS_CHANGED], 0);
+}
+
+void firtree_sampler_region_changed(FirtreeSampler * self, FirtreeVec4 * region)
+{
+	g_return_if_fail(FIRTREE_IS_SAMPLER(self));
+	g_signal_emit(self, _firtree_sampler_signals[REGION_CHANGED], 0, region);
+}
+
 /**
  * firtree_sampler_module_changed:
  * @self: A FirtreeSampler object.
@@ -369,6 +474,132 @@ firtree_sampler_get_sample_function_default(FirtreeSampler * self)
 	return NULL;
 }
 
+gboolean firtree_sampler_is_opaque(FirtreeSampler * self)
+{
+	FirtreeSamplerIntlVTable *vtable =
+	    FIRTREE_SAMPLER_GET_CLASS(self)->intl_vtable;
+
+	/* Sub-classes need only fill in the entries they override. */
+	if (!vtable->is_opaque) {
+		return FALSE;
+	}
+
+	return vtable->is_opaque(self);
+}
+
+gboolean firtree_sampler_is_opaque_default(FirtreeSampler * self)
+{
+	return FALSE;
+}
+
+gboolean firtree_sampler_extent_is_infinite(const FirtreeVec4 * extent)
+{
+	/* Anything this large cannot survive being transformed. */
+	return (extent->z >= 0.25f * G_MAXFLOAT) ||
+	    (extent->w >= 0.25f * G_MAXFLOAT);
+}
+
+FirtreeVec4 firtree_sampler_get_output_extent(FirtreeSampler * self)
+{
+	FirtreeVec4 extent = firtree_sampler_get_extent(self);
+	return firtree_sampler_map_region_to_output(self, &extent);
+}
+
+FirtreeVec4
+firtree_sampler_map_region_to_output(FirtreeSampler * self,
+				     const FirtreeVec4 * region)
+{
+	FirtreeVec4 extent = *region;
+
+	if (firtree_sampler_extent_is_infinite(&extent)) {
+		return firtree_sampler_get_extent_default(self);
+	}
+
+	if ((extent.z <= 0.f) || (extent.w <= 0.f)) {
+		FirtreeVec4 empty = { 0, 0, 0, 0 };
+		return empty;
+	}
+
+	/* Interpolating samplers return non-zero values up to half a pixel
+	 * outside of their extent. Allow a whole unit to be safe. */
+	extent.x -= 1.f;
+	extent.y -= 1.f;
+	extent.z += 2.f;
+	extent.w += 2.f;
+
+	FirtreeAffineTransform *transform = firtree_sampler_get_transform(self);
+	if (firtree_affine_transform_is_identity(transform)) {
+		g_object_unref(transform);
+		return extent;
+	}
+
+	/* The sampler transform maps output to sampler co-ordinates so
+	 * the output extent is that of the inverse applied to the corners. */
+	if (!firtree_affine_transform_invert(transform)) {
+		g_object_unref(transform);
+		return firtree_sampler_get_extent_default(self);
+	}
+
+	float corners[][2] = {
+		{extent.x, extent.y},
+		{extent.x + extent.z, extent.y},
+		{extent.x, extent.y + extent.w},
+		{extent.x + extent.z, extent.y + extent.w},
+	};
+
+	float min_x = G_MAXFLOAT, min_y = G_MAXFLOAT;
+	float max_x = -G_MAXFLOAT, max_y = -G_MAXFLOAT;
+	for (guint i = 0; i < 4; ++i) {
+		FirtreeVec2 pt =
+		    firtree_affine_transform_transform_point(transform,
+							     corners[i][0],
+							     corners[i][1]);
+		min_x = MIN(min_x, pt.x);
+		min_y = MIN(min_y, pt.y);
+		max_x = MAX(max_x, pt.x);
+		max_y = MAX(max_y, pt.y);
+	}
+
+	g_object_unref(transform);
+
+	FirtreeVec4 rv = { min_x, min_y, max_x - min_x, max_y - min_y };
+	return rv;
+}
+
+/* The cost assumed for a call to a function which is not defined in the
+ * sampler's module, such as a buffer sampling builtin. */
+#define EXTERNAL_CALL_COST 16
+
+guint firtree_sampler_estimate_cost(FirtreeSampler * self)
+{
+	llvm::Function * sample_f = firtree_sampler_get_sample_function(self);
+	if (!sample_f) {
+		return 0;
+	}
+
+	guint cost = 0;
+	llvm::Module * m = sample_f->getParent();
+	for (llvm::Module::iterator fi = m->begin(); fi != m->end(); ++fi) {
+		for (llvm::Function::iterator bi = fi->begin();
+		     bi != fi->end(); ++bi) {
+			for (llvm::BasicBlock::iterator ii = bi->begin();
+			     ii != bi->end(); ++ii) {
+				llvm::CallInst * call =
+				    llvm::dyn_cast < llvm::CallInst > (ii);
+				llvm::Function * callee =
+				    call ? call->getCalledFunction() : NULL;
+				if (callee && callee->isDeclaration()) {
+					cost += EXTERNAL_CALL_COST;
+				} else {
+					cost += 1;
+				}
+			}
+		}
+	}
+
+	return cost;
+}
+
 #if 0
 llvm::Function * firtree_sampler_get_transform_function(FirtreeSampler * self)
 {
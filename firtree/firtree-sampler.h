@@ -52,6 +52,8 @@ struct _FirtreeSamplerClass
 	void 		(*module_changed)	(FirtreeSampler *sampler);
 	void 		(*extents_changed) 	(FirtreeSampler *sampler);
 	void 		(*transform_changed) 	(FirtreeSampler *sampler);
+	void 		(*region_changed) 	(FirtreeSampler *sampler,
+						 FirtreeVec4	*region);
 
 	/* Publically overridable virtual methods. */
 
@@ -73,8 +75,15 @@ FirtreeVec4 	 firtree_sampler_get_extent		(FirtreeSampler *self);
 FirtreeAffineTransform *firtree_sampler_get_transform
 							(FirtreeSampler *self);
 
+void		 firtree_sampler_set_transform		(FirtreeSampler *self,
+							 FirtreeAffineTransform *transform);
+
 void		 firtree_sampler_contents_changed	(FirtreeSampler *self);
 
+void		 firtree_sampler_contents_changed_in_region
+							(FirtreeSampler *self,
+							 FirtreeVec4	*region);
+
 void		 firtree_sampler_module_changed		(FirtreeSampler *self);
 
 void		 firtree_sampler_extents_changed	(FirtreeSampler *self);
@@ -0,0 +1,927 @@
+/* firtree-tiled-file-sampler.cc */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.    See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA    02110-1301, USA
+ */
+
+#define __STDC_LIMIT_MACROS
+#define __STDC_CONSTANT_MACROS
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+
+#include <common/uuid.h>
+
+/* For the LLVM version macros */
+#include <firtree/firtree.h>
+
+#include "internal/firtree-engine-intl.hh"
+#include "internal/firtree-sampler-intl.hh"
+#include "internal/firtree-tiled-file-sampler-intl.hh"
+#include "firtree-tiled-file-sampler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * SECTION:firtree-tiled-file-sampler
+ * @short_description: A FirtreeSampler which samples from a tiled image file.
+ * @include: firtree/firtree-tiled-file-sampler.h
+ *
+ * A FirtreeTiledFileSampler is a FirtreeSampler which samples from an image
+ * stored on disk as a grid of fixed-size tiles. Tiles are memory-mapped
+ * the first time a render touches them and are kept in a least recently
+ * used cache whose size is set via
+ * firtree_tiled_file_sampler_set_cache_size(). Since tiles are unmapped
+ * when they are evicted from the cache, the memory used by the sampler is
+ * bounded by the cache size, plus the one tile each render thread may still
+ * be using, rather than by the size of the image.
+ *
+ * The file starts with a header made up of the eight characters "FIRTILE1"
+ * followed by six little-endian 32-bit unsigned integers: the image width,
+ * the image height, the tile width, the tile height, the FirtreeBufferFormat
+ * of the pixels and the offset in bytes from the start of the file to the
+ * first tile. The tiles follow in row-major order. Each tile holds
+ * tile width * tile height tightly packed pixels in row-major order and
+ * tiles at the right and bottom edges of the image are padded to the full
+ * tile size. The planar formats are not supported.
+ *
+ * firtree_tiled_file_sampler_write_file() can be used to write a buffer in
+ * memory to a file of this form.
+ *
+ * The CPU engine renders from the top of the output to the bottom so a
+ * cache large enough to hold two rows of tiles will fault each tile in once
+ * when the image is rendered without rotation.
+ */
+
+/**
+ * FirtreeTiledFileSampler:
+ * @parent: The parent FirtreeSampler.
+ *
+ * A structure representing a FirtreeTiledFileSampler object.
+ */
+
+/**
+ * FirtreeTiledFileSamplerPrivate:
+ *
+ * Private data for a FirtreeTiledFileSampler instance.
+ */
+
+G_DEFINE_TYPE(FirtreeTiledFileSampler, firtree_tiled_file_sampler,
+	      FIRTREE_TYPE_SAMPLER)
+
+#define GET_PRIVATE(o) 		(G_TYPE_INSTANCE_GET_PRIVATE ((o), FIRTREE_TYPE_TILED_FILE_SAMPLER, FirtreeTiledFileSamplerPrivate))
+
+#define TILED_FILE_MAGIC "FIRTILE1"
+#define TILED_FILE_HEADER_SIZE 32
+
+/* The stride of the blocks filled by firtree_tiled_file_sampler_fetch_block().
+ * This must match TILED_BLOCK_STRIDE in the CPU engine. */
+#define TILED_BLOCK_STRIDE 32
+
+/* The default cache size in bytes. */
+#define DEFAULT_CACHE_SIZE (64 << 20)
+
+/* The cache always has room for enough tiles to cover a 2x2 block. */
+#define MIN_RESIDENT_TILES 4
+
+typedef struct _FirtreeTiledFileSamplerTile FirtreeTiledFileSamplerTile;
+
+struct _FirtreeTiledFileSamplerTile {
+	guint index;
+	gpointer map_base;
+	gsize map_length;
+	guint8 *data;
+
+	/* one reference is held by the cache while the tile is resident and
+	 * one by each render thread copying pixels out of it. The tile is
+	 * unmapped when the last is dropped. */
+	volatile gint ref_count;
+
+	/* link in the LRU queue, data points to this tile. */
+	GList link;
+};
+
+struct _FirtreeTiledFileSamplerPrivate {
+	gchar *filename;
+	gint fd;
+	gboolean do_interp;
+	 llvm::Function * cached_function;
+
+	guint width;
+	guint height;
+	guint tile_width;
+	guint tile_height;
+	guint n_tiles_x;
+	guint n_tiles_y;
+	FirtreeBufferFormat format;
+	guint pixel_size;
+	gsize tile_size;
+	guint64 data_offset;
+
+	/* changed each time the file is closed so that render threads drop
+	 * the tiles they hold from the previous file. */
+	gint generation;
+
+	/* cache_lock protects the fields below. It is held while tiles are
+	 * looked up, faulted in and evicted but not while pixels are copied
+	 * out of them. */
+	GMutex *cache_lock;
+	gsize cache_size;
+	FirtreeTiledFileSamplerTile **tiles;
+	GQueue lru;
+};
+
+/* the tile each render thread last copied pixels from. A render thread
+ * keeps its own reference to the tile so that successive fetches from the
+ * same tile need not take cache_lock. The cache's LRU order is then only
+ * updated when a thread moves on to another tile. */
+typedef struct {
+	FirtreeTiledFileSamplerPrivate *owner;
+	gint generation;
+	FirtreeTiledFileSamplerTile *tile;
+} FirtreeTiledFileSamplerLastTile;
+
+static GStaticPrivate _firtree_tiled_file_sampler_last_tile =
+    G_STATIC_PRIVATE_INIT;
+
+/* the source of FirtreeTiledFileSamplerPrivate generations. Generations
+ * are unique across samplers so that a sampler allocated where a disposed
+ * one was never matches a thread's last tile. */
+static volatile gint _firtree_tiled_file_sampler_next_generation = 0;
+
+llvm::Function *
+firtree_tiled_file_sampler_get_sample_function(FirtreeSampler * self);
+
+llvm::Function *
+_firtree_tiled_file_sampler_create_sample_function(FirtreeTiledFileSampler *
+						   self);
+
+FirtreeVec4 firtree_tiled_file_sampler_get_extent(FirtreeSampler * self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	if (!p || (p->fd < 0)) {
+		/* return 'NULL' extent */
+		FirtreeVec4 rv = { 0, 0, 0, 0 };
+		return rv;
+	}
+
+	FirtreeVec4 rv = { 0, 0, p->width, p->height };
+	return rv;
+}
+
+/* invalidate (and release) any cached LLVM modules/functions. This
+ * will cause them to be re-generated when ..._get_function() is next
+ * called. */
+static void
+_firtree_tiled_file_sampler_invalidate_llvm_cache(FirtreeTiledFileSampler *
+						  self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	if (p && p->cached_function) {
+		delete p->cached_function->getParent();
+		p->cached_function = NULL;
+	}
+	firtree_sampler_module_changed(FIRTREE_SAMPLER(self));
+	firtree_sampler_contents_changed(FIRTREE_SAMPLER(self));
+}
+
+/* drop a reference to a tile, unmapping it if it was the last. May be
+ * called without cache_lock held. */
+static void
+_firtree_tiled_file_sampler_tile_unref(FirtreeTiledFileSamplerTile * tile)
+{
+	if (g_atomic_int_dec_and_test(&tile->ref_count)) {
+		munmap(tile->map_base, tile->map_length);
+		g_slice_free(FirtreeTiledFileSamplerTile, tile);
+	}
+}
+
+/* remove a tile from the cache. It is unmapped once no render thread is
+ * copying from it. Must be called with cache_lock held. */
+static void
+_firtree_tiled_file_sampler_evict_tile(FirtreeTiledFileSamplerPrivate * p,
+				       FirtreeTiledFileSamplerTile * tile)
+{
+	g_queue_unlink(&p->lru, &tile->link);
+	p->tiles[tile->index] = NULL;
+	_firtree_tiled_file_sampler_tile_unref(tile);
+}
+
+/* evict the least recently used tiles until at most max_tiles are
+ * resident. Must be called with cache_lock held. */
+static void
+_firtree_tiled_file_sampler_trim_cache(FirtreeTiledFileSamplerPrivate * p,
+				       guint max_tiles)
+{
+	while (g_queue_get_length(&p->lru) > max_tiles) {
+		GList *link = g_queue_peek_tail_link(&p->lru);
+		_firtree_tiled_file_sampler_evict_tile(p,
+						       (FirtreeTiledFileSamplerTile
+							*) link->data);
+	}
+}
+
+/* the maximum number of tiles the cache may hold. */
+static guint
+_firtree_tiled_file_sampler_max_resident_tiles(FirtreeTiledFileSamplerPrivate
+					       * p)
+{
+	gsize max_tiles = p->tile_size ? (p->cache_size / p->tile_size) : 0;
+	return MAX(max_tiles, MIN_RESIDENT_TILES);
+}
+
+/* return the tile with the passed index, mapping it in if necessary and
+ * marking it as the most recently used. Must be called with cache_lock
+ * held. Returns NULL if the tile could not be mapped. The tile remains
+ * owned by the cache. */
+static FirtreeTiledFileSamplerTile *
+_firtree_tiled_file_sampler_get_tile(FirtreeTiledFileSamplerPrivate * p,
+				     guint index)
+{
+	FirtreeTiledFileSamplerTile *tile = p->tiles[index];
+
+	if (tile) {
+		if (g_queue_peek_head_link(&p->lru) != &tile->link) {
+			g_queue_unlink(&p->lru, &tile->link);
+			g_queue_push_head_link(&p->lru, &tile->link);
+		}
+		return tile;
+	}
+
+	/* make room for the new tile. */
+	_firtree_tiled_file_sampler_trim_cache(p,
+					       _firtree_tiled_file_sampler_max_resident_tiles
+					       (p) - 1);
+
+	/* mmap() requires a page-aligned offset. */
+	guint64 offset = p->data_offset + ((guint64) index * p->tile_size);
+	guint64 page_size = (guint64) sysconf(_SC_PAGESIZE);
+	guint64 map_offset = offset - (offset % page_size);
+	gsize map_length = p->tile_size + (gsize) (offset - map_offset);
+
+	gpointer map_base = mmap(NULL, map_length, PROT_READ, MAP_SHARED,
+				 p->fd, (off_t) map_offset);
+	if (map_base == MAP_FAILED) {
+		g_warning("Could not map tile %u of '%s': %s", index,
+			  p->filename, g_strerror(errno));
+		return NULL;
+	}
+
+	tile = g_slice_new(FirtreeTiledFileSamplerTile);
+	tile->index = index;
+	tile->map_base = map_base;
+	tile->map_length = map_length;
+	tile->data = (guint8 *) map_base + (offset - map_offset);
+	tile->ref_count = 1;
+	tile->link.data = tile;
+	tile->link.next = tile->link.prev = NULL;
+
+	g_queue_push_head_link(&p->lru, &tile->link);
+	p->tiles[index] = tile;
+
+	return tile;
+}
+
+/* return a reference to the tile with the passed index, to be released
+ * with _firtree_tiled_file_sampler_tile_unref(), or NULL. cache_lock is
+ * only held for the lookup. */
+static FirtreeTiledFileSamplerTile *
+_firtree_tiled_file_sampler_ref_tile(FirtreeTiledFileSamplerPrivate * p,
+				     guint index)
+{
+	g_mutex_lock(p->cache_lock);
+	FirtreeTiledFileSamplerTile *tile =
+	    _firtree_tiled_file_sampler_get_tile(p, index);
+	if (tile) {
+		g_atomic_int_inc(&tile->ref_count);
+	}
+	g_mutex_unlock(p->cache_lock);
+
+	return tile;
+}
+
+static void _firtree_tiled_file_sampler_last_tile_free(gpointer data)
+{
+	FirtreeTiledFileSamplerLastTile *last =
+	    (FirtreeTiledFileSamplerLastTile *) data;
+	if (last->tile) {
+		_firtree_tiled_file_sampler_tile_unref(last->tile);
+	}
+	g_slice_free(FirtreeTiledFileSamplerLastTile, last);
+}
+
+/* return the tile with the passed index, or NULL. The tile is referenced
+ * by the calling thread until it looks up a different tile and so must
+ * not be unreferenced by the caller. cache_lock is only taken if the
+ * thread did not last look up this tile. */
+static FirtreeTiledFileSamplerTile *
+_firtree_tiled_file_sampler_lookup_tile(FirtreeTiledFileSamplerPrivate * p,
+					guint index)
+{
+	FirtreeTiledFileSamplerLastTile *last =
+	    (FirtreeTiledFileSamplerLastTile *)
+	    g_static_private_get(&_firtree_tiled_file_sampler_last_tile);
+	if (!last) {
+		last = g_slice_new0(FirtreeTiledFileSamplerLastTile);
+		g_static_private_set(&_firtree_tiled_file_sampler_last_tile,
+				     last,
+				     _firtree_tiled_file_sampler_last_tile_free);
+	}
+
+	if (last->tile && (last->owner == p) &&
+	    (last->generation == p->generation) &&
+	    (last->tile->index == index)) {
+		return last->tile;
+	}
+
+	if (last->tile) {
+		_firtree_tiled_file_sampler_tile_unref(last->tile);
+	}
+
+	last->owner = p;
+	last->generation = p->generation;
+	last->tile = _firtree_tiled_file_sampler_ref_tile(p, index);
+
+	return last->tile;
+}
+
+void
+firtree_tiled_file_sampler_fetch_block(gpointer handle, gint x, gint y,
+				       guint8 * block)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(handle);
+	FirtreeTiledFileSamplerTile *tile = NULL;
+	guint tile_index = G_MAXUINT;
+
+	/* the tiles are referenced by the render thread so that the pixels
+	 * can be copied without holding cache_lock. Render threads then only
+	 * contend on the lookup of a tile they have not just used. */
+	for (gint j = 0; j < 2; ++j) {
+		gint py = y + j;
+		if ((py < 0) || (py >= (gint) p->height)) {
+			continue;
+		}
+
+		for (gint i = 0; i < 2; ++i) {
+			gint px = x + i;
+			if ((px < 0) || (px >= (gint) p->width)) {
+				continue;
+			}
+
+			guint index = ((py / p->tile_height) * p->n_tiles_x) +
+			    (px / p->tile_width);
+
+			/* the block usually lies within one tile. */
+			if (index != tile_index) {
+				tile =
+				    _firtree_tiled_file_sampler_lookup_tile(p,
+									    index);
+				tile_index = index;
+			}
+
+			guint8 *dest = block + (j * TILED_BLOCK_STRIDE) +
+			    (i * p->pixel_size);
+			if (!tile) {
+				memset(dest, 0, p->pixel_size);
+				continue;
+			}
+
+			guint tx = px % p->tile_width;
+			guint ty = py % p->tile_height;
+			memcpy(dest, tile->data +
+			       (((ty * p->tile_width) + tx) * p->pixel_size),
+			       p->pixel_size);
+		}
+	}
+}
+
+/* unmap all tiles and close any open file. */
+static void _firtree_tiled_file_sampler_close(FirtreeTiledFileSampler * self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+
+	g_mutex_lock(p->cache_lock);
+	_firtree_tiled_file_sampler_trim_cache(p, 0);
+	g_mutex_unlock(p->cache_lock);
+
+	/* tiles still held by render threads are unmapped when each thread
+	 * next fetches a block or exits. */
+	p->generation =
+	    g_atomic_int_exchange_and_add
+	    (&_firtree_tiled_file_sampler_next_generation, 1);
+
+	if (p->tiles) {
+		g_free(p->tiles);
+		p->tiles = NULL;
+	}
+
+	if (p->fd >= 0) {
+		close(p->fd);
+		p->fd = -1;
+	}
+
+	if (p->filename) {
+		g_free(p->filename);
+		p->filename = NULL;
+	}
+
+	p->width = p->height = 0;
+	p->tile_width = p->tile_height = 0;
+	p->n_tiles_x = p->n_tiles_y = 0;
+	p->format = FIRTREE_FORMAT_LAST;
+	p->pixel_size = 0;
+	p->tile_size = 0;
+	p->data_offset = 0;
+}
+
+static void firtree_tiled_file_sampler_dispose(GObject * object)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(object);
+
+	/* dispose of any LLVM modules we might have. */
+	if (p && p->cached_function) {
+		delete p->cached_function->getParent();
+		p->cached_function = NULL;
+	}
+
+	_firtree_tiled_file_sampler_close(FIRTREE_TILED_FILE_SAMPLER(object));
+
+	G_OBJECT_CLASS(firtree_tiled_file_sampler_parent_class)->dispose(object);
+}
+
+static void firtree_tiled_file_sampler_finalize(GObject * object)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(object);
+
+	if (p->cache_lock) {
+		g_mutex_free(p->cache_lock);
+		p->cache_lock = NULL;
+	}
+
+	G_OBJECT_CLASS(firtree_tiled_file_sampler_parent_class)->
+	    finalize(object);
+}
+
+static FirtreeSamplerIntlVTable _firtree_tiled_file_sampler_class_vtable;
+
+static void
+firtree_tiled_file_sampler_class_init(FirtreeTiledFileSamplerClass * klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	g_type_class_add_private(klass, sizeof(FirtreeTiledFileSamplerPrivate));
+
+	object_class->dispose = firtree_tiled_file_sampler_dispose;
+	object_class->finalize = firtree_tiled_file_sampler_finalize;
+
+	/* override the sampler virtual functions with our own */
+	FirtreeSamplerClass *sampler_class = FIRTREE_SAMPLER_CLASS(klass);
+
+	sampler_class->get_extent = firtree_tiled_file_sampler_get_extent;
+
+	sampler_class->intl_vtable = &_firtree_tiled_file_sampler_class_vtable;
+
+	sampler_class->intl_vtable->get_sample_function =
+	    firtree_tiled_file_sampler_get_sample_function;
+}
+
+static void firtree_tiled_file_sampler_init(FirtreeTiledFileSampler * self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	p->filename = NULL;
+	p->fd = -1;
+	p->do_interp = FALSE;
+	p->cached_function = NULL;
+	p->width = p->height = 0;
+	p->tile_width = p->tile_height = 0;
+	p->n_tiles_x = p->n_tiles_y = 0;
+	p->format = FIRTREE_FORMAT_LAST;
+	p->pixel_size = 0;
+	p->tile_size = 0;
+	p->data_offset = 0;
+	p->generation =
+	    g_atomic_int_exchange_and_add
+	    (&_firtree_tiled_file_sampler_next_generation, 1);
+	p->cache_lock = g_mutex_new();
+	p->cache_size = DEFAULT_CACHE_SIZE;
+	p->tiles = NULL;
+	g_queue_init(&p->lru);
+}
+
+/**
+ * firtree_tiled_file_sampler_new:
+ *
+ * Construct an uninitialised tiled file sampler. Until this has been
+ * associated with a file via firtree_tiled_file_sampler_set_file(), the
+ * sampler is invalid.
+ *
+ * Returns: A new FirtreeTiledFileSampler.
+ */
+FirtreeTiledFileSampler *firtree_tiled_file_sampler_new(void)
+{
+	return (FirtreeTiledFileSampler *)
+	    g_object_new(FIRTREE_TYPE_TILED_FILE_SAMPLER, NULL);
+}
+
+/**
+ * firtree_tiled_file_sampler_set_file:
+ * @self: A FirtreeTiledFileSampler.
+ * @filename: The name of a tiled image file or NULL.
+ *
+ * Associate the tiled image file @filename with this sampler. Any file
+ * previously associated with the sampler is closed. Only the file's header
+ * is read. Tiles are read when they are first sampled from.
+ *
+ * Pass NULL in order to desociate this sampler with any file.
+ *
+ * Returns: FALSE if @filename could not be opened or is not a valid tiled
+ * image file, TRUE otherwise.
+ */
+gboolean
+firtree_tiled_file_sampler_set_file(FirtreeTiledFileSampler * self,
+				    const gchar * filename)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	gboolean rv = TRUE;
+
+	_firtree_tiled_file_sampler_close(self);
+
+	if (filename) {
+		rv = FALSE;
+
+		guint8 header[TILED_FILE_HEADER_SIZE];
+		guint32 fields[6];
+		struct stat file_stat;
+
+		p->fd = open(filename, O_RDONLY);
+		if (p->fd < 0) {
+			g_debug("Could not open '%s': %s", filename,
+				g_strerror(errno));
+			goto out;
+		}
+
+		if ((pread(p->fd, header, TILED_FILE_HEADER_SIZE, 0) !=
+		     TILED_FILE_HEADER_SIZE) ||
+		    memcmp(header, TILED_FILE_MAGIC, 8)) {
+			g_debug("'%s' is not a tiled image file.", filename);
+			goto out;
+		}
+
+		memcpy(fields, header + 8, sizeof(fields));
+		p->width = GUINT32_FROM_LE(fields[0]);
+		p->height = GUINT32_FROM_LE(fields[1]);
+		p->tile_width = GUINT32_FROM_LE(fields[2]);
+		p->tile_height = GUINT32_FROM_LE(fields[3]);
+		p->format = (FirtreeBufferFormat) GUINT32_FROM_LE(fields[4]);
+		p->data_offset = GUINT32_FROM_LE(fields[5]);
+
+		if ((p->format < 0) || (p->format >= FIRTREE_FORMAT_LAST)) {
+			p->pixel_size = 0;
+		} else {
+			p->pixel_size =
+			    firtree_engine_get_buffer_format_pixel_size
+			    (p->format);
+		}
+
+		if ((p->pixel_size == 0) || (p->width == 0) ||
+		    (p->height == 0) || (p->tile_width == 0) ||
+		    (p->tile_height == 0)) {
+			g_debug("'%s' has an unsupported format or size.",
+				filename);
+			goto out;
+		}
+
+		p->n_tiles_x = (p->width + p->tile_width - 1) / p->tile_width;
+		p->n_tiles_y =
+		    (p->height + p->tile_height - 1) / p->tile_height;
+		p->tile_size = (gsize) p->tile_width * p->tile_height *
+		    p->pixel_size;
+
+		/* Check the file really contains all of the tiles, mapping
+		 * past its end would fault. */
+		if ((fstat(p->fd, &file_stat) != 0) ||
+		    ((guint64) file_stat.st_size < p->data_offset +
+		     ((guint64) p->n_tiles_x * p->n_tiles_y * p->tile_size))) {
+			g_debug("'%s' is truncated.", filename);
+			goto out;
+		}
+
+		p->tiles = g_new0(FirtreeTiledFileSamplerTile *,
+				  p->n_tiles_x * p->n_tiles_y);
+		p->filename = g_strdup(filename);
+		rv = TRUE;
+	}
+
+      out:
+	if (!rv) {
+		_firtree_tiled_file_sampler_close(self);
+	}
+
+	_firtree_tiled_file_sampler_invalidate_llvm_cache(self);
+	firtree_sampler_extents_changed(FIRTREE_SAMPLER(self));
+
+	return rv;
+}
+
+/**
+ * firtree_tiled_file_sampler_get_file:
+ * @self: A FirtreeTiledFileSampler.
+ *
+ * Retrieve the name of the file previously associated with this sampler via
+ * firtree_tiled_file_sampler_set_file().
+ *
+ * Returns: The file name or NULL if there is no file associated.
+ */
+const gchar *firtree_tiled_file_sampler_get_file(FirtreeTiledFileSampler *
+						 self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	return p->filename;
+}
+
+/**
+ * firtree_tiled_file_sampler_get_do_interpolation:
+ * @self:  A FirtreeTiledFileSampler.
+ *
+ * Get a flag which indicates if the sampler should attempt linear interpolation
+ * of the pixel values.
+ *
+ * Returns: A flag indicating if interpolation is performed.
+ */
+gboolean
+firtree_tiled_file_sampler_get_do_interpolation(FirtreeTiledFileSampler *
+						self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	return p->do_interp;
+}
+
+/**
+ * firtree_tiled_file_sampler_set_do_interpolation:
+ * @self:  A FirtreeTiledFileSampler.
+ * @do_interp: A flag indicating if interpolation is performed.
+ *
+ * Set a flag which indicates if the sampler should attempt linear interpolation
+ * of the pixel values.
+ */
+void
+firtree_tiled_file_sampler_set_do_interpolation(FirtreeTiledFileSampler *
+						self, gboolean do_interp)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	if (do_interp != p->do_interp) {
+		p->do_interp = do_interp;
+		_firtree_tiled_file_sampler_invalidate_llvm_cache(self);
+	}
+}
+
+/**
+ * firtree_tiled_file_sampler_get_cache_size:
+ * @self:  A FirtreeTiledFileSampler.
+ *
+ * Get the maximum number of bytes of tile data which may be mapped at once.
+ * See firtree_tiled_file_sampler_set_cache_size().
+ *
+ * Returns: The cache size in bytes.
+ */
+gsize firtree_tiled_file_sampler_get_cache_size(FirtreeTiledFileSampler * self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	return p->cache_size;
+}
+
+/**
+ * firtree_tiled_file_sampler_set_cache_size:
+ * @self:  A FirtreeTiledFileSampler.
+ * @cache_size: The cache size in bytes.
+ *
+ * Set the maximum number of bytes of tile data which may be mapped at once.
+ * When a tile is needed and the cache is full, the least recently used tile
+ * is unmapped. The cache always has room for at least four tiles whatever
+ * its size. The default size is 64MiB.
+ */
+void
+firtree_tiled_file_sampler_set_cache_size(FirtreeTiledFileSampler * self,
+					  gsize cache_size)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+
+	g_mutex_lock(p->cache_lock);
+	p->cache_size = cache_size;
+	_firtree_tiled_file_sampler_trim_cache(p,
+					       _firtree_tiled_file_sampler_max_resident_tiles
+					       (p));
+	g_mutex_unlock(p->cache_lock);
+}
+
+/**
+ * firtree_tiled_file_sampler_get_resident_tile_count:
+ * @self:  A FirtreeTiledFileSampler.
+ *
+ * Returns: The number of tiles which are currently mapped.
+ */
+guint
+firtree_tiled_file_sampler_get_resident_tile_count(FirtreeTiledFileSampler *
+						   self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+
+	g_mutex_lock(p->cache_lock);
+	guint rv = g_queue_get_length(&p->lru);
+	g_mutex_unlock(p->cache_lock);
+
+	return rv;
+}
+
+/**
+ * firtree_tiled_file_sampler_write_file:
+ * @filename: The name of the file to write.
+ * @buffer: The location of the image in memory.
+ * @width: The image width in pixels.
+ * @height: The image height in rows.
+ * @stride: The size of one row in bytes.
+ * @format: The format of the image.
+ * @tile_width: The width of each tile in pixels.
+ * @tile_height: The height of each tile in rows.
+ *
+ * Write an image in memory to @filename in the tiled form read by
+ * FirtreeTiledFileSampler.
+ *
+ * Returns: TRUE if the file was written, FALSE otherwise.
+ */
+gboolean
+firtree_tiled_file_sampler_write_file(const gchar * filename,
+				      gpointer buffer, guint width,
+				      guint height, guint stride,
+				      FirtreeBufferFormat format,
+				      guint tile_width, guint tile_height)
+{
+	guint pixel_size = firtree_engine_get_buffer_format_pixel_size(format);
+	if ((pixel_size == 0) || (width == 0) || (height == 0) ||
+	    (tile_width == 0) || (tile_height == 0)) {
+		g_debug("Unsupported format or size for a tiled image file.");
+		return FALSE;
+	}
+
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		g_debug("Could not open '%s': %s", filename,
+			g_strerror(errno));
+		return FALSE;
+	}
+
+	guint32 fields[6] = {
+		GUINT32_TO_LE(width), GUINT32_TO_LE(height),
+		GUINT32_TO_LE(tile_width), GUINT32_TO_LE(tile_height),
+		GUINT32_TO_LE((guint32) format),
+		GUINT32_TO_LE(TILED_FILE_HEADER_SIZE),
+	};
+
+	gboolean rv = (fwrite(TILED_FILE_MAGIC, 8, 1, fp) == 1) &&
+	    (fwrite(fields, sizeof(fields), 1, fp) == 1);
+
+	gsize tile_row_size = tile_width * pixel_size;
+	guint8 *tile_row = (guint8 *) g_malloc(tile_row_size);
+
+	for (guint ty = 0; rv && (ty < height); ty += tile_height) {
+		for (guint tx = 0; rv && (tx < width); tx += tile_width) {
+			for (guint y = ty; rv && (y < ty + tile_height); ++y) {
+				/* pad the tiles at the edges with zeros. */
+				memset(tile_row, 0, tile_row_size);
+				if (y < height) {
+					guint n = MIN(tile_width, width - tx);
+					memcpy(tile_row, (guint8 *) buffer +
+					       (y * stride) + (tx * pixel_size),
+					       n * pixel_size);
+				}
+				rv = (fwrite(tile_row, tile_row_size, 1, fp) ==
+				      1);
+			}
+		}
+	}
+
+	g_free(tile_row);
+
+	if (fclose(fp) != 0) {
+		rv = FALSE;
+	}
+
+	if (!rv) {
+		g_debug("Error writing '%s'.", filename);
+	}
+
+	return rv;
+}
+
+llvm::Function *
+firtree_tiled_file_sampler_get_sample_function(FirtreeSampler * self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+
+	if (p->cached_function) {
+		return p->cached_function;
+	}
+
+	return
+	    _firtree_tiled_file_sampler_create_sample_function
+	    (FIRTREE_TILED_FILE_SAMPLER(self));
+}
+
+/* Create the sampler function */
+llvm::Function *
+_firtree_tiled_file_sampler_create_sample_function(FirtreeTiledFileSampler *
+						   self)
+{
+	FirtreeTiledFileSamplerPrivate *p = GET_PRIVATE(self);
+	if (p->fd < 0) {
+		return NULL;
+	}
+
+	_firtree_tiled_file_sampler_invalidate_llvm_cache(self);
+
+#if FIRTREE_LLVM_AT_LEAST_2_6
+	llvm::Module * m = new llvm::Module("tiled_file",
+					    llvm::getGlobalContext());
+#else
+	llvm::Module * m = new llvm::Module("tiled_file");
+#endif
+
+	/* declare the sample_tiled_image() function which will be implemented
+	 * by the engine. */
+	llvm::Function * sample_tiled_func =
+	    firtree_engine_create_sample_tiled_image_prototype(m,
+							       p->do_interp);
+	g_assert(sample_tiled_func);
+
+	/* declare the sample() function which we shall implement. */
+	llvm::Function * sample_func =
+	    firtree_engine_create_sample_function_prototype(m);
+	g_assert(sample_func);
+
+	llvm::Value * llvm_width = llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+							  (uint64_t) p->width,
+							  false);
+	llvm::Value * llvm_height =
+	    llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY, (uint64_t) p->height,
+				   false);
+	llvm::Value * llvm_format =
+	    llvm::ConstantInt::get(FIRTREE_LLVM_INT32_TY,
+				   (uint64_t) p->format, false);
+
+	/* The engine passes the handle back to
+	 * firtree_tiled_file_sampler_fetch_block(). */
+	llvm::Constant * llvm_handle_int =
+	    llvm::ConstantInt::get(FIRTREE_LLVM_INT64_TY, (uint64_t) self,
+				   false);
+	llvm::Value * llvm_handle =
+	    llvm::ConstantExpr::getIntToPtr(llvm_handle_int,
+					    llvm::PointerType::
+					    getUnqual(FIRTREE_LLVM_INT8_TY));
+
+	/* Implement the sample function. */
+	llvm::BasicBlock * bb = llvm::BasicBlock::Create(FIRTREE_LLVM_CONTEXT
+							 "entry", sample_func);
+
+	std::vector < llvm::Value * >func_args;
+	func_args.push_back(llvm_handle);
+	func_args.push_back(llvm_format);
+	func_args.push_back(llvm_width);
+	func_args.push_back(llvm_height);
+	func_args.push_back(sample_func->arg_begin());
+
+	llvm::Value * ret_val = llvm::CallInst::Create(sample_tiled_func,
+						       func_args.begin(),
+						       func_args.end(), "rv",
+						       bb);
+
+	llvm::ReturnInst::Create(FIRTREE_LLVM_CONTEXT ret_val, bb);
+
+	p->cached_function = sample_func;
+	return sample_func;
+}
+
+/* vim:sw=8:ts=8:tw=78:noet:cindent
+ */
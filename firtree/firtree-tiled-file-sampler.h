@@ -0,0 +1,94 @@
+/* firtree-tiled-file-sampler.h */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.    See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA    02110-1301, USA
+ */
+
+#ifndef __FIRTREE_TILED_FILE_SAMPLER_H__
+#define __FIRTREE_TILED_FILE_SAMPLER_H__
+
+#include <glib-object.h>
+
+#include "firtree-types.h"
+#include "firtree-sampler.h"
+
+G_BEGIN_DECLS
+
+#define FIRTREE_TYPE_TILED_FILE_SAMPLER 		firtree_tiled_file_sampler_get_type()
+#define FIRTREE_TILED_FILE_SAMPLER(obj) 		(G_TYPE_CHECK_INSTANCE_CAST ((obj), FIRTREE_TYPE_TILED_FILE_SAMPLER, FirtreeTiledFileSampler))
+#define FIRTREE_TILED_FILE_SAMPLER_CLASS(klass) 	(G_TYPE_CHECK_CLASS_CAST ((klass), FIRTREE_TYPE_TILED_FILE_SAMPLER, FirtreeTiledFileSamplerClass))
+#define FIRTREE_IS_TILED_FILE_SAMPLER(obj) 		(G_TYPE_CHECK_INSTANCE_TYPE ((obj), FIRTREE_TYPE_TILED_FILE_SAMPLER))
+#define FIRTREE_IS_TILED_FILE_SAMPLER_CLASS(klass) 	(G_TYPE_CHECK_CLASS_TYPE ((klass), FIRTREE_TYPE_TILED_FILE_SAMPLER))
+#define FIRTREE_TILED_FILE_SAMPLER_GET_CLASS(obj) 	(G_TYPE_INSTANCE_GET_CLASS ((obj), FIRTREE_TYPE_TILED_FILE_SAMPLER, FirtreeTiledFileSamplerClass))
+
+typedef struct _FirtreeTiledFileSampler 		FirtreeTiledFileSampler;
+typedef struct _FirtreeTiledFileSamplerClass	FirtreeTiledFileSamplerClass;
+typedef struct _FirtreeTiledFileSamplerPrivate 	FirtreeTiledFileSamplerPrivate;
+
+struct _FirtreeTiledFileSampler
+{
+	FirtreeSampler 		parent;
+};
+
+struct _FirtreeTiledFileSamplerClass
+{
+	FirtreeSamplerClass 	parent_class;
+};
+
+GType 			 firtree_tiled_file_sampler_get_type(void);
+
+FirtreeTiledFileSampler	*firtree_tiled_file_sampler_new	(void);
+
+gboolean		 firtree_tiled_file_sampler_set_file
+							(FirtreeTiledFileSampler	*self,
+							 const gchar		*filename);
+
+const gchar		*firtree_tiled_file_sampler_get_file
+							(FirtreeTiledFileSampler	*self);
+
+gboolean		 firtree_tiled_file_sampler_get_do_interpolation
+							(FirtreeTiledFileSampler	*self);
+
+void			 firtree_tiled_file_sampler_set_do_interpolation
+							(FirtreeTiledFileSampler	*self,
+							 gboolean		 do_interp);
+
+gsize			 firtree_tiled_file_sampler_get_cache_size
+							(FirtreeTiledFileSampler	*self);
+
+void			 firtree_tiled_file_sampler_set_cache_size
+							(FirtreeTiledFileSampler	*self,
+							 gsize			 cache_size);
+
+guint			 firtree_tiled_file_sampler_get_resident_tile_count
+							(FirtreeTiledFileSampler	*self);
+
+gboolean		 firtree_tiled_file_sampler_write_file
+							(const gchar		*filename,
+				 			 gpointer		 buffer,
+							 guint			 width,
+							 guint			 height,
+				 			 guint			 stride,
+							 FirtreeBufferFormat 	 format,
+							 guint			 tile_width,
+							 guint			 tile_height);
+
+G_END_DECLS
+
+#endif				/* __FIRTREE_TILED_FILE_SAMPLER_H__ */
+
+/* vim:sw=8:ts=8:noet:cindent
+ */
@@ -47,18 +47,37 @@
  * @FIRTREE_FORMAT_RGBX32:
  * @FIRTREE_FORMAT_BGRX32:
  * @FIRTREE_FORMAT_L8:
+ * @FIRTREE_FORMAT_I420_FOURCC: Planar 4:2:0 YCbCr. A Y plane followed by
+ * half-resolution Cb and Cr planes with half the stride.
+ * @FIRTREE_FORMAT_YV12_FOURCC: As I420 but with the Cr plane before the Cb
+ * plane.
  * @FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED: 4 component 32-bit floating point numbers.
+ * @FIRTREE_FORMAT_NV12_FOURCC: Semi-planar 4:2:0 YCbCr. A Y plane followed
+ * by a half-height plane of interleaved Cb, Cr pairs with the same stride.
+ * @FIRTREE_FORMAT_NV21_FOURCC: As NV12 but with Cr before Cb in each pair.
+ * @FIRTREE_FORMAT_P010_FOURCC: As NV12 but with each sample stored as a
+ * little-endian 16-bit value whose top 10 bits hold the sample.
+ * @FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED: 4 component 16-bit (half
+ * precision) floating point numbers.
+ * @FIRTREE_FORMAT_RGBA64: 4 component 16-bit unsigned integers.
+ * @FIRTREE_FORMAT_RGBA64_PREMULTIPLIED: As RGBA64 with the colour
+ * premultiplied by alpha.
  * 
  * A set of possible formats memory buffers can be in. The names are of the
  * form FIRTREE_FORMAT_abcdNN where abcd gives the byte order of the packed 
  * components in memory and NN is the number of bits per pixel.
  *
- * Exceptions to this are the _FOURCC and _F32 formats. The former are laid 
- * out in memory as specified by their four character code and the latter are
- * laid out as arrays of 4-component floating point vectors.
+ * Exceptions to this are the _FOURCC, _F32 and _F16 formats. The former are
+ * laid out in memory as specified by their four character code and the
+ * latter are laid out as arrays of 4-component floating point vectors.
  *
  * Since these are specified in terms of byte order in memory, they are
- * endian independent.
+ * endian independent. The components of the _F32, _F16 and 64-bit formats
+ * are in native byte order.
+ *
+ * The YCbCr formats use ITU-R BT.601 studio range and occupy
+ * height * stride * 3 / 2 bytes. They may only be rendered into if both the
+ * width and height are even.
  */
 typedef enum {
 	FIRTREE_FORMAT_ARGB32 			= 0x00,
@@ -85,9 +104,72 @@ typedef enum {
 
 	FIRTREE_FORMAT_RGBA_F32_PREMULTIPLIED 	= 0x11,
 
+	FIRTREE_FORMAT_NV12_FOURCC 		= 0x12,
+	FIRTREE_FORMAT_NV21_FOURCC 		= 0x13,
+	FIRTREE_FORMAT_P010_FOURCC 		= 0x14,
+
+	FIRTREE_FORMAT_RGBA_F16_PREMULTIPLIED 	= 0x15,
+	FIRTREE_FORMAT_RGBA64 			= 0x16,
+	FIRTREE_FORMAT_RGBA64_PREMULTIPLIED 	= 0x17,
+
 	FIRTREE_FORMAT_LAST
 } FirtreeBufferFormat;
 
+/**
+ * FirtreeInterpolationMode:
+ * @FIRTREE_INTERPOLATION_NEAREST: Use the value of the nearest pixel.
+ * @FIRTREE_INTERPOLATION_LINEAR: Linearly interpolate the four nearest
+ * pixels.
+ * @FIRTREE_INTERPOLATION_BICUBIC: Apply a cubic convolution filter to the
+ * sixteen nearest pixels.
+ * @FIRTREE_INTERPOLATION_LANCZOS3: Apply a three lobed Lanczos filter to
+ * the thirty-six nearest pixels.
+ * @FIRTREE_INTERPOLATION_LAST: A sentinel value.
+ *
+ * The methods image samplers may use to find a value between pixels. The
+ * bicubic and Lanczos filters are separable. If a sampler's transform
+ * is a pure scale which shrinks the image, they widen in proportion to the
+ * scale so that the image is filtered as it shrinks.
+ */
+typedef enum {
+	FIRTREE_INTERPOLATION_NEAREST 		= 0x00,
+	FIRTREE_INTERPOLATION_LINEAR 		= 0x01,
+	FIRTREE_INTERPOLATION_BICUBIC 		= 0x02,
+	FIRTREE_INTERPOLATION_LANCZOS3 		= 0x03,
+
+	FIRTREE_INTERPOLATION_LAST
+} FirtreeInterpolationMode;
+
+/**
+ * FirtreeRenderMode:
+ * @FIRTREE_RENDER_MODE_OVER: Composite the render over the existing contents
+ * of the target. Pixels where the sampler is transparent are left alone.
+ * @FIRTREE_RENDER_MODE_REPLACE: Replace the contents of the target with the
+ * render, transparent pixels included. The target is never read.
+ * @FIRTREE_RENDER_MODE_ADD: Add the render to the target. Targets with 8-bit
+ * or 16-bit integer components saturate at 1; floating point targets do not.
+ * @FIRTREE_RENDER_MODE_MULTIPLY: Multiply the target by the render where
+ * both are opaque, falling back to "over" where either is transparent.
+ * @FIRTREE_RENDER_MODE_SCREEN: Multiply the complements of the render and
+ * the target and complement the result, lightening the target.
+ * @FIRTREE_RENDER_MODE_LAST: A sentinel value.
+ *
+ * How a render is combined with what is already in its target. The
+ * operators act on premultiplied colour with the same definitions as the
+ * corresponding cairo operators. For a sampler which is known to be opaque
+ * "over" and "replace" are equivalent and the engine renders in
+ * @FIRTREE_RENDER_MODE_REPLACE mode regardless.
+ */
+typedef enum {
+	FIRTREE_RENDER_MODE_OVER 		= 0x00,
+	FIRTREE_RENDER_MODE_REPLACE 		= 0x01,
+	FIRTREE_RENDER_MODE_ADD 		= 0x02,
+	FIRTREE_RENDER_MODE_MULTIPLY 		= 0x03,
+	FIRTREE_RENDER_MODE_SCREEN 		= 0x04,
+
+	FIRTREE_RENDER_MODE_LAST
+} FirtreeRenderMode;
+
 #endif				/* __FIRTREE_TYPES_H__ */
 
 /* vim:sw=8:ts=8:noet:cindent
@@ -85,6 +85,58 @@ llvm::Function*
 firtree_engine_create_sample_image_buffer_prototype(llvm::Module* module,
         gboolean interp);
 
+/**
+ * firtree_engine_create_sample_image_buffer_filtered_prototype:
+ * @module: An LLVM module.
+ * @mode: The interpolation mode.
+ *
+ * Create a prototype for the engine intrinsic which samples an image buffer
+ * with the interpolation mode @mode. For the nearest and linear modes this
+ * is the same as firtree_engine_create_sample_image_buffer_prototype().
+ * For the other modes the C-style prototype would be:
+ *
+ *   vec4 sample_image_buffer_filtered(guchar* buffer,
+ *      FirtreeEngineBufferFormat format, unsigned int width,
+ *      unsigned int height, unsigned int stride,
+ *      float scale_x, float scale_y, vec2 location);
+ *
+ * where @scale_x and @scale_y give the factor by which the filter is
+ * widened along each axis. See firtree_engine_get_filter_scale().
+ *
+ * Returns: A new LLVM function.
+ */
+llvm::Function*
+firtree_engine_create_sample_image_buffer_filtered_prototype(
+        llvm::Module* module, FirtreeInterpolationMode mode);
+
+/**
+ * firtree_engine_interpolation_mode_is_filtered:
+ * @mode: The interpolation mode.
+ *
+ * Returns: TRUE if the sampling intrinsic for @mode takes filter scale
+ * arguments.
+ */
+gboolean
+firtree_engine_interpolation_mode_is_filtered(FirtreeInterpolationMode mode);
+
+/**
+ * firtree_engine_get_filter_scale:
+ * @transform: The transform which maps output space to the image space.
+ * @level_index: The index of the image pyramid level being sampled or 0.
+ * @scale_x: Filled with the filter scale along the x-axis.
+ * @scale_y: Filled with the filter scale along the y-axis.
+ *
+ * Work out how much to widen a resampling filter so that it covers the
+ * footprint of one output pixel. If @transform is a pure scale which
+ * shrinks the image, the filter is widened by the scale factor along each
+ * axis, up to a limit. Otherwise both scales are one. If the image is
+ * sampled from a pyramid level the scale is reduced by the level's
+ * shrink factor.
+ */
+void
+firtree_engine_get_filter_scale(FirtreeAffineTransform* transform,
+        guint level_index, float* scale_x, float* scale_y);
+
 /**
  * firtree_engine_create_sample_cogl_texture_prototype:
  * @module: An LLVM module.
@@ -99,6 +151,88 @@ firtree_engine_create_sample_image_buffer_prototype(llvm::Module* module,
 llvm::Function*
 firtree_engine_create_sample_cogl_texture_prototype(llvm::Module* module);
 
+/**
+ * firtree_engine_create_sample_tiled_image_prototype:
+ * @module: An LLVM module.
+ * @interp: Whether to use linear interpolation.
+ *
+ * Create a prototype for the sample_tiled_image() engine intrinsic. The
+ * C-style ptototype would be:
+ *
+ *   vec4 sample_tiled_image(FirtreeTiledFileSampler* sampler,
+ *      FirtreeBufferFormat format, unsigned int width, unsigned int height,
+ *      vec2 location);
+ *
+ * The engine fetches pixels via firtree_tiled_file_sampler_fetch_block().
+ *
+ * Returns: A new LLVM function.
+ */
+llvm::Function*
+firtree_engine_create_sample_tiled_image_prototype(llvm::Module* module,
+        gboolean interp);
+
+/**
+ * firtree_engine_create_prefetch_image_buffer_prototype:
+ * @module: An LLVM module.
+ *
+ * Create a prototype for the prefetch_image_buffer() engine intrinsic. The
+ * C-style prototype would be:
+ *
+ *   void prefetch_image_buffer(guchar* buffer,
+ *      FirtreeEngineBufferFormat format, unsigned int width,
+ *      unsigned int height, unsigned int stride,
+ *      int rows_ahead, float x_step, vec2 location);
+ *
+ * It hints that the pixel @rows_ahead rows below @location is about to be
+ * sampled and has no other effect. @x_step is the distance along the row,
+ * in pixels, from the previous sample so that each cache line is only
+ * prefetched once.
+ *
+ * Returns: A new LLVM function.
+ */
+llvm::Function*
+firtree_engine_create_prefetch_image_buffer_prototype(llvm::Module* module);
+
+/**
+ * firtree_engine_get_prefetch_rows:
+ * @transform: The transform which maps output space to the image space.
+ * @level_index: The index of the image pyramid level being sampled or 0.
+ *
+ * Work out how many rows ahead of each sample of an image buffer to
+ * prefetch. Engines render row by row and so if @transform maps output rows
+ * onto image rows, the rows sampled for the next output row are known. The
+ * result is negative if @transform flips the image vertically.
+ *
+ * Returns: The number of rows to prefetch ahead or 0 if @transform does not
+ * preserve rows.
+ */
+gint
+firtree_engine_get_prefetch_rows(FirtreeAffineTransform* transform,
+        guint level_index);
+
+/**
+ * firtree_engine_get_buffer_format_pixel_size:
+ * @format: A FirtreeBufferFormat.
+ *
+ * Returns: The number of bytes used by one pixel of @format or 0 if @format
+ * is a planar format.
+ */
+guint
+firtree_engine_get_buffer_format_pixel_size(FirtreeBufferFormat format);
+
+/**
+ * firtree_engine_get_buffer_size:
+ * @format: A FirtreeBufferFormat.
+ * @height: The buffer height in rows.
+ * @stride: The size of one row of the buffer (or its luma plane) in bytes.
+ *
+ * Returns: The total number of bytes occupied by a buffer of @format,
+ * including any chroma planes.
+ */
+guint
+firtree_engine_get_buffer_size(FirtreeBufferFormat format, guint height,
+        guint stride);
+
 /**
  * firtree_engine_create_sample_function_prototype:
  * @module: An LLVM module.
@@ -133,6 +267,42 @@ firtree_engine_create_sample_function_prototype(llvm::Module* module);
 llvm::Function*
 firtree_engine_create_reduce_function_prototype(llvm::Module* module);
 
+/**
+ * firtree_engine_create_affine_transform_prototype:
+ * @module: An LLVM module.
+ *
+ * Create a prototype for the affine_transform() engine intrinsic. The C-style
+ * prototype would be:
+ *
+ *   vec2 affine_transform(vec4 linear, vec2 translation, vec2 location);
+ *
+ * where @linear holds (m11, m21, m12, m22) and @translation holds (tx, ty).
+ * Calls to this function are folded together and lowered into arithmetic by
+ * Firtree::AffineTransformFoldingPass and
+ * Firtree::AffineTransformLoweringPass.
+ *
+ * Returns: A new LLVM function.
+ */
+llvm::Function*
+firtree_engine_create_affine_transform_prototype(llvm::Module* module);
+
+/**
+ * firtree_engine_create_affine_transform_call:
+ * @module: An LLVM module.
+ * @transform: The transform to apply.
+ * @location: An LLVM value holding the location to transform.
+ * @bb: The basic block to append the call to.
+ *
+ * Append a call to affine_transform() which applies @transform to @location
+ * to @bb. If @transform is the identity, no call is made.
+ *
+ * Returns: An LLVM value holding the transformed location.
+ */
+llvm::Value*
+firtree_engine_create_affine_transform_call(llvm::Module* module,
+        FirtreeAffineTransform* transform, llvm::Value* location,
+        llvm::BasicBlock* bb);
+
 /**
  * firtree_engine_get_constant_for_kernel_argument:
  * @kernel_arg: The value of the kernel's argument.
@@ -207,6 +377,61 @@ class FunctionCallReplacementPass : public llvm::BasicBlockPass {
         virtual llvm::Value* getReplacementForCallInst(llvm::CallInst& instruction) = 0;
 };
 
+/**
+ * AffineTransformFoldingPass
+ *
+ * Replaces a call to affine_transform() whose location is itself the result
+ * of a call to affine_transform() with a single call using the composed
+ * transform. After inlining, this collapses a chain of sampler transforms
+ * into one matrix per leaf sampler.
+ */
+class AffineTransformFoldingPass : public FunctionCallReplacementPass {
+    public:
+        static char ID;
+        AffineTransformFoldingPass() : FunctionCallReplacementPass(&ID) { }
+
+    protected:
+        virtual bool         interestedInCallToFunction(const std::string& name);
+        virtual llvm::Value* getReplacementForCallInst(llvm::CallInst& instruction);
+};
+
+/**
+ * AffineTransformLoweringPass
+ *
+ * Replaces calls to affine_transform() with the equivalent vector
+ * multiply-adds. Multiplies by an identity linear part and additions of a
+ * zero translation are omitted.
+ */
+class AffineTransformLoweringPass : public FunctionCallReplacementPass {
+    public:
+        static char ID;
+        AffineTransformLoweringPass() : FunctionCallReplacementPass(&ID) { }
+
+    protected:
+        virtual bool         interestedInCallToFunction(const std::string& name);
+        virtual llvm::Value* getReplacementForCallInst(llvm::CallInst& instruction);
+};
+
+/**
+ * SpecialiseImageBufferCallsPass
+ *
+ * Replaces calls to sample_image_buffer_nn() and sample_image_buffer_lerp()
+ * whose format argument is constant with calls to the format-specialised
+ * versions from the engine support module, e.g.
+ * sample_image_buffer_lerp_FIRTREE_FORMAT_ARGB32(). Calls for formats with
+ * no specialised version are left alone. This must run on the linked module
+ * before the support functions are internalised.
+ */
+class SpecialiseImageBufferCallsPass : public FunctionCallReplacementPass {
+    public:
+        static char ID;
+        SpecialiseImageBufferCallsPass() : FunctionCallReplacementPass(&ID) { }
+
+    protected:
+        virtual bool         interestedInCallToFunction(const std::string& name);
+        virtual llvm::Value* getReplacementForCallInst(llvm::CallInst& instruction);
+};
+
 } /* namespace Firtree */
 
 G_END_DECLS
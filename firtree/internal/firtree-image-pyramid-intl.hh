@@ -0,0 +1,146 @@
+/* firtree-image-pyramid-intl.hh */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef _FIRTREE_IMAGE_PYRAMID_INTL
+#define _FIRTREE_IMAGE_PYRAMID_INTL
+
+#include "../firtree-affine-transform.h"
+#include "../firtree-types.h"
+
+#include <llvm/Module.h>
+#include <llvm/Instructions.h>
+
+G_BEGIN_DECLS
+
+/**
+ * SECTION:firtree-image-pyramid-intl
+ * @short_description: Lazily built mip levels for the image samplers.
+ * @include: firtree/internal/firtree-image-pyramid-intl.hh
+ *
+ * A FirtreeImagePyramid holds successively half-sized copies of an image
+ * buffer. The image samplers use it to sample a pre-filtered level when
+ * their transform shrinks the image so that downscaled renders neither alias
+ * nor touch every pixel of the full-resolution buffer.
+ */
+
+/**
+ * FirtreeImagePyramidLevel:
+ * @data: The first byte of the level's pixel data.
+ * @width: The width of the level in pixels.
+ * @height: The height of the level in rows.
+ * @stride: The size of one row of the level in bytes.
+ * @format: The format of the level's pixel data.
+ *
+ * A description of one level of an image pyramid. Level zero is the
+ * original image.
+ */
+typedef struct _FirtreeImagePyramidLevel FirtreeImagePyramidLevel;
+struct _FirtreeImagePyramidLevel {
+    gpointer data;
+    guint width;
+    guint height;
+    guint stride;
+    FirtreeBufferFormat format;
+};
+
+typedef struct _FirtreeImagePyramid FirtreeImagePyramid;
+
+/**
+ * firtree_image_pyramid_new:
+ *
+ * Create a new, empty, image pyramid.
+ *
+ * Returns: A new FirtreeImagePyramid. Free it with
+ * firtree_image_pyramid_free().
+ */
+FirtreeImagePyramid*
+firtree_image_pyramid_new(void);
+
+/**
+ * firtree_image_pyramid_free:
+ * @pyramid: A FirtreeImagePyramid.
+ *
+ * Release @pyramid and any levels it has built.
+ */
+void
+firtree_image_pyramid_free(FirtreeImagePyramid* pyramid);
+
+/**
+ * firtree_image_pyramid_reset:
+ * @pyramid: A FirtreeImagePyramid.
+ *
+ * Release any levels built by @pyramid. This should be called whenever the
+ * contents of the source image change.
+ */
+void
+firtree_image_pyramid_reset(FirtreeImagePyramid* pyramid);
+
+/**
+ * firtree_image_pyramid_format_is_supported:
+ * @format: A FirtreeBufferFormat.
+ *
+ * Returns: TRUE if mip levels can be built for buffers of @format.
+ */
+gboolean
+firtree_image_pyramid_format_is_supported(FirtreeBufferFormat format);
+
+/**
+ * firtree_image_pyramid_select_level:
+ * @pyramid: A FirtreeImagePyramid.
+ * @transform: The transform which maps output space to the image space.
+ * @base: The description of the source image.
+ * @level: Filled with the description of the selected level.
+ *
+ * Choose the level of @pyramid which best matches the sampling footprint of
+ * @transform and build it, along with any levels it depends upon, if it has
+ * not already been built. Level zero, a copy of @base, is chosen if @transform
+ * does not shrink the image or if the format of @base is not supported.
+ *
+ * Returns: The index of the selected level.
+ */
+guint
+firtree_image_pyramid_select_level(FirtreeImagePyramid* pyramid,
+                                   FirtreeAffineTransform* transform,
+                                   const FirtreeImagePyramidLevel* base,
+                                   FirtreeImagePyramidLevel* level);
+
+/**
+ * firtree_image_pyramid_create_level_location:
+ * @module: An LLVM module.
+ * @level_index: The index of a pyramid level.
+ * @location: An LLVM value holding a location in the source image.
+ * @bb: The basic block to append the computation to.
+ *
+ * Append instructions to @bb which map @location from the space of the
+ * source image into the space of level @level_index.
+ *
+ * Returns: An LLVM value holding the location within the level.
+ */
+llvm::Value*
+firtree_image_pyramid_create_level_location(llvm::Module* module,
+                                            guint level_index,
+                                            llvm::Value* location,
+                                            llvm::BasicBlock* bb);
+
+G_END_DECLS
+
+#endif /* _FIRTREE_IMAGE_PYRAMID_INTL */
+
+/* vim:sw=4:ts=4:et:cindent
+ */
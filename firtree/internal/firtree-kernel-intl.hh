@@ -69,6 +69,107 @@ firtree_kernel_get_function(FirtreeKernel* self);
 llvm::Function*
 firtree_kernel_create_overall_function(FirtreeKernel* self);
 
+/**
+ * firtree_kernel_preserves_transparency:
+ * @self: A FirtreeKernel instance.
+ *
+ * Determine if @self only samples each sampler argument at samplerCoord()
+ * and returns a transparent pixel whenever all of those samples are
+ * transparent. Such a kernel is transparent outside of the union of the
+ * output extents of its sampler arguments.
+ *
+ * This is established by constant folding the kernel with its static
+ * arguments substituted in and so may return FALSE for kernels which do
+ * have this property. The result is cached until the kernel's module or
+ * arguments change.
+ *
+ * Returns: TRUE if @self is known to preserve transparency.
+ */
+gboolean
+firtree_kernel_preserves_transparency(FirtreeKernel* self);
+
+/**
+ * firtree_kernel_is_opaque:
+ * @self: A FirtreeKernel instance.
+ *
+ * Determine if the alpha component of every pixel returned by @self is 1
+ * whatever its sampler arguments hold. Renders of such a kernel may simply
+ * replace the existing contents of their target rather than compositing
+ * over them.
+ *
+ * As with firtree_kernel_preserves_transparency(), this is established by
+ * constant folding the kernel with its static arguments substituted in and
+ * so may return FALSE for kernels which are opaque. The alpha of a sample is
+ * never assumed to be 1. The result is cached until the kernel's module or
+ * arguments change.
+ *
+ * Returns: TRUE if @self is known to be opaque.
+ */
+gboolean
+firtree_kernel_is_opaque(FirtreeKernel* self);
+
+/**
+ * firtree_kernel_get_sample_count:
+ * @self: A FirtreeKernel instance.
+ * @arg_name: A quark corresponding to the name of a sampler argument.
+ *
+ * Estimate how many times @self samples the sampler argument @arg_name for
+ * each output pixel. Calls to sample() at the same co-ordinate are counted
+ * once and calls within loops are assumed to be made several times.
+ *
+ * Returns: The estimated number of samples or 0 if @self cannot be analysed.
+ */
+guint
+firtree_kernel_get_sample_count(FirtreeKernel* self, GQuark arg_name);
+
+/**
+ * firtree_kernel_get_sample_footprint:
+ * @self: A FirtreeKernel instance.
+ * @arg_name: A quark corresponding to the name of a sampler argument.
+ * @sampler_radius: Filled with the largest offset in sampler space.
+ * @dest_radius: Filled with the largest offset in output space.
+ *
+ * Determine how far from samplerCoord() @self samples the sampler argument
+ * @arg_name. This succeeds if every sample is taken at
+ * samplerTransform(s, destCoord() + d) + e for constant vectors d and e.
+ * @dest_radius and @sampler_radius are set to the largest magnitude of each
+ * component of d and e respectively. Offsets which vary, such as those
+ * computed in a loop, cannot be bounded. The result is cached until the
+ * kernel's module or arguments change.
+ *
+ * Returns: TRUE if the samples of @arg_name could be bounded.
+ */
+gboolean
+firtree_kernel_get_sample_footprint(FirtreeKernel* self, GQuark arg_name,
+        FirtreeVec2* sampler_radius, FirtreeVec2* dest_radius);
+
+/**
+ * firtree_kernel_samples_whole_pixels:
+ * @self: A FirtreeKernel instance.
+ * @arg_name: A quark corresponding to the name of a sampler argument.
+ *
+ * Determine if @self only samples @arg_name a whole number of pixels away
+ * from samplerCoord(). This is so if the footprint of @arg_name is known,
+ * as for firtree_kernel_get_sample_footprint(), and every component of
+ * each offset d and e is a whole number.
+ *
+ * Returns: TRUE if every sample of @arg_name is a whole number of pixels
+ * from samplerCoord().
+ */
+gboolean
+firtree_kernel_samples_whole_pixels(FirtreeKernel* self, GQuark arg_name);
+
+/**
+ * firtree_kernel_region_changed:
+ * @self: A FirtreeKernel instance.
+ * @region: The part of the output of @self which has changed.
+ *
+ * Emit the ::region-changed signal. It must be followed by a
+ * ::contents-changed signal.
+ */
+void
+firtree_kernel_region_changed(FirtreeKernel* self, FirtreeVec4* region);
+
 G_END_DECLS
 
 #endif /* _FIRTREE_KERNEL_INTL */
@@ -38,6 +38,7 @@ struct _FirtreeSamplerIntlVTable {
     gboolean (* get_param) (FirtreeSampler* self, guint param, 
         gpointer dest, guint dest_size);
     llvm::Function* (* get_sample_function) (FirtreeSampler* self);
+    gboolean (* is_opaque) (FirtreeSampler* self);
 };
 
 /**
@@ -82,6 +83,23 @@ firtree_sampler_get_param(FirtreeSampler* self, guint param,
 llvm::Function*
 firtree_sampler_get_sample_function(FirtreeSampler* self);
 
+/**
+ * firtree_sampler_is_opaque:
+ * @self: A FirtreeSampler instance.
+ *
+ * Determine if every sample of @self, at any co-ordinate, has an alpha
+ * component of 1. Renderers may then write the samples over their target
+ * without reading or blending with what was there.
+ *
+ * The default implementation returns FALSE. Image samplers are never opaque
+ * since they are transparent outside of their image and partially so at
+ * its edges.
+ *
+ * Returns: TRUE if @self is known to be opaque.
+ */
+gboolean
+firtree_sampler_is_opaque(FirtreeSampler* self);
+
 /**
  * firtree_sampler_lock:
  * @self: A FirtreeSampler instance.
@@ -111,6 +129,70 @@ firtree_sampler_lock(FirtreeSampler* self);
 void
 firtree_sampler_unlock(FirtreeSampler* self);
 
+/**
+ * firtree_sampler_extent_is_infinite:
+ * @extent: An extent as returned by firtree_sampler_get_extent().
+ *
+ * Returns: TRUE if @extent is (effectively) the infinite extent.
+ */
+gboolean
+firtree_sampler_extent_is_infinite(const FirtreeVec4* extent);
+
+/**
+ * firtree_sampler_get_output_extent:
+ * @self: A FirtreeSampler instance.
+ *
+ * Find a rectangle in the output space of @self outside of which sampling
+ * @self is guaranteed to give a transparent pixel. This is the extent of
+ * @self, padded to allow for interpolation, mapped through the inverse of the
+ * sampler transform. It may be the infinite extent if no such rectangle is
+ * known.
+ *
+ * Returns: A (minx, miny, width, height) 4-vector.
+ */
+FirtreeVec4
+firtree_sampler_get_output_extent(FirtreeSampler* self);
+
+/**
+ * firtree_sampler_map_region_to_output:
+ * @self: A FirtreeSampler instance.
+ * @region: A (minx, miny, width, height) rectangle in sampler co-ordinates.
+ *
+ * Find a rectangle in the output space of @self which contains every point
+ * whose sample from @self depends on @region, as for
+ * firtree_sampler_get_output_extent().
+ *
+ * Returns: A (minx, miny, width, height) 4-vector.
+ */
+FirtreeVec4
+firtree_sampler_map_region_to_output(FirtreeSampler* self,
+        const FirtreeVec4* region);
+
+/**
+ * firtree_sampler_region_changed:
+ * @self: A FirtreeSampler instance.
+ * @region: The (minx, miny, width, height) rectangle which has changed.
+ *
+ * Emit only the ::region-changed signal. This is for samplers which pass on
+ * the changes of their inputs. The caller must make sure that a matching
+ * ::contents-changed signal follows.
+ */
+void
+firtree_sampler_region_changed(FirtreeSampler* self, FirtreeVec4* region);
+
+/**
+ * firtree_sampler_estimate_cost:
+ * @self: A FirtreeSampler instance.
+ *
+ * Estimate the cost of sampling @self once from the size of its sample
+ * function. The units are roughly LLVM instructions with calls to functions
+ * outside of the sampler's module counted as several instructions.
+ *
+ * Returns: The estimated cost or 0 if @self has no sample function.
+ */
+guint
+firtree_sampler_estimate_cost(FirtreeSampler* self);
+
 G_END_DECLS
 
 #endif /* _FIRTREE_SAMPLER_INTL */
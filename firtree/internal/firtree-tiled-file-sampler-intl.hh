@@ -0,0 +1,53 @@
+/* firtree-tiled-file-sampler-intl.hh */
+
+/* Firtree - A generic image processing library
+ * Copyright (C) 2009 Rich Wareham <richwareham@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef _FIRTREE_TILED_FILE_SAMPLER_INTL
+#define _FIRTREE_TILED_FILE_SAMPLER_INTL
+
+#include <glib-object.h>
+#include <firtree/firtree-tiled-file-sampler.h>
+
+G_BEGIN_DECLS
+
+/**
+ * firtree_tiled_file_sampler_fetch_block:
+ * @handle: The FirtreeTiledFileSampler being sampled.
+ * @x: The x co-ordinate of the top-left pixel of the block.
+ * @y: The y co-ordinate of the top-left pixel of the block.
+ * @block: Memory to copy the block into.
+ *
+ * Called by the engine's sample_tiled_image() intrinsic. Copy the 2x2 block
+ * of pixels whose top-left pixel is (@x, @y) into @block, faulting in
+ * tiles as required. Pixel (i, j) of the block is copied to @block + (j * 32)
+ * + (i * pixel size). Pixels outside of the image are not written.
+ *
+ * This may be called from any thread. Each thread keeps a reference to the
+ * tile it last copied from, so the sampler's cache lock is only taken when
+ * a thread moves on to another tile and never while pixels are copied.
+ */
+void
+firtree_tiled_file_sampler_fetch_block(gpointer handle, gint x, gint y,
+        guint8* block);
+
+G_END_DECLS
+
+#endif /* _FIRTREE_TILED_FILE_SAMPLER_INTL */
+
+/* vim:sw=4:ts=4:et:cindent
+ */
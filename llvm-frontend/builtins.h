@@ -234,6 +234,10 @@ const char* _firtree_builtins =
 	"}\n"
 
 	/* Reduce kernel-only functions */
+	"__builtin__ __reduce __stateful__ void emit(float);\n"
+	"__builtin__ __reduce __stateful__ void emit(int);\n"
+	"__builtin__ __reduce __stateful__ void emit(vec2);\n"
+	"__builtin__ __reduce __stateful__ void emit(vec3);\n"
 	"__builtin__ __reduce __stateful__ void emit(vec4);\n"
 
 	"";
@@ -35,6 +35,28 @@ class FunctionCallEmitter : ExpressionEmitter
 			return new FunctionCallEmitter();
 		}
 
+        //===================================================================
+		/// Return true if the types of each of the parameters match
+		/// those of the prototype without any implicit casting.
+		static bool ParametersMatchExactly(
+		    const std::vector<ExpressionValue*>& parameters,
+		    const FunctionPrototype& proto ) {
+			if(parameters.size() != proto.Parameters.size()) {
+				return false;
+			}
+
+			for(unsigned int i=0; i<parameters.size(); i++) {
+				FullType param_type = parameters[i]->GetType();
+				if((param_type.Specifier != proto.Parameters[i].Type.Specifier) ||
+						!TypeCaster::CanImplicitlyCast(param_type,
+							proto.Parameters[i].Type)) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
         //===================================================================
 		ExpressionValue* EmitFunctionCall(
 		    LLVMContext* context,
@@ -49,11 +71,26 @@ class FunctionCallEmitter : ExpressionEmitter
 				return NULL;
 			}
 
+			// If there is an overload whose parameters match exactly,
+			// prefer it to those which need implicit casts (e.g.
+			// emit(int) vs. emit(float)).
+			bool have_exact_match = false;
+			std::multimap<symbol, FunctionPrototype>::const_iterator it =
+				context->FuncTable.begin();
+			for( ; it != context->FuncTable.end(); ++it)
+			{
+				if((it->first == GLS_Tok_symbol(identifier)) &&
+						ParametersMatchExactly(parameters, it->second))
+				{
+					have_exact_match = true;
+					break;
+				}
+			}
+
 			// Scan the function table looking for a matching function
 			// and emit a call to it. If this loop finishes, no
 			// matching function was found.
-			std::multimap<symbol, FunctionPrototype>::const_iterator it =
-				context->FuncTable.begin();
+			it = context->FuncTable.begin();
 
 			for( ; it != context->FuncTable.end(); ++it)
 			{
@@ -89,6 +126,12 @@ class FunctionCallEmitter : ExpressionEmitter
 						continue;
 					}
 
+					if(have_exact_match &&
+							!ParametersMatchExactly(parameters, proto))
+					{
+						continue;
+					}
+
 					//FIRTREE_LLVM_WARNING( context, func_spec, 
 					//		"Possible match: %s",
 					//		it->second.GetMangledName(context).c_str());
@@ -3,6 +3,7 @@ import gobject
 import Image
 import cairo
 import array
+import math
 from pyfirtree import *
 
 from utils import FirtreeTestCase
@@ -277,5 +278,575 @@ class RenderIntoBuffer(FirtreeTestCase):
         self.assert_(rv)
         self.assertCairoSurfaceMatches(cs, 'cpu-buffer-rgba-f32-premul-kernel')
 
-# vim:sw=4:ts=4:et:autoindent
+class Transforms(FirtreeTestCase):
+    # An 8x8 float buffer where pixel (x,y) has value (x/8, y/8, 0, 1).
+    def setUp(self):
+        self._size = 8
+        values = []
+        for y in range(self._size):
+            for x in range(self._size):
+                values.extend((x / 8.0, y / 8.0, 0.0, 1.0))
+        self._source_buffer = array.array('f', values)
+        self._source = BufferSampler()
+        self._source.set_buffer_no_copy(self._source_buffer,
+            self._size, self._size, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+
+    def tearDown(self):
+        self._source = None
 
+    def render(self, sampler):
+        out_buffer = array.array('f', (0.0,) * 4 * self._size * self._size)
+        engine = CpuRenderer()
+        engine.set_sampler(sampler)
+        rv = engine.render_into_buffer((0, 0, self._size, self._size),
+            out_buffer, self._size, self._size, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(rv)
+        return out_buffer
+
+    def assertOffset(self, out_buffer, dx, dy):
+        # Check that output pixel (x,y) was sampled from (x+dx, y+dy).
+        for y in range(self._size - dy):
+            for x in range(self._size - dx):
+                idx = 4 * (x + y * self._size)
+                self.assertEqual(out_buffer[idx], (x + dx) / 8.0)
+                self.assertEqual(out_buffer[idx+1], (y + dy) / 8.0)
+
+    def kernelSampler(self, src):
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 passthrough(static sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        """)
+        k['src'] = src
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        return ks
+
+    def testSetTransform(self):
+        t = AffineTransform()
+        t.set_translation_by(2, 1)
+        self._source.set_transform(t)
+        got = self._source.get_transform()
+        self.assertEqual(got.get_elements(), t.get_elements())
+        self._source.set_transform(None)
+        self.assert_(self._source.get_transform().is_identity())
+
+    def testRootTransform(self):
+        t = AffineTransform()
+        t.set_translation_by(2, 1)
+        self._source.set_transform(t)
+        self.assertOffset(self.render(self._source), 2, 1)
+
+    def testKernelTransform(self):
+        ks = self.kernelSampler(self._source)
+        self.assertOffset(self.render(ks), 0, 0)
+
+        # Changing the transform re-generates the kernel's function.
+        t = AffineTransform()
+        t.set_translation_by(2, 1)
+        self._source.set_transform(t)
+        self.assertOffset(self.render(ks), 2, 1)
+
+    def testChainedTransform(self):
+        t = AffineTransform()
+        t.set_translation_by(2, 1)
+        self._source.set_transform(t)
+
+        ks = self.kernelSampler(self._source)
+        t = AffineTransform()
+        t.set_translation_by(1, 2)
+        ks.set_transform(t)
+
+        outer_ks = self.kernelSampler(ks)
+        self.assertOffset(self.render(outer_ks), 3, 3)
+
+class Pyramid(FirtreeTestCase):
+    # A 16x16 float buffer holding a one pixel checkerboard.
+    def setUp(self):
+        self._size = 16
+        values = []
+        for y in range(self._size):
+            for x in range(self._size):
+                v = float((x + y) % 2)
+                values.extend((v, v, v, 1.0))
+        self._source_buffer = array.array('f', values)
+        self._source = BufferSampler()
+        self._source.set_buffer(self._source_buffer,
+            self._size, self._size, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+
+    def tearDown(self):
+        self._source = None
+
+    def renderShrunk(self, scale):
+        size = self._size / scale
+        t = AffineTransform()
+        t.set_scaling_by(scale, scale)
+        self._source.set_transform(t)
+
+        out_buffer = array.array('f', (0.0,) * 4 * size * size)
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        rv = engine.render_into_buffer((0, 0, size, size),
+            out_buffer, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(rv)
+        return out_buffer
+
+    def testUsePyramid(self):
+        self.assert_(not self._source.get_use_pyramid())
+        self._source.set_use_pyramid(True)
+        self.assert_(self._source.get_use_pyramid())
+        self._source.set_use_pyramid(False)
+        self.assert_(not self._source.get_use_pyramid())
+
+    def testNoPyramid(self):
+        # Without a pyramid, point sampling the checkerboard aliases.
+        out_buffer = self.renderShrunk(2)
+        for v in out_buffer[0::4]:
+            self.assert_(v in (0.0, 1.0))
+
+    def testShrink(self):
+        self._source.set_use_pyramid(True)
+        for scale in (2, 4, 8):
+            out_buffer = self.renderShrunk(scale)
+            for idx in range(0, len(out_buffer), 4):
+                self.assertAlmostEqual(out_buffer[idx], 0.5)
+                self.assertAlmostEqual(out_buffer[idx+3], 1.0)
+
+    def testBufferChanged(self):
+        self._source.set_use_pyramid(True)
+        self.renderShrunk(2)
+
+        # Levels built from the old contents must be discarded.
+        values = array.array('f', (1.0,) * 4 * self._size * self._size)
+        self._source.set_buffer(values, self._size, self._size,
+            self._size * 16, FORMAT_RGBA_F32_PREMULTIPLIED)
+        out_buffer = self.renderShrunk(2)
+        for v in out_buffer[0::4]:
+            self.assertAlmostEqual(v, 1.0)
+
+class Interpolation(FirtreeTestCase):
+    # A 32x32 float buffer holding a one pixel checkerboard.
+    def setUp(self):
+        self._size = 32
+        values = []
+        for y in range(self._size):
+            for x in range(self._size):
+                v = float((x + y) % 2)
+                values.extend((v, v, v, 1.0))
+        self._source_buffer = array.array('f', values)
+        self._source = BufferSampler()
+        self._source.set_buffer(self._source_buffer,
+            self._size, self._size, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+
+    def tearDown(self):
+        self._source = None
+
+    def renderScaled(self, scale):
+        size = self._size / scale
+        t = AffineTransform()
+        t.set_scaling_by(scale, scale)
+        self._source.set_transform(t)
+
+        out_buffer = array.array('f', (0.0,) * 4 * size * size)
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        rv = engine.render_into_buffer((0, 0, size, size),
+            out_buffer, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(rv)
+        return out_buffer
+
+    def testInterpolationMode(self):
+        self.assertEqual(self._source.get_interpolation_mode(),
+            INTERPOLATION_NEAREST)
+        self.assert_(not self._source.get_do_interpolation())
+
+        self._source.set_interpolation_mode(INTERPOLATION_LANCZOS3)
+        self.assertEqual(self._source.get_interpolation_mode(),
+            INTERPOLATION_LANCZOS3)
+        self.assert_(self._source.get_do_interpolation())
+
+        self._source.set_do_interpolation(True)
+        self.assertEqual(self._source.get_interpolation_mode(),
+            INTERPOLATION_LINEAR)
+        self._source.set_do_interpolation(False)
+        self.assertEqual(self._source.get_interpolation_mode(),
+            INTERPOLATION_NEAREST)
+
+    def testIdentity(self):
+        # Both filters pass pixel centres through unchanged.
+        for mode in (INTERPOLATION_BICUBIC, INTERPOLATION_LANCZOS3):
+            self._source.set_interpolation_mode(mode)
+            out_buffer = self.renderScaled(1)
+            for idx in range(len(out_buffer)):
+                self.assertAlmostEqual(out_buffer[idx],
+                    self._source_buffer[idx], 5)
+
+    def testShrink(self):
+        # Shrinking widens the filters so the checkerboard averages out
+        # away from the edges rather than aliasing.
+        for mode in (INTERPOLATION_BICUBIC, INTERPOLATION_LANCZOS3):
+            self._source.set_interpolation_mode(mode)
+            out_buffer = self.renderScaled(2)
+            size = self._size / 2
+            for y in range(3, size - 3):
+                for x in range(3, size - 3):
+                    idx = 4 * ((y * size) + x)
+                    self.assertAlmostEqual(out_buffer[idx], 0.5, 4)
+            for v in out_buffer[3::4]:
+                self.assertAlmostEqual(v, 1.0, 5)
+
+class YCbCr(FirtreeTestCase):
+    # Formats with their luma stride in bytes for a row of size pixels.
+    formats = (
+        (FORMAT_I420_FOURCC, 1),
+        (FORMAT_YV12_FOURCC, 1),
+        (FORMAT_NV12_FOURCC, 1),
+        (FORMAT_NV21_FOURCC, 1),
+        (FORMAT_P010_FOURCC, 2),
+    )
+
+    def setUp(self):
+        self._size = 16
+        self._colour = (0.8, 0.5, 0.2, 1.0)
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 constant(vec4 colour) {
+                return colour;
+            }
+        """)
+        self.assertKernelCompiled(k)
+        k['colour'] = self._colour
+        self._source = KernelSampler()
+        self._source.set_kernel(k)
+
+    def tearDown(self):
+        self._source = None
+
+    def renderYCbCr(self, format, stride):
+        buffer = array.array('B', (0,) * (self._size * stride * 3 / 2))
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        rv = engine.render_into_buffer((0, 0, self._size, self._size),
+            buffer, self._size, self._size, stride, format)
+        self.assert_(rv)
+        return buffer
+
+    def testRoundTrip(self):
+        for format, sample_size in YCbCr.formats:
+            stride = self._size * sample_size
+            buffer = self.renderYCbCr(format, stride)
+
+            s = BufferSampler()
+            s.set_buffer(buffer, self._size, self._size, stride, format)
+            out_buffer = array.array('f', (0.0,) * 4 * self._size * self._size)
+            engine = CpuRenderer()
+            engine.set_sampler(s)
+            rv = engine.render_into_buffer((0, 0, self._size, self._size),
+                out_buffer, self._size, self._size, self._size * 16,
+                FORMAT_RGBA_F32_PREMULTIPLIED)
+            self.assert_(rv)
+
+            for idx in range(len(out_buffer)):
+                self.assertAlmostEqual(out_buffer[idx],
+                    self._colour[idx % 4], 1)
+
+    def testOddSize(self):
+        buffer = array.array('B', (0,) * (15 * 16 * 3 / 2))
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        self.assert_(not engine.render_into_buffer((0, 0, 15, 15),
+            buffer, 15, 15, 16, FORMAT_NV12_FOURCC))
+
+    def testSmallBuffer(self):
+        # The chroma planes must fit in the buffer too.
+        buffer = array.array('B', (0,) * (self._size * self._size))
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        self.assertRaises(RuntimeError, engine.render_into_buffer,
+            (0, 0, self._size, self._size), buffer, self._size, self._size,
+            self._size, FORMAT_NV12_FOURCC)
+
+class HighPrecision(FirtreeTestCase):
+    # An 8x8 float buffer of premultiplied colours with fractional alpha.
+    def setUp(self):
+        self._size = 8
+        values = []
+        for y in range(self._size):
+            for x in range(self._size):
+                a = (y + 1) / 8.0
+                values.extend((a * x / 8.0, a * 0.5, a * 0.25, a))
+        self._source_buffer = array.array('f', values)
+
+    def render(self, sampler, buffer, stride, format):
+        engine = CpuRenderer()
+        engine.set_sampler(sampler)
+        rv = engine.render_into_buffer((0, 0, self._size, self._size),
+            buffer, self._size, self._size, stride, format)
+        self.assert_(rv)
+
+    def roundTrip(self, format, places):
+        source = BufferSampler()
+        source.set_buffer_no_copy(self._source_buffer,
+            self._size, self._size, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        buffer = array.array('H', (0,) * 4 * self._size * self._size)
+        self.render(source, buffer, self._size * 8, format)
+
+        s = BufferSampler()
+        s.set_buffer(buffer, self._size, self._size, self._size * 8, format)
+        out_buffer = array.array('f', (0.0,) * 4 * self._size * self._size)
+        self.render(s, out_buffer, self._size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+
+        for idx in range(len(out_buffer)):
+            self.assertAlmostEqual(out_buffer[idx],
+                self._source_buffer[idx], places)
+
+    def testHalfFloat(self):
+        self.roundTrip(FORMAT_RGBA_F16_PREMULTIPLIED, 3)
+
+    def testHalfFloatRange(self):
+        # Half floats may hold values greater than one.
+        self._source_buffer = array.array('f',
+            (2.0, 100.0, -1.0, 1.0) * self._size * self._size)
+        self.roundTrip(FORMAT_RGBA_F16_PREMULTIPLIED, 3)
+
+    def testRGBA64(self):
+        self.roundTrip(FORMAT_RGBA64, 4)
+        self.roundTrip(FORMAT_RGBA64_PREMULTIPLIED, 4)
+
+class SpecialisedSampling(FirtreeTestCase):
+    # Compare renders of small buffers against samples computed here. The
+    # odd sizes and the half pixel offset renders exercise both the
+    # unchecked interior path and the checked path for samples straddling
+    # the edge of the image.
+    def setUp(self):
+        self._width = 5
+        self._height = 3
+
+    def pixel(self, x, y):
+        # The premultiplied value of the test pixel at (x, y).
+        if (x < 0) or (x >= self._width) or (y < 0) or (y >= self._height):
+            return (0.0, 0.0, 0.0, 0.0)
+        a = 1.0 - (0.2 * y)
+        return ((x * 50 + 15) * a / 255.0, (y * 90 + 30) * a / 255.0,
+            (250 - x * 40 - y * 10) * a / 255.0, a)
+
+    def makeBuffer(self, format):
+        if format == FORMAT_RGBA_F32_PREMULTIPLIED:
+            values = [ ]
+            for y in range(self._height):
+                for x in range(self._width):
+                    values.extend(self.pixel(x, y))
+            return array.array('f', values), self._width * 16
+
+        # The 8-bit test pixels are chosen to unpremultiply exactly.
+        pix_size = { FORMAT_RGBA32: 4, FORMAT_RGB24: 3 }[format]
+        data = array.array('B')
+        for y in range(self._height):
+            for x in range(self._width):
+                p = self.pixel(x, y)
+                rgb = [int(round(c * 255.0 / p[3])) for c in p[0:3]]
+                if format == FORMAT_RGBA32:
+                    data.extend(rgb + [int(round(p[3] * 255.0))])
+                else:
+                    data.extend(rgb)
+        return data, self._width * pix_size
+
+    def expected(self, format, x, y, linear):
+        # The sample at (x, y) in buffer co-ordinates.
+        pixel = self.pixel
+        if format == FORMAT_RGB24:
+            pixel = self.opaquePixel
+
+        if not linear:
+            return pixel(int(math.floor(x)), int(math.floor(y)))
+
+        x -= 0.5
+        y -= 0.5
+        x0 = int(math.floor(x))
+        y0 = int(math.floor(y))
+        fx = x - x0
+        fy = y - y0
+        rv = [ ]
+        for c in range(4):
+            b = (1.0 - fx) * pixel(x0, y0)[c] + fx * pixel(x0 + 1, y0)[c]
+            t = (1.0 - fx) * pixel(x0, y0 + 1)[c] + \
+                fx * pixel(x0 + 1, y0 + 1)[c]
+            rv.append((1.0 - fy) * b + fy * t)
+        return rv
+
+    def opaquePixel(self, x, y):
+        # RGB24 has no alpha and so stores the unpremultiplied colour.
+        p = self.pixel(x, y)
+        if p[3] == 0.0:
+            return p
+        return tuple(round(c * 255.0 / p[3]) / 255.0 for c in p[0:3]) + \
+            (1.0,)
+
+    def checkRender(self, format, linear, offset):
+        data, stride = self.makeBuffer(format)
+        s = BufferSampler()
+        s.set_buffer(data, self._width, self._height, stride, format)
+        if linear:
+            s.set_interpolation_mode(INTERPOLATION_LINEAR)
+
+        # Render one output pixel per source pixel with an @offset pixel
+        # border all around.
+        w = self._width + 2 * offset
+        h = self._height + 2 * offset
+        ow = int(w)
+        oh = int(h)
+
+        out_buffer = array.array('f', (0.0,) * 4 * ow * oh)
+        engine = CpuRenderer()
+        engine.set_sampler(s)
+        self.assert_(engine.render_into_buffer(
+            (-offset, -offset, w, h), out_buffer, ow, oh, ow * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED))
+
+        for oy in range(oh):
+            for ox in range(ow):
+                e = self.expected(format, ox + 0.5 - offset,
+                    oy + 0.5 - offset, linear)
+                idx = 4 * (ox + oy * ow)
+                for c in range(4):
+                    self.assertAlmostEqual(out_buffer[idx + c], e[c], 2,
+                        '(%s, %s)[%i]: %s != %s' % (ox, oy, c,
+                            tuple(out_buffer[idx:idx+4]), tuple(e)))
+
+    def checkFormat(self, format):
+        # Interior samples on pixel centres.
+        self.checkRender(format, False, 0)
+        self.checkRender(format, True, 0)
+
+        # Samples on pixel corners straddle every edge with linear
+        # interpolation. Nearest samples beyond the edge are transparent.
+        self.checkRender(format, True, 0.5)
+        self.checkRender(format, False, 2)
+
+    def testRgba32(self):
+        self.checkFormat(FORMAT_RGBA32)
+
+    def testRgbaF32Premultiplied(self):
+        self.checkFormat(FORMAT_RGBA_F32_PREMULTIPLIED)
+
+    def testRgb24(self):
+        self.checkFormat(FORMAT_RGB24)
+
+class BufferProtocol(FirtreeTestCase):
+    # An 8x8 RGBA32 buffer with a different colour in each row.
+    def setUp(self):
+        self._size = 8
+        self._source = bytearray()
+        for y in range(self._size):
+            self._source.extend((y * 32, 255 - y * 32, 128, 255) * self._size)
+
+    def render(self, sampler, buffer, stride = None):
+        engine = CpuRenderer()
+        engine.set_sampler(sampler)
+        if stride is None:
+            stride = self._size * 4
+        return engine.render_into_buffer((0, 0, self._size, self._size),
+            buffer, self._size, self._size, stride, FORMAT_RGBA32)
+
+    def assertBytesMatch(self, a, b):
+        self.assertEqual(len(a), len(b))
+        for idx in range(len(a)):
+            self.assert_(abs(a[idx] - b[idx]) <= 1)
+
+    def testMemoryView(self):
+        s = BufferSampler()
+        s.set_buffer_no_copy(memoryview(self._source),
+            self._size, self._size, self._size * 4, FORMAT_RGBA32)
+        out_buffer = bytearray(len(self._source))
+        self.assert_(self.render(s, memoryview(out_buffer)))
+        self.assertBytesMatch(out_buffer, self._source)
+
+    def testNoCopyKeepsBuffer(self):
+        # The sampler must keep the buffer it refers to alive.
+        s = BufferSampler()
+        s.set_buffer_no_copy(bytearray(self._source),
+            self._size, self._size, self._size * 4, FORMAT_RGBA32)
+        out_buffer = bytearray(len(self._source))
+        self.assert_(self.render(s, out_buffer))
+        self.assertBytesMatch(out_buffer, self._source)
+
+    def testNoCopyPinsBuffer(self):
+        # The buffer cannot be resized while the sampler refers to it.
+        data = bytearray(self._source)
+        s = BufferSampler()
+        s.set_buffer_no_copy(data, self._size, self._size, self._size * 4,
+            FORMAT_RGBA32)
+        self.assertRaises(BufferError, data.extend, 'x' * 4096)
+
+        s.set_buffer_no_copy(None, 0, 0, 0, FORMAT_RGBA32)
+        data.extend('x' * 4096)
+
+    def testReadOnlyOutput(self):
+        s = BufferSampler()
+        s.set_buffer(self._source, self._size, self._size, self._size * 4,
+            FORMAT_RGBA32)
+        self.assertRaises(TypeError, self.render, s, str(self._source))
+
+    def testStrideTooSmall(self):
+        s = BufferSampler()
+        self.assertRaises(ValueError, s.set_buffer, self._source,
+            self._size, self._size, self._size * 4 - 1, FORMAT_RGBA32)
+        s.set_buffer(self._source, self._size, self._size, self._size * 4,
+            FORMAT_RGBA32)
+        self.assertRaises(ValueError, self.render, s,
+            bytearray(len(self._source)), self._size * 4 - 1)
+
+class LargeBuffer(FirtreeTestCase):
+    # A buffer large enough for its rows to be prefetched while rendering.
+    def setUp(self):
+        self._width = 1024
+        self._height = 512
+        self._stride = self._width * 4
+        self._data = array.array('B', (0,) * self._stride * self._height)
+        for i in range(0, len(self._data), 4):
+            p = i / 4
+            self._data[i] = p % 251
+            self._data[i+1] = (p / self._width) % 253
+            self._data[i+3] = 255
+        self._source = BufferSampler()
+        self._source.set_buffer(self._data, self._width, self._height,
+            self._stride, FORMAT_RGBA32)
+
+    def tearDown(self):
+        self._source = None
+
+    def render(self):
+        buf = array.array('B', (0,) * self._stride * self._height)
+        engine = CpuRenderer()
+        engine.set_sampler(self._source)
+        self.assert_(engine.render_into_buffer(
+            (0, 0, self._width, self._height), buf,
+            self._width, self._height, self._stride, FORMAT_RGBA32))
+        return buf
+
+    def row(self, buf, y):
+        return buf[y * self._stride:(y + 1) * self._stride]
+
+    def testIdentity(self):
+        self.assertEqual(self.render(), self._data)
+
+    def testFlipped(self):
+        # Rows are prefetched upwards when the buffer is flipped.
+        t = AffineTransform()
+        t.set_elements(1, 0, 0, -1, 0, self._height)
+        self._source.set_transform(t)
+        buf = self.render()
+        for y in range(self._height):
+            self.assertEqual(self.row(buf, y),
+                self.row(self._data, self._height - 1 - y))
+
+# vim:sw=4:ts=4:et:autoindent
@@ -0,0 +1,232 @@
+import unittest
+import array
+from pyfirtree import *
+
+from utils import FirtreeTestCase
+
+size = 16
+
+class CachingSampler(FirtreeTestCase):
+    def setUp(self):
+        values = []
+        for y in range(size):
+            for x in range(size):
+                values.extend((x / float(size), y / float(size), 0.5, 1.0))
+        self._buffer = array.array('f', values)
+        self._source = BufferSampler()
+        self._source.set_buffer(self._buffer, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+
+        self._grade = Kernel()
+        self._grade.compile_from_source("""
+            kernel vec4 grade(static sampler src, static float gain) {
+                return gain * sample(src, samplerCoord(src));
+            }
+        """)
+        self.assertKernelCompiled(self._grade)
+        self._grade['src'] = self._source
+        self._grade['gain'] = 0.5
+        self._graded = KernelSampler()
+        self._graded.set_kernel(self._grade)
+
+        self._s = CpuCachingSampler()
+        self.failIfEqual(self._s, None)
+        self._s.set_sampler(self._graded)
+
+    def tearDown(self):
+        self._s = None
+        self._graded = None
+        self._grade = None
+        self._source = None
+
+    def blur(self, input):
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 blur(static sampler src) {
+                vec2 c = samplerCoord(src);
+                return (sample(src, c + vec2(-1,0)) + sample(src, c) +
+                    sample(src, c + vec2(1,0))) / 3.0;
+            }
+        """)
+        self.assertKernelCompiled(k)
+        k['src'] = input
+        s = KernelSampler()
+        s.set_kernel(k)
+        return s
+
+    def render(self, sampler):
+        out_buffer = array.array('f', (0.0,) * 4 * size * size)
+        engine = CpuRenderer()
+        engine.set_sampler(sampler)
+        self.assert_(engine.render_into_buffer((0, 0, size, size),
+            out_buffer, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED))
+        return out_buffer
+
+    def assertBuffersMatch(self, a, b):
+        self.assertEqual(len(a), len(b))
+        for idx in range(len(a)):
+            self.assertAlmostEqual(a[idx], b[idx], 5)
+
+    def testSetSampler(self):
+        self.assertEqual(self._s.get_sampler(), self._graded)
+        self._s.set_sampler(None)
+        self.assertEqual(self._s.get_sampler(), None)
+
+    def testExtent(self):
+        # The kernel's extent padded again for interpolation.
+        self.assertEqual(self._s.get_extent(), (-2, -2, 20, 20))
+
+    def testMatchesUncached(self):
+        self.assert_(not self._s.is_cached())
+        cached = self.render(self.blur(self._s))
+        self.assert_(self._s.is_cached())
+        self.assertBuffersMatch(cached, self.render(self.blur(self._graded)))
+
+    def testArgumentChanged(self):
+        blurred = self.blur(self._s)
+        self.render(blurred)
+        self.assert_(self._s.is_cached())
+
+        self._grade['gain'] = 0.25
+        self.assert_(not self._s.is_cached())
+        self.assertBuffersMatch(self.render(blurred),
+            self.render(self.blur(self._graded)))
+
+    def testBufferReplaced(self):
+        # A new frame of the same geometry refreshes the cache.
+        blurred = self.blur(self._s)
+        self.render(blurred)
+        self.assert_(self._s.is_cached())
+
+        frame = array.array('f', (0.25, 0.5, 0.75, 1.0) * size * size)
+        self._source.set_buffer(frame, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(not self._s.is_cached())
+        out_buffer = self.render(blurred)
+        self.assertBuffersMatch(out_buffer, self.render(self.blur(self._graded)))
+        # Away from the edges every pixel is the graded constant colour.
+        o = 4 * ((8 * size) + 8)
+        for c, v in enumerate((0.125, 0.25, 0.375, 0.5)):
+            self.assertAlmostEqual(out_buffer[o + c], v, 5)
+
+        frame = array.array('f', (1.0, 0.0, 0.0, 1.0) * size * size)
+        self._source.set_buffer_no_copy(frame, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(not self._s.is_cached())
+        out_buffer = self.render(blurred)
+        for c, v in enumerate((0.5, 0.0, 0.0, 0.5)):
+            self.assertAlmostEqual(out_buffer[o + c], v, 5)
+
+    def testInfiniteInput(self):
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 constant(static vec4 colour) {
+                return colour;
+            }
+        """)
+        self.assertKernelCompiled(k)
+        colour = (0.25, 0.5, 0.75, 1.0)
+        k['colour'] = colour
+        constant = KernelSampler()
+        constant.set_kernel(k)
+
+        # Inputs which cannot be cached are sampled directly.
+        self._s.set_sampler(constant)
+        self.assert_(self._s.get_extent()[2] > 1e30)
+        out_buffer = self.render(self._s)
+        self.assert_(not self._s.is_cached())
+        for idx in range(len(out_buffer)):
+            self.assertAlmostEqual(out_buffer[idx], colour[idx % 4])
+    def expensive(self, input):
+        # A long polynomial in the input which is transparent wherever the
+        # input is and so has a finite extent.
+        poly = '0.01'
+        for i in range(48):
+            poly = '(%f + p * %s)' % (1.0 / (i + 2), poly)
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 expensive(static sampler src) {
+                vec4 p = sample(src, samplerCoord(src));
+                return p * %s;
+            }
+        """ % poly)
+        self.assertKernelCompiled(k)
+        k['src'] = input
+        s = KernelSampler()
+        s.set_kernel(k)
+        return s
+
+    def testCachesExpensiveInput(self):
+        expensive = self.expensive(self._source)
+        blurred = self.blur(expensive)
+        self.assertEqual(cpu_caching_sampler_plan_graph(blurred), 1)
+
+        cache = blurred.get_kernel()['src']
+        self.assert_(isinstance(cache, CpuCachingSampler))
+        self.assertEqual(cache.get_sampler(), expensive)
+
+        # Planning again keeps the existing cache.
+        self.assertEqual(cpu_caching_sampler_plan_graph(blurred), 0)
+        self.assertEqual(blurred.get_kernel()['src'], cache)
+
+        self.assertBuffersMatch(self.render(blurred),
+            self.render(self.blur(self.expensive(self._source))))
+
+    def testSingleTapNotCached(self):
+        expensive = self.expensive(self._source)
+        graded = KernelSampler()
+        graded.set_kernel(self._grade)
+        self._grade['src'] = expensive
+        self.assertEqual(cpu_caching_sampler_plan_graph(graded), 0)
+        self.assertEqual(self._grade['src'], expensive)
+
+    def testInfiniteInputNotCached(self):
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 rings() {
+                return vec4(0.5 + 0.5 * sin(destCoord() * 0.1), 0, 1);
+            }
+        """)
+        self.assertKernelCompiled(k)
+        rings = KernelSampler()
+        rings.set_kernel(k)
+        blurred = self.blur(self.expensive(rings))
+        self.assertEqual(cpu_caching_sampler_plan_graph(blurred), 0)
+
+    def testOffGridTapsNotCached(self):
+        # Taps between pixels would interpolate the cache.
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 blur(static sampler src) {
+                vec2 c = samplerCoord(src);
+                return (sample(src, c + vec2(-0.5,0)) +
+                    sample(src, c + vec2(0.5,0))) / 2.0;
+            }
+        """)
+        self.assertKernelCompiled(k)
+        expensive = self.expensive(self._source)
+        k['src'] = expensive
+        blurred = KernelSampler()
+        blurred.set_kernel(k)
+        self.assertEqual(cpu_caching_sampler_plan_graph(blurred), 0)
+        self.assertEqual(k['src'], expensive)
+
+    def testScaledInputNotCached(self):
+        # A cache of a magnified input would not hold enough pixels.
+        expensive = self.expensive(self._source)
+        t = AffineTransform()
+        t.scale_by(4, 4)
+        expensive.set_transform(t)
+        blurred = self.blur(expensive)
+        self.assertEqual(cpu_caching_sampler_plan_graph(blurred), 0)
+
+        # Nor is anything beneath a scaled sampler.
+        outer = self.blur(self.expensive(self.blur(self.expensive(
+            self._source))))
+        t = AffineTransform()
+        t.scale_by(0.5, 0.5)
+        outer.get_kernel()['src'].set_transform(t)
+        self.assertEqual(cpu_caching_sampler_plan_graph(outer), 0)
+
+# vim:sw=4:ts=4:et:autoindent
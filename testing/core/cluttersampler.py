@@ -1,4 +1,5 @@
 import unittest
+import array
 import gobject
 import cairo
 import clutter
@@ -243,6 +244,82 @@ class Creation(FirtreeTestCase):
         self.assert_(rv)
         self.assertCairoSurfaceMatches(cs, 'cpu-mexican-hat')
 
+    def renderSolid(self, engine):
+        out_buffer = array.array('f', (0.0,) * 4 * 8 * 8)
+        rv = engine.render_into_buffer((0, 0, 8, 8), out_buffer, 8, 8, 8 * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(rv)
+        return out_buffer[(4 * 8 + 4) * 4:(4 * 8 + 4) * 4 + 4]
+
+    def testUpdateContents(self):
+        tex = clutter.Texture()
+        tex.set_from_rgb_data('\xff\x00\x00\xff' * 64, True, 8, 8, 32, 4, 0)
+        self._s.set_clutter_texture(tex)
+
+        engine = CpuRenderer()
+        engine.set_sampler(self._s)
+        for a, b in zip(self.renderSolid(engine), (1, 0, 0, 1)):
+            self.assertAlmostEqual(a, b, 2)
+
+        # Replacing the image re-reads it without re-setting the texture.
+        tex.set_from_rgb_data('\x00\xff\x00\xff' * 64, True, 8, 8, 32, 4, 0)
+        for a, b in zip(self.renderSolid(engine), (0, 1, 0, 1)):
+            self.assertAlmostEqual(a, b, 2)
+
+        # As does an explicit update.
+        self._s.update_contents()
+        for a, b in zip(self.renderSolid(engine), (0, 1, 0, 1)):
+            self.assertAlmostEqual(a, b, 2)
+
+    def testUpdateWaitsForRenders(self):
+        tex = clutter.Texture()
+        tex.set_from_rgb_data('\xff\x00\x00\xff' * 64, True, 8, 8, 32, 4, 0)
+        self._s.set_clutter_texture(tex)
+
+        engine = CpuRenderer()
+        engine.set_sampler(self._s)
+        size = 512
+        buf = array.array('B', (0,) * 4 * size * size)
+        self.assert_(engine.render_async((0, 0, 8, 8), buf,
+            size, size, size * 4, FORMAT_RGBA32))
+
+        # The texture is not re-read until the render above has finished
+        # and so all of it sees the first image.
+        tex.set_from_rgb_data('\x00\xff\x00\xff' * 64, True, 8, 8, 32, 4, 0)
+        engine.wait()
+        for idx in range(0, len(buf), 4 * 97):
+            self.assertEqual(buf[idx:idx+4].tolist(), [255, 0, 0, 255])
+
+        for a, b in zip(self.renderSolid(engine), (0, 1, 0, 1)):
+            self.assertAlmostEqual(a, b, 2)
+
+    def testRenderIntoCoglTexture(self):
+        k = Kernel()
+        k.compile_from_source("""
+            kernel vec4 constant(static vec4 colour) {
+                return colour;
+            }
+        """)
+        self.assertKernelCompiled(k)
+        k['colour'] = (0.0, 0.0, 1.0, 1.0)
+        ks = KernelSampler()
+        ks.set_kernel(k)
+
+        tex = clutter.Texture()
+        tex.set_from_rgb_data('\xff\x00\x00\xff' * 64, True, 8, 8, 32, 4, 0)
+        self._s.set_clutter_texture(tex)
+
+        engine = CpuRenderer()
+        engine.set_sampler(ks)
+        self.assert_(engine.render_into_cogl_texture((0, 0, 8, 8),
+            self._s.get_cogl_texture()))
+
+        # Read the texture back through a sampler.
+        self._s.update_contents()
+        engine.set_sampler(self._s)
+        for a, b in zip(self.renderSolid(engine), (0, 0, 1, 1)):
+            self.assertAlmostEqual(a, b, 2)
+
 
 # vim:sw=4:ts=4:et:autoindent
 
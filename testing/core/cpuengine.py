@@ -1,4 +1,6 @@
 import unittest
+import threading
+import array
 import gobject
 import gtk.gdk
 import cairo
@@ -366,5 +368,564 @@ class KernelTests(FirtreeTestCase):
         self.assertNotEqual(asm, None)
         #print(asm)
 
+class Threads(FirtreeTestCase):
+    # The bindings release the GIL while compiling and rendering so these
+    # really do run concurrently.
+
+    def runThreads(self, targets):
+        threads = [threading.Thread(target=t) for t in targets]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+    def testConcurrentCompile(self):
+        kernels = [Kernel() for i in range(8)]
+        changed = [ ]
+        for k in kernels:
+            k.connect('module-changed', lambda k: changed.append(k))
+
+        def compile(i):
+            kernels[i].compile_from_source(
+                'kernel vec4 c() { return vec4(%i.0/8.0, 0, 0, 1); }' % i)
+
+        self.runThreads([lambda i=i: compile(i) for i in range(len(kernels))])
+
+        self.assertEqual(len(changed), len(kernels))
+        for k in kernels:
+            self.assertKernelCompiled(k)
+
+    def testSharedRenderer(self):
+        k = Kernel()
+        k.compile_from_source('kernel vec4 c() { return vec4(1, 0.5, 0.25, 1); }')
+        self.assertKernelCompiled(k)
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        engine = CpuRenderer()
+        engine.set_sampler(ks)
+
+        # Alternating formats would have each render replace the JIT-ed
+        # function another thread is using were renders not serialised.
+        expected = {
+            FORMAT_RGBA32: (255, 128, 64, 255),
+            FORMAT_BGRA32: (64, 128, 255, 255),
+        }
+        failures = [ ]
+        def render(format):
+            for i in range(8):
+                buf = array.array('B', (0,) * 4 * 16 * 16)
+                if not engine.render_into_buffer((0, 0, 16, 16), buf,
+                        16, 16, 16 * 4, format):
+                    failures.append('render failed')
+                    return
+                for c in range(4):
+                    if abs(buf[c] - expected[format][c]) > 1:
+                        failures.append((format, tuple(buf[0:4])))
+                        return
+
+        self.runThreads([lambda f=f: render(f)
+            for f in (FORMAT_RGBA32, FORMAT_BGRA32) * 2])
+
+        self.assertEqual(failures, [ ])
+
+    def testSharedSampler(self):
+        # One sampler graph rendered by a renderer per thread. Each
+        # renderer generates its function from, and analyses, the same
+        # sampler and kernel caches.
+        k = Kernel()
+        k.compile_from_source('kernel vec4 c() { return vec4(1, 0.5, 0.25, 1); }')
+        self.assertKernelCompiled(k)
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        engines = [CpuRenderer() for i in range(4)]
+        for e in engines:
+            e.set_sampler(ks)
+
+        failures = [ ]
+        def render(engine):
+            for i in range(8):
+                buf = array.array('B', (0,) * 4 * 16 * 16)
+                if not engine.render_into_buffer((0, 0, 16, 16), buf,
+                        16, 16, 16 * 4, FORMAT_RGBA32):
+                    failures.append('render failed')
+                    return
+                for c, v in enumerate((255, 128, 64, 255)):
+                    if abs(buf[c] - v) > 1:
+                        failures.append(tuple(buf[0:4]))
+                        return
+
+        self.runThreads([lambda e=e: render(e) for e in engines])
+
+        self.assertEqual(failures, [ ])
+
+class AsyncRender(FirtreeTestCase):
+    def setUp(self):
+        k = Kernel()
+        k.compile_from_source('kernel vec4 c() { return vec4(1, 0.5, 0.25, 1); }')
+        self.assertKernelCompiled(k)
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        self._e = CpuRenderer()
+        self._e.set_sampler(ks)
+
+    def tearDown(self):
+        self._e = None
+
+    def testMaxFramesInFlight(self):
+        self.assertEqual(self._e.get_max_frames_in_flight(), 2)
+        self._e.set_max_frames_in_flight(4)
+        self.assertEqual(self._e.get_max_frames_in_flight(), 4)
+        self._e.set_max_frames_in_flight(0)
+        self.assertEqual(self._e.get_max_frames_in_flight(), 1)
+
+    def testCallbacks(self):
+        done = [ ]
+        def callback(renderer, success, index):
+            self.assertEqual(renderer, self._e)
+            done.append((index, success))
+
+        buffers = [array.array('B', (0,) * 4 * 64 * 64) for i in range(6)]
+        for i, buf in enumerate(buffers):
+            self.assert_(self._e.render_async((0, 0, 64, 64), buf,
+                64, 64, 64 * 4, FORMAT_RGBA32, callback, i))
+        self._e.wait()
+
+        self.assertEqual(sorted(done), [(i, True) for i in range(6)])
+        for buf in buffers:
+            for c, v in enumerate((255, 128, 64, 255)):
+                self.assert_(abs(buf[c] - v) <= 1)
+                self.assert_(abs(buf[-4 + c] - v) <= 1)
+
+    def testSyncRenderWaits(self):
+        async_buf = array.array('B', (0,) * 4 * 256 * 256)
+        self.assert_(self._e.render_async((0, 0, 256, 256), async_buf,
+            256, 256, 256 * 4, FORMAT_RGBA32))
+
+        # A synchronous render in another format replaces the JIT-ed function
+        # and so must not start until the render above has finished.
+        buf = array.array('B', (0,) * 4 * 16 * 16)
+        self.assert_(self._e.render_into_buffer((0, 0, 16, 16), buf,
+            16, 16, 16 * 4, FORMAT_BGRA32))
+        self.assert_(abs(async_buf[-4] - 255) <= 1)
+        self.assert_(abs(buf[0] - 64) <= 1)
+
+    def testReentrantCallback(self):
+        # The frame is retired before its callback runs and so the callback
+        # may wait and render via the same renderer.
+        self._e.set_max_frames_in_flight(1)
+        inner = [ ]
+        def callback(renderer, success, data):
+            renderer.wait()
+            buf = array.array('B', (0,) * 4 * 16 * 16)
+            inner.append(renderer.render_into_buffer((0, 0, 16, 16), buf,
+                16, 16, 16 * 4, FORMAT_RGBA32))
+
+        buffers = [array.array('B', (0,) * 4 * 64 * 64) for i in range(3)]
+        for buf in buffers:
+            self.assert_(self._e.render_async((0, 0, 64, 64), buf,
+                64, 64, 64 * 4, FORMAT_RGBA32, callback, None))
+        self._e.wait()
+        self.assertEqual(inner, [True] * 3)
+
+    def testEmptyRenderCallback(self):
+        # Even with nothing to render, the callback runs on a worker.
+        bs = BufferSampler()
+        bs.set_buffer(array.array('B', (255,) * 4 * 8 * 8), 8, 8, 8 * 4,
+            FORMAT_RGBA32)
+        self._e.set_sampler(bs)
+
+        threads = [ ]
+        def callback(renderer, success, data):
+            threads.append(threading.currentThread())
+
+        buf = array.array('B', (0,) * 4 * 16 * 16)
+        self.assert_(self._e.render_async((100, 100, 16, 16), buf,
+            16, 16, 16 * 4, FORMAT_RGBA32, callback, None))
+        self._e.wait()
+        self.assertEqual(len(threads), 1)
+        self.failIfEqual(threads[0], threading.currentThread())
+        self.assertEqual(buf, array.array('B', (0,) * 4 * 16 * 16))
+
+    def testInvalidFormat(self):
+        buf = array.array('B', (0,) * 64 * 64)
+        self.failIf(self._e.render_async((0, 0, 64, 64), buf,
+            64, 64, 64, FORMAT_L8, lambda *args: self.fail()))
+
+class BatchRender(FirtreeTestCase):
+    def setUp(self):
+        k = Kernel()
+        k.compile_from_source('''
+            kernel vec4 ramp() {
+                vec2 d = destCoord();
+                return vec4(d.x / 64.0, d.y / 64.0, 0.5, 1);
+            }
+        ''')
+        self.assertKernelCompiled(k)
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        self._e = CpuRenderer()
+        self._e.set_sampler(ks)
+
+    def tearDown(self):
+        self._e = None
+
+    def testMatchesSingleRenders(self):
+        # Tiles of differing sizes so that the slices of one job do not
+        # line up with those of the next.
+        jobs = [ ]
+        for i in range(12):
+            size = 8 + 4 * i
+            extents = (4 * i, 2 * i, size, size)
+            buf = array.array('B', (0,) * 4 * size * size)
+            jobs.append((extents, buf, size, size, size * 4))
+
+        self.assert_(self._e.render_batch(jobs, FORMAT_RGBA32))
+
+        for extents, buf, width, height, stride in jobs:
+            expected = array.array('B', (0,) * len(buf))
+            self.assert_(self._e.render_into_buffer(extents, expected,
+                width, height, stride, FORMAT_RGBA32))
+            self.assertEqual(buf, expected)
+
+    def testEmptyBatch(self):
+        self.assert_(self._e.render_batch([ ], FORMAT_RGBA32))
+
+    def testBadJob(self):
+        buf = array.array('B', (0,) * 4 * 16 * 16)
+        self.assertRaises(TypeError, self._e.render_batch,
+            [ ((0, 0, 16, 16), buf, 16, 16) ], FORMAT_RGBA32)
+        self.assertRaises(RuntimeError, self._e.render_batch,
+            [ ((0, 0, 16, 16), buf, 16, 32, 16 * 4) ], FORMAT_RGBA32)
+
+class DirtyRegion(FirtreeTestCase):
+    def setUp(self):
+        self._size = 256
+        self._data = array.array('B', (0,) * 4 * self._size * self._size)
+        for i in range(0, len(self._data), 4):
+            p = i / 4
+            self._data[i] = p % 251
+            self._data[i+1] = (p / self._size) % 253
+            self._data[i+3] = 255
+        self._bs = BufferSampler()
+        self._bs.set_buffer(self._data, self._size, self._size,
+            self._size * 4, FORMAT_RGBA32)
+        self._e = CpuRenderer()
+
+    def tearDown(self):
+        self._e = None
+        self._bs = None
+
+    def useKernel(self, source):
+        self._k = Kernel()
+        self._k.compile_from_source(source)
+        self.assertKernelCompiled(self._k)
+        self._k['src'] = self._bs
+        ks = KernelSampler()
+        ks.set_kernel(self._k)
+        self._e.set_sampler(ks)
+
+    def render(self):
+        buf = array.array('B', (0,) * 4 * self._size * self._size)
+        self.assert_(self._e.render_into_buffer((0, 0, self._size, self._size),
+            buf, self._size, self._size, self._size * 4, FORMAT_RGBA32))
+        return buf
+
+    def update(self, buf):
+        self.assert_(self._e.update_buffer((0, 0, self._size, self._size),
+            buf, self._size, self._size, self._size * 4, FORMAT_RGBA32))
+
+    def changeSource(self, x, y, w, h):
+        data = array.array('B', (255,) * 4 * w * h)
+        self._bs.update_region(data, x, y, w, h, w * 4)
+
+    def pixel(self, buf, x, y):
+        o = 4 * ((y * self._size) + x)
+        return tuple(buf[o:o+4])
+
+    def testRegionRender(self):
+        self.useKernel('''
+            kernel vec4 pass(sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        ''')
+        expected = self.render()
+
+        buf = array.array('B', (7,) * 4 * self._size * self._size)
+        self.assert_(self._e.render_region_into_buffer(
+            (0, 0, self._size, self._size), buf,
+            self._size, self._size, self._size * 4, FORMAT_RGBA32,
+            16, 32, 40, 20))
+        for y in range(self._size):
+            for x in range(self._size):
+                if (16 <= x < 56) and (32 <= y < 52):
+                    self.assertEqual(self.pixel(buf, x, y),
+                        self.pixel(expected, x, y))
+                else:
+                    self.assertEqual(self.pixel(buf, x, y), (7, 7, 7, 7))
+
+    def testOffsetSample(self):
+        self.useKernel('''
+            kernel vec4 shift(sampler src) {
+                return sample(src, samplerTransform(src,
+                    destCoord() + vec2(2, 0)));
+            }
+        ''')
+
+        # Nothing has been rendered yet.
+        self.assert_(self._e.get_dirty_extent()[2] > 1e6)
+
+        buf = array.array('B', (0,) * 4 * self._size * self._size)
+        self.update(buf)
+        self.assertEqual(self._e.get_dirty_extent(), None)
+
+        regions = [ ]
+        self._k.connect('region-changed', lambda k, r: regions.append(r))
+
+        # Poison a pixel far away from the change. It must survive the
+        # update.
+        o = 4 * ((200 * self._size) + 200)
+        buf[o:o+4] = array.array('B', (1, 2, 3, 4))
+
+        self.changeSource(20, 10, 4, 4)
+        self.assertEqual(len(regions), 1)
+        extent = self._e.get_dirty_extent()
+        self.failIfEqual(extent, None)
+        self.assert_(extent[0] <= 18 and extent[0] + extent[2] >= 22)
+        self.assert_(extent[2] < 64 and extent[3] < 64)
+
+        self.update(buf)
+        self.assertEqual(self._e.get_dirty_extent(), None)
+
+        expected = self.render()
+        for y in range(64):
+            for x in range(64):
+                self.assertEqual(self.pixel(buf, x, y),
+                    self.pixel(expected, x, y))
+        self.assertEqual(self.pixel(buf, 200, 200), (1, 2, 3, 4))
+
+        # Invalidating everything re-renders the poisoned pixel.
+        self._e.invalidate()
+        self.update(buf)
+        self.assertEqual(buf, expected)
+
+    def testUnboundedSample(self):
+        self.useKernel('''
+            kernel vec4 zoom(sampler src) {
+                return sample(src, samplerTransform(src, destCoord() * 0.5));
+            }
+        ''')
+        buf = array.array('B', (0,) * 4 * self._size * self._size)
+        self.update(buf)
+        self.assertEqual(self._e.get_dirty_extent(), None)
+
+        # The footprint of this kernel cannot be bounded and so any change
+        # to its input changes all of its output.
+        self.changeSource(20, 10, 4, 4)
+        self.assert_(self._e.get_dirty_extent()[2] > 1e6)
+
+        self.update(buf)
+        self.assertEqual(buf, self.render())
+
+    def testReplaceBuffer(self):
+        self.useKernel('''
+            kernel vec4 pass(sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        ''')
+        buf = array.array('B', (0,) * 4 * self._size * self._size)
+        self.update(buf)
+        self.assertEqual(self._e.get_dirty_extent(), None)
+
+        # A new frame of the same geometry must still be re-rendered, both
+        # when copied and when referred to in place.
+        frame = array.array('B', (40, 80, 120, 255) * self._size * self._size)
+        self._bs.set_buffer(frame, self._size, self._size,
+            self._size * 4, FORMAT_RGBA32)
+        self.failIfEqual(self._e.get_dirty_extent(), None)
+        self.update(buf)
+        self.assertEqual(buf, frame)
+
+        frame = array.array('B', (200, 10, 30, 255) * self._size * self._size)
+        self._bs.set_buffer_no_copy(frame, self._size, self._size,
+            self._size * 4, FORMAT_RGBA32)
+        self.failIfEqual(self._e.get_dirty_extent(), None)
+        self.update(buf)
+        self.assertEqual(buf, frame)
+
+class RenderMode(FirtreeTestCase):
+    def setUp(self):
+        self._e = CpuRenderer()
+
+    def tearDown(self):
+        self._e = None
+
+    def useKernel(self, source, **args):
+        k = Kernel()
+        k.compile_from_source(source)
+        self.assertKernelCompiled(k)
+        for name, value in args.items():
+            k[name] = value
+        ks = KernelSampler()
+        ks.set_kernel(k)
+        self._e.set_sampler(ks)
+
+    def render(self, fill):
+        return self.renderOnto((fill,) * 4)
+
+    def renderOnto(self, pixel):
+        buf = array.array('B', tuple(pixel) * 32 * 32)
+        self.assert_(self._e.render_into_buffer((0, 0, 32, 32), buf,
+            32, 32, 32 * 4, FORMAT_RGBA32_PREMULTIPLIED))
+        return buf
+
+    def assertPixel(self, buf, x, y, expected):
+        o = 4 * ((y * 32) + x)
+        for c, v in enumerate(expected):
+            self.assert_(abs(buf[o + c] - v) <= 1,
+                '%s != %s' % (tuple(buf[o:o+4]), expected))
+
+    def testDefault(self):
+        self.assertEqual(self._e.get_render_mode(), RENDER_MODE_OVER)
+        self._e.set_render_mode(RENDER_MODE_REPLACE)
+        self.assertEqual(self._e.get_render_mode(), RENDER_MODE_REPLACE)
+
+    def testReplace(self):
+        self.useKernel('kernel vec4 c() { return vec4(0.25, 0.5, 0, 0.5); }')
+        over = self.render(0)
+        self.assertPixel(self.render(200), 4, 4, (163, 227, 100, 227))
+
+        # Replacing the contents is the same as compositing over a
+        # transparent buffer.
+        self._e.set_render_mode(RENDER_MODE_REPLACE)
+        self.assertEqual(self.render(200), over)
+
+    def testReplaceOutsideExtent(self):
+        bs = BufferSampler()
+        bs.set_buffer(array.array('B', (255,) * 4 * 8 * 8), 8, 8, 8 * 4,
+            FORMAT_RGBA32)
+        self.useKernel('''
+            kernel vec4 pass(sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        ''', src=bs)
+
+        buf = self.render(7)
+        self.assertPixel(buf, 2, 2, (255, 255, 255, 255))
+        self.assertPixel(buf, 20, 20, (7, 7, 7, 7))
+
+        # Pixels where the sampler is transparent are replaced too.
+        self._e.set_render_mode(RENDER_MODE_REPLACE)
+        buf = self.render(7)
+        self.assertPixel(buf, 2, 2, (255, 255, 255, 255))
+        self.assertPixel(buf, 20, 20, (0, 0, 0, 0))
+
+    def testOpaqueKernel(self):
+        # Every path through the kernel returns an alpha of 1 and so the
+        # buffer is simply overwritten.
+        self.useKernel('''
+            kernel vec4 split() {
+                vec4 c = vec4(0, 0, 1, 1);
+                if(destCoord().x < 16.0) {
+                    c = vec4(1, 0, 0, 1);
+                }
+                return c;
+            }
+        ''')
+        buf = self.render(200)
+        self.assertEqual(buf, self.render(0))
+        self.assertPixel(buf, 4, 4, (255, 0, 0, 255))
+        self.assertPixel(buf, 20, 4, (0, 0, 255, 255))
+
+    def testPartlyOpaqueKernel(self):
+        # Only one path is opaque and so the other must still be blended.
+        self.useKernel('''
+            kernel vec4 split() {
+                vec4 c = vec4(0, 0, 0, 0);
+                if(destCoord().x < 16.0) {
+                    c = vec4(1, 0, 0, 1);
+                }
+                return c;
+            }
+        ''')
+        buf = self.render(200)
+        self.assertPixel(buf, 4, 4, (255, 0, 0, 255))
+        self.assertPixel(buf, 20, 4, (200, 200, 200, 200))
+
+    def testStreamedReplace(self):
+        # Rows this long are streamed to memory in replace mode. Rows which
+        # do not start on a cache line are written partly normally.
+        self.useKernel('''
+            kernel vec4 ramp() {
+                return vec4(destCoord().x / 8192.0, 0.5, 0, 0.5);
+            }
+        ''')
+        width, height, stride = 4099, 9, 4099 * 4 + 4
+
+        def render(fill):
+            buf = array.array('B', (fill,) * stride * height)
+            self.assert_(self._e.render_into_buffer((0, 0, width, height),
+                buf, width, height, stride, FORMAT_RGBA32_PREMULTIPLIED))
+            return buf
+
+        over = render(0)
+        self._e.set_render_mode(RENDER_MODE_REPLACE)
+        replaced = render(200)
+        for y in range(height):
+            o = y * stride
+            self.assertEqual(replaced[o:o + width * 4], over[o:o + width * 4])
+
+    def useHalfAlphaKernel(self):
+        self.useKernel('kernel vec4 c() { return vec4(0.25, 0.5, 0, 0.5); }')
+
+    def testAdd(self):
+        self.useHalfAlphaKernel()
+        self._e.set_render_mode(RENDER_MODE_ADD)
+        buf = self.renderOnto((100, 200, 50, 255))
+        self.assertPixel(buf, 4, 4, (164, 255, 50, 255))
+
+    def testAddFloat(self):
+        # Floating point targets keep sums above 1.
+        self.useKernel('kernel vec4 c() { return vec4(0.75, 0.25, 0, 0.75); }')
+        self._e.set_render_mode(RENDER_MODE_ADD)
+        buf = array.array('f', (0.5,) * 4 * 8 * 8)
+        self.assert_(self._e.render_into_buffer((0, 0, 8, 8), buf,
+            8, 8, 8 * 16, FORMAT_RGBA_F32_PREMULTIPLIED))
+        for c, v in enumerate((1.25, 0.75, 0.5, 1.25)):
+            self.assertAlmostEqual(buf[c], v, 5)
+            self.assertAlmostEqual(buf[-4 + c], v, 5)
+
+    def testMultiply(self):
+        self.useHalfAlphaKernel()
+        self._e.set_render_mode(RENDER_MODE_MULTIPLY)
+        buf = self.renderOnto((100, 200, 50, 255))
+        self.assertPixel(buf, 4, 4, (75, 200, 25, 255))
+
+        # Over a transparent target the sample is left as it is.
+        self.assertPixel(self.render(0), 4, 4, (64, 128, 0, 128))
+
+    def testScreen(self):
+        self.useHalfAlphaKernel()
+        self._e.set_render_mode(RENDER_MODE_SCREEN)
+        buf = self.renderOnto((100, 200, 50, 255))
+        self.assertPixel(buf, 4, 4, (139, 227, 50, 255))
+
+    def testBlendOutsideExtent(self):
+        bs = BufferSampler()
+        bs.set_buffer(array.array('B', (255,) * 4 * 8 * 8), 8, 8, 8 * 4,
+            FORMAT_RGBA32)
+        self.useKernel('''
+            kernel vec4 pass(sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        ''', src=bs)
+
+        # Blending a transparent pixel leaves the target alone in every
+        # mode but replace.
+        for mode in (RENDER_MODE_ADD, RENDER_MODE_MULTIPLY,
+                RENDER_MODE_SCREEN):
+            self._e.set_render_mode(mode)
+            buf = self.renderOnto((100, 200, 50, 255))
+            self.assertPixel(buf, 20, 20, (100, 200, 50, 255))
+
 # vim:sw=4:ts=4:et:autoindent
 
@@ -1,7 +1,10 @@
 import unittest
 import gobject
+import array
 from pyfirtree import *
 
+from utils import FirtreeTestCase
+
 class Creation(unittest.TestCase):
     def setUp(self):
         self._s = KernelSampler()
@@ -25,5 +28,98 @@ class Creation(unittest.TestCase):
         self._s.set_kernel(None)
         self.assertEqual(self._s.get_kernel(), None)
 
+class Extent(FirtreeTestCase):
+    # An opaque 8x8 float buffer.
+    def setUp(self):
+        self._size = 8
+        self._buffer = array.array('f', (0.25, 0.5, 0.75, 1.0) *
+            (self._size * self._size))
+        self._source = BufferSampler()
+        self._source.set_buffer(self._buffer, self._size, self._size,
+            self._size * 16, FORMAT_RGBA_F32_PREMULTIPLIED)
+        self._s = KernelSampler()
+
+    def tearDown(self):
+        self._s = None
+        self._source = None
+
+    def setKernelSource(self, source):
+        k = Kernel()
+        k.compile_from_source(source)
+        self.assertKernelCompiled(k)
+        self._s.set_kernel(k)
+        return k
+
+    def assertInfinite(self, extent):
+        self.assert_(extent[2] > 1e30)
+        self.assert_(extent[3] > 1e30)
+
+    def testPassThrough(self):
+        k = self.setKernelSource("""
+            kernel vec4 pass(static sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        """)
+        k['src'] = self._source
+        # Padded by one pixel to allow for interpolation.
+        self.assertEqual(self._s.get_extent(), (-1, -1, 10, 10))
+
+    def testScale(self):
+        k = self.setKernelSource("""
+            kernel vec4 fade(static sampler src, static float alpha) {
+                return alpha * sample(src, samplerCoord(src));
+            }
+        """)
+        k['src'] = self._source
+        k['alpha'] = 0.5
+        self.assertEqual(self._s.get_extent(), (-1, -1, 10, 10))
+
+    def testConstantIsInfinite(self):
+        k = self.setKernelSource("""
+            kernel vec4 constant(static sampler src) {
+                return vec4(1,0,0,1) + sample(src, samplerCoord(src));
+            }
+        """)
+        k['src'] = self._source
+        self.assertInfinite(self._s.get_extent())
+
+    def testOffsetTapIsInfinite(self):
+        # Sampling away from samplerCoord() cannot be bounded.
+        k = self.setKernelSource("""
+            kernel vec4 shift(static sampler src) {
+                return sample(src, samplerCoord(src) + vec2(4,0));
+            }
+        """)
+        k['src'] = self._source
+        self.assertInfinite(self._s.get_extent())
+
+    def testRenderOutsideExtent(self):
+        k = self.setKernelSource("""
+            kernel vec4 pass(static sampler src) {
+                return sample(src, samplerCoord(src));
+            }
+        """)
+        k['src'] = self._source
+
+        size = 32
+        out_buffer = array.array('f', (0.125,) * 4 * size * size)
+        engine = CpuRenderer()
+        engine.set_sampler(self._s)
+        self.assert_(engine.render_into_buffer((0, 0, size, size),
+            out_buffer, size, size, size * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED))
+
+        for y in range(size):
+            for x in range(size):
+                idx = 4 * (x + y * size)
+                if (x < self._size - 1) and (y < self._size - 1):
+                    expected = self._buffer[0:4]
+                elif (x > self._size) or (y > self._size):
+                    expected = (0.125,) * 4
+                else:
+                    continue
+                for c in range(4):
+                    self.assertAlmostEqual(out_buffer[idx + c], expected[c])
+
 # vim:sw=4:ts=4:et:autoindent
 
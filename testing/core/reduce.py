@@ -1,4 +1,5 @@
 import unittest
+import array
 import gobject
 import cairo
 from pyfirtree import *
@@ -102,6 +103,84 @@ class SimpleReduce(unittest.TestCase):
         self.assertEqual(len(filter(lambda v: (v[2] == 2) and (v[1] > 20), output)), 0)
         self.assertEqual(len(filter(lambda v: (v[2] == 2) and (v[1] < 10), output)), 0)
         
+    def testBoundedReduce(self):
+        engine = CpuReduceEngine()
+        engine.set_kernel(self._k)
+        self.assertEqual(engine.get_max_elements(), 0)
+
+        engine.set_max_elements(10)
+        self.assertEqual(engine.get_max_elements(), 10)
+        output = engine.run((0,0,320,240),320,240)
+        self.assertEqual(len(output), 10)
+
+        engine.set_max_elements(1)
+        output = engine.run((0,0,320,240),320,240)
+        self.assertEqual(len(output), 1)
+
+        engine.set_max_elements(0)
+        output = engine.run((0,0,320,240),320,240)
+        self.assertEqual(len(output), 38600)
+
+    def testDeterministicReduce(self):
+        engine = CpuReduceEngine()
+        engine.set_kernel(self._k)
+        self.assertEqual(engine.get_deterministic(), False)
+        engine.set_deterministic(True)
+        self.assertEqual(engine.get_deterministic(), True)
+
+        output = engine.run((0,0,320,240),320,240)
+        self.assertEqual(len(output), 38600)
+        self.assertEqual(output, engine.run((0,0,320,240),320,240))
+
+        # Elements appear in row-major order of the emitting pixel.
+        keys = map(lambda v: (v[1], v[0], v[2]), output)
+        self.assertEqual(keys, sorted(keys))
+
+        # With a limit, the first elements in row-major order are kept. Each
+        # 8-row slice emits 1280 or more elements and so the larger limits
+        # are only reached part way through later slices.
+        for limit in (1, 100, 1281, 3000):
+            engine.set_max_elements(limit)
+            self.assertEqual(engine.run((0,0,320,240),320,240),
+                output[:limit])
+
+    def testCancelledBeforeRun(self):
+        # A cancel request does not carry over to the next run.
+        engine = CpuReduceEngine()
+        engine.set_kernel(self._k)
+        engine.cancel()
+        output = engine.run((0,0,320,240),320,240)
+        self.assertEqual(len(output), 38600)
+
+    def testStreamReduce(self):
+        engine = CpuReduceEngine()
+        engine.set_kernel(self._k)
+        self.assertEqual(engine.get_stream_window(), 1)
+        engine.set_stream_window(2)
+        self.assertEqual(engine.get_stream_window(), 2)
+
+        output = engine.run_stream((0,0,320,240),320,240)
+        self.assertEqual(len(output), 38600)
+        count, sum, min, max = engine.get_stream_accumulators()
+        self.assertEqual(count, 38600)
+        self.assertEqual(sum[2], 38800)
+        self.assertEqual(min[2], 1)
+        self.assertEqual(max[2], 2)
+
+        # The window holds at most two frames.
+        for i in range(3):
+            output = engine.run_stream((0,0,320,240),320,240)
+            self.assertEqual(len(output), 38600)
+        count, sum, min, max = engine.get_stream_accumulators()
+        self.assertEqual(count, 2 * 38600)
+        self.assertEqual(sum[2], 2 * 38800)
+        self.assertEqual(min[2], 1)
+        self.assertEqual(max[2], 2)
+
+        engine.reset_stream()
+        count, sum, min, max = engine.get_stream_accumulators()
+        self.assertEqual(count, 0)
+
     def testReduceAsm(self):
         engine = CpuReduceEngine()
         self.assertEqual(engine.get_kernel(), None)
@@ -111,5 +190,214 @@ class SimpleReduce(unittest.TestCase):
         self.assertNotEqual(asm, None)
         # print(asm)
 
+class TypedReduce(unittest.TestCase):
+    def setUp(self):
+        source_surface = cairo.ImageSurface(cairo.FORMAT_ARGB32, 64, 32)
+        cr = cairo.Context(source_surface)
+        cr.set_source_rgba(0,0,1,1)
+        cr.paint()
+
+        # 16x32 == 512 red pixels
+        cr.set_source_rgba(1,0,0,1)
+        cr.rectangle(0,0,16,32)
+        cr.fill()
+
+        self._s = CairoSurfaceSampler()
+        self._s.set_cairo_surface(source_surface)
+
+    def tearDown(self):
+        self._s = None
+
+    def _compile(self, src):
+        k = Kernel()
+        k.compile_from_source(src)
+        log = k.get_compile_log()
+        if len(log) != 0:
+            print('\n'.join(log))
+        self.assertEqual(k.get_compile_status(), True)
+        k['src'] = self._s
+        return k
+
+    def testEmitVec2(self):
+        k = self._compile("""
+            kernel __reduce void vec2Kernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).r > 0.5) {
+                    emit(destCoord());
+                }
+            }
+        """)
+        self.assertEqual(k.get_emit_size(), 8)
+        engine = CpuReduceEngine()
+        engine.set_kernel(k)
+        self.assertEqual(engine.get_element_size(), 8)
+        output = engine.run((0,0,64,32),64,32)
+        self.assertEqual(len(output), 512)
+        self.assertEqual(len(output[0]), 2)
+        self.assertEqual(len(filter(lambda v: v[0] > 16, output)), 0)
+
+    def testEmitInt(self):
+        k = self._compile("""
+            kernel __reduce void intKernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).r > 0.5) {
+                    emit(int(destCoord().x));
+                }
+            }
+        """)
+        self.assertEqual(k.get_emit_size(), 4)
+        engine = CpuReduceEngine()
+        engine.set_kernel(k)
+        output = engine.run((0,0,64,32),64,32)
+        self.assertEqual(len(output), 512)
+        self.assertEqual(len(filter(lambda v: v == 0, output)), 32)
+        self.assertEqual(len(filter(lambda v: v >= 16, output)), 0)
+
+    def testEmitFloatStream(self):
+        k = self._compile("""
+            kernel __reduce void floatKernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).r > 0.5) {
+                    emit(1.0);
+                }
+            }
+        """)
+        self.assertEqual(k.get_emit_size(), 4)
+        engine = CpuReduceEngine()
+        engine.set_kernel(k)
+        output = engine.run_stream((0,0,64,32),64,32)
+        self.assertEqual(len(output), 512)
+        count, sum, min, max = engine.get_stream_accumulators()
+        self.assertEqual(count, 512)
+        self.assertEqual(sum, (512, 0, 0, 0))
+
+    def testRenderAndReduce(self):
+        src = """
+            kernel __reduce void redKernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).r > 0.5) {
+                    emit(1.0);
+                }
+            }
+        """
+        renderer = CpuRenderer()
+        renderer.set_sampler(self._s)
+
+        width, height, stride = 64, 32, 64 * 4
+        out_buffer = array.array('B', (0,) * stride * height)
+
+        # One reduction samples the source directly, the other reads back
+        # the rendered pixels.
+        engine = CpuReduceEngine()
+        engine.set_kernel(self._compile(src))
+
+        obs = BufferSampler()
+        obs.set_buffer_no_copy(out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED)
+        readback_kernel = self._compile(src)
+        readback_kernel['src'] = obs
+        readback_engine = CpuReduceEngine()
+        readback_engine.set_kernel(readback_kernel)
+
+        rv, outputs = renderer.render_and_reduce_into_buffer(
+            (0,0,64,32), out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED, (engine, readback_engine))
+        self.assert_(rv)
+        self.assertEqual(len(outputs), 2)
+        self.assertEqual(len(outputs[0]), 512)
+        self.assertEqual(len(outputs[1]), 512)
+
+        # The rendered pixels match a plain render.
+        plain_buffer = array.array('B', (0,) * stride * height)
+        self.assert_(renderer.render_into_buffer((0,0,64,32), plain_buffer,
+            width, height, stride, FORMAT_RGBA32_PREMULTIPLIED))
+        self.assertEqual(out_buffer, plain_buffer)
+
+        # With no reduce engines this is a plain render.
+        rv, outputs = renderer.render_and_reduce_into_buffer(
+            (0,0,64,32), out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED, ())
+        self.assert_(rv)
+        self.assertEqual(outputs, ())
+
+    def testRenderAndReduceReadBack(self):
+        # The source is opaque everywhere and so a reduce kernel reading
+        # the target through a nearest sampler must never see a transparent
+        # pixel which has yet to be rendered.
+        src = """
+            kernel __reduce void unrenderedKernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).a < 0.5) {
+                    emit(destCoord());
+                }
+            }
+        """
+        renderer = CpuRenderer()
+        renderer.set_sampler(self._s)
+
+        width, height, stride = 64, 32, 64 * 4
+        out_buffer = array.array('B', (0,) * stride * height)
+
+        obs = BufferSampler()
+        obs.set_buffer_no_copy(out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED)
+        self.assertEqual(obs.get_interpolation_mode(), INTERPOLATION_NEAREST)
+        readback_kernel = self._compile(src)
+        readback_kernel['src'] = obs
+        readback_engine = CpuReduceEngine()
+        readback_engine.set_kernel(readback_kernel)
+
+        rv, outputs = renderer.render_and_reduce_into_buffer(
+            (0,0,64,32), out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED, (readback_engine,))
+        self.assert_(rv)
+        self.assertEqual(len(outputs), 1)
+        self.assertEqual(len(outputs[0]), 0)
+
+        # Reading back once the render has finished sees the same pixels.
+        self.assertEqual(len(readback_engine.run((0,0,64,32),64,32)), 0)
+
+    def testRenderAndReduceRebindsSampler(self):
+        # The render saturates, so a reduce kernel sampling the renderer's
+        # sampler only sees red above 1 if it evaluates the sampler itself.
+        bright_kernel = self._compile("""
+            kernel vec4 brightKernel(static sampler src) {
+                return 2.0 * sample(src, samplerCoord(src));
+            }
+        """)
+        bright = KernelSampler()
+        bright.set_kernel(bright_kernel)
+
+        renderer = CpuRenderer()
+        renderer.set_sampler(bright)
+
+        reduce_kernel = self._compile("""
+            kernel __reduce void brightRedKernel(static sampler src) {
+                if(sample(src, samplerCoord(src)).r > 1.5) {
+                    emit(1.0);
+                }
+            }
+        """)
+        reduce_kernel['src'] = bright
+        engine = CpuReduceEngine()
+        engine.set_kernel(reduce_kernel)
+
+        width, height, stride = 64, 32, 64 * 4
+        out_buffer = array.array('B', (0,) * stride * height)
+
+        # The reduction reads the rendered pixels.
+        rv, outputs = renderer.render_and_reduce_into_buffer(
+            (0,0,64,32), out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED, (engine,))
+        self.assert_(rv)
+        self.assertEqual(len(outputs[0]), 0)
+
+        # The kernel still samples the renderer's sampler afterwards.
+        self.assertEqual(reduce_kernel['src'], bright)
+        self.assertEqual(len(engine.run((0,0,64,32),64,32)), 512)
+
+        # If the buffer's pixels are not those the reduction visits, the
+        # sampler is evaluated. 8x32 == 256 pixels are red at this scale.
+        rv, outputs = renderer.render_and_reduce_into_buffer(
+            (0,0,128,64), out_buffer, width, height, stride,
+            FORMAT_RGBA32_PREMULTIPLIED, (engine,))
+        self.assert_(rv)
+        self.assertEqual(len(outputs[0]), 256)
+
 # vim:sw=4:ts=4:et:autoindent
 
@@ -0,0 +1,109 @@
+import unittest
+import array
+import os
+import tempfile
+from pyfirtree import *
+
+from utils import FirtreeTestCase
+
+# Deliberately not a multiple of the tile size so that the edge tiles are
+# padded.
+width = 40
+height = 24
+tile_size = 16
+
+class TiledFileSampler(FirtreeTestCase):
+    def setUp(self):
+        values = []
+        for y in range(height):
+            for x in range(width):
+                values.extend((x / float(width), y / float(height),
+                    ((x + y) % 2) * 1.0, 1.0))
+        self._source_buffer = array.array('f', values)
+
+        fd, self._filename = tempfile.mkstemp('.tiled')
+        os.close(fd)
+        self.assert_(tiled_file_sampler_write_file(self._filename,
+            self._source_buffer, width, height, width * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED, tile_size, tile_size))
+
+        self._s = TiledFileSampler()
+        self.failIfEqual(self._s, None)
+
+    def tearDown(self):
+        self._s = None
+        os.unlink(self._filename)
+
+    def render(self):
+        out_buffer = array.array('f', (0.0,) * 4 * width * height)
+        engine = CpuRenderer()
+        engine.set_sampler(self._s)
+        rv = engine.render_into_buffer((0, 0, width, height),
+            out_buffer, width, height, width * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED)
+        self.assert_(rv)
+        return out_buffer
+
+    def testSetFile(self):
+        self.assertEqual(self._s.get_file(), None)
+        self.assertEqual(self._s.get_extent()[2], 0)
+        self.assert_(self._s.set_file(self._filename))
+        self.assertEqual(self._s.get_file(), self._filename)
+        self.assertEqual(self._s.get_extent(), (0, 0, width, height))
+        self.assert_(self._s.set_file(None))
+        self.assertEqual(self._s.get_file(), None)
+        self.assertEqual(self._s.get_extent()[2], 0)
+
+    def testInvalidFile(self):
+        self.assert_(not self._s.set_file(self._filename + '.missing'))
+        self.assertEqual(self._s.get_file(), None)
+
+        # A truncated file must be rejected rather than faulting later.
+        fd, truncated = tempfile.mkstemp('.tiled')
+        f = os.fdopen(fd, 'wb')
+        f.write(open(self._filename, 'rb').read()[:100])
+        f.close()
+        self.assert_(not self._s.set_file(truncated))
+        os.unlink(truncated)
+
+    def testRender(self):
+        self.assert_(self._s.set_file(self._filename))
+        out_buffer = self.render()
+        for idx in range(len(out_buffer)):
+            self.assertAlmostEqual(out_buffer[idx], self._source_buffer[idx])
+
+    def testCacheSize(self):
+        self.assert_(self._s.set_file(self._filename))
+        self.assertEqual(self._s.get_resident_tile_count(), 0)
+
+        self.render()
+        self.assertEqual(self._s.get_resident_tile_count(), 6)
+
+        # The cache always has room for four tiles.
+        self._s.set_cache_size(0)
+        self.assertEqual(self._s.get_cache_size(), 0)
+        self.assertEqual(self._s.get_resident_tile_count(), 4)
+
+        out_buffer = self.render()
+        self.assert_(self._s.get_resident_tile_count() <= 4)
+        for idx in range(len(out_buffer)):
+            self.assertAlmostEqual(out_buffer[idx], self._source_buffer[idx])
+
+    def testReplaceFile(self):
+        # Render threads must not keep sampling tiles of the old file.
+        self.assert_(self._s.set_file(self._filename))
+        self.render()
+
+        other = array.array('f', (0.25, 0.5, 0.75, 1.0) * width * height)
+        fd, other_filename = tempfile.mkstemp('.tiled')
+        os.close(fd)
+        self.assert_(tiled_file_sampler_write_file(other_filename,
+            other, width, height, width * 16,
+            FORMAT_RGBA_F32_PREMULTIPLIED, tile_size, tile_size))
+        self.assert_(self._s.set_file(other_filename))
+        out_buffer = self.render()
+        os.unlink(other_filename)
+        for idx in range(len(out_buffer)):
+            self.assertAlmostEqual(out_buffer[idx], other[idx])
+
+# vim:sw=4:ts=4:et:autoindent
@@ -30,6 +30,8 @@ import core.cluttersampler
 import core.kernelargs
 import core.buffersampler
 import core.reduce
+import core.tiledfilesampler
+import core.cachingsampler
 
 suite = unittest.TestSuite()
 suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.affinetransform))
@@ -43,6 +45,8 @@ suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.cluttersampler
 suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.kernelargs))
 suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.buffersampler))
 suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.reduce))
+suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.tiledfilesampler))
+suite.addTest(unittest.defaultTestLoader.loadTestsFromModule(core.cachingsampler))
 
 if __name__ == '__main__':
     runner = unittest.TextTestRunner()